@@ -1,5 +1,6 @@
 #include "address.h"
 
+#include "blocking_executor.h"
 #include "endian.h"
 #include "hiper.h"
 #include "log.h"
@@ -86,7 +87,9 @@ bool Address::Lookup(std::vector<Address::ptr>& result, const std::string& host,
         node = host;
     }
 
-    int error = getaddrinfo(node.c_str(), service, &hints, &results);
+    // 域名解析无法被hook，交给阻塞任务执行器，避免阻塞IO线程上的其他协程
+    int error = BlockingExecutorMgr::GetInstance()->call(
+        [&]() { return getaddrinfo(node.c_str(), service, &hints, &results); });
     if (error) {
         LOG_DEBUG(g_logger) << "Address::Lookup getaddress(" << host << ", " << family << ", "
                             << type << ") err=" << error << " errstr=" << gai_strerror(error);
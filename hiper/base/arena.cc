@@ -0,0 +1,157 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-16 10:40:03
+ * @Description: 连接级别的内存池(bump arena)与对象空闲链表
+ */
+
+#include "arena.h"
+
+#include "config.h"
+#include "macro.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace hiper {
+
+static hiper::ConfigVar<uint32_t>::ptr g_pool_max_free = hiper::Config::Lookup(
+    "pool.max_free", (uint32_t)4096, "max cached free objects per size class");
+
+static uint32_t s_pool_max_free = 4096;
+
+struct _ArenaIniter
+{
+    _ArenaIniter()
+    {
+        s_pool_max_free = g_pool_max_free->getValue();
+        g_pool_max_free->addListener(
+            [](const uint32_t& old_value, const uint32_t& new_value) { s_pool_max_free = new_value; });
+    }
+};
+
+static _ArenaIniter s_arena_initer;
+
+Arena::Arena(size_t block_size)
+    : block_size_(block_size)
+{}
+
+Arena::~Arena()
+{
+    reset();
+    freeBlocks(head_);
+}
+
+void* Arena::allocate(size_t size, size_t align)
+{
+    HIPER_ASSERT(align && !(align & (align - 1)));
+    uintptr_t p = ((uintptr_t)ptr_ + align - 1) & ~(uintptr_t)(align - 1);
+    if (HIPER_UNLIKELY(!ptr_ || p + size > (uintptr_t)end_)) {
+        newBlock(size + align);
+        p = ((uintptr_t)ptr_ + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    ptr_ = (char*)(p + size);
+    used_ += size;
+    return (void*)p;
+}
+
+void Arena::addCleanup(void* obj, void (*fn)(void*))
+{
+    Cleanup* c = static_cast<Cleanup*>(allocate(sizeof(Cleanup), alignof(Cleanup)));
+    c->fn      = fn;
+    c->obj     = obj;
+    c->next    = cleanups_;
+    cleanups_  = c;
+}
+
+void Arena::reset()
+{
+    // 逆序析构
+    while (cleanups_) {
+        Cleanup* c = cleanups_;
+        cleanups_  = c->next;
+        c->fn(c->obj);
+    }
+
+    // 用了多个块时合并成一个足够大的块，下次同样的用量只需要一个块
+    if (head_ && head_->next) {
+        size_t total = capacity_;
+        freeBlocks(head_);
+        head_     = nullptr;
+        capacity_ = 0;
+        newBlock(total);
+    }
+    if (head_) {
+        ptr_ = head_->data();
+        end_ = ptr_ + head_->size;
+    }
+    used_ = 0;
+}
+
+void Arena::newBlock(size_t size)
+{
+    size_t bsize = std::max(size, block_size_);
+    Block* block = static_cast<Block*>(::malloc(sizeof(Block) + bsize));
+    if (HIPER_UNLIKELY(!block)) {
+        throw std::bad_alloc();
+    }
+    block->next = head_;
+    block->size = bsize;
+    head_       = block;
+    ptr_        = block->data();
+    end_        = ptr_ + bsize;
+    capacity_ += bsize;
+    ++block_allocs_;
+}
+
+void Arena::freeBlocks(Block* block)
+{
+    while (block) {
+        Block* next = block->next;
+        ::free(block);
+        block = next;
+    }
+}
+
+FreeList::FreeList(size_t size)
+    : size_(std::max(size, sizeof(Node)))
+{}
+
+FreeList::~FreeList()
+{
+    while (head_) {
+        Node* next = head_->next;
+        ::operator delete(head_);
+        head_ = next;
+    }
+}
+
+void* FreeList::alloc()
+{
+    {
+        MutexType::Lock lock(mutex_);
+        if (head_) {
+            Node* node = head_;
+            head_      = node->next;
+            --count_;
+            return node;
+        }
+    }
+    return ::operator new(size_);
+}
+
+void FreeList::free(void* ptr)
+{
+    {
+        MutexType::Lock lock(mutex_);
+        if (count_ < s_pool_max_free) {
+            Node* node = static_cast<Node*>(ptr);
+            node->next = head_;
+            head_      = node;
+            ++count_;
+            return;
+        }
+    }
+    ::operator delete(ptr);
+}
+
+}   // namespace hiper
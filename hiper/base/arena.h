@@ -0,0 +1,224 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-16 10:12:40
+ * @Description: 连接级别的内存池(bump arena)与对象空闲链表
+ */
+
+#ifndef HIPER_ARENA_H
+#define HIPER_ARENA_H
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace hiper {
+
+/**
+ * @brief 只增不减的内存池
+ * @details 分配只移动指针，不支持单独释放，reset()时统一回收。
+ *          适合请求级别的临时对象：每个请求开始时reset，上一个请求的对象全部失效。
+ *          reset后只保留一个足够容纳上次用量的内存块，稳定后不再向系统申请内存
+ */
+class Arena : public Noncopyable {
+public:
+    typedef std::shared_ptr<Arena> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] block_size 内存块的最小大小，第一次分配时才申请
+     */
+    Arena(size_t block_size = 4096);
+
+    ~Arena();
+
+    /**
+     * @brief 分配内存，失败抛出std::bad_alloc
+     * @param[in] size 字节数
+     * @param[in] align 对齐，必须是2的幂
+     */
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    /**
+     * @brief 在arena上构造对象
+     * @details 非平凡析构的对象会登记析构函数，reset或arena析构时按构造的逆序调用
+     */
+    template<class T, class... Args> T* create(Args&&... args)
+    {
+        void* mem = allocate(sizeof(T), alignof(T));
+        T*    obj = new (mem) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            addCleanup(obj, [](void* p) { static_cast<T*>(p)->~T(); });
+        }
+        return obj;
+    }
+
+    /**
+     * @brief 释放本次使用的全部内存，析构通过create创建的对象
+     */
+    void reset();
+
+    // 已分配的字节数
+    size_t getUsed() const { return used_; }
+
+    // 当前持有的内存总量
+    size_t getCapacity() const { return capacity_; }
+
+    // 向系统申请内存块的次数
+    uint64_t getBlockAllocs() const { return block_allocs_; }
+
+private:
+    struct Block
+    {
+        Block* next;
+        size_t size;   // 数据区大小
+
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    struct Cleanup
+    {
+        void (*fn)(void*);
+        void*    obj;
+        Cleanup* next;
+    };
+
+    void addCleanup(void* obj, void (*fn)(void*));
+
+    // 申请一个至少能放下size字节的新块
+    void newBlock(size_t size);
+
+    void freeBlocks(Block* block);
+
+private:
+    Block*   head_     = nullptr;   // 当前正在使用的块，next指向更早的块
+    char*    ptr_      = nullptr;   // 当前块的空闲位置
+    char*    end_      = nullptr;   // 当前块的结束位置
+    Cleanup* cleanups_ = nullptr;
+    size_t   block_size_;
+    size_t   used_         = 0;
+    size_t   capacity_     = 0;
+    uint64_t block_allocs_ = 0;
+};
+
+/**
+ * @brief 从Arena分配内存的STL分配器，deallocate为空操作
+ */
+template<class T> class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena* arena)
+        : arena_(arena)
+    {}
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+        : arena_(other.getArena())
+    {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena_->allocate(sizeof(T) * n, alignof(T))); }
+
+    void deallocate(T*, size_t) {}
+
+    Arena* getArena() const { return arena_; }
+
+    template<class U> bool operator==(const ArenaAllocator<U>& rhs) const
+    {
+        return arena_ == rhs.getArena();
+    }
+
+    template<class U> bool operator!=(const ArenaAllocator<U>& rhs) const
+    {
+        return arena_ != rhs.getArena();
+    }
+
+private:
+    Arena* arena_;
+};
+
+/**
+ * @brief 固定大小内存块的空闲链表
+ * @details 释放的内存块缓存起来供下次分配，各个线程共享，超过上限(pool.max_free)后直接释放
+ */
+class FreeList : public Noncopyable {
+public:
+    typedef SpinLock MutexType;
+
+    FreeList(size_t size);
+
+    ~FreeList();
+
+    void* alloc();
+
+    void free(void* ptr);
+
+    size_t getSize() const { return size_; }
+
+    size_t getFreeCount() const { return count_; }
+
+    /**
+     * @brief 返回对应大小的空闲链表，大小按16字节向上取整
+     */
+    template<size_t Size> static FreeList& Get()
+    {
+        // 不析构，程序退出时静态对象析构中释放的对象仍然可以归还
+        static FreeList* s_list = new FreeList((Size + 15) & ~(size_t)15);
+        return *s_list;
+    }
+
+private:
+    struct Node
+    {
+        Node* next;
+    };
+
+    MutexType mutex_;
+    Node*     head_  = nullptr;
+    size_t    count_ = 0;
+    size_t    size_;
+};
+
+/**
+ * @brief 使用FreeList回收内存的分配器
+ * @details 配合std::allocate_shared使用时，对象和引用计数块一起从空闲链表中分配，
+ *          频繁创建销毁的连接对象(Socket、FdCtx等)在稳定后不再向系统申请内存
+ */
+template<class T> class PoolAllocator {
+public:
+    typedef T value_type;
+
+    PoolAllocator() = default;
+
+    template<class U> PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        if (n == 1) {
+            return static_cast<T*>(FreeList::Get<sizeof(T)>().alloc());
+        }
+        return static_cast<T*>(::operator new(sizeof(T) * n));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (n == 1) {
+            FreeList::Get<sizeof(T)>().free(p);
+        }
+        else {
+            ::operator delete(p);
+        }
+    }
+
+    template<class U> bool operator==(const PoolAllocator<U>&) const { return true; }
+
+    template<class U> bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+}   // namespace hiper
+
+#endif   // HIPER_ARENA_H
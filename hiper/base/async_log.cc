@@ -0,0 +1,440 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-23 10:05:42
+ * @Description: 异步日志
+ */
+
+#include "async_log.h"
+#include "config.h"
+#include "macro.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <iostream>
+#include <limits.h>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <set>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace hiper {
+
+static hiper::ConfigVar<uint32_t>::ptr g_async_log_buffer_size = hiper::Config::Lookup(
+    "log.async.buffer_size", (uint32_t)(256 * 1024), "async log appender buffer size");
+
+static hiper::ConfigVar<uint32_t>::ptr g_async_log_max_backlog = hiper::Config::Lookup(
+    "log.async.max_backlog", (uint32_t)(16 * 1024 * 1024),
+    "max bytes waiting to be written before the overflow policy applies");
+
+static hiper::ConfigVar<uint32_t>::ptr g_async_log_flush_interval = hiper::Config::Lookup(
+    "log.async.flush_interval", (uint32_t)500, "async log appender flush interval ms");
+
+/**
+ * @brief 存活的AsyncLogAppender，fork时逐个处理
+ */
+struct AsyncLogRegistry
+{
+    Mutex                        mutex;
+    std::set<AsyncLogAppender*> appenders;
+};
+
+static AsyncLogRegistry& GetAsyncLogRegistry()
+{
+    // 不析构，进程退出时其他静态对象中的Appender还可能被释放
+    static AsyncLogRegistry* s_registry = new AsyncLogRegistry;
+    return *s_registry;
+}
+
+/**
+ * @brief 日志缓冲区，大小固定，写满后整块交给后台线程
+ */
+struct AsyncLogAppender::Buffer
+{
+    Buffer(size_t cap)
+        : data(new char[cap])
+        , capacity(cap)
+    {}
+
+    size_t avail() const { return capacity - size; }
+
+    void append(const char* buf, size_t len)
+    {
+        memcpy(data.get() + size, buf, len);
+        size += len;
+    }
+
+    std::unique_ptr<char[]> data;
+    size_t                  capacity;
+    size_t                  size = 0;
+};
+
+const char* AsyncLogAppender::PolicyToString(OverflowPolicy policy)
+{
+    switch (policy) {
+    case BLOCK: return "block";
+    case DROP: return "drop";
+    case DROP_DEBUG: return "drop_debug";
+    }
+    return "block";
+}
+
+AsyncLogAppender::OverflowPolicy AsyncLogAppender::PolicyFromString(const std::string& str)
+{
+    std::string v = ToLower(str);
+    if (v == "drop") {
+        return DROP;
+    }
+    if (v == "drop_debug") {
+        return DROP_DEBUG;
+    }
+    return BLOCK;
+}
+
+AsyncLogAppender::AsyncLogAppender(const std::string& filename, OverflowPolicy policy)
+    : filename_(filename)
+    , policy_(policy)
+{
+    buffer_size_    = std::max<size_t>(g_async_log_buffer_size->getValue(), 4096);
+    max_buffers_    = std::max<size_t>(g_async_log_max_backlog->getValue() / buffer_size_, 2);
+    flush_interval_ = std::max<uint32_t>(g_async_log_flush_interval->getValue(), 1);
+
+    reopen();
+    last_check_ = GetElapsedMS();
+    cur_        = getBuffer(buffer_size_);
+    running_    = true;
+    startThread();
+
+    static std::once_flag s_once;
+    std::call_once(s_once,
+                   []() { pthread_atfork(&ForkPrepare, &ForkParent, &ForkChild); });
+    AsyncLogRegistry& registry = GetAsyncLogRegistry();
+    Mutex::Lock       lock(registry.mutex);
+    registry.appenders.insert(this);
+}
+
+AsyncLogAppender::~AsyncLogAppender()
+{
+    {
+        AsyncLogRegistry& registry = GetAsyncLogRegistry();
+        Mutex::Lock       lock(registry.mutex);
+        registry.appenders.erase(this);
+    }
+    stop();
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void AsyncLogAppender::startThread()
+{
+    thread_.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "async_log"));
+}
+
+void AsyncLogAppender::ForkPrepare()
+{
+    // 持有所有锁再fork，子进程里的锁和缓冲区都处于一致的状态
+    AsyncLogRegistry& registry = GetAsyncLogRegistry();
+    registry.mutex.lock();
+    for (auto i : registry.appenders) {
+        i->buf_mutex_.lock();
+    }
+}
+
+void AsyncLogAppender::ForkParent()
+{
+    AsyncLogRegistry& registry = GetAsyncLogRegistry();
+    for (auto i : registry.appenders) {
+        i->buf_mutex_.unlock();
+    }
+    registry.mutex.unlock();
+}
+
+void AsyncLogAppender::ForkChild()
+{
+    AsyncLogRegistry& registry = GetAsyncLogRegistry();
+    for (auto i : registry.appenders) {
+        i->afterFork();
+        i->buf_mutex_.unlock();
+    }
+    registry.mutex.unlock();
+}
+
+void AsyncLogAppender::afterFork()
+{
+    // 条件变量上可能登记着父进程里其他线程的等待，子进程中重新初始化，不能调用析构
+    new (&cond_) Condition;
+    new (&space_cond_) Condition;
+    new (&flush_cond_) Condition;
+    // 缓冲区里是父进程的日志，由父进程负责写入
+    cur_->size = 0;
+    for (auto& i : full_) {
+        if (i->capacity == buffer_size_ && free_.size() < 4) {
+            i->size = 0;
+            free_.push_back(std::move(i));
+        }
+    }
+    full_.clear();
+    flush_pending_    = false;
+    taken_            = 0;
+    written_          = 0;
+    reported_dropped_ = dropped_;
+    if (running_) {
+        // 线程对象描述的是父进程中的线程，析构时会对它调用pthread_detach，直接泄漏
+        new Thread::ptr(std::move(thread_));
+        forked_ = true;
+    }
+}
+
+void AsyncLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event)
+{
+    if (level < level_) {
+        return;
+    }
+    // 在锁外格式化，锁内只做拷贝
+    LogStreamBuf& buf = LogFormatter::GetThreadBuffer();
+    {
+        Rcu::ReadLock rcu;
+        LogFormatter* formatter = peekFormatter();
+        if (!formatter) {
+            return;
+        }
+        formatter->format(buf, logger, level, event);
+    }
+    append(buf.data(), buf.size(), level);
+}
+
+bool AsyncLogAppender::append(const char* data, size_t len, LogLevel::Level level)
+{
+    Mutex::Lock lock(buf_mutex_);
+    if (HIPER_UNLIKELY(!running_)) {
+        // 后台线程已经退出，直接写文件
+        writeDirect(data, len);
+        return true;
+    }
+    if (HIPER_UNLIKELY(forked_)) {
+        forked_ = false;
+        startThread();
+    }
+
+    if (policy_ == DROP_DEBUG && level < LogLevel::WARN && full_.size() >= max_buffers_ / 2) {
+        ++dropped_;
+        return false;
+    }
+    if (HIPER_LIKELY(cur_->avail() >= len)) {
+        cur_->append(data, len);
+        return true;
+    }
+
+    while (full_.size() >= max_buffers_) {
+        if (policy_ != BLOCK) {
+            ++dropped_;
+            return false;
+        }
+        space_cond_.wait(buf_mutex_);
+        if (!running_) {
+            writeDirect(data, len);
+            return true;
+        }
+    }
+    // 缓冲区可能在等待期间被后台线程取走，换成了空的
+    if (cur_->avail() < len) {
+        if (cur_->size > 0) {
+            full_.push_back(std::move(cur_));
+        }
+        cur_ = getBuffer(std::max(len, buffer_size_));
+    }
+    cur_->append(data, len);
+    cond_.notify();
+    return true;
+}
+
+AsyncLogAppender::BufferPtr AsyncLogAppender::getBuffer(size_t size)
+{
+    if (size == buffer_size_ && !free_.empty()) {
+        BufferPtr buf = std::move(free_.back());
+        free_.pop_back();
+        return buf;
+    }
+    return BufferPtr(new Buffer(size));
+}
+
+void AsyncLogAppender::flush()
+{
+    Mutex::Lock lock(buf_mutex_);
+    if (!running_ || forked_) {
+        return;
+    }
+    // 下一次取走的缓冲区一定包含调用之前提交的日志
+    uint64_t target = taken_ + 1;
+    flush_pending_  = true;
+    cond_.notify();
+    while (written_ < target && running_) {
+        flush_cond_.wait(buf_mutex_);
+    }
+}
+
+void AsyncLogAppender::stop()
+{
+    {
+        Mutex::Lock lock(buf_mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+        cond_.notify();
+        space_cond_.notifyAll();
+        flush_cond_.notifyAll();
+        if (forked_) {
+            // fork后还没有启动过后台线程
+            forked_ = false;
+            return;
+        }
+    }
+    thread_->join();
+}
+
+void AsyncLogAppender::run()
+{
+    std::vector<BufferPtr> writing;
+    while (true) {
+        bool     stopping;
+        uint64_t taken;
+        {
+            Mutex::Lock lock(buf_mutex_);
+            if (full_.empty() && !flush_pending_ && running_) {
+                cond_.waitFor(buf_mutex_, flush_interval_);
+            }
+            if (cur_->size > 0) {
+                full_.push_back(std::move(cur_));
+                cur_ = getBuffer(buffer_size_);
+            }
+            writing.swap(full_);
+            flush_pending_ = false;
+            taken          = ++taken_;
+            stopping       = !running_;
+            space_cond_.notifyAll();
+        }
+
+        uint64_t now = GetElapsedMS();
+        if (now >= last_check_ + 3000) {
+            last_check_ = now;
+            struct stat st;
+            struct stat fst;
+            if (fd_ < 0 || stat(filename_.c_str(), &st) != 0 || fstat(fd_, &fst) != 0 ||
+                st.st_ino != fst.st_ino || st.st_dev != fst.st_dev) {
+                reopen();
+            }
+        }
+        writeBuffers(writing);
+
+        uint64_t dropped = dropped_;
+        if (dropped > reported_dropped_ && fd_ >= 0) {
+            std::string msg = Time2Str() + "\tAsyncLogAppender dropped " +
+                              std::to_string(dropped - reported_dropped_) + " log lines\n";
+            reported_dropped_ = dropped;
+            writeDirect(msg.c_str(), msg.size());
+        }
+
+        {
+            Mutex::Lock lock(buf_mutex_);
+            for (auto& i : writing) {
+                if (i->capacity == buffer_size_ && free_.size() < 4) {
+                    i->size = 0;
+                    free_.push_back(std::move(i));
+                }
+            }
+            written_ = taken;
+            flush_cond_.notifyAll();
+        }
+        writing.clear();
+
+        if (stopping) {
+            break;
+        }
+    }
+}
+
+void AsyncLogAppender::writeBuffers(const std::vector<BufferPtr>& buffers)
+{
+    if (fd_ < 0 || buffers.empty()) {
+        return;
+    }
+    std::vector<iovec> iovs(buffers.size());
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        iovs[i].iov_base = buffers[i]->data.get();
+        iovs[i].iov_len  = buffers[i]->size;
+    }
+
+    size_t pos = 0;
+    while (pos < iovs.size()) {
+        int     cnt = std::min<size_t>(iovs.size() - pos, IOV_MAX);
+        ssize_t rt  = writev(fd_, &iovs[pos], cnt);
+        if (rt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cout << "AsyncLogAppender writev " << filename_ << " error: " << strerror(errno)
+                      << std::endl;
+            return;
+        }
+        // 部分写入时跳过已经写完的部分
+        size_t n = rt;
+        while (pos < iovs.size() && n >= iovs[pos].iov_len) {
+            n -= iovs[pos].iov_len;
+            ++pos;
+        }
+        if (n > 0) {
+            iovs[pos].iov_base = (char*)iovs[pos].iov_base + n;
+            iovs[pos].iov_len -= n;
+        }
+    }
+}
+
+void AsyncLogAppender::writeDirect(const char* data, size_t len)
+{
+    if (fd_ >= 0 && write(fd_, data, len) < 0) {
+        std::cout << "AsyncLogAppender write " << filename_ << " error: " << strerror(errno)
+                  << std::endl;
+    }
+}
+
+bool AsyncLogAppender::reopen()
+{
+    FSUtil::Mkdir(FSUtil::Dirname(filename_));
+    int fd = open(filename_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cout << "AsyncLogAppender open " << filename_ << " error: " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    fd_ = fd;
+    return true;
+}
+
+std::string AsyncLogAppender::toYamlString()
+{
+    MutexType::Lock lock(mutex_);
+    YAML::Node      node;
+    node["type"]     = "AsyncLogAppender";
+    node["file"]     = filename_;
+    node["overflow"] = PolicyToString(policy_);
+    if (level_ != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(level_);
+    }
+    LogFormatter::ptr formatter = getFormatter();
+    if (hasFormatter_ && formatter) {
+        node["formatter"] = formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+}   // namespace hiper
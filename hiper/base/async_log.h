@@ -0,0 +1,179 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-23 10:05:42
+ * @Description: 异步日志，前台线程只把格式化好的日志拷贝到内存缓冲区，后台线程批量写文件
+ */
+
+#ifndef HIPER_ASYNC_LOG_H
+#define HIPER_ASYNC_LOG_H
+
+#include "log.h"
+#include "mutex.h"
+#include "thread.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hiper {
+
+/**
+ * @brief 输出到文件的异步Appender
+ * @details 双缓冲：前台线程把日志追加到当前缓冲区，写满后交给后台线程，换一块空闲缓冲区继续写；
+ *          后台线程每隔log.async.flush_interval毫秒或有写满的缓冲区时被唤醒，
+ *          把所有缓冲区用一次writev写入文件。前台线程只在拷贝日志时持有锁，磁盘慢的时候不会被阻塞，
+ *          除非积压超过log.async.max_backlog，此时按溢出策略处理。
+ *          fork出的子进程里没有后台线程，fork时清空从父进程复制来的缓冲区，
+ *          子进程第一次写日志时重新启动后台线程
+ */
+class AsyncLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+    /**
+     * @brief 积压的日志超过上限时的处理方式
+     */
+    enum OverflowPolicy {
+        // 等待后台线程写完，不丢日志
+        BLOCK = 0,
+        // 丢弃新的日志
+        DROP = 1,
+        // 积压超过一半时先丢弃WARN以下的日志，写满后全部丢弃
+        DROP_DEBUG = 2
+    };
+
+    static const char*    PolicyToString(OverflowPolicy policy);
+    static OverflowPolicy PolicyFromString(const std::string& str);
+
+    /**
+     * @brief 构造函数，打开文件并启动后台线程
+     * @param[in] filename 文件路径
+     * @param[in] policy 溢出策略
+     */
+    AsyncLogAppender(const std::string& filename, OverflowPolicy policy = BLOCK);
+
+    /**
+     * @brief 析构函数，写完积压的日志后退出后台线程
+     */
+    ~AsyncLogAppender();
+
+    void        log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+
+    /**
+     * @brief 等待调用之前提交的日志全部写入文件
+     */
+    void flush() override;
+
+    /**
+     * @brief 写完积压的日志，停止后台线程，之后的日志直接同步写文件
+     */
+    void stop();
+
+    /**
+     * @brief 溢出丢弃的日志条数
+     */
+    uint64_t getDropped() const { return dropped_; }
+
+    OverflowPolicy getPolicy() const { return policy_; }
+
+private:
+    struct Buffer;
+    typedef std::unique_ptr<Buffer> BufferPtr;
+
+    /**
+     * @brief 后台线程
+     */
+    void run();
+
+    /**
+     * @brief 启动后台线程，需持有buf_mutex_或者在构造函数中调用
+     */
+    void startThread();
+
+    /**
+     * @brief fork后在子进程中调用，此时只有一个线程
+     */
+    void afterFork();
+
+    /**
+     * @brief pthread_atfork的回调，对所有存活的AsyncLogAppender加锁、解锁或重置
+     */
+    static void ForkPrepare();
+    static void ForkParent();
+    static void ForkChild();
+
+    /**
+     * @brief 追加一条日志，返回false表示被丢弃
+     */
+    bool append(const char* data, size_t len, LogLevel::Level level);
+
+    /**
+     * @brief 取一块空闲缓冲区，需持有buf_mutex_
+     */
+    BufferPtr getBuffer(size_t size);
+
+    /**
+     * @brief 把缓冲区写入文件
+     */
+    void writeBuffers(const std::vector<BufferPtr>& buffers);
+
+    /**
+     * @brief 不经过缓冲区直接写文件
+     */
+    void writeDirect(const char* data, size_t len);
+
+    /**
+     * @brief 文件被移走或删除时重新打开
+     */
+    bool reopen();
+
+private:
+    // 文件路径
+    std::string filename_;
+    // 溢出策略
+    OverflowPolicy policy_;
+    // 文件描述符，只在后台线程和停止后的同步写中使用
+    int fd_ = -1;
+    // 缓冲区大小
+    size_t buffer_size_;
+    // 最多积压的缓冲区数量
+    size_t max_buffers_;
+    // 后台线程最长的等待时间
+    uint64_t flush_interval_;
+
+    Mutex buf_mutex_;
+    // 唤醒后台线程
+    Condition cond_;
+    // 唤醒等待空间的前台线程(BLOCK)
+    Condition space_cond_;
+    // 唤醒等待flush的线程
+    Condition flush_cond_;
+    // 正在写入的缓冲区
+    BufferPtr cur_;
+    // 写满等待后台线程处理的缓冲区
+    std::vector<BufferPtr> full_;
+    // 空闲缓冲区
+    std::vector<BufferPtr> free_;
+    // 有线程在等待flush
+    bool flush_pending_ = false;
+    // 后台线程取走缓冲区的次数和已经写完的次数
+    uint64_t taken_   = 0;
+    uint64_t written_ = 0;
+    bool     running_ = false;
+    // fork后子进程还没有重新启动后台线程
+    bool forked_ = false;
+
+    std::atomic<uint64_t> dropped_{0};
+    // 已经在文件中报告过的丢弃条数
+    uint64_t reported_dropped_ = 0;
+    // 上次检查文件的时间
+    uint64_t last_check_ = 0;
+
+    Thread::ptr thread_;
+};
+
+}   // namespace hiper
+
+#endif   // HIPER_ASYNC_LOG_H
@@ -0,0 +1,677 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-25 16:20:08
+ * @Description: 二进制日志
+ */
+
+#include "binary_log.h"
+#include "config.h"
+#include "endian.hpp"
+#include "macro.h"
+#include "util.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <pthread.h>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hiper {
+
+// 缓冲超过该大小时写文件
+static const size_t kFlushSize = 64 * 1024;
+// 距上次写文件超过该时间(毫秒)时写文件
+static const uint64_t kFlushInterval = 1000;
+
+const char BinaryLog::kMagic[4] = {'H', 'L', 'O', 'G'};
+
+/**
+ * @brief 存活的BinaryLogAppender，fork时逐个处理
+ */
+struct BinaryLogRegistry
+{
+    Mutex                        mutex;
+    std::set<BinaryLogAppender*> appenders;
+};
+
+static BinaryLogRegistry& GetBinaryLogRegistry()
+{
+    // 不析构，进程退出时其他静态对象中的Appender还可能被释放
+    static BinaryLogRegistry* s_registry = new BinaryLogRegistry;
+    return *s_registry;
+}
+
+static RWMutex& GetSitesMutex()
+{
+    static RWMutex s_mutex;
+    return s_mutex;
+}
+
+static std::vector<const BinaryLogSite*>& GetSites()
+{
+    static std::vector<const BinaryLogSite*> s_sites;
+    return s_sites;
+}
+
+BinaryLogSite::BinaryLogSite(LogLevel::Level level, const char* file, int32_t line,
+                             const char* fmt)
+    : level_(level)
+    , file_(file)
+    , line_(line)
+    , fmt_(fmt)
+{
+    RWMutex::WriteLock lock(GetSitesMutex());
+    GetSites().push_back(this);
+    id_ = GetSites().size();
+}
+
+const BinaryLogSite* BinaryLogSite::Get(uint32_t id)
+{
+    RWMutex::ReadLock lock(GetSitesMutex());
+    if (id == 0 || id > GetSites().size()) {
+        return nullptr;
+    }
+    return GetSites()[id - 1];
+}
+
+size_t BinaryEncoder::EncodeUint64(char* out, uint64_t v)
+{
+    size_t i = 0;
+    while (v >= 0x80) {
+        out[i++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    out[i++] = v;
+    return i;
+}
+
+void BinaryEncoder::WriteUint64(LogStreamBuf& buf, uint64_t v)
+{
+    buf.reserve(10);
+    buf.commit(EncodeUint64(buf.cur(), v));
+}
+
+void BinaryEncoder::WriteDouble(LogStreamBuf& buf, double v)
+{
+    uint64_t u;
+    memcpy(&u, &v, sizeof(v));
+    u = byteswapOnLittleEndian(u);
+    buf.append((const char*)&u, sizeof(u));
+}
+
+void BinaryEncoder::WriteString(LogStreamBuf& buf, const char* str, size_t len)
+{
+    WriteUint64(buf, len);
+    buf.append(str, len);
+}
+
+LogStream& BinaryEncoder::GetThreadStream()
+{
+    static thread_local LogStream s_stream;
+    s_stream.reset();
+    return s_stream;
+}
+
+bool BinaryDecoder::readUint8(uint8_t& v)
+{
+    if (cur_ >= end_) {
+        return false;
+    }
+    v = *cur_++;
+    return true;
+}
+
+bool BinaryDecoder::readUint64(uint64_t& v)
+{
+    v = 0;
+    for (int shift = 0; shift < 64 && cur_ < end_; shift += 7) {
+        uint8_t b = *cur_++;
+        v |= ((uint64_t)(b & 0x7F)) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BinaryDecoder::readInt64(int64_t& v)
+{
+    uint64_t u;
+    if (!readUint64(u)) {
+        return false;
+    }
+    v = (u >> 1) ^ -(u & 1);
+    return true;
+}
+
+bool BinaryDecoder::readDouble(double& v)
+{
+    uint64_t u;
+    if (left() < sizeof(u)) {
+        return false;
+    }
+    memcpy(&u, cur_, sizeof(u));
+    cur_ += sizeof(u);
+    u = byteswapOnLittleEndian(u);
+    memcpy(&v, &u, sizeof(v));
+    return true;
+}
+
+bool BinaryDecoder::readString(const char*& str, size_t& len)
+{
+    uint64_t n;
+    if (!readUint64(n) || n > left()) {
+        return false;
+    }
+    str = cur_;
+    len = n;
+    cur_ += n;
+    return true;
+}
+
+/**
+ * @brief 按spec格式化一个值追加到out
+ */
+template <class T>
+static void AppendFormat(LogStreamBuf& out, const char* spec, T v)
+{
+    int len = snprintf(out.cur(), out.avail(), spec, v);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len >= out.avail()) {
+        out.reserve(len + 1);
+        snprintf(out.cur(), out.avail(), spec, v);
+    }
+    out.commit(len);
+}
+
+static bool IsFloatConv(char c)
+{
+    return c && strchr("fFeEgGaA", c) != nullptr;
+}
+
+void BinaryLog::Render(const char* fmt, const char* args, size_t len, LogStreamBuf& out)
+{
+    BinaryDecoder in(args, len);
+    const char*   p = fmt;
+    while (*p) {
+        if (*p != '%') {
+            const char* begin = p;
+            while (*p && *p != '%') {
+                ++p;
+            }
+            out.append(begin, p - begin);
+            continue;
+        }
+        if (p[1] == '%') {
+            out.append("%", 1);
+            p += 2;
+            continue;
+        }
+
+        // 解析 %[flags][width][.precision][length]conversion，去掉长度修饰，按参数的实际类型重新拼
+        char        spec[32];
+        const char* begin = p++;
+        while (*p && strchr("-+ #0123456789.", *p)) {
+            ++p;
+        }
+        // 留出长度修饰、转换符和结尾的空间
+        size_t n = std::min<size_t>(p - begin, sizeof(spec) - 4);
+        memcpy(spec, begin, n);
+        bool plain = (n == 1);
+        while (*p && strchr("hlLqjzt", *p)) {
+            ++p;
+        }
+        char conv = *p;
+        if (conv) {
+            ++p;
+        }
+
+        uint8_t tag;
+        if (!in.readUint8(tag)) {
+            out.append("<?>", 3);
+            continue;
+        }
+        switch (tag) {
+        case BinaryEncoder::ARG_INT:
+        {
+            int64_t v = 0;
+            in.readInt64(v);
+            if (IsFloatConv(conv)) {
+                spec[n] = conv;
+                spec[n + 1] = 0;
+                AppendFormat(out, spec, (double)v);
+            }
+            else if (conv == 'c') {
+                memcpy(spec + n, "c", 2);
+                AppendFormat(out, spec, (int)v);
+            }
+            else if (conv && strchr("uxXo", conv)) {
+                spec[n]     = 'l';
+                spec[n + 1] = 'l';
+                spec[n + 2] = conv;
+                spec[n + 3] = 0;
+                AppendFormat(out, spec, (unsigned long long)v);
+            }
+            else {
+                memcpy(spec + n, "lld", 4);
+                AppendFormat(out, spec, (long long)v);
+            }
+            break;
+        }
+        case BinaryEncoder::ARG_UINT:
+        case BinaryEncoder::ARG_POINTER:
+        {
+            uint64_t v = 0;
+            in.readUint64(v);
+            if (tag == BinaryEncoder::ARG_POINTER || conv == 'p') {
+                memcpy(spec + n, "p", 2);
+                AppendFormat(out, spec, (void*)(uintptr_t)v);
+            }
+            else if (IsFloatConv(conv)) {
+                spec[n]     = conv;
+                spec[n + 1] = 0;
+                AppendFormat(out, spec, (double)v);
+            }
+            else if (conv == 'c') {
+                memcpy(spec + n, "c", 2);
+                AppendFormat(out, spec, (int)v);
+            }
+            else {
+                spec[n]     = 'l';
+                spec[n + 1] = 'l';
+                spec[n + 2] = (conv && strchr("xXo", conv)) ? conv : 'u';
+                spec[n + 3] = 0;
+                AppendFormat(out, spec, (unsigned long long)v);
+            }
+            break;
+        }
+        case BinaryEncoder::ARG_DOUBLE:
+        {
+            double v = 0;
+            in.readDouble(v);
+            spec[n]     = IsFloatConv(conv) ? conv : 'g';
+            spec[n + 1] = 0;
+            AppendFormat(out, spec, v);
+            break;
+        }
+        case BinaryEncoder::ARG_STRING:
+        {
+            const char* str = "";
+            size_t      slen = 0;
+            in.readString(str, slen);
+            if (plain) {
+                out.append(str, slen);
+            }
+            else {
+                memcpy(spec + n, "s", 2);
+                AppendFormat(out, spec, std::string(str, slen).c_str());
+            }
+            break;
+        }
+        case BinaryEncoder::ARG_CHAR:
+        {
+            uint8_t c = 0;
+            in.readUint8(c);
+            memcpy(spec + n, "c", 2);
+            AppendFormat(out, spec, (int)c);
+            break;
+        }
+        default:
+            // 不认识的类型，后面的参数已经无法解析
+            out.append("<?>", 3);
+            in = BinaryDecoder(nullptr, 0);
+            break;
+        }
+    }
+}
+
+void BinaryLog::WriteFields(LogStreamBuf& buf, const LogFields& fields)
+{
+    fields.forEach([&buf](const LogFields::Field& f) {
+        BinaryEncoder::WriteUint8(buf, f.type);
+        BinaryEncoder::WriteString(buf, f.key.data(), f.key.size());
+        switch (f.type) {
+        case LogFields::STRING: BinaryEncoder::WriteString(buf, f.str.data(), f.str.size()); break;
+        case LogFields::INT: BinaryEncoder::WriteInt64(buf, f.i); break;
+        case LogFields::UINT: BinaryEncoder::WriteUint64(buf, f.u); break;
+        case LogFields::DOUBLE: BinaryEncoder::WriteDouble(buf, f.d); break;
+        case LogFields::BOOL: BinaryEncoder::WriteUint8(buf, f.b); break;
+        }
+    });
+}
+
+bool BinaryLog::ReadFields(BinaryDecoder& in, LogFields& fields)
+{
+    while (in.left() > 0) {
+        uint8_t     type;
+        const char* key;
+        size_t      key_len;
+        if (!in.readUint8(type) || !in.readString(key, key_len)) {
+            return false;
+        }
+        std::string_view name(key, key_len);
+        switch (type) {
+        case LogFields::STRING:
+        {
+            const char* str;
+            size_t      len;
+            if (!in.readString(str, len)) {
+                return false;
+            }
+            fields.addString(name, std::string_view(str, len));
+            break;
+        }
+        case LogFields::INT:
+        {
+            int64_t v;
+            if (!in.readInt64(v)) {
+                return false;
+            }
+            fields.addInt(name, v);
+            break;
+        }
+        case LogFields::UINT:
+        {
+            uint64_t v;
+            if (!in.readUint64(v)) {
+                return false;
+            }
+            fields.addUint(name, v);
+            break;
+        }
+        case LogFields::DOUBLE:
+        {
+            double v;
+            if (!in.readDouble(v)) {
+                return false;
+            }
+            fields.addDouble(name, v);
+            break;
+        }
+        case LogFields::BOOL:
+        {
+            uint8_t v;
+            if (!in.readUint8(v)) {
+                return false;
+            }
+            fields.addBool(name, v != 0);
+            break;
+        }
+        default: return false;
+        }
+    }
+    return true;
+}
+
+BinaryLogAppender::BinaryLogAppender(const std::string& filename)
+    : filename_(filename)
+{
+    buffer_.reserve(kFlushSize * 2);
+    pid_ = getpid();
+    {
+        Mutex::Lock lock(buf_mutex_);
+        reopenLocked();
+        lastFlush_ = lastCheck_ = GetElapsedMS();
+    }
+
+    static std::once_flag s_once;
+    std::call_once(s_once,
+                   []() { pthread_atfork(&ForkPrepare, &ForkParent, &ForkChild); });
+    {
+        BinaryLogRegistry& registry = GetBinaryLogRegistry();
+        Mutex::Lock        lock(registry.mutex);
+        registry.appenders.insert(this);
+    }
+    startTimer();
+}
+
+BinaryLogAppender::~BinaryLogAppender()
+{
+    stopTimer();
+    {
+        BinaryLogRegistry& registry = GetBinaryLogRegistry();
+        Mutex::Lock        lock(registry.mutex);
+        registry.appenders.erase(this);
+    }
+    flush();
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void BinaryLogAppender::ForkPrepare()
+{
+    // 持有所有锁再fork，子进程里的缓冲区和已写定义的记录处于一致的状态
+    BinaryLogRegistry& registry = GetBinaryLogRegistry();
+    registry.mutex.lock();
+    for (auto i : registry.appenders) {
+        i->buf_mutex_.lock();
+    }
+}
+
+void BinaryLogAppender::ForkParent()
+{
+    BinaryLogRegistry& registry = GetBinaryLogRegistry();
+    for (auto i : registry.appenders) {
+        i->buf_mutex_.unlock();
+    }
+    registry.mutex.unlock();
+}
+
+void BinaryLogAppender::ForkChild()
+{
+    BinaryLogRegistry& registry = GetBinaryLogRegistry();
+    pid_t              pid = getpid();
+    for (auto i : registry.appenders) {
+        // 缓冲区里是父进程的记录，由父进程负责写入；子进程的编号和父进程的不再对应，定义要重新写
+        i->pid_ = pid;
+        i->buffer_.clear();
+        i->sites_.clear();
+        i->loggers_.clear();
+        i->buf_mutex_.unlock();
+    }
+    registry.mutex.unlock();
+}
+
+void BinaryLogAppender::AppendRecord(std::string& out, const char* payload, size_t len)
+{
+    char   head[10];
+    size_t n = BinaryEncoder::EncodeUint64(head, len);
+    out.append(head, n);
+    out.append(payload, len);
+}
+
+void BinaryLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event)
+{
+    if (level < level_) {
+        return;
+    }
+    const BinaryLogSite* site = event->getBinarySite();
+
+    // 在锁外编码
+    LogStreamBuf& rec = LogFormatter::GetThreadBuffer();
+    if (site) {
+        BinaryEncoder::WriteUint8(rec, BinaryLog::EVENT);
+        BinaryEncoder::WriteUint64(rec, pid_);
+        BinaryEncoder::WriteUint64(rec, site->getId());
+        BinaryEncoder::WriteUint64(rec, logger->getId());
+        BinaryEncoder::WriteUint64(rec, event->getTime());
+        BinaryEncoder::WriteUint64(rec, event->getThreadId());
+        BinaryEncoder::WriteUint64(rec, event->getFiberId());
+        rec.append(event->getContentData(), event->getContentSize());
+    }
+    else {
+        BinaryEncoder::WriteUint8(rec, BinaryLog::TEXT);
+        BinaryEncoder::WriteUint64(rec, pid_);
+        BinaryEncoder::WriteUint64(rec, logger->getId());
+        BinaryEncoder::WriteUint8(rec, level);
+        BinaryEncoder::WriteUint64(rec, event->getTime());
+        BinaryEncoder::WriteUint64(rec, event->getThreadId());
+        BinaryEncoder::WriteUint64(rec, event->getFiberId());
+        BinaryEncoder::WriteUint64(rec, event->getLine());
+        BinaryEncoder::WriteString(rec, event->getFile(), strlen(event->getFile()));
+        BinaryEncoder::WriteString(rec, event->getContentData(), event->getContentSize());
+        BinaryLog::WriteFields(rec, event->getFields());
+    }
+
+    Mutex::Lock lock(buf_mutex_);
+    uint64_t    now = GetElapsedMS();
+
+    // 第一次引用的日志器和调用点先写定义
+    if (loggers_.insert(logger->getId()).second) {
+        LogStreamBuf def;
+        BinaryEncoder::WriteUint8(def, BinaryLog::LOGGER);
+        BinaryEncoder::WriteUint64(def, pid_);
+        BinaryEncoder::WriteUint64(def, logger->getId());
+        BinaryEncoder::WriteString(def, logger->getName().c_str(), logger->getName().size());
+        AppendRecord(buffer_, def.data(), def.size());
+    }
+    if (site && (site->getId() >= sites_.size() || !sites_[site->getId()])) {
+        if (site->getId() >= sites_.size()) {
+            sites_.resize(site->getId() + 1);
+        }
+        sites_[site->getId()] = true;
+        LogStreamBuf def;
+        BinaryEncoder::WriteUint8(def, BinaryLog::SITE);
+        BinaryEncoder::WriteUint64(def, pid_);
+        BinaryEncoder::WriteUint64(def, site->getId());
+        BinaryEncoder::WriteUint8(def, site->getLevel());
+        BinaryEncoder::WriteUint64(def, site->getLine());
+        BinaryEncoder::WriteString(def, site->getFile(), strlen(site->getFile()));
+        BinaryEncoder::WriteString(def, site->getFormat(), strlen(site->getFormat()));
+        AppendRecord(buffer_, def.data(), def.size());
+    }
+    AppendRecord(buffer_, rec.data(), rec.size());
+
+    if (buffer_.size() >= kFlushSize || level >= LogLevel::WARN ||
+        now >= lastFlush_ + kFlushInterval) {
+        flushLocked();
+        lastFlush_ = now;
+    }
+}
+
+void BinaryLogAppender::flush()
+{
+    Mutex::Lock lock(buf_mutex_);
+    flushLocked();
+}
+
+void BinaryLogAppender::onTimer(time_t now)
+{
+    // 一段日志之后没有新的记录时，缓冲区最多在内存中停留kFlushInterval再多1秒
+    Mutex::Lock lock(buf_mutex_);
+    uint64_t    ms = GetElapsedMS();
+    if (!buffer_.empty() && ms >= lastFlush_ + kFlushInterval) {
+        flushLocked();
+        lastFlush_ = ms;
+    }
+    // 文件被移走或删除后重新打开，写日志的线程不做这个检查
+    if (ms >= lastCheck_ + 3000) {
+        lastCheck_ = ms;
+        struct stat st;
+        struct stat fst;
+        if (fd_ < 0 || stat(filename_.c_str(), &st) != 0 || fstat(fd_, &fst) != 0 ||
+            st.st_ino != fst.st_ino || st.st_dev != fst.st_dev) {
+            flushLocked();
+            lastFlush_ = ms;
+            reopenLocked();
+        }
+    }
+}
+
+void BinaryLogAppender::flushLocked()
+{
+    size_t pos = 0;
+    while (fd_ >= 0 && pos < buffer_.size()) {
+        ssize_t rt = write(fd_, buffer_.data() + pos, buffer_.size() - pos);
+        if (rt < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cout << "BinaryLogAppender write " << filename_ << " error: " << strerror(errno)
+                      << std::endl;
+            break;
+        }
+        pos += rt;
+    }
+    buffer_.clear();
+}
+
+// 文件头: 魔数加一字节版本号
+static const size_t kHeaderSize = sizeof(BinaryLog::kMagic) + 1;
+
+static void FillHeader(char* head)
+{
+    memcpy(head, BinaryLog::kMagic, sizeof(BinaryLog::kMagic));
+    head[sizeof(BinaryLog::kMagic)] = (char)BinaryLog::kVersion;
+}
+
+bool BinaryLogAppender::reopenLocked()
+{
+    FSUtil::Mkdir(FSUtil::Dirname(filename_));
+    int fd = open(filename_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT) {
+        // 先在临时文件里写好文件头再link过去，fork出的其他进程同时创建时也只有一个文件头，
+        // 其他进程的记录不会出现在文件头之前
+        std::string tmp = filename_ + "." + std::to_string(pid_) + ".tmp";
+        int         tmp_fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (tmp_fd >= 0) {
+            char head[kHeaderSize];
+            FillHeader(head);
+            bool ok = write(tmp_fd, head, sizeof(head)) == (ssize_t)sizeof(head);
+            close(tmp_fd);
+            // 已经存在说明别的进程先创建了
+            if (ok) {
+                link(tmp.c_str(), filename_.c_str());
+            }
+            unlink(tmp.c_str());
+        }
+        fd = open(filename_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        std::cout << "BinaryLogAppender open " << filename_ << " error: " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    fd_ = fd;
+    // 外部创建的空文件直接补上文件头
+    struct stat st;
+    if (fstat(fd_, &st) == 0 && st.st_size == 0) {
+        char head[kHeaderSize];
+        FillHeader(head);
+        if (write(fd_, head, sizeof(head)) < 0) {
+            std::cout << "BinaryLogAppender write " << filename_ << " error: " << strerror(errno)
+                      << std::endl;
+        }
+    }
+    // 新文件重新写调用点和日志器
+    sites_.clear();
+    loggers_.clear();
+    return true;
+}
+
+std::string BinaryLogAppender::toYamlString()
+{
+    MutexType::Lock lock(mutex_);
+    YAML::Node      node;
+    node["type"] = "BinaryLogAppender";
+    node["file"] = filename_;
+    if (level_ != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(level_);
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+}   // namespace hiper
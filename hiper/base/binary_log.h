@@ -0,0 +1,322 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-25 16:20:08
+ * @Description: 二进制日志，调用点只登记一次格式和元信息，运行时只记录调用点编号和参数的二进制编码
+ */
+
+#ifndef HIPER_BINARY_LOG_H
+#define HIPER_BINARY_LOG_H
+
+#include "log.h"
+#include "mutex.h"
+
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief 以二进制方式将日志级别level的日志写入到logger
+ * @details fmt必须是字符串字面量，使用printf风格的占位符，参数在运行时只做二进制编码，
+ *          交给BinaryLogAppender时直接写入文件，交给文本Appender时才格式化
+ */
+#define LOG_BIN_LEVEL(logger, level, fmt, ...) \
+    HIPER_LOG_IF(hiper_log_logger_, logger, level) \
+        hiper::LogBinary(hiper_log_logger_, \
+            []() -> const hiper::BinaryLogSite& { \
+                static const hiper::BinaryLogSite s_site(level, __FILE__, __LINE__, fmt); \
+                return s_site; \
+            }(), ##__VA_ARGS__)
+
+#define LOG_BIN_DEBUG(logger, fmt, ...) LOG_BIN_LEVEL(logger, hiper::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_BIN_INFO(logger, fmt, ...)  LOG_BIN_LEVEL(logger, hiper::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define LOG_BIN_WARN(logger, fmt, ...)  LOG_BIN_LEVEL(logger, hiper::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define LOG_BIN_ERROR(logger, fmt, ...) LOG_BIN_LEVEL(logger, hiper::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define LOG_BIN_FATAL(logger, fmt, ...) LOG_BIN_LEVEL(logger, hiper::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+namespace hiper {
+
+/**
+ * @brief 二进制日志的调用点，构造时登记到全局表，分配进程内唯一的编号
+ */
+class BinaryLogSite {
+public:
+    BinaryLogSite(LogLevel::Level level, const char* file, int32_t line, const char* fmt);
+
+    /**
+     * @brief 按编号查找调用点，不存在返回nullptr
+     */
+    static const BinaryLogSite* Get(uint32_t id);
+
+    uint32_t getId() const { return id_;}
+    LogLevel::Level getLevel() const { return level_;}
+    const char* getFile() const { return file_;}
+    int32_t getLine() const { return line_;}
+    const char* getFormat() const { return fmt_;}
+
+private:
+    uint32_t id_;
+    LogLevel::Level level_;
+    const char* file_;
+    int32_t line_;
+    const char* fmt_;
+};
+
+/**
+ * @brief 二进制编码，格式与ByteArray一致：整数为Varint(有符号数先做zigzag)，
+ *        浮点数为大端定长，字符串为Varint长度加内容
+ */
+class BinaryEncoder {
+public:
+    /**
+     * @brief 参数的类型标记，每个参数前写一个字节
+     */
+    enum ArgType {
+        ARG_INT = 1,
+        ARG_UINT = 2,
+        ARG_DOUBLE = 3,
+        ARG_STRING = 4,
+        ARG_CHAR = 5,
+        ARG_POINTER = 6
+    };
+
+    /**
+     * @brief 把Varint写入out，返回字节数，out至少10字节
+     */
+    static size_t EncodeUint64(char* out, uint64_t v);
+
+    static void WriteUint8(LogStreamBuf& buf, uint8_t v) { buf.append((const char*)&v, 1);}
+    static void WriteUint64(LogStreamBuf& buf, uint64_t v);
+    static void WriteInt64(LogStreamBuf& buf, int64_t v) { WriteUint64(buf, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));}
+    static void WriteDouble(LogStreamBuf& buf, double v);
+    static void WriteString(LogStreamBuf& buf, const char* str, size_t len);
+
+    /**
+     * @brief 写入一个日志参数
+     */
+    template <class T>
+    static void WriteArg(LogStreamBuf& buf, const T& v)
+    {
+        typedef std::decay_t<T> D;
+        if constexpr (std::is_same_v<D, bool>) {
+            WriteUint8(buf, ARG_UINT);
+            WriteUint64(buf, v);
+        }
+        else if constexpr (std::is_same_v<D, char>) {
+            WriteUint8(buf, ARG_CHAR);
+            WriteUint8(buf, v);
+        }
+        else if constexpr (std::is_integral_v<D> && std::is_signed_v<D>) {
+            WriteUint8(buf, ARG_INT);
+            WriteInt64(buf, v);
+        }
+        else if constexpr (std::is_integral_v<D>) {
+            WriteUint8(buf, ARG_UINT);
+            WriteUint64(buf, v);
+        }
+        else if constexpr (std::is_enum_v<D>) {
+            WriteUint8(buf, ARG_INT);
+            WriteInt64(buf, (int64_t)v);
+        }
+        else if constexpr (std::is_floating_point_v<D>) {
+            WriteUint8(buf, ARG_DOUBLE);
+            WriteDouble(buf, v);
+        }
+        else if constexpr (std::is_convertible_v<const T&, const char*>) {
+            const char* str = v;
+            WriteUint8(buf, ARG_STRING);
+            if (str) {
+                WriteString(buf, str, strlen(str));
+            }
+            else {
+                WriteString(buf, "(null)", 6);
+            }
+        }
+        else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            std::string_view str = v;
+            WriteUint8(buf, ARG_STRING);
+            WriteString(buf, str.data(), str.size());
+        }
+        else if constexpr (std::is_pointer_v<D>) {
+            WriteUint8(buf, ARG_POINTER);
+            WriteUint64(buf, (uint64_t)(uintptr_t)v);
+        }
+        else {
+            // 其他类型通过operator<<转成字符串
+            LogStream& ss = GetThreadStream();
+            ss << v;
+            WriteUint8(buf, ARG_STRING);
+            WriteString(buf, ss.buffer().data(), ss.buffer().size());
+        }
+    }
+
+private:
+    /**
+     * @brief 当前线程清空后的字符串流，用于不认识的参数类型
+     */
+    static LogStream& GetThreadStream();
+};
+
+/**
+ * @brief 二进制解码，和BinaryEncoder对应，数据不足时返回false
+ */
+class BinaryDecoder {
+public:
+    BinaryDecoder(const char* data, size_t len)
+        : cur_(data)
+        , end_(data + len)
+    {}
+
+    bool readUint8(uint8_t& v);
+    bool readUint64(uint64_t& v);
+    bool readInt64(int64_t& v);
+    bool readDouble(double& v);
+    /**
+     * @brief 读取字符串，str指向原始数据，不拷贝
+     */
+    bool readString(const char*& str, size_t& len);
+
+    const char* cur() const { return cur_;}
+    size_t left() const { return end_ - cur_;}
+
+private:
+    const char* cur_;
+    const char* end_;
+};
+
+/**
+ * @brief 二进制日志的格式化和文件格式
+ * @details 文件以"HLOG"和一字节版本号开头，之后每条记录为Varint长度加记录内容，
+ *          记录内容第一个字节是记录类型，第二项是写入进程的pid：
+ *          SITE   pid 调用点编号 级别 行号 文件名 格式
+ *          LOGGER pid 日志器编号 名称
+ *          EVENT  pid 调用点编号 日志器编号 时间 线程ID 协程ID 参数...
+ *          TEXT   pid 日志器编号 级别 时间 线程ID 协程ID 行号 文件名 内容 字段... (非二进制的普通日志)
+ *          调用点和日志器的编号只在进程内唯一，prefork的多个worker写同一个文件时按(pid, 编号)区分，
+ *          同一个文件里，每个进程的调用点和日志器在第一次被EVENT/TEXT引用之前写入。
+ *          TEXT的结构化字段一直到记录末尾，每个字段为 类型 名称 值，值按类型编码：
+ *          字符串为String，有符号整数为Int64，无符号整数为Varint，浮点数为Double，布尔为一个字节。
+ *          没有字段的记录和加入字段之前的格式相同
+ */
+class BinaryLog {
+public:
+    enum RecordType {
+        SITE = 1,
+        LOGGER = 2,
+        EVENT = 3,
+        TEXT = 4
+    };
+
+    static const char kMagic[4];
+    static const uint8_t kVersion = 2;
+
+    /**
+     * @brief 按printf风格的格式把参数追加到out
+     * @param[in] fmt 调用点的格式
+     * @param[in] args 参数的二进制编码
+     */
+    static void Render(const char* fmt, const char* args, size_t len, LogStreamBuf& out);
+
+    /**
+     * @brief 把结构化字段按TEXT记录的格式追加到buf
+     */
+    static void WriteFields(LogStreamBuf& buf, const LogFields& fields);
+
+    /**
+     * @brief 读取到记录末尾的结构化字段
+     * @return 数据不完整或者类型不认识返回false，已经读出的字段保留
+     */
+    static bool ReadFields(BinaryDecoder& in, LogFields& fields);
+};
+
+/**
+ * @brief LOG_BIN_*宏的实现，编码参数后交给logger
+ */
+template <class... Args>
+void LogBinary(const std::shared_ptr<Logger>& logger, const BinaryLogSite& site,
+               const Args&... args)
+{
+    LogEvent::ptr event = LogEvent::Create(site.getLevel(), site.getFile(), site.getLine(), 0,
+                                           GetThreadId(), GetFiberId(), time(0),
+                                           Thread::GetName());
+    event->setBinarySite(&site);
+    LogStreamBuf& buf = event->getBuffer();
+    (BinaryEncoder::WriteArg(buf, args), ...);
+    logger->log(site.getLevel(), event);
+}
+
+/**
+ * @brief 以二进制格式写文件的Appender
+ * @details LOG_BIN_*的日志只写调用点编号和参数，普通日志写成TEXT记录。
+ *          记录先攒在内存里，超过64K、日志级别不低于WARN、距上次写入超过1秒时才write，
+ *          没有新日志时由日志的后台线程每秒检查一次，缓冲的记录最多在内存里停留2秒。
+ *          后台线程每3秒检查一次文件是否被移走或删除，是则重新打开，新文件重新写调用点和日志器信息。
+ *          fork出的子进程清空从父进程复制来的缓冲区，以自己的pid重新写调用点和日志器信息。
+ *          用hiper-logcat把文件转成文本
+ */
+class BinaryLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<BinaryLogAppender> ptr;
+
+    BinaryLogAppender(const std::string& filename);
+    ~BinaryLogAppender();
+
+    void        log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+
+    /**
+     * @brief 把内存中的记录写入文件
+     */
+    void flush() override;
+
+    /**
+     * @brief 后台线程调用，距上次写入超过1秒时把缓冲的记录写入文件，每3秒检查一次文件是否需要重新打开
+     */
+    void onTimer(time_t now) override;
+
+    /**
+     * @brief pthread_atfork的回调，对所有存活的BinaryLogAppender加锁、解锁或重置
+     */
+    static void ForkPrepare();
+    static void ForkParent();
+    static void ForkChild();
+
+private:
+    /**
+     * @brief 追加一条记录到out，payload为记录内容
+     */
+    static void AppendRecord(std::string& out, const char* payload, size_t len);
+
+    /**
+     * @brief 写入缓冲的记录，需持有buf_mutex_
+     */
+    void flushLocked();
+
+    /**
+     * @brief 打开文件，空文件写入文件头，需持有buf_mutex_
+     */
+    bool reopenLocked();
+
+private:
+    // 文件路径
+    std::string filename_;
+    // 文件描述符
+    int fd_ = -1;
+    // 写入记录的进程
+    pid_t pid_;
+    Mutex buf_mutex_;
+    // 等待写入的记录
+    std::string buffer_;
+    // 当前文件中已经写过的调用点和日志器
+    std::vector<bool> sites_;
+    std::unordered_set<uint32_t> loggers_;
+    // 上次写入和检查文件的时间
+    uint64_t lastFlush_ = 0;
+    uint64_t lastCheck_ = 0;
+};
+
+}   // namespace hiper
+
+#endif   // HIPER_BINARY_LOG_H
@@ -0,0 +1,247 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-12 10:48:07
+ * @Description: 阻塞调用卸载线程池
+ */
+
+#include "blocking_executor.h"
+
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "metrics.h"
+#include "scheduler.h"
+#include "util.h"
+
+#include <algorithm>
+
+namespace hiper {
+
+static hiper::Logger::ptr g_logger = LOG_NAME("system");
+
+static hiper::ConfigVar<uint32_t>::ptr g_blocking_executor_thread_num = hiper::Config::Lookup(
+    "blocking_executor.thread_num", (uint32_t)4, "blocking executor thread num");
+
+// 当前线程所属的执行器
+static thread_local BlockingExecutor* t_executor = nullptr;
+
+BlockingExecutor::BlockingExecutor(size_t threads, const std::string& name)
+    : sem_(0)
+    , name_(name)
+    , thread_count_(threads)
+{
+    std::string labels = "executor=\"" + name_ + "\"";
+    wait_us_           = MetricsMgr::GetInstance()->histogram(
+        "hiper_blocking_executor_wait_us", "time a blocking task waits in the queue", labels);
+    run_us_ = MetricsMgr::GetInstance()->histogram(
+        "hiper_blocking_executor_run_us", "time a blocking task runs", labels);
+    std::string gauge_labels =
+        labels + ",instance=\"" + std::to_string(MetricsRegistry::NextInstanceId()) + "\"";
+    queue_depth_ = MetricsMgr::GetInstance()->gauge(
+        "hiper_blocking_executor_queue_depth", [this]() { return (int64_t)pending_count_; },
+        "blocking tasks waiting in the queue", gauge_labels);
+    active_ = MetricsMgr::GetInstance()->gauge(
+        "hiper_blocking_executor_active", [this]() { return (int64_t)active_count_; },
+        "blocking tasks running", gauge_labels);
+}
+
+BlockingExecutor::~BlockingExecutor()
+{
+    stop();
+    MetricsMgr::GetInstance()->remove(queue_depth_);
+    MetricsMgr::GetInstance()->remove(active_);
+}
+
+BlockingExecutor* BlockingExecutor::GetThis()
+{
+    return t_executor;
+}
+
+void BlockingExecutor::start()
+{
+    MutexType::Lock lock(mutex_);
+    if (!stopping_) {
+        return;
+    }
+    stopping_ = false;
+    started_  = true;
+    HIPER_ASSERT(threads_.empty());
+
+    // 延迟到启动时读取配置，保证配置文件已经加载
+    if (thread_count_ == 0) {
+        thread_count_ = std::max(g_blocking_executor_thread_num->getValue(), (uint32_t)1);
+    }
+    threads_.resize(thread_count_);
+    for (size_t i = 0; i < thread_count_; ++i) {
+        threads_[i].reset(
+            new Thread(std::bind(&BlockingExecutor::work, this), name_ + "_" + std::to_string(i)));
+    }
+}
+
+void BlockingExecutor::stop()
+{
+    std::vector<Thread::ptr> thrs;
+    {
+        MutexType::Lock lock(mutex_);
+        if (stopping_) {
+            return;
+        }
+        stopping_ = true;
+        thrs.swap(threads_);
+    }
+
+    // 每个工作线程都需要一次唤醒来发现stopping_
+    for (size_t i = 0; i < thrs.size(); ++i) {
+        sem_.notify();
+    }
+    for (auto& i : thrs) {
+        i->join();
+    }
+}
+
+void BlockingExecutor::run(std::function<void()> cb)
+{
+    Scheduler* scheduler = Scheduler::GetThis();
+
+    // 不在协程调度器中、处于线程主协程/调度协程中、或者已经在执行器线程中，直接执行
+    if (!scheduler || t_executor || Fiber::GetFiberId() == 0 ||
+        Fiber::GetThis().get() == Scheduler::GetSchedulerFiber()) {
+        cb();
+        return;
+    }
+
+    std::exception_ptr error;
+
+    Task task;
+    task.cb.swap(cb);
+    task.scheduler = scheduler;
+    task.fiber     = Fiber::GetThis();
+    task.thread_id = hiper::GetThreadId();
+    task.error     = &error;
+    scheduler->addExternalWait();
+    if (HIPER_UNLIKELY(!enqueue(task))) {
+        // 执行器已停止，退化为在调用线程上执行
+        scheduler->delExternalWait();
+        task.cb();
+        return;
+    }
+
+    // 固定回到原线程恢复，保证任务完成时协程已经完全切出
+    Fiber::YieldToHold();
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void BlockingExecutor::dispatch(std::function<void()> cb)
+{
+    Task task;
+    task.cb.swap(cb);
+    if (HIPER_UNLIKELY(!enqueue(task))) {
+        task.cb();
+    }
+}
+
+bool BlockingExecutor::enqueue(Task& task)
+{
+    // 第一次投递任务时才创建线程，未使用执行器的程序不会多出线程
+    if (HIPER_UNLIKELY(!started_)) {
+        start();
+    }
+
+    task.enqueue_us = hiper::GetElapsedUS();
+    {
+        MutexType::Lock lock(mutex_);
+        if (HIPER_UNLIKELY(stopping_)) {
+            return false;
+        }
+        tasks_.push_back(std::move(task));
+        ++pending_count_;
+    }
+    sem_.notify();
+    return true;
+}
+
+void BlockingExecutor::work()
+{
+    t_executor = this;
+    while (true) {
+        sem_.wait();
+
+        Task task;
+        {
+            MutexType::Lock lock(mutex_);
+            if (tasks_.empty()) {
+                if (stopping_) {
+                    break;
+                }
+                continue;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        --pending_count_;
+        ++active_count_;
+
+        uint64_t start = hiper::GetElapsedUS();
+        uint64_t wait  = start - task.enqueue_us;
+        total_wait_us_ += wait;
+        wait_us_->record(wait);
+        uint64_t max_wait = max_wait_us_;
+        while (wait > max_wait && !max_wait_us_.compare_exchange_weak(max_wait, wait))
+            ;
+
+        try {
+            task.cb();
+        }
+        catch (...) {
+            if (task.error) {
+                *task.error = std::current_exception();
+            }
+            else {
+                LOG_ERROR(g_logger) << "BlockingExecutor " << name_ << " task except"
+                                    << std::endl
+                                    << hiper::BacktraceToString();
+            }
+        }
+        task.cb = nullptr;
+
+        uint64_t run = hiper::GetElapsedUS() - start;
+        total_run_us_ += run;
+        run_us_->record(run);
+        ++total_tasks_;
+        --active_count_;
+
+        if (task.fiber) {
+            // 先放回调度队列再撤销计数，调度器不会在两者之间停止
+            task.scheduler->schedule(task.fiber, task.thread_id);
+            task.scheduler->delExternalWait();
+        }
+    }
+    t_executor = nullptr;
+}
+
+uint64_t BlockingExecutor::getAvgWaitUS() const
+{
+    uint64_t total = total_tasks_;
+    return total ? total_wait_us_ / total : 0;
+}
+
+uint64_t BlockingExecutor::getAvgRunUS() const
+{
+    uint64_t total = total_tasks_;
+    return total ? total_run_us_ / total : 0;
+}
+
+std::ostream& BlockingExecutor::dump(std::ostream& os)
+{
+    os << "[BlockingExecutor name=" << name_ << " size=" << thread_count_
+       << " queue_depth=" << pending_count_ << " active_count=" << active_count_
+       << " total_tasks=" << total_tasks_ << " avg_wait_us=" << getAvgWaitUS()
+       << " max_wait_us=" << max_wait_us_ << " avg_run_us=" << getAvgRunUS()
+       << " stopping=" << stopping_ << " ]";
+    return os;
+}
+
+}   // namespace hiper
@@ -0,0 +1,159 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-12 10:20:31
+ * @Description: 阻塞调用卸载线程池，执行无法被hook的阻塞操作(文件IO、getaddrinfo、fsync、CPU密集计算)
+ */
+
+#ifndef HIPER_BLOCKING_EXECUTOR_H
+#define HIPER_BLOCKING_EXECUTOR_H
+
+#include "fiber.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "singleton.h"
+#include "thread.h"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+namespace hiper {
+
+class Scheduler;
+class Histogram;
+class Gauge;
+
+/**
+ * @brief 阻塞任务执行器
+ * @details 协程调用run()后以HOLD状态让出执行权，任务在独立的线程池中执行，
+ *          执行完成后协程被重新调度回原调度器的原线程，IO线程上的其他协程不受影响。
+ *          不在协程调度器中调用时直接在当前线程执行。
+ */
+class BlockingExecutor : public Noncopyable {
+public:
+    typedef std::shared_ptr<BlockingExecutor> ptr;
+    typedef Mutex                             MutexType;
+
+    /**
+     * @brief 构造函数
+     * @param[in] threads 线程数，0表示使用配置blocking_executor.thread_num
+     * @param[in] name 线程池名称
+     */
+    BlockingExecutor(size_t threads = 0, const std::string& name = "blocking");
+
+    ~BlockingExecutor();
+
+    const std::string& getName() const { return name_; }
+
+    /**
+     * @brief 启动线程池，第一次投递任务时会自动调用
+     */
+    void start();
+
+    /**
+     * @brief 停止线程池，队列中剩余的任务会执行完毕后再退出
+     */
+    void stop();
+
+    /**
+     * @brief 执行阻塞任务，当前协程挂起直到任务完成
+     * @note 任务中抛出的异常会在调用协程中重新抛出
+     */
+    void run(std::function<void()> cb);
+
+    /**
+     * @brief 执行带返回值的阻塞任务
+     */
+    template<class F> auto call(F f) -> decltype(f())
+    {
+        typedef decltype(f()) R;
+        if constexpr (std::is_void<R>::value) {
+            run(f);
+        }
+        else {
+            std::unique_ptr<R> result;
+            run([&result, &f]() { result.reset(new R(f())); });
+            return std::move(*result);
+        }
+    }
+
+    /**
+     * @brief 投递任务后立即返回，不等待执行结果
+     */
+    void dispatch(std::function<void()> cb);
+
+    // 当前排队等待执行的任务数
+    size_t getQueueDepth() const { return pending_count_; }
+
+    // 正在执行的任务数
+    size_t getActiveCount() const { return active_count_; }
+
+    // 已完成的任务数
+    uint64_t getTotalTasks() const { return total_tasks_; }
+
+    // 平均排队等待时间(微秒)
+    uint64_t getAvgWaitUS() const;
+
+    // 平均执行时间(微秒)
+    uint64_t getAvgRunUS() const;
+
+    // 最大排队等待时间(微秒)
+    uint64_t getMaxWaitUS() const { return max_wait_us_; }
+
+    std::ostream& dump(std::ostream& os);
+
+    /**
+     * @brief 返回当前线程所属的执行器，非执行器线程返回nullptr
+     */
+    static BlockingExecutor* GetThis();
+
+private:
+    struct Task
+    {
+        std::function<void()> cb;
+        Scheduler*            scheduler  = nullptr;   // 挂起协程所在的调度器
+        Fiber::ptr            fiber;                  // 挂起的协程
+        int                   thread_id  = -1;        // 挂起协程所在的线程
+        uint64_t              enqueue_us = 0;         // 入队时间
+        std::exception_ptr*   error      = nullptr;   // 异常回传
+    };
+
+    // 任务入队，执行器已停止时返回false
+    bool enqueue(Task& task);
+
+    void work();
+
+private:
+    MutexType                mutex_;
+    Semaphore                sem_;
+    std::vector<Thread::ptr> threads_;
+    std::list<Task>          tasks_;
+    std::string              name_;
+    size_t                   thread_count_;
+    bool                     stopping_ = true;
+    std::atomic<bool>        started_  = {false};
+
+    std::atomic<size_t>   pending_count_ = {0};
+    std::atomic<size_t>   active_count_  = {0};
+    std::atomic<uint64_t> total_tasks_   = {0};
+    std::atomic<uint64_t> total_wait_us_ = {0};
+    std::atomic<uint64_t> total_run_us_  = {0};
+    std::atomic<uint64_t> max_wait_us_   = {0};
+
+    std::shared_ptr<Histogram> wait_us_;
+    std::shared_ptr<Histogram> run_us_;
+    std::shared_ptr<Gauge>     queue_depth_;
+    std::shared_ptr<Gauge>     active_;
+};
+
+// 全局阻塞任务执行器
+typedef Singleton<BlockingExecutor> BlockingExecutorMgr;
+
+}   // namespace hiper
+
+#endif   // HIPER_BLOCKING_EXECUTOR_H
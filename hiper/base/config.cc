@@ -6,6 +6,7 @@
 
 #include "config.h"
 
+#include "blocking_executor.h"
 #include "env.h"
 #include "util.h"
 
@@ -83,21 +84,31 @@ void Config::LoadFromConfDir(const std::string& path, bool force)
 {
     std::string              absoulte_path = hiper::EnvMgr::GetInstance()->getAbsolutePath(path);
     std::vector<std::string> files;
-    FSUtil::ListAllFile(files, absoulte_path, ".yml");
-
-    for (auto& i : files) {
-        {
+    std::vector<uint64_t>    mtimes;
+    // 目录遍历、stat和文件读取都是阻塞IO，在协程中重新加载配置时交给阻塞任务执行器
+    BlockingExecutor* executor = BlockingExecutorMgr::GetInstance();
+    executor->run([&]() {
+        FSUtil::ListAllFile(files, absoulte_path, ".yml");
+        for (auto& i : files) {
             struct stat st;
+            memset(&st, 0, sizeof(st));
             lstat(i.c_str(), &st);
+            mtimes.push_back(st.st_mtime);
+        }
+    });
+
+    for (size_t n = 0; n < files.size(); ++n) {
+        const std::string& i = files[n];
+        {
             hiper::Mutex::Lock lock(s_mutex);
             // 使用文件最后修改时间判断是否需要加载,避免每次都遍历加载所有的配置文件
-            if (!force && s_file2modifytime[i] == (uint64_t)st.st_mtime) {
+            if (!force && s_file2modifytime[i] == mtimes[n]) {
                 continue;
             }
-            s_file2modifytime[i] = st.st_mtime;
+            s_file2modifytime[i] = mtimes[n];
         }
         try {
-            YAML::Node root = YAML::LoadFile(i);
+            YAML::Node root = executor->call([&i]() { return YAML::LoadFile(i); });
             LoadFromYaml(root);
             LOG_INFO(g_logger) << "LoadConfFile file=" << i << " ok";
         }
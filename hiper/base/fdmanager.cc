@@ -1,5 +1,6 @@
 #include "fdmanager.h"
 
+#include "arena.h"
 #include "hook.h"
 
 #include <fcntl.h>
@@ -97,10 +98,14 @@ FdCtx::ptr FdManager:: get(int fd, bool auto_create) {
     lock.unlock();
 
     RWMutexType::WriteLock lock2(mutex_);
-    FdCtx::ptr ctx(new FdCtx(fd));
     if(fd >= (int)datas_.size()) {
-        datas_.resize(fd * 1.5);
+        datas_.resize(fd * 1.5 + 1);
+    } else if(datas_[fd]) {
+        // 释放读锁期间可能已经被其他线程创建
+        return datas_[fd];
     }
+    // 连接频繁创建关闭，FdCtx从空闲链表中分配
+    FdCtx::ptr ctx = std::allocate_shared<FdCtx>(PoolAllocator<FdCtx>(), fd);
     datas_[fd] = ctx;
     return ctx;
 }
@@ -113,4 +118,14 @@ void FdManager::del(int fd) {
     datas_[fd].reset();
 }
 
+void FdManager::visit(std::function<void(FdCtx::ptr)> cb)
+{
+    RWMutexType::ReadLock lock(mutex_);
+    for (auto& i : datas_) {
+        if (i) {
+            cb(i);
+        }
+    }
+}
+
 }   // namespace hiper
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include "singleton.h"
 #include "thread.h"
 
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -39,6 +40,8 @@ public:
 
     bool isClose() const { return is_closed_; }
 
+    int getFd() const { return fd_; }
+
     /**
      * @brief 设置用户主动设置非阻塞
      * @param[in] v 是否阻塞
@@ -112,6 +115,12 @@ public:
 
     void del(int fd);
 
+    /**
+     * @brief 遍历所有已创建的FdCtx
+     * @note 回调在读锁内执行，不能再调用get/del
+     */
+    void visit(std::function<void(FdCtx::ptr)> cb);
+
 private:
     // 读写锁
     RWMutexType mutex_;
@@ -8,16 +8,27 @@
 #include "fiber.h"
 
 #include "config.h"
+#include "hook.h"
+#include "iomanager.h"
 #include "log.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "task_monitor.h"
+#include "util.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <execinfo.h>
 #include <mimalloc-2.1/mimalloc.h>
+#include <mutex>
+#include <signal.h>
+#include <sstream>
 #include <sys/types.h>
+#include <typeinfo>
 #include <ucontext.h>
+#include <unordered_set>
 
 namespace hiper {
 
@@ -37,11 +48,265 @@ static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 1024 * 1024, "fiber stack size");
 
 
+static ConfigVar<uint32_t>::ptr g_fiber_stack_cache_size = Config::Lookup<uint32_t>(
+    "fiber.stack_cache_size", 16, "cached fiber stacks per thread");
+
+static uint32_t s_fiber_stack_size       = 1024 * 1024;
+static uint32_t s_fiber_stack_cache_size = 16;
+
+struct _FiberIniter
+{
+    _FiberIniter()
+    {
+        s_fiber_stack_size       = g_fiber_stack_size->getValue();
+        s_fiber_stack_cache_size = g_fiber_stack_cache_size->getValue();
+        g_fiber_stack_size->addListener(
+            [](const uint32_t& old_value, const uint32_t& new_value) { s_fiber_stack_size = new_value; });
+        g_fiber_stack_cache_size->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_fiber_stack_cache_size = new_value;
+        });
+    }
+};
+
+static _FiberIniter s_fiber_initer;
+
+static ConfigVar<bool>::ptr g_fiber_trace = Config::Lookup(
+    "fiber.trace", false, "record fiber state and yield sites for dumps, dump on SIGUSR1");
+
+static bool s_fiber_trace = false;
+
+static void StartTraceDumper();
+
+struct _FiberTraceIniter
+{
+    _FiberTraceIniter()
+    {
+        g_fiber_trace->addListener([](const bool& old_value, const bool& new_value) {
+            if (new_value) {
+                StartTraceDumper();
+            }
+            s_fiber_trace = new_value;
+        });
+    }
+};
+
+static _FiberTraceIniter s_fiber_trace_initer;
+
+/**
+ * @brief 协程的跟踪信息
+ * @details 字段由协程所在的线程写入，DumpFibers在其他线程读取，都使用relaxed的原子变量。
+ *          调用栈只保存返回地址，输出时才做符号化
+ */
+struct Fiber::Trace
+{
+    static constexpr int kDepth = 8;
+
+    std::atomic<int>                   state{INIT};
+    std::atomic<int>                   thread_id{-1};        // 最近一次执行所在的线程
+    std::atomic<uint64_t>              create_us{0};
+    std::atomic<uint64_t>              yield_us{0};          // 最近一次让出的时间
+    std::atomic<uint64_t>              hold_total_us{0};     // 累计挂起的时间
+    std::atomic<uint64_t>              switches{0};
+    std::atomic<bool>                  waiting{false};
+    std::atomic<int>                   wait_fd{-1};
+    std::atomic<uint32_t>              wait_event{0};
+    std::atomic<uint64_t>              wait_timeout{~0ull};
+    std::atomic<const std::type_info*> cb_type{nullptr};
+    std::atomic<int>                   create_depth{0};
+    std::atomic<void*>                 create_frames[kDepth];
+    std::atomic<void*>                 yield_site{nullptr};   // 调用yield的位置，只有一层
+
+    /**
+     * @brief 保存当前调用栈，跳过skip层(包括Capture自己)，只在创建时调用
+     */
+    static void Capture(std::atomic<void*>* frames, std::atomic<int>& depth, int skip)
+    {
+        void* buf[kDepth + 3];
+        int   n = ::backtrace(buf, kDepth + skip);
+        n       = std::max(n - skip, 0);
+        for (int i = 0; i < n; ++i) {
+            frames[i].store(buf[i + skip], std::memory_order_relaxed);
+        }
+        depth.store(n, std::memory_order_relaxed);
+    }
+};
+
+struct FiberRegistry
+{
+    Mutex                      mutex;
+    std::unordered_set<Fiber*> fibers;
+};
+
+static FiberRegistry& GetFiberRegistry()
+{
+    static FiberRegistry s_registry;
+    return s_registry;
+}
+
+static int s_trace_pipe[2] = {-1, -1};
+
+static void OnTraceSignal(int)
+{
+    // 信号处理中不能加锁和分配内存，只通知后台线程
+    char c = 1;
+    if (write_old(s_trace_pipe[1], &c, 1) < 0) {
+        return;
+    }
+}
+
+static void RunTraceDumper()
+{
+    char c;
+    while (true) {
+        ssize_t n = read_old(s_trace_pipe[0], &c, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        std::stringstream ss;
+        Fiber::DumpFibers(ss);
+        LOG_INFO(g_logger) << "fiber dump:" << std::endl << ss.str();
+    }
+}
+
+static Thread* s_trace_dumper = nullptr;
+
+static void OpenTracePipe(int fds[2])
+{
+    if (pipe2(fds, O_CLOEXEC)) {
+        fds[0] = fds[1] = -1;
+        return;
+    }
+    fcntl_old(fds[1], F_SETFL, O_NONBLOCK);
+}
+
+// fork时持有注册表的锁，子进程里不会有别的线程停在加锁的中间，DumpFibers不会死锁
+static void TraceForkPrepare() { GetFiberRegistry().mutex.lock(); }
+
+static void TraceForkParent() { GetFiberRegistry().mutex.unlock(); }
+
+// fork后子进程里还没有重新创建管道和后台线程
+static std::atomic<bool> s_trace_forked{false};
+
+/**
+ * @brief 子进程继承了信号处理函数和管道，但没有后台线程
+ * @details 关掉继承来的管道，否则收到SIGUSR1时会通知到父进程的线程。这里还在fork的过程中，
+ *          子进程可能马上exec，不创建线程，等子进程第一次登记协程时再创建管道和后台线程，
+ *          在此之前收到的SIGUSR1被忽略
+ */
+static void TraceForkChild()
+{
+    int old_pipe[2] = {s_trace_pipe[0], s_trace_pipe[1]};
+    s_trace_pipe[0] = s_trace_pipe[1] = -1;
+    close_old(old_pipe[0]);
+    close_old(old_pipe[1]);
+    // 线程对象描述的是父进程中的线程，析构时会对它调用pthread_detach，直接泄漏
+    s_trace_dumper = nullptr;
+    s_trace_forked.store(true, std::memory_order_relaxed);
+    GetFiberRegistry().mutex.unlock();
+}
+
+/**
+ * @brief fork出的子进程里第一次需要后台线程时重新创建管道和线程
+ */
+static void RestartTraceDumper()
+{
+    Mutex::Lock lock(GetFiberRegistry().mutex);
+    if (!s_trace_forked.load(std::memory_order_relaxed)) {
+        return;
+    }
+    s_trace_forked.store(false, std::memory_order_relaxed);
+    int fds[2];
+    OpenTracePipe(fds);
+    if (fds[0] < 0) {
+        return;
+    }
+    s_trace_pipe[0] = fds[0];
+    s_trace_pipe[1] = fds[1];
+    s_trace_dumper  = new Thread(&RunTraceDumper, "fiber_dump");
+}
+
+static void StartTraceDumper()
+{
+    static std::once_flag s_once;
+    std::call_once(s_once, []() {
+        OpenTracePipe(s_trace_pipe);
+        if (s_trace_pipe[0] < 0) {
+            LOG_ERROR(g_logger) << "fiber trace pipe2 errno=" << errno
+                                << " errstr=" << strerror(errno);
+            return;
+        }
+        s_trace_dumper = new Thread(&RunTraceDumper, "fiber_dump");
+        pthread_atfork(&TraceForkPrepare, &TraceForkParent, &TraceForkChild);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = OnTraceSignal;
+        sa.sa_flags   = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR1, &sa, nullptr);
+    });
+    if (HIPER_UNLIKELY(s_trace_forked.load(std::memory_order_relaxed))) {
+        RestartTraceDumper();
+    }
+}
+
+/**
+ * @brief 线程内缓存的默认大小协程栈
+ * @details 每个连接、每个任务都会创建协程，缓存释放的栈避免反复向系统申请大块内存。
+ *          fiber.stack_size可以在运行时修改，每个栈记录自己的大小，大小不符的旧栈在取用时释放
+ */
+struct StackCache
+{
+    static constexpr size_t kMaxSize = 64;
+
+    ~StackCache()
+    {
+        for (size_t i = 0; i < count; ++i) {
+            mi_free(stacks[i].ptr);
+        }
+        count = 0;
+    }
+
+    struct Slot
+    {
+        void*  ptr;
+        size_t size;
+    };
+
+    Slot   stacks[kMaxSize];
+    size_t count = 0;
+};
+
+static thread_local StackCache t_stack_cache;
+
 class MallocStackAllocator {
 public:
-    static void* Alloc(size_t size) { return mi_malloc(size); }
+    static void* Alloc(size_t size)
+    {
+        if (size == s_fiber_stack_size) {
+            while (t_stack_cache.count) {
+                StackCache::Slot& slot = t_stack_cache.stacks[--t_stack_cache.count];
+                if (slot.size == size) {
+                    return slot.ptr;
+                }
+                mi_free(slot.ptr);
+            }
+        }
+        return mi_malloc(size);
+    }
 
-    static void Dealloc(void* vp, size_t size) { mi_free(vp); }
+    static void Dealloc(void* vp, size_t size)
+    {
+        if (size == s_fiber_stack_size &&
+            t_stack_cache.count < std::min<size_t>(s_fiber_stack_cache_size, StackCache::kMaxSize)) {
+            t_stack_cache.stacks[t_stack_cache.count++] = {vp, size};
+            return;
+        }
+        mi_free(vp);
+    }
 };
 
 
@@ -79,7 +344,7 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool back_to_caller)
     , cb_(cb)
 {
     ++s_fiber_count;
-    stacksize_ = stacksize ? stacksize : g_fiber_stack_size->getValue();
+    stacksize_ = stacksize ? stacksize : s_fiber_stack_size;
 
     stack_ = StackAllocator::Alloc(stacksize_);
     if (getcontext(&ctx_)) {
@@ -94,6 +359,9 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool back_to_caller)
 
     makecontext(&ctx_, &Fiber::MainFunc, 0);
 
+    if (HIPER_UNLIKELY(s_fiber_trace)) {
+        traceStart();
+    }
     LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << id_;
 }
 
@@ -101,6 +369,9 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool back_to_caller)
 Fiber::~Fiber()
 {
     --s_fiber_count;
+    if (trace_) {
+        traceStop();
+    }
     if (stack_) {
         HIPER_ASSERT(state_ == TERM || state_ == EXCEPT || state_ == INIT);
         StackAllocator::Dealloc(stack_, stacksize_);
@@ -134,7 +405,16 @@ void Fiber::reset(std::function<void()> cb)
     ctx_.uc_stack.ss_size = stacksize_;
 
     makecontext(&ctx_, &Fiber::MainFunc, 0);
-    state_ = INIT;
+    state_         = INIT;
+    pin_scheduler_ = nullptr;
+    pin_thread_    = -1;
+    // 复用的协程在关闭跟踪后不再登记，否则之后每次切换都还要记录
+    if (HIPER_UNLIKELY(s_fiber_trace)) {
+        traceStart();
+    }
+    else if (HIPER_UNLIKELY(trace_)) {
+        traceStop();
+    }
 }
 
 // 切换到当前协程执行
@@ -143,6 +423,18 @@ void Fiber::resume()
     SetThis(this);
     HIPER_ASSERT(state_ != EXEC);
     state_ = EXEC;
+    if (HIPER_UNLIKELY(trace_)) {
+        uint64_t now   = GetElapsedUS();
+        uint64_t yield = trace_->yield_us.load(std::memory_order_relaxed);
+        if (yield) {
+            trace_->hold_total_us.fetch_add(now - yield, std::memory_order_relaxed);
+            trace_->yield_us.store(0, std::memory_order_relaxed);
+        }
+        trace_->state.store(EXEC, std::memory_order_relaxed);
+        trace_->thread_id.store(GetThreadId(), std::memory_order_relaxed);
+        trace_->waiting.store(false, std::memory_order_relaxed);
+        trace_->switches.fetch_add(1, std::memory_order_relaxed);
+    }
     if (back_to_caller_) {
         // LOG_DEBUG(g_logger) << " back_to_caller_ from " << t_thread_main_fiber->id_;
         if (swapcontext(&t_thread_main_fiber->ctx_, &ctx_)) {
@@ -160,6 +452,18 @@ void Fiber::resume()
 // 将当前协程切换到后台
 void Fiber::yield()
 {
+    yieldFrom(__builtin_return_address(0));
+}
+
+void Fiber::yieldFrom(void* site)
+{
+    if (HIPER_UNLIKELY(trace_)) {
+        traceYield(site);
+    }
+    // 执行完的协程在MainFunc中让出，调用栈里已经没有回调了
+    if (state_ != TERM && state_ != EXCEPT) {
+        TaskMonitor::TaskYield();
+    }
     if (back_to_caller_) {
         // LOG_DEBUG(g_logger) << " back_to_caller_ yield to " << t_thread_main_fiber->id_;
         SetThis(t_thread_main_fiber.get());
@@ -202,7 +506,7 @@ void Fiber::YieldToReady()
     Fiber::ptr cur = GetThis();
     HIPER_ASSERT(cur->state_ == EXEC);
     cur->state_ = READY;
-    cur->yield();
+    cur->yieldFrom(__builtin_return_address(0));
 }
 
 // 协程切换到后台，并且设置为Hold状态
@@ -211,7 +515,7 @@ void Fiber::YieldToHold()
     Fiber::ptr cur = GetThis();
     HIPER_ASSERT(cur->state_ == EXEC);
     cur->state_ = HOLD;
-    cur->yield();
+    cur->yieldFrom(__builtin_return_address(0));
 }
 
 // 总协程数
@@ -257,4 +561,175 @@ uint64_t Fiber::GetFiberId()
     return 0;
 }
 
+void Fiber::traceStart()
+{
+    if (HIPER_UNLIKELY(s_trace_forked.load(std::memory_order_relaxed))) {
+        RestartTraceDumper();
+    }
+    if (!trace_) {
+        trace_ = new Trace;
+        FiberRegistry& r = GetFiberRegistry();
+        Mutex::Lock    lock(r.mutex);
+        r.fibers.insert(this);
+    }
+    // reset复用时创建位置和回调也跟着更新
+    trace_->state.store(INIT, std::memory_order_relaxed);
+    trace_->create_us.store(GetElapsedUS(), std::memory_order_relaxed);
+    trace_->yield_us.store(0, std::memory_order_relaxed);
+    trace_->hold_total_us.store(0, std::memory_order_relaxed);
+    trace_->switches.store(0, std::memory_order_relaxed);
+    trace_->yield_site.store(nullptr, std::memory_order_relaxed);
+    trace_->cb_type.store(cb_ ? &cb_.target_type() : nullptr, std::memory_order_relaxed);
+    Trace::Capture(trace_->create_frames, trace_->create_depth, 3);
+}
+
+void Fiber::traceStop()
+{
+    FiberRegistry& r = GetFiberRegistry();
+    {
+        Mutex::Lock lock(r.mutex);
+        r.fibers.erase(this);
+    }
+    delete trace_;
+    trace_ = nullptr;
+}
+
+void Fiber::traceYield(void* site)
+{
+    // 直接调用yield时状态还是EXEC，调度器随后会置为HOLD。
+    // 每次切换都会走到这里，只记录调用位置，完整的调用栈只在创建时取
+    trace_->state.store(state_ == EXEC ? HOLD : state_, std::memory_order_relaxed);
+    trace_->yield_us.store(GetElapsedUS(), std::memory_order_relaxed);
+    trace_->yield_site.store(site, std::memory_order_relaxed);
+}
+
+void Fiber::EnableTrace(bool v)
+{
+    g_fiber_trace->setValue(v);
+}
+
+bool Fiber::IsTraceEnabled()
+{
+    return s_fiber_trace;
+}
+
+void Fiber::SetWaiting(int fd, uint32_t event, uint64_t timeout_ms)
+{
+    Fiber* cur = t_fiber;
+    if (!cur || !cur->trace_) {
+        return;
+    }
+    cur->trace_->wait_fd.store(fd, std::memory_order_relaxed);
+    cur->trace_->wait_event.store(event, std::memory_order_relaxed);
+    cur->trace_->wait_timeout.store(timeout_ms, std::memory_order_relaxed);
+    cur->trace_->waiting.store(true, std::memory_order_relaxed);
+}
+
+static const char* StateToString(int state)
+{
+    switch (state) {
+#define XX(name) \
+    case Fiber::name: return #name;
+        XX(INIT);
+        XX(HOLD);
+        XX(EXEC);
+        XX(TERM);
+        XX(READY);
+        XX(EXCEPT);
+#undef XX
+    }
+    return "UNKNOWN";
+}
+
+std::ostream& Fiber::DumpFibers(std::ostream& os)
+{
+    struct Record
+    {
+        uint64_t               id;
+        int                    state;
+        int                    thread_id;
+        uint64_t               create_us;
+        uint64_t               yield_us;
+        uint64_t               hold_total_us;
+        uint64_t               switches;
+        bool                   waiting;
+        int                    wait_fd;
+        uint32_t               wait_event;
+        uint64_t               wait_timeout;
+        const std::type_info*  cb_type;
+        int                    create_depth;
+        void*                  create_frames[Trace::kDepth];
+        void*                  yield_site;
+    };
+
+    // 锁内只复制，符号化比较慢，放到锁外
+    std::vector<Record> records;
+    {
+        FiberRegistry& r = GetFiberRegistry();
+        Mutex::Lock    lock(r.mutex);
+        records.resize(r.fibers.size());
+        size_t i = 0;
+        for (Fiber* f : r.fibers) {
+            Trace*  t      = f->trace_;
+            Record& rec    = records[i++];
+            rec.id            = f->id_;
+            rec.state         = t->state.load(std::memory_order_relaxed);
+            rec.thread_id     = t->thread_id.load(std::memory_order_relaxed);
+            rec.create_us     = t->create_us.load(std::memory_order_relaxed);
+            rec.yield_us      = t->yield_us.load(std::memory_order_relaxed);
+            rec.hold_total_us = t->hold_total_us.load(std::memory_order_relaxed);
+            rec.switches      = t->switches.load(std::memory_order_relaxed);
+            rec.waiting       = t->waiting.load(std::memory_order_relaxed);
+            rec.wait_fd       = t->wait_fd.load(std::memory_order_relaxed);
+            rec.wait_event    = t->wait_event.load(std::memory_order_relaxed);
+            rec.wait_timeout  = t->wait_timeout.load(std::memory_order_relaxed);
+            rec.cb_type       = t->cb_type.load(std::memory_order_relaxed);
+            rec.create_depth  = t->create_depth.load(std::memory_order_relaxed);
+            rec.yield_site    = t->yield_site.load(std::memory_order_relaxed);
+            for (int j = 0; j < Trace::kDepth; ++j) {
+                rec.create_frames[j] = t->create_frames[j].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    std::sort(records.begin(), records.end(),
+              [](const Record& a, const Record& b) { return a.id < b.id; });
+
+    uint64_t now = GetElapsedUS();
+    os << "[Fibers total=" << TotalFibers() << " traced=" << records.size()
+       << " trace=" << (s_fiber_trace ? "on" : "off") << "]" << std::endl;
+    for (auto& rec : records) {
+        os << "fiber id=" << rec.id << " state=" << StateToString(rec.state)
+           << " thread=" << rec.thread_id << " age_ms=" << (now - rec.create_us) / 1000
+           << " switches=" << rec.switches;
+        uint64_t hold = 0;
+        if (rec.yield_us && (rec.state == HOLD || rec.state == READY)) {
+            hold = now - rec.yield_us;
+            os << " hold_ms=" << hold / 1000;
+        }
+        os << " hold_total_ms=" << (rec.hold_total_us + hold) / 1000;
+        if (rec.waiting && rec.state != EXEC) {
+            if (rec.wait_fd >= 0) {
+                os << " wait=fd:" << rec.wait_fd << (rec.wait_event & IOManager::WRITE ? "(WRITE)" : "(READ)");
+                if (rec.wait_timeout != ~0ull) {
+                    os << " timeout_ms=" << rec.wait_timeout;
+                }
+            }
+            else {
+                os << " wait=timer:" << rec.wait_timeout << "ms";
+            }
+        }
+        if (rec.cb_type) {
+            os << " cb=" << Demangle(rec.cb_type->name());
+        }
+        os << std::endl;
+        os << "    created at:" << std::endl;
+        os << BacktraceToString(rec.create_frames, rec.create_depth, "        ");
+        if (rec.yield_site && rec.state != EXEC) {
+            os << "    yielded at:" << std::endl;
+            os << BacktraceToString(&rec.yield_site, 1, "        ");
+        }
+    }
+    return os;
+}
+
 }   // namespace hiper
\ No newline at end of file
@@ -12,10 +12,13 @@
 
 #include <functional>
 #include <memory>
+#include <ostream>
 #include <ucontext.h>
 
 namespace hiper {
 
+class Scheduler;
+
 class Fiber : public std::enable_shared_from_this<Fiber> {
     friend class Scheduler;
 
@@ -69,7 +72,40 @@ public:
 
     static uint64_t GetFiberId();
 
+    /**
+     * @brief 开启或关闭协程跟踪，等同于设置配置fiber.trace
+     * @details 开启后新建(或被reset复用)的协程会登记到全局表中，记录状态、创建位置的调用栈、
+     *          最近一次让出的调用位置、HOLD的时长以及等待的fd或定时器。
+     *          关闭后被reset复用的协程从全局表中移除。
+     *          第一次开启时安装SIGUSR1处理，收到信号后由后台线程把DumpFibers输出到system日志。
+     *          关闭时协程切换路径上只多一次空指针判断
+     */
+    static void EnableTrace(bool v);
+
+    static bool IsTraceEnabled();
+
+    /**
+     * @brief 输出所有被跟踪协程的信息，调用栈在这里才做符号化
+     */
+    static std::ostream& DumpFibers(std::ostream& os);
+
+    /**
+     * @brief 记录当前协程接下来要等待的对象，让出前调用，恢复执行时清除
+     * @param[in] fd 等待的fd，只等待定时器时为-1
+     * @param[in] event IOManager::Event
+     * @param[in] timeout_ms 超时时间，没有超时为~0ull
+     */
+    static void SetWaiting(int fd, uint32_t event, uint64_t timeout_ms);
+
 private:
+    struct Trace;
+
+    // yield的实现，site是调用yield的位置，开启跟踪时记录
+    void yieldFrom(void* site);
+
+    void traceStart();
+    void traceStop();
+    void traceYield(void* site);
     uint64_t   id_        = 0;
     uint32_t   stacksize_ = 0;
     State      state_     = INIT;
@@ -78,6 +114,10 @@ private:
     bool       back_to_caller_ = false; // 是否切换到调用者线程中的main协程去还是交由调度器调度
 
     std::function<void()> cb_;
+    Trace*                trace_ = nullptr;   // 没有开启跟踪时为空
+    // 调度时指定了线程的协程之后在同一个调度器中都回到这个线程执行，reset时清除
+    Scheduler* pin_scheduler_ = nullptr;
+    int        pin_thread_    = -1;
 };
 
 }   // namespace hiper
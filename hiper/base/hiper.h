@@ -9,9 +9,15 @@
 #include "../http/http.h"
 #include "../http/http-parser/http_parser.h"
 #include "../http/http_parser.h"
+#include "../http/http_server.h"
+#include "../http/admin_server.h"
 #include "../http/http_session.h"
 #include "../streams/socket_stream.h"
 #include "address.h"
+#include "arena.h"
+#include "async_log.h"
+#include "binary_log.h"
+#include "blocking_executor.h"
 #include "bytearray.h"
 #include "config.h"
 #include "endian.hpp"
@@ -22,14 +28,20 @@
 #include "iomanager.h"
 #include "log.h"
 #include "macro.h"
+#include "metrics.h"
+#include "mmap_log.h"
 #include "mutex.h"
 #include "noncopyable.h"
+#include "process_master.h"
+#include "rcu.h"
 #include "scheduler.h"
 #include "singleton.h"
 #include "socket.h"
+#include "task_monitor.h"
 #include "tcp_server.h"
 #include "thread.h"
 #include "timer.h"
 #include "util.h"
+#include "worker.h"
 
 #endif   // HIPER_HIPER_H
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "hiper.h"
 
 #include <dlfcn.h>
+#include <unordered_map>
 
 hiper::Logger::ptr g_logger = LOG_ROOT();
 
@@ -22,16 +23,19 @@ static uint64_t s_connect_timeout = -1;
     XX(socket)       \
     XX(connect)      \
     XX(accept)       \
+    XX(accept4)      \
     XX(read)         \
     XX(readv)        \
     XX(recv)         \
     XX(recvfrom)     \
     XX(recvmsg)      \
+    XX(recvmmsg)     \
     XX(write)        \
     XX(writev)       \
     XX(send)         \
     XX(sendto)       \
     XX(sendmsg)      \
+    XX(sendmmsg)     \
     XX(close)        \
     XX(fcntl)        \
     XX(ioctl)        \
@@ -97,6 +101,22 @@ struct timer_info
 
 
 
+/**
+ * @brief 按系统调用名称取阻塞时间直方图
+ * @details 只在需要挂起等待时调用，名称是字符串常量，按指针缓存在线程本地
+ */
+static hiper::Histogram* IoBlockHistogram(const char* name)
+{
+    static thread_local std::unordered_map<const char*, hiper::Histogram::ptr> t_cache;
+    auto& h = t_cache[name];
+    if (!h) {
+        h = hiper::MetricsMgr::GetInstance()->histogram(
+            "hiper_hook_block_us", "time a fiber waits for an fd to become ready",
+            std::string("syscall=\"") + name + "\"");
+    }
+    return h.get();
+}
+
 /**
  * @brief 非阻塞 I/O 处理, 通过设置超时时间,将阻塞 I/O 转换为非阻塞 I/O
  *        在系统调用可能阻塞时自动执行一系列处理,将其变成异步执行,从而避免阻塞。配合协程调度,可以实现非阻塞IO模型。
@@ -136,7 +156,8 @@ static ssize_t do_io(int fd, OriginFunc func, const char* hook_func_name, uint32
 
     uint64_t timeout = ctx->getTimeout(timeout_so);
 
-    std::shared_ptr<timer_info> tinfo(new timer_info);
+    // 只有需要等待时才创建，数据已经就绪的读写不分配内存
+    std::shared_ptr<timer_info> tinfo;
 
 retry:
     ssize_t n = func(fd, std::forward<Args>(args)...);
@@ -148,6 +169,9 @@ retry:
     if (n == -1 && errno == EAGAIN) {
         hiper::IOManager*         iom = hiper::IOManager::GetThis();
         hiper::Timer::ptr         timer;
+        if (!tinfo) {
+            tinfo = std::make_shared<timer_info>();
+        }
         std::weak_ptr<timer_info> winfo(tinfo);
 
         if (timeout != (uint64_t)-1) {
@@ -166,14 +190,20 @@ retry:
 
         int rt = iom->addEvent(fd, (hiper::IOManager::Event)(event));
         if (HIPER_UNLIKELY(rt)) {
-            LOG_ERROR(g_logger) << hook_func_name << " addEvent(" << fd << ", " << event << ")";
+            LOG_ERROR_LIMIT(g_logger, 10)
+                << hook_func_name << " addEvent(" << fd << ", " << event << ")";
             if (timer) {
                 timer->cancel();
             }
             return -1;
         }
         else {
+            uint64_t block_start = hiper::MetricsRegistry::IsEnabled() ? hiper::GetElapsedUS() : 0;
+            hiper::Fiber::SetWaiting(fd, event, timeout);
             hiper::Fiber::GetThis()->yield();
+            if (block_start) {
+                IoBlockHistogram(hook_func_name)->record(hiper::GetElapsedUS() - block_start);
+            }
             if (timer) {
                 timer->cancel();
             }
@@ -213,6 +243,7 @@ unsigned int sleep(unsigned int seconds)
     //                         fiber,
     //                         -1));
     iom->addTimer(seconds * 1000, [iom, fiber]() { iom->schedule(fiber, -1); });
+    hiper::Fiber::SetWaiting(-1, 0, seconds * 1000);
     hiper::Fiber::GetThis()->yield();
     return 0;
 }
@@ -225,6 +256,7 @@ int usleep(useconds_t usec)
     hiper::Fiber::ptr fiber = hiper::Fiber::GetThis();
     hiper::IOManager* iom   = hiper::IOManager::GetThis();
     iom->addTimer(usec / 1000, [iom, fiber]() { iom->schedule(fiber, -1); });
+    hiper::Fiber::SetWaiting(-1, 0, usec / 1000);
     hiper::Fiber::GetThis()->yield();
     return 0;
 }
@@ -239,6 +271,7 @@ int nanosleep(const struct timespec* req, struct timespec* rem)
     hiper::Fiber::ptr fiber      = hiper::Fiber::GetThis();
     hiper::IOManager* iom        = hiper::IOManager::GetThis();
     iom->addTimer(timeout_ms, [iom, fiber]() { iom->schedule(fiber, -1); });
+    hiper::Fiber::SetWaiting(-1, 0, timeout_ms);
     hiper::Fiber::GetThis()->yield();
     return 0;
 }
@@ -307,6 +340,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
 
     int rt = iom->addEvent(fd, hiper::IOManager::WRITE);
     if (rt == 0) {
+        hiper::Fiber::SetWaiting(fd, hiper::IOManager::WRITE, timeout_ms);
         hiper::Fiber::GetThis()->yield();
         if (timer) {
             timer->cancel();
@@ -320,7 +354,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         if (timer) {
             timer->cancel();
         }
-        LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
+        LOG_ERROR_LIMIT(g_logger, 10) << "connect addEvent(" << fd << ", WRITE) error";
     }
 
     // 检查连接结果
@@ -352,6 +386,16 @@ int accept(int s, struct sockaddr* addr, socklen_t* addrlen)
     return fd;
 }
 
+int accept4(int s, struct sockaddr* addr, socklen_t* addrlen, int flags)
+{
+    int fd = do_io(
+        s, accept4_old, "accept4", hiper::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags);
+    if (fd >= 0) {
+        hiper::FdMgr::GetInstance()->get(fd, true);
+    }
+    return fd;
+}
+
 ssize_t read(int fd, void* buf, size_t count)
 {
     return do_io(fd, read_old, "read", hiper::IOManager::READ, SO_RCVTIMEO, buf, count);
@@ -387,6 +431,20 @@ ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags)
     return do_io(sockfd, recvmsg_old, "recvmsg", hiper::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
+int recvmmsg(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags,
+             struct timespec* timeout)
+{
+    return do_io(sockfd,
+                 recvmmsg_old,
+                 "recvmmsg",
+                 hiper::IOManager::READ,
+                 SO_RCVTIMEO,
+                 msgvec,
+                 vlen,
+                 flags,
+                 timeout);
+}
+
 ssize_t write(int fd, const void* buf, size_t count)
 {
     return do_io(fd, write_old, "write", hiper::IOManager::WRITE, SO_SNDTIMEO, buf, count);
@@ -414,6 +472,12 @@ ssize_t sendmsg(int s, const struct msghdr* msg, int flags)
     return do_io(s, sendmsg_old, "sendmsg", hiper::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
 }
 
+int sendmmsg(int s, struct mmsghdr* msgvec, unsigned int vlen, int flags)
+{
+    return do_io(
+        s, sendmmsg_old, "sendmmsg", hiper::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
 int close(int fd)
 {
     if (!hiper::t_hook_enable) {
@@ -18,7 +18,7 @@
 
 namespace hiper {
 // 细化到线程程度
-bool is_hook_enabel();
+bool is_hook_enable();
 
 void set_hook_enable(bool flag);
 }   // namespace hiper
@@ -50,6 +50,9 @@ extern connect_func connect_old;
 typedef int (*accept_func)(int s, struct sockaddr* addr, socklen_t* addrlen);
 extern accept_func accept_old;
 
+typedef int (*accept4_func)(int s, struct sockaddr* addr, socklen_t* addrlen, int flags);
+extern accept4_func accept4_old;
+
 // read
 typedef ssize_t (*read_func)(int fd, void* buf, size_t count);
 extern read_func read_old;
@@ -67,6 +70,10 @@ extern recvfrom_func recvfrom_old;
 typedef ssize_t (*recvmsg_func)(int sockfd, struct msghdr* msg, int flags);
 extern recvmsg_func recvmsg_old;
 
+typedef int (*recvmmsg_func)(int sockfd, struct mmsghdr* msgvec, unsigned int vlen, int flags,
+                             struct timespec* timeout);
+extern recvmmsg_func recvmmsg_old;
+
 // write
 typedef ssize_t (*write_func)(int fd, const void* buf, size_t count);
 extern write_func write_old;
@@ -84,6 +91,9 @@ extern sendto_func sendto_old;
 typedef ssize_t (*sendmsg_func)(int s, const struct msghdr* msg, int flags);
 extern sendmsg_func sendmsg_old;
 
+typedef int (*sendmmsg_func)(int s, struct mmsghdr* msgvec, unsigned int vlen, int flags);
+extern sendmmsg_func sendmmsg_old;
+
 typedef int (*close_func)(int fd);
 extern close_func close_old;
 
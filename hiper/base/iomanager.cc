@@ -94,6 +94,8 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event)
     else {
         ctx.scheduler->schedule(&ctx.fiber);
     }
+    // 清空上下文，同一个事件才能被再次添加
+    ctx.scheduler = nullptr;
 }
 
 
@@ -119,6 +121,12 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
     HIPER_ASSERT(!ret);
 
     contextResize(32);
+
+    std::string labels = "iomanager=\"" + getName() + "\"";
+    events_per_wake_   = MetricsMgr::GetInstance()->histogram(
+        "hiper_iomanager_events_per_wake", "events returned by one epoll_wait", labels);
+    epoll_wait_us_ = MetricsMgr::GetInstance()->histogram(
+        "hiper_iomanager_epoll_wait_us", "time blocked in epoll_wait", labels);
     start();
 }
 
@@ -149,7 +157,10 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
     else {
         lock.unlock();
         RWMutexType::WriteLock lock2(mutex_);
-        fd_contexts_.resize(fd * 1.5);
+        // 扩容时要同时创建新的FdContext，其他线程可能已经先完成了扩容
+        if ((int)fd_contexts_.size() <= fd) {
+            contextResize(fd * 1.5);
+        }
         fd_ctx = fd_contexts_[fd];
     }
 
@@ -169,10 +180,11 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
 
     int ret = epoll_ctl(epoll_fd_, op, fd, &epevent);
     if (ret) {
-        LOG_ERROR(g_logger) << "epoll_ctl(" << epoll_fd_ << ", " << (EpollCtlOp)op << ", " << fd
-                            << ", " << (EPOLL_EVENTS)epevent.events << "): " << ret << " (" << errno
-                            << ") (" << strerror(errno)
-                            << ") fd_ctx->events=" << (EPOLL_EVENTS)fd_ctx->events;
+        // fd耗尽等情况下会连续失败，限制日志频率
+        LOG_ERROR_LIMIT(g_logger, 10) << "epoll_ctl(" << epoll_fd_ << ", " << (EpollCtlOp)op << ", "
+                                      << fd << ", " << (EPOLL_EVENTS)epevent.events << "): " << ret
+                                      << " (" << errno << ") (" << strerror(errno)
+                                      << ") fd_ctx->events=" << (EPOLL_EVENTS)fd_ctx->events;
         return -1;
     }
 
@@ -372,6 +384,8 @@ void IOManager::idle()
         uint64_t next_timeout = 0;
         if (HIPER_UNLIKELY(stopping(next_timeout))) {
             LOG_INFO(g_logger) << "name = " << getName() << " idle stopping exit";
+            // stop时的多次tickle可能只唤醒了一个线程(管道是边缘触发的)，退出前接力唤醒下一个
+            tickle();
             break;
         }
 
@@ -387,7 +401,11 @@ void IOManager::idle()
             }
             // epoll_wait返回前，如果有事件发生，那么会立即返回，否则会等待next_timeout时间
             // 将发生的事件记录在events数组中
+            uint64_t wait_start = MetricsRegistry::IsEnabled() ? GetElapsedUS() : 0;
             ret = epoll_wait(epoll_fd_, events, MAX_EVNETS, (int)next_timeout);
+            if (wait_start) {
+                epoll_wait_us_->record(GetElapsedUS() - wait_start);
+            }
             if (ret < 0 && errno == EINTR) {
                 continue;
             }
@@ -396,6 +414,10 @@ void IOManager::idle()
             }
         } while (true);
 
+        if (ret >= 0) {
+            events_per_wake_->record(ret);
+        }
+
         // 事件发生（或定时器超时）后，先处理定时器事件
 
         std::vector<std::function<void()>> cbs;
@@ -426,7 +448,8 @@ void IOManager::idle()
              * 出现这两种事件，应该同时触发fd的读和写事件，否则有可能出现注册的事件永远执行不到的情况
              */
             if (event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= EPOLLIN | EPOLLOUT;
+                // 只触发已注册的事件，例如shutdown后只等待读的fd不能触发写事件
+                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
             }
 
             // 通过real_events记录当前fd上发生的事件
@@ -127,6 +127,9 @@ private:
     int tickle_fds_[2];
     // 当前等待执行的事件数量
     std::atomic<size_t> pending_event_count_ = {0};
+    // 每次epoll_wait返回的事件数，以及阻塞在epoll_wait上的时间(微秒)
+    Histogram::ptr events_per_wake_;
+    Histogram::ptr epoll_wait_us_;
 
     RWMutexType mutex_;
     /**
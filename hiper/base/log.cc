@@ -1,14 +1,35 @@
+#include "async_log.h"
+#include "binary_log.h"
 #include "config.h"
 #include "env.h"
 #include "log.h"
+#include "macro.h"
+#include "mmap_log.h"
 #include "util.h"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <dirent.h>
+#include <fcntl.h>
 #include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <new>
+#include <pthread.h>
+#include <set>
+#include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace hiper {
 
@@ -50,212 +71,258 @@ LogLevel::Level LogLevel::FromString(const std::string& str)
 #undef XX
 }
 
-LogEventWrap::LogEventWrap(std::shared_ptr<Logger> logger, LogEvent::ptr e)
-    :  logger_(logger), event_(e)
-{}
+LogStreamBuf::LogStreamBuf()
+{
+    setp(inline_, inline_ + kInlineSize);
+}
 
-LogEventWrap::~LogEventWrap()
+void LogStreamBuf::reset()
 {
-   getLogger()->log(event_->getLevel(), event_);
+    if (heapSize_ > kMaxKeepSize) {
+        heap_.reset();
+        heapSize_ = 0;
+    }
+    setp(inline_, inline_ + kInlineSize);
 }
 
-void LogEvent::format(const char* fmt, ...)
+void LogStreamBuf::reserve(size_t len)
 {
-    va_list al;
-    va_start(al, fmt);
-    format(fmt, al);
-    va_end(al);
+    if (avail() >= len) {
+        return;
+    }
+    size_t used = size();
+    size_t need = used + len;
+    if (pbase() != heap_.get() && heapSize_ >= need) {
+        // 之前申请过的堆内存足够，直接复用
+        memcpy(heap_.get(), pbase(), used);
+    }
+    else {
+        size_t cap = std::max(need, std::max(heapSize_, kInlineSize) * 2);
+        std::unique_ptr<char[]> buf(new char[cap]);
+        memcpy(buf.get(), pbase(), used);
+        heap_.swap(buf);
+        heapSize_ = cap;
+    }
+    setp(heap_.get(), heap_.get() + heapSize_);
+    pbump(used);
 }
 
-void LogEvent::format(const char* fmt, va_list al)
+LogStreamBuf::int_type LogStreamBuf::overflow(int_type c)
 {
-    char* buf = nullptr;
-    int   len = vasprintf(&buf, fmt, al);
-    if (len != -1) {
-        ss_ << std::string(buf, len);
-        free(buf);
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+        return traits_type::not_eof(c);
     }
+    reserve(1);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
 }
 
-std::stringstream& LogEventWrap::getSS()
+std::streamsize LogStreamBuf::xsputn(const char* s, std::streamsize n)
 {
-    return event_->getSS();
+    append(s, n);
+    return n;
 }
 
+void LogFields::addKey(std::string_view key, Type type)
+{
+    uint32_t len = key.size();
+    buf_.reserve(1 + sizeof(len) + len);
+    char* p = buf_.cur();
+    *p++    = type;
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), key.data(), len);
+    buf_.commit(1 + sizeof(len) + len);
+}
 
-void LogAppender::setFormatter(LogFormatter::ptr val)
+void LogFields::addValue(std::string_view key, Type type, const void* val, size_t len)
 {
-    MutexType::Lock lock(mutex_);
-    formatter_ = val;
-    if (formatter_) {
-        hasFormatter_ = true;
-    }
-    else {
-        hasFormatter_ = false;
-    }
+    addKey(key, type);
+    buf_.append((const char*)val, len);
 }
 
-LogFormatter::ptr LogAppender::getFormatter()
+void LogFields::addString(std::string_view key, std::string_view val)
 {
-    MutexType::Lock lock(mutex_);
-    return formatter_;
+    addKey(key, STRING);
+    uint32_t len = val.size();
+    buf_.append((const char*)&len, sizeof(len));
+    buf_.append(val.data(), len);
 }
 
-class MessageFormatItem : public LogFormatter::FormatItem {
-public:
-    MessageFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << event->getContent();
-    }
-};
+void LogFields::addStreamed(std::string_view key)
+{
+    LogStream& ss = static_cast<LogStream&>(GetThreadStream());
+    addString(key, std::string_view(ss.buffer().data(), ss.buffer().size()));
+    ss.reset();
+}
 
-class LevelFormatItem : public LogFormatter::FormatItem {
-public:
-    LevelFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << LogLevel::ToString(level);
-    }
-};
+std::ostream& LogFields::GetThreadStream()
+{
+    static thread_local LogStream t_stream;
+    return t_stream;
+}
 
-class ElapseFormatItem : public LogFormatter::FormatItem {
-public:
-    ElapseFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << event->getElapse();
+const char* LogFields::decode(const char* p, Field& field)
+{
+    uint32_t len;
+    field.type = (Type)*p++;
+    memcpy(&len, p, sizeof(len));
+    p += sizeof(len);
+    field.key = std::string_view(p, len);
+    p += len;
+    switch (field.type) {
+    case STRING:
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        field.str = std::string_view(p, len);
+        return p + len;
+    case BOOL: memcpy(&field.b, p, sizeof(bool)); return p + sizeof(bool);
+    default:
+        // INT/UINT/DOUBLE都是8字节
+        memcpy(&field.u, p, sizeof(uint64_t));
+        return p + sizeof(uint64_t);
     }
-};
+}
 
-class NameFormatItem : public LogFormatter::FormatItem {
-public:
-    NameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        // os << event->getLogger()->getName();
-        os << logger->getName();
-    }
-};
+void LogStream::reset()
+{
+    buf_.reset();
+    fields_.clear();
+    clear();
+    flags(std::ios_base::skipws | std::ios_base::dec);
+    precision(6);
+    width(0);
+    fill(' ');
+}
 
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << event->getThreadId();
-    }
-};
+// 每个线程缓存一个日志事件，避免每条日志都申请内存
+static thread_local LogEvent::ptr t_log_event;
 
-class FiberIdFormatItem : public LogFormatter::FormatItem {
-public:
-    FiberIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << event->getFiberId();
+LogEvent::ptr LogEvent::Create(LogLevel::Level level, const char* file, int32_t line,
+                               uint32_t elapse, uint32_t thread_id, uint32_t fiber_id,
+                               uint64_t time, const std::string& thread_name)
+{
+    LogEvent::ptr& cached = t_log_event;
+    if (HIPER_LIKELY(cached && cached.use_count() == 1)) {
+        cached->reset(level, file, line, elapse, thread_id, fiber_id, time, thread_name);
+        return cached;
     }
-};
-
-class ThreadNameFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadNameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << event->getThreadName();
+    LogEvent::ptr event = std::make_shared<LogEvent>(level, file, line, elapse, thread_id,
+                                                     fiber_id, time, thread_name);
+    if (!cached) {
+        cached = event;
     }
-};
+    return event;
+}
 
-class DateTimeFormatItem : public LogFormatter::FormatItem {
-public:
-    DateTimeFormatItem(const std::string& format = "%Y-%m-%d %H:%M:%S")
-        : format_(format)
-    {
-        if (format_.empty()) {
-            format_ = "%Y-%m-%d %H:%M:%S";
-        }
-    }
+void LogEvent::reset(LogLevel::Level level, const char* file, int32_t line, uint32_t elapse,
+                     uint32_t thread_id, uint32_t fiber_id, uint64_t time,
+                     const std::string& thread_name)
+{
+    file_     = file;
+    line_     = line;
+    elapse_   = elapse;
+    threadId_ = thread_id;
+    fiberId_  = fiber_id;
+    time_     = time;
+    level_    = level;
+    binarySite_ = nullptr;
+    // 同一个线程的名称一般不变，assign会复用已有的内存
+    threadName_.assign(thread_name);
+    ss_.reset();
+}
 
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        struct tm tm;
-        time_t    time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), format_.c_str(), &tm);
-        os << buf;
+LogEventWrap::LogEventWrap(const std::shared_ptr<Logger>& logger, LogEvent::ptr&& e,
+                           uint64_t suppressed)
+    : logger_(logger.get())
+    , event_(std::move(e))
+    , suppressed_(suppressed)
+{}
+
+LogEventWrap::~LogEventWrap()
+{
+    if (suppressed_) {
+        event_->getSS() << " (suppressed " << suppressed_ << ")";
     }
+    logger_->log(event_->getLevel(), event_);
+}
 
-private:
-    std::string format_;
-};
+std::shared_ptr<Logger> LogEventWrap::getLogger() const
+{
+    return logger_->shared_from_this();
+}
 
-class FilenameFormatItem : public LogFormatter::FormatItem {
-public:
-    FilenameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << event->getFile();
-    }
-};
+void LogEvent::format(const char* fmt, ...)
+{
+    va_list al;
+    va_start(al, fmt);
+    format(fmt, al);
+    va_end(al);
+}
 
-class LineFormatItem : public LogFormatter::FormatItem {
-public:
-    LineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << event->getLine();
+void LogEvent::format(const char* fmt, va_list al)
+{
+    // 直接格式化到内容缓冲区，空间不够时扩容后再格式化一次
+    LogStreamBuf& buf = ss_.buffer();
+    va_list       copy;
+    va_copy(copy, al);
+    int len = vsnprintf(buf.cur(), buf.avail(), fmt, copy);
+    va_end(copy);
+    if (len < 0) {
+        return;
     }
-};
-
-class NewLineFormatItem : public LogFormatter::FormatItem {
-public:
-    NewLineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << std::endl;
+    if ((size_t)len >= buf.avail()) {
+        buf.reserve(len + 1);
+        vsnprintf(buf.cur(), buf.avail(), fmt, al);
     }
-};
+    buf.commit(len);
+}
+
+std::ostream& LogEventWrap::getSS()
+{
+    return event_->getSS();
+}
 
 
-class StringFormatItem : public LogFormatter::FormatItem {
-public:
-    StringFormatItem(const std::string& str)
-        : string_(str)
-    {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
-    {
-        os << string_;
+/**
+ * @brief 等读者离开后释放替换下来的对象，在锁外调用
+ */
+template <class T>
+static void RetireAll(std::vector<T*>& olds)
+{
+    if (!olds.empty()) {
+        Rcu::Retire([olds]() {
+            for (auto i : olds) {
+                delete i;
+            }
+        });
     }
+}
 
-private:
-    std::string string_;
-};
-
-class TabFormatItem : public LogFormatter::FormatItem {
-public:
-    TabFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
-                LogEvent::ptr event) override
+void LogAppender::setFormatter(LogFormatter::ptr val)
+{
+    LogFormatter::ptr* old;
     {
-        os << "\t";
+        MutexType::Lock lock(mutex_);
+        old = formatter_.exchange(new LogFormatter::ptr(val));
+        if (val) {
+            hasFormatter_ = true;
+        }
+        else {
+            hasFormatter_ = false;
+        }
     }
+    if (old) {
+        Rcu::Retire([old]() { delete old; });
+    }
+}
 
-private:
-    std::string string_;
-};
-
+LogFormatter::ptr LogAppender::getFormatter()
+{
+    Rcu::ReadLock     rcu;
+    LogFormatter::ptr* formatter = formatter_.get();
+    return formatter ? *formatter : nullptr;
+}
 
 // LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level, const char* file,
 //                    int32_t line, uint32_t elapse, uint32_t thread_id, uint32_t fiber_id,
@@ -284,25 +351,42 @@ LogEvent::LogEvent(LogLevel::Level level, const char* file,
     , level_(level)
 {}
 
+std::atomic<uint32_t> LogSite::s_generation{0};
+
+static std::atomic<uint32_t> s_logger_id{0};
+
 Logger::Logger(const std::string& name)
     : name_(name)
+    , id_(++s_logger_id)
     , level_(LogLevel::DEBUG)
+    , appenders_(new AppenderList)
 {
     formatter_.reset(
         new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
 }
 
+void Logger::setLevel(LogLevel::Level val)
+{
+    level_ = val;
+    LogSite::Invalidate();
+}
+
 void Logger::setFormatter(LogFormatter::ptr val)
 {
-    MutexType::Lock lock(mutex_);
-    formatter_ = val;
+    std::vector<LogFormatter::ptr*> olds;
+    {
+        MutexType::Lock lock(mutex_);
+        formatter_ = val;
 
-    for (auto& i : appenders_) {
-        MutexType::Lock ll(i->mutex_);
-        if (!i->hasFormatter_) {
-            i->formatter_ = formatter_;
+        // 持有mutex_时appenders_不会被替换，不需要读区间
+        for (auto& i : *appenders_.get()) {
+            MutexType::Lock ll(i->mutex_);
+            if (!i->hasFormatter_) {
+                olds.push_back(i->formatter_.exchange(new LogFormatter::ptr(formatter_)));
+            }
         }
     }
+    RetireAll(olds);
 }
 
 void Logger::setFormatter(const std::string& val)
@@ -330,7 +414,7 @@ std::string Logger::toYamlString()
         node["formatter"] = formatter_->getPattern();
     }
 
-    for (auto& i : appenders_) {
+    for (auto& i : *appenders_.get()) {
         node["appenders"].push_back(YAML::Load(i->toYamlString()));
     }
     std::stringstream ss;
@@ -345,40 +429,74 @@ LogFormatter::ptr Logger::getFormatter()
     return formatter_;
 }
 
+Logger::AppenderList Logger::getAppenders() const
+{
+    Rcu::ReadLock rcu;
+    return *appenders_.get();
+}
+
 void Logger::addAppender(LogAppender::ptr appender)
 {
-    MutexType::Lock lock(mutex_);
-    if (!appender->getFormatter()) {
-        MutexType::Lock ll(appender->mutex_);
-        appender->formatter_ = formatter_;
+    std::vector<LogFormatter::ptr*>   formatters;
+    std::vector<const AppenderList*> lists;
+    {
+        MutexType::Lock lock(mutex_);
+        if (!appender->getFormatter()) {
+            MutexType::Lock ll(appender->mutex_);
+            formatters.push_back(appender->formatter_.exchange(new LogFormatter::ptr(formatter_)));
+        }
+        AppenderList* list = new AppenderList(*appenders_.get());
+        list->push_back(appender);
+        lists.push_back(appenders_.exchange(list));
     }
-    appenders_.push_back(appender);
+    RetireAll(formatters);
+    RetireAll(lists);
 }
 
 void Logger::delAppender(LogAppender::ptr appender)
 {
-    MutexType::Lock lock(mutex_);
-    for (auto it = appenders_.begin(); it != appenders_.end(); ++it) {
-        if (*it == appender) {
-            appenders_.erase(it);
-            break;
+    std::vector<const AppenderList*> lists;
+    {
+        MutexType::Lock lock(mutex_);
+        AppenderList* list = new AppenderList(*appenders_.get());
+        auto          it   = std::find(list->begin(), list->end(), appender);
+        if (it == list->end()) {
+            delete list;
+            return;
         }
+        list->erase(it);
+        lists.push_back(appenders_.exchange(list));
     }
+    RetireAll(lists);
 }
 
 void Logger::clearAppenders()
 {
-    MutexType::Lock lock(mutex_);
-    appenders_.clear();
+    std::vector<const AppenderList*> lists;
+    {
+        MutexType::Lock lock(mutex_);
+        lists.push_back(appenders_.exchange(new AppenderList));
+    }
+    RetireAll(lists);
 }
 
+// fork出的子进程里还没有重新启动日志的后台线程
+static std::atomic<bool> s_log_timer_forked{false};
+
+static void RestartLogTimer();
+
 void Logger::log(LogLevel::Level level, LogEvent::ptr event)
 {
     if (level >= level_) {
-        auto            self = shared_from_this();
-        MutexType::Lock lock(mutex_);
-        if (!appenders_.empty()) {
-            for (auto& i : appenders_) {
+        if (HIPER_UNLIKELY(s_log_timer_forked.load(std::memory_order_relaxed))) {
+            RestartLogTimer();
+        }
+        // 修改日志目标时会替换整个列表，旧列表等读区间结束后才释放，写日志期间不会变化
+        Rcu::ReadLock       rcu;
+        const AppenderList* appenders = appenders_.get();
+        if (!appenders->empty()) {
+            auto self = shared_from_this();
+            for (auto& i : *appenders) {
                 i->log(self, level, event);
             }
         }
@@ -413,26 +531,242 @@ void Logger::fatal(LogEvent::ptr event)
     log(LogLevel::FATAL, event);
 }
 
-FileLogAppender::FileLogAppender(const std::string& filename)
+const char* LogRotatePolicy::IntervalToString(Interval val)
+{
+    switch (val) {
+    case HOURLY: return "hourly";
+    case DAILY: return "daily";
+    default: return "none";
+    }
+}
+
+LogRotatePolicy::Interval LogRotatePolicy::IntervalFromString(const std::string& str)
+{
+    std::string v = ToLower(str);
+    if (v == "hourly") {
+        return HOURLY;
+    }
+    if (v == "daily") {
+        return DAILY;
+    }
+    return NONE;
+}
+
+uint64_t LogRotatePolicy::SizeFromString(const std::string& str)
+{
+    char*    end = nullptr;
+    uint64_t v   = strtoull(str.c_str(), &end, 10);
+    if (!end || end == str.c_str()) {
+        return 0;
+    }
+    switch (*end) {
+    case 'k':
+    case 'K': return v << 10;
+    case 'm':
+    case 'M': return v << 20;
+    case 'g':
+    case 'G': return v << 30;
+    default: return v;
+    }
+}
+
+time_t LogRotatePolicy::NextRotateTime(time_t now, Interval interval)
+{
+    if (interval == NONE) {
+        return 0;
+    }
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_sec = 0;
+    tm.tm_min = 0;
+    if (interval == HOURLY) {
+        tm.tm_hour += 1;
+    }
+    else {
+        tm.tm_hour = 0;
+        tm.tm_mday += 1;
+    }
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+/**
+ * @brief 日志的后台线程，每秒调用一次注册的Appender的onTimer，做文件滚动、刷新缓冲区等工作
+ * @details onTimer在锁外调用，滚动和压缩大文件时不会阻塞Appender的创建和销毁；
+ *          del会等待正在执行的onTimer返回。fork时等当前的onTimer结束后再fork，
+ *          子进程里在第一次写日志或者注册Appender时重新启动后台线程。
+ *          故意不析构，进程退出时静态对象的析构顺序不会影响到它
+ */
+class LogTimer {
+public:
+    static LogTimer* GetInstance()
+    {
+        static LogTimer* s_instance = new LogTimer;
+        return s_instance;
+    }
+
+    void add(LogAppender* appender)
+    {
+        Mutex::Lock lock(mutex_);
+        appenders_.insert(appender);
+        if (!thread_) {
+            s_log_timer_forked.store(false, std::memory_order_relaxed);
+            thread_.reset(new Thread(std::bind(&LogTimer::run, this), "log_timer"));
+        }
+    }
+
+    /**
+     * @brief fork出的子进程里有注册的Appender时重新启动后台线程
+     */
+    void restart()
+    {
+        Mutex::Lock lock(mutex_);
+        if (!s_log_timer_forked.load(std::memory_order_relaxed)) {
+            return;
+        }
+        s_log_timer_forked.store(false, std::memory_order_relaxed);
+        if (!thread_ && !appenders_.empty()) {
+            thread_.reset(new Thread(std::bind(&LogTimer::run, this), "log_timer"));
+        }
+    }
+
+    void del(LogAppender* appender)
+    {
+        Mutex::Lock lock(mutex_);
+        appenders_.erase(appender);
+        // 返回后后台线程不会再访问appender
+        while (current_ == appender) {
+            done_cond_.wait(mutex_);
+        }
+    }
+
+private:
+    LogTimer() { pthread_atfork(&ForkPrepare, &ForkParent, &ForkChild); }
+
+    void run()
+    {
+        std::vector<LogAppender*> appenders;
+        Mutex::Lock               lock(mutex_);
+        while (true) {
+            cond_.waitFor(mutex_, 1000);
+            time_t now = time(0);
+            appenders.assign(appenders_.begin(), appenders_.end());
+            for (auto appender : appenders) {
+                // 锁外执行期间可能已经被删除
+                if (!appenders_.count(appender)) {
+                    continue;
+                }
+                current_ = appender;
+                lock.unlock();
+                appender->onTimer(now);
+                lock.lock();
+                current_ = nullptr;
+                done_cond_.notifyAll();
+            }
+        }
+    }
+
+    static void ForkPrepare()
+    {
+        // 持有锁并且没有正在执行的onTimer，子进程里的Appender不会停在滚动的中间
+        LogTimer* self = GetInstance();
+        self->mutex_.lock();
+        while (self->current_) {
+            self->done_cond_.wait(self->mutex_);
+        }
+    }
+
+    static void ForkParent() { GetInstance()->mutex_.unlock(); }
+
+    /**
+     * @brief 这里还在fork的过程中，子进程可能马上exec，只重置状态不创建线程，由restart或add重新启动
+     */
+    static void ForkChild()
+    {
+        LogTimer* self = GetInstance();
+        // 条件变量上登记着父进程中线程的等待，重新初始化，不能调用析构
+        new (&self->cond_) Condition;
+        new (&self->done_cond_) Condition;
+        if (self->thread_) {
+            // 线程对象描述的是父进程中的线程，析构时会对它调用pthread_detach，直接泄漏
+            self->thread_.release();
+            s_log_timer_forked.store(true, std::memory_order_relaxed);
+        }
+        self->mutex_.unlock();
+    }
+
+private:
+    Mutex                        mutex_;
+    Condition                    cond_;
+    // 通知onTimer执行完
+    Condition                    done_cond_;
+    std::set<LogAppender*>       appenders_;
+    // 正在执行onTimer的Appender
+    LogAppender*                 current_ = nullptr;
+    std::unique_ptr<Thread>      thread_;
+};
+
+static void RestartLogTimer()
+{
+    LogTimer::GetInstance()->restart();
+}
+
+void LogAppender::startTimer()
+{
+    LogTimer::GetInstance()->add(this);
+}
+
+void LogAppender::stopTimer()
+{
+    LogTimer::GetInstance()->del(this);
+}
+
+FileLogAppender::File::~File()
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+FileLogAppender::FileLogAppender(const std::string& filename, const LogRotatePolicy& policy)
     : filename_(filename)
+    , policy_(policy)
 {
     reopen();
+    pid_        = getpid();
+    lastCheck_  = time(0);
+    nextRotate_ = LogRotatePolicy::NextRotateTime(lastCheck_, policy_.interval);
+    startTimer();
+}
+
+FileLogAppender::~FileLogAppender()
+{
+    stopTimer();
 }
 
 void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level,
                           LogEvent::ptr event)
 {
     if (level >= level_) {
-        uint64_t now = event->getTime();
-        if (now >= (lastTime_ + 3)) {
-            reopen();
-            lastTime_ = now;
+        LogStreamBuf& buf = LogFormatter::GetThreadBuffer();
+        Rcu::ReadLock rcu;
+        LogFormatter* formatter = peekFormatter();
+        if (!formatter) {
+            return;
         }
-        MutexType::Lock lock(mutex_);
-        // if(!(filestream_ << formatter_->format(logger, level, event))) {
-        if (!formatter_->format(filestream_, logger, level, event)) {
-            std::cout << "error" << std::endl;
+        formatter->format(buf, logger, level, event);
+        // O_APPEND保证每次write完整追加，写文件不需要加锁
+        File* file = file_.get();
+        if (!file) {
+            return;
+        }
+        ssize_t n = write(file->fd, buf.data(), buf.size());
+        if (n < 0) {
+            std::cout << "FileLogAppender write " << filename_ << " error: " << strerror(errno)
+                      << std::endl;
+            return;
         }
+        fileSize_ += n;
     }
 }
 
@@ -445,8 +779,21 @@ std::string FileLogAppender::toYamlString()
     if (level_ != LogLevel::UNKNOW) {
         node["level"] = LogLevel::ToString(level_);
     }
-    if (hasFormatter_ && formatter_) {
-        node["formatter"] = formatter_->getPattern();
+    LogFormatter::ptr formatter = getFormatter();
+    if (hasFormatter_ && formatter) {
+        node["formatter"] = formatter->getPattern();
+    }
+    if (policy_.maxSize) {
+        node["max_size"] = policy_.maxSize;
+    }
+    if (policy_.interval != LogRotatePolicy::NONE) {
+        node["rotate"] = LogRotatePolicy::IntervalToString(policy_.interval);
+    }
+    if (policy_.maxFiles) {
+        node["max_files"] = policy_.maxFiles;
+    }
+    if (policy_.compress) {
+        node["compress"] = true;
     }
     std::stringstream ss;
     ss << node;
@@ -455,20 +802,248 @@ std::string FileLogAppender::toYamlString()
 
 bool FileLogAppender::reopen()
 {
-    MutexType::Lock lock(mutex_);
-    if (filestream_) {
-        filestream_.close();
+    Mutex::Lock lock(rotateMutex_);
+    return openLocked();
+}
+
+bool FileLogAppender::openLocked()
+{
+    FSUtil::Mkdir(FSUtil::Dirname(filename_));
+    int fd = open(filename_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cout << "FileLogAppender open " << filename_ << " error: " << strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    struct stat st;
+    fileSize_ = fstat(fd, &st) == 0 ? st.st_size : 0;
+    // 等正在写旧文件的线程写完后关闭旧文件
+    file_.reset(new File(fd));
+    return true;
+}
+
+/**
+ * @brief 把src压缩成dst，成功后删除src
+ */
+static bool GzipFile(const std::string& src, const std::string& dst)
+{
+    int fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    gzFile gz = gzopen(dst.c_str(), "wb");
+    if (!gz) {
+        close(fd);
+        return false;
+    }
+    bool    ok = true;
+    char    buf[64 * 1024];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (gzwrite(gz, buf, n) != n) {
+            ok = false;
+            break;
+        }
+    }
+    ok = ok && n == 0;
+    close(fd);
+    if (gzclose(gz) != Z_OK) {
+        ok = false;
+    }
+    if (!ok) {
+        unlink(dst.c_str());
+        return false;
+    }
+    unlink(src.c_str());
+    return true;
+}
+
+// 子进程每隔kReopenCheckSec秒检查一次文件是否被移走
+static const time_t kReopenCheckSec = 3;
+// 滚动后等所有进程都重新打开再压缩和清理，后台线程每秒运行一次，多留一秒余量
+static const time_t kRotateFinishDelaySec = kReopenCheckSec + 2;
+
+bool FileLogAppender::rotate()
+{
+    Mutex::Lock lock(rotateMutex_);
+
+    std::string target = filename_ + "." + Time2Str(time(0), "%Y%m%d-%H%M%S");
+    std::string name   = target;
+    struct stat st;
+    for (int i = 1; lstat(name.c_str(), &st) == 0 || lstat((name + ".gz").c_str(), &st) == 0;
+         ++i) {
+        name = target + "." + std::to_string(i);
+    }
+    if (rename(filename_.c_str(), name.c_str()) != 0) {
+        std::cout << "FileLogAppender rename " << filename_ << " to " << name
+                  << " error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (!openLocked()) {
+        return false;
+    }
+
+    // 当前进程的线程已经写完旧文件，但子进程要到下次检查时才重新打开，
+    // 这之前压缩或删除旧文件，子进程追加的日志会丢失
+    if (policy_.compress || policy_.maxFiles) {
+        pending_.emplace_back(time(0) + kRotateFinishDelaySec, name);
+    }
+    return true;
+}
+
+void FileLogAppender::finishRotateLocked(time_t now)
+{
+    bool finished = false;
+    while (!pending_.empty() && pending_.front().first <= now) {
+        const std::string& name = pending_.front().second;
+        if (policy_.compress && !GzipFile(name, name + ".gz")) {
+            std::cout << "FileLogAppender compress " << name << " error" << std::endl;
+        }
+        pending_.pop_front();
+        finished = true;
+    }
+    if (finished && policy_.maxFiles) {
+        removeOldFiles();
+    }
+}
+
+void FileLogAppender::removeOldFiles()
+{
+    std::string dir    = FSUtil::Dirname(filename_);
+    std::string prefix = FSUtil::Basename(filename_) + ".";
+    DIR*        d      = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    // 历史文件的名字是 文件名.时间[.序号][.gz]
+    std::vector<std::pair<uint64_t, std::string>> files;
+    struct dirent*                                dp;
+    while ((dp = readdir(d)) != nullptr) {
+        std::string name = dp->d_name;
+        if (name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            !isdigit((unsigned char)name[prefix.size()])) {
+            continue;
+        }
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            files.emplace_back(st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec, path);
+        }
+    }
+    closedir(d);
+    if (files.size() <= policy_.maxFiles) {
+        return;
+    }
+    std::sort(files.begin(), files.end());
+    for (size_t i = 0; i < files.size() - policy_.maxFiles; ++i) {
+        unlink(files[i].second.c_str());
+    }
+}
+
+void FileLogAppender::onTimer(time_t now)
+{
+    // fork出的子进程和父进程写同一个文件，只由创建Appender的进程滚动，子进程发现文件被移走后重新打开
+    bool owner = getpid() == pid_;
+    {
+        Mutex::Lock lock(rotateMutex_);
+        finishRotateLocked(now);
+    }
+    if (owner && policy_.interval != LogRotatePolicy::NONE && now >= nextRotate_) {
+        nextRotate_ = LogRotatePolicy::NextRotateTime(now, policy_.interval);
+        rotate();
+        lastCheck_ = now;
+        return;
+    }
+    if (owner && policy_.maxSize) {
+        // fileSize_只统计当前进程写入的字节，子进程写入的要从文件的实际大小里看
+        uint64_t size = fileSize_;
+        {
+            Rcu::ReadLock rcu;
+            File*         file = file_.get();
+            struct stat   st;
+            if (file && fstat(file->fd, &st) == 0) {
+                size = st.st_size;
+            }
+        }
+        if (size >= policy_.maxSize) {
+            rotate();
+            lastCheck_ = now;
+            return;
+        }
+    }
+    if (now >= lastCheck_ + kReopenCheckSec) {
+        lastCheck_ = now;
+        // 文件被移走或删除后重新打开，持有rotateMutex_时文件不会被替换
+        Mutex::Lock lock(rotateMutex_);
+        File*       file = file_.get();
+        struct stat st;
+        struct stat fst;
+        if (!file || stat(filename_.c_str(), &st) != 0 || fstat(file->fd, &fst) != 0 ||
+            st.st_ino != fst.st_ino || st.st_dev != fst.st_dev) {
+            openLocked();
+        }
     }
-    return FSUtil::OpenForWrite(filestream_, filename_, std::ios::app);
 }
 
 void StdoutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level,
                             LogEvent::ptr event)
 {
-    if (level >= level_) {
-        MutexType::Lock lock(mutex_);
-        formatter_->format(std::cout, logger, level, event);
+    if (level < level_) {
+        return;
+    }
+    LogStreamBuf& buf = LogFormatter::GetThreadBuffer();
+    {
+        Rcu::ReadLock rcu;
+        LogFormatter* formatter = peekFormatter();
+        if (!formatter) {
+            return;
+        }
+        formatter->format(buf, logger, level, event);
+    }
+
+    Mutex::Lock lock(queue_mutex_);
+    // 队列满了等输出的线程写出去，输出的线程交出后由自己接着写
+    while (flushing_ && queue_.size() >= kMaxQueueBytes) {
+        ++waiting_;
+        flushed_cond_.wait(queue_mutex_);
+        --waiting_;
+    }
+    queue_.append(buf.data(), buf.size());
+    queued_ += buf.size();
+    uint64_t mine = queued_;
+    if (flushing_) {
+        // 正在输出的线程会把这条一起写出去
+        if (level < LogLevel::ERROR) {
+            return;
+        }
+        // ERROR以上等自己的内容写出去
+        ++waiting_;
+        while (flushing_ && flushed_ < mine) {
+            flushed_cond_.wait(queue_mutex_);
+        }
+        --waiting_;
+        if (flushed_ >= mine) {
+            return;
+        }
+    }
+
+    flushing_ = true;
+    for (uint32_t batches = 0; !queue_.empty(); ++batches) {
+        // 一个线程最多连续写kMaxFlushBatches批，之后有线程在等就交给它，不让一个线程一直写下去
+        if (batches >= kMaxFlushBatches && waiting_ > 0) {
+            break;
+        }
+        writing_.swap(queue_);
+        uint64_t end = queued_;
+        lock.unlock();
+        std::cout.write(writing_.data(), writing_.size()).flush();
+        writing_.clear();
+        lock.lock();
+        flushed_ = end;
+        flushed_cond_.notifyAll();
     }
+    flushing_ = false;
+    flushed_cond_.notifyAll();
 }
 
 std::string StdoutLogAppender::toYamlString()
@@ -479,8 +1054,9 @@ std::string StdoutLogAppender::toYamlString()
     if (level_ != LogLevel::UNKNOW) {
         node["level"] = LogLevel::ToString(level_);
     }
-    if (hasFormatter_ && formatter_) {
-        node["formatter"] = formatter_->getPattern();
+    LogFormatter::ptr formatter = getFormatter();
+    if (hasFormatter_ && formatter) {
+        node["formatter"] = formatter->getPattern();
     }
     std::stringstream ss;
     ss << node;
@@ -493,29 +1069,299 @@ LogFormatter::LogFormatter(const std::string& pattern)
     init();
 }
 
+// 每个线程缓存最近一秒格式化好的时间，按DATETIME指令的编号直接映射
+struct TimeCache
+{
+    uint32_t id  = 0;
+    time_t   sec = -1;
+    size_t   len = 0;
+    char     buf[64];
+};
+
+static const size_t                 kTimeCacheSize = 8;
+static thread_local TimeCache       t_time_cache[kTimeCacheSize];
+static std::atomic<uint32_t>        s_datetime_id{0};
+static thread_local LogStreamBuf    t_format_buf;
+
+static inline void AppendTime(LogStreamBuf& buf, const LogFormatter::Op& op, time_t sec)
+{
+    TimeCache& cache = t_time_cache[op.id % kTimeCacheSize];
+    if (HIPER_UNLIKELY(cache.id != op.id || cache.sec != sec)) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        cache.id  = op.id;
+        cache.sec = sec;
+        cache.len = strftime(cache.buf, sizeof(cache.buf), op.arg.c_str(), &tm);
+    }
+    buf.append(cache.buf, cache.len);
+}
+
+template <class T>
+static inline void AppendInt(LogStreamBuf& buf, T v)
+{
+    buf.reserve(24);
+    char* end = std::to_chars(buf.cur(), buf.cur() + buf.avail(), v).ptr;
+    buf.commit(end - buf.cur());
+}
+
+static inline void AppendDouble(LogStreamBuf& buf, double v)
+{
+    buf.reserve(32);
+    char* end = std::to_chars(buf.cur(), buf.cur() + buf.avail(), v).ptr;
+    buf.commit(end - buf.cur());
+}
+
+/**
+ * @brief 文本格式的结构化字段，追加在消息后面: " key=value"
+ */
+static void AppendTextFields(LogStreamBuf& buf, const LogFields& fields)
+{
+    fields.forEach([&buf](const LogFields::Field& f) {
+        buf.append(" ", 1);
+        buf.append(f.key.data(), f.key.size());
+        buf.append("=", 1);
+        switch (f.type) {
+        case LogFields::STRING: buf.append(f.str.data(), f.str.size()); break;
+        case LogFields::INT: AppendInt(buf, f.i); break;
+        case LogFields::UINT: AppendInt(buf, f.u); break;
+        case LogFields::DOUBLE: AppendDouble(buf, f.d); break;
+        case LogFields::BOOL: f.b ? buf.append("true", 4) : buf.append("false", 5); break;
+        }
+    });
+}
+
+/**
+ * @brief 返回[p, end)中第一个需要转义的字符(控制字符、双引号、反斜杠)，没有返回end
+ */
+static inline const char* FindJsonEscape(const char* p, const char* end)
+{
+#ifdef __SSE2__
+    const __m128i quote     = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl      = _mm_set1_epi8(0x1f);
+    for (; p + 16 <= end; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        // 无符号比较v <= 0x1f，UTF-8的多字节字符不受影响
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                                              _mm_cmpeq_epi8(v, backslash)));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; p < end; ++p) {
+        unsigned char c = *p;
+        if (c <= 0x1f || c == '"' || c == '\\') {
+            return p;
+        }
+    }
+    return end;
+}
+
+void LogFormatter::AppendJsonString(LogStreamBuf& buf, const char* str, size_t len)
+{
+    static const char* s_hex = "0123456789abcdef";
+    const char*        end   = str + len;
+    buf.append("\"", 1);
+    while (str < end) {
+        const char* esc = FindJsonEscape(str, end);
+        buf.append(str, esc - str);
+        if (esc == end) {
+            break;
+        }
+        unsigned char c = *esc;
+        switch (c) {
+        case '"': buf.append("\\\"", 2); break;
+        case '\\': buf.append("\\\\", 2); break;
+        case '\n': buf.append("\\n", 2); break;
+        case '\r': buf.append("\\r", 2); break;
+        case '\t': buf.append("\\t", 2); break;
+        case '\b': buf.append("\\b", 2); break;
+        case '\f': buf.append("\\f", 2); break;
+        default:
+        {
+            char u[6] = {'\\', 'u', '0', '0', s_hex[c >> 4], s_hex[c & 0xf]};
+            buf.append(u, sizeof(u));
+            break;
+        }
+        }
+        str = esc + 1;
+    }
+    buf.append("\"", 1);
+}
+
+/**
+ * @brief 追加JSON的键，带前面的逗号
+ */
+static inline void AppendJsonKey(LogStreamBuf& buf, const char* key, size_t len)
+{
+    buf.append(",\"", 2);
+    buf.append(key, len);
+    buf.append("\":", 2);
+}
+
+/**
+ * @brief 把结构化字段写成"fields":{...}
+ */
+static void AppendJsonFields(LogStreamBuf& buf, const LogFields& fields)
+{
+    buf.append(",\"fields\":{", 11);
+    bool first = true;
+    fields.forEach([&buf, &first](const LogFields::Field& f) {
+        if (!first) {
+            buf.append(",", 1);
+        }
+        first = false;
+        LogFormatter::AppendJsonString(buf, f.key.data(), f.key.size());
+        buf.append(":", 1);
+        switch (f.type) {
+        case LogFields::STRING:
+            LogFormatter::AppendJsonString(buf, f.str.data(), f.str.size());
+            break;
+        case LogFields::INT: AppendInt(buf, f.i); break;
+        case LogFields::UINT: AppendInt(buf, f.u); break;
+        case LogFields::DOUBLE:
+            // JSON没有inf和nan
+            if (std::isfinite(f.d)) {
+                AppendDouble(buf, f.d);
+            }
+            else {
+                buf.append("null", 4);
+            }
+            break;
+        case LogFields::BOOL: f.b ? buf.append("true", 4) : buf.append("false", 5); break;
+        }
+    });
+    buf.append("}", 1);
+}
+
+void LogFormatter::formatJson(LogStreamBuf& buf, const std::shared_ptr<Logger>& logger,
+                              LogLevel::Level level, const LogEvent::ptr& event)
+{
+    buf.append("{\"time\":\"", 9);
+    AppendTime(buf, ops_[0], event->getTime());
+    buf.append("\",\"level\":\"", 11);
+    const char* level_str = LogLevel::ToString(level);
+    buf.append(level_str, strlen(level_str));
+    buf.append("\"", 1);
+    AppendJsonKey(buf, "logger", 6);
+    AppendJsonString(buf, logger->getName().c_str(), logger->getName().size());
+    AppendJsonKey(buf, "elapse", 6);
+    AppendInt(buf, event->getElapse());
+    AppendJsonKey(buf, "thread_id", 9);
+    AppendInt(buf, event->getThreadId());
+    AppendJsonKey(buf, "thread_name", 11);
+    AppendJsonString(buf, event->getThreadName().c_str(), event->getThreadName().size());
+    AppendJsonKey(buf, "fiber_id", 8);
+    AppendInt(buf, event->getFiberId());
+    AppendJsonKey(buf, "file", 4);
+    AppendJsonString(buf, event->getFile(), strlen(event->getFile()));
+    AppendJsonKey(buf, "line", 4);
+    AppendInt(buf, event->getLine());
+    AppendJsonKey(buf, "msg", 3);
+    if (HIPER_UNLIKELY(event->getBinarySite() != nullptr)) {
+        // 二进制日志先渲染成文本再转义
+        static thread_local LogStreamBuf t_msg;
+        t_msg.reset();
+        BinaryLog::Render(event->getBinarySite()->getFormat(), event->getContentData(),
+                          event->getContentSize(), t_msg);
+        AppendJsonString(buf, t_msg.data(), t_msg.size());
+    }
+    else {
+        AppendJsonString(buf, event->getContentData(), event->getContentSize());
+    }
+    // 用户字段放在fields里，和msg、level这些固定字段同名时也不会出现重复的键
+    if (HIPER_UNLIKELY(!event->getFields().empty())) {
+        AppendJsonFields(buf, event->getFields());
+    }
+    buf.append("}\n", 2);
+}
+
+LogStreamBuf& LogFormatter::GetThreadBuffer()
+{
+    t_format_buf.reset();
+    return t_format_buf;
+}
+
+void LogFormatter::format(LogStreamBuf& buf, const std::shared_ptr<Logger>& logger,
+                          LogLevel::Level level, const LogEvent::ptr& event)
+{
+    if (json_) {
+        formatJson(buf, logger, level, event);
+        return;
+    }
+    for (auto& op : ops_) {
+        switch (op.type) {
+        case Op::STRING: buf.append(op.arg.c_str(), op.arg.size()); break;
+        case Op::MESSAGE:
+            if (HIPER_UNLIKELY(event->getBinarySite() != nullptr)) {
+                BinaryLog::Render(event->getBinarySite()->getFormat(), event->getContentData(),
+                                  event->getContentSize(), buf);
+            }
+            else {
+                buf.append(event->getContentData(), event->getContentSize());
+            }
+            if (HIPER_UNLIKELY(!event->getFields().empty())) {
+                AppendTextFields(buf, event->getFields());
+            }
+            break;
+        case Op::LEVEL:
+        {
+            const char* str = LogLevel::ToString(level);
+            buf.append(str, strlen(str));
+            break;
+        }
+        case Op::ELAPSE: AppendInt(buf, event->getElapse()); break;
+        case Op::NAME: buf.append(logger->getName().c_str(), logger->getName().size()); break;
+        case Op::THREAD_ID: AppendInt(buf, event->getThreadId()); break;
+        case Op::DATETIME: AppendTime(buf, op, event->getTime()); break;
+        case Op::FILENAME:
+        {
+            const char* file = event->getFile();
+            buf.append(file, strlen(file));
+            break;
+        }
+        case Op::LINE: AppendInt(buf, event->getLine()); break;
+        case Op::FIBER_ID: AppendInt(buf, event->getFiberId()); break;
+        case Op::THREAD_NAME:
+            buf.append(event->getThreadName().c_str(), event->getThreadName().size());
+            break;
+        }
+    }
+}
+
 std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level,
                                  LogEvent::ptr event)
 {
-    std::stringstream ss;
-    for (auto& i : items_) {
-        i->format(ss, logger, level, event);
-    }
-    return ss.str();
+    LogStreamBuf& buf = GetThreadBuffer();
+    format(buf, logger, level, event);
+    return std::string(buf.data(), buf.size());
 }
 
 std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger> logger,
                                    LogLevel::Level level, LogEvent::ptr event)
 {
-    for (auto& i : items_) {
-        i->format(ofs, logger, level, event);
-    }
-    return ofs;
+    LogStreamBuf& buf = GetThreadBuffer();
+    format(buf, logger, level, event);
+    return ofs.write(buf.data(), buf.size());
 }
 
 // "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
-// 解析模板字符串pattern_，提取出其中的转义字符和普通字符，并将其转换为一系列格式化项（FormatItem）以供后续使用
+// 解析模板字符串pattern_，提取出其中的转义字符和普通字符，并编译成一系列渲染指令（Op）以供后续使用
 void LogFormatter::init()
 {
+    // json或json{时间格式}
+    if (pattern_ == "json" ||
+        (pattern_.size() > 6 && pattern_.compare(0, 5, "json{") == 0 && pattern_.back() == '}')) {
+        std::string fmt = pattern_.size() > 6 ? pattern_.substr(5, pattern_.size() - 6)
+                                              : "%Y-%m-%dT%H:%M:%S%z";
+        json_ = true;
+        ops_.push_back(Op{Op::DATETIME, fmt, ++s_datetime_id});
+        return;
+    }
+
     // str, format, type
     // 0:普通字符串 1:格式化
     // (%d {%Y-%m-%d %H:%M:%S} 1)   (%T "" 0)
@@ -607,44 +1453,58 @@ void LogFormatter::init()
     if (!nstr.empty()) {
         vec.push_back(std::make_tuple(nstr, "", 0));
     }
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string& str)>>
-        s_format_items = {
-#define XX(str, C)                                                               \
-    {                                                                            \
-        #str, [](const std::string& fmt) { return FormatItem::ptr(new C(fmt)); } \
-    }
-
-            XX(m, MessageFormatItem),      // m:消息
-            XX(p, LevelFormatItem),        // p:日志级别
-            XX(r, ElapseFormatItem),       // r:累计毫秒数
-            XX(c, NameFormatItem),         // c:日志名称
-            XX(t, ThreadIdFormatItem),     // t:线程id
-            XX(n, NewLineFormatItem),      // n:换行
-            XX(d, DateTimeFormatItem),     // d:时间
-            XX(f, FilenameFormatItem),     // f:文件名
-            XX(l, LineFormatItem),         // l:行号
-            XX(T, TabFormatItem),          // T:Tab
-            XX(F, FiberIdFormatItem),      // F:协程id
-            XX(N, ThreadNameFormatItem),   // N:线程名称
-#undef XX
-        };
+    static std::map<std::string, Op::Type> s_format_ops = {
+        {"m", Op::MESSAGE},       // m:消息
+        {"p", Op::LEVEL},         // p:日志级别
+        {"r", Op::ELAPSE},        // r:累计毫秒数
+        {"c", Op::NAME},          // c:日志名称
+        {"t", Op::THREAD_ID},     // t:线程id
+        {"n", Op::STRING},        // n:换行
+        {"d", Op::DATETIME},      // d:时间
+        {"f", Op::FILENAME},      // f:文件名
+        {"l", Op::LINE},          // l:行号
+        {"T", Op::STRING},        // T:Tab
+        {"F", Op::FIBER_ID},      // F:协程id
+        {"N", Op::THREAD_NAME},   // N:线程名称
+    };
+
+    // 相邻的字符串合并成一条指令
+    auto add_string = [this](const std::string& str) {
+        if (!ops_.empty() && ops_.back().type == Op::STRING) {
+            ops_.back().arg.append(str);
+        }
+        else {
+            ops_.push_back(Op{Op::STRING, str});
+        }
+    };
 
     for (auto& i : vec) {
         if (std::get<2>(i) == 0) {
-            items_.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+            add_string(std::get<0>(i));
+            continue;
         }
-        else {
-            auto it = s_format_items.find(std::get<0>(i));
-            if (it == s_format_items.end()) {
-                items_.push_back(FormatItem::ptr(
-                    new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
-                error_ = true;
-            }
-            else {
-                items_.push_back(it->second(std::get<1>(i)));
+        const std::string& key = std::get<0>(i);
+        auto                it  = s_format_ops.find(key);
+        if (it == s_format_ops.end()) {
+            add_string("<<error_format %" + key + ">>");
+            error_ = true;
+        }
+        else if (key == "n") {
+            add_string("\n");
+        }
+        else if (key == "T") {
+            add_string("\t");
+        }
+        else if (it->second == Op::DATETIME) {
+            std::string fmt = std::get<1>(i);
+            if (fmt.empty()) {
+                fmt = "%Y-%m-%d %H:%M:%S";
             }
+            ops_.push_back(Op{Op::DATETIME, fmt, ++s_datetime_id});
+        }
+        else {
+            ops_.push_back(Op{it->second});
         }
-
     }
 }
 
@@ -675,15 +1535,19 @@ Logger::ptr LoggerManager::getLogger(const std::string& name)
 
 struct LogAppenderDefine
 {
-    int             type  = 0;   // 1 File, 2 Stdout
+    int             type  = 0;   // 1 File, 2 Stdout, 3 Async, 4 Binary, 5 Mmap
     LogLevel::Level level = LogLevel::UNKNOW;
     std::string     formatter;
     std::string     file;
+    std::string     overflow;   // AsyncLogAppender的溢出策略
+    LogRotatePolicy rotate;     // FileLogAppender的滚动策略
+    uint64_t        size = 0;   // MmapLogAppender的环形区大小
 
     bool operator==(const LogAppenderDefine& oth) const
     {
         return type == oth.type && level == oth.level && formatter == oth.formatter &&
-               file == oth.file;
+               file == oth.file && overflow == oth.overflow && rotate == oth.rotate &&
+               size == oth.size;
     }
 };
 
@@ -745,6 +1609,59 @@ public:
                         continue;
                     }
                     lad.file = a["file"].as<std::string>();
+                    if (a["max_size"].IsDefined()) {
+                        lad.rotate.maxSize =
+                            LogRotatePolicy::SizeFromString(a["max_size"].as<std::string>());
+                    }
+                    if (a["rotate"].IsDefined()) {
+                        lad.rotate.interval =
+                            LogRotatePolicy::IntervalFromString(a["rotate"].as<std::string>());
+                    }
+                    if (a["max_files"].IsDefined()) {
+                        lad.rotate.maxFiles = a["max_files"].as<uint32_t>();
+                    }
+                    if (a["compress"].IsDefined()) {
+                        lad.rotate.compress = a["compress"].as<bool>();
+                    }
+                    if (a["formatter"].IsDefined()) {
+                        lad.formatter = a["formatter"].as<std::string>();
+                    }
+                }
+                else if (type == "AsyncLogAppender") {
+                    lad.type = 3;
+                    if (!a["file"].IsDefined()) {
+                        std::cout << "log config error: asyncappender file is null, " << a
+                                  << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    if (a["overflow"].IsDefined()) {
+                        lad.overflow = a["overflow"].as<std::string>();
+                    }
+                    if (a["formatter"].IsDefined()) {
+                        lad.formatter = a["formatter"].as<std::string>();
+                    }
+                }
+                else if (type == "BinaryLogAppender") {
+                    lad.type = 4;
+                    if (!a["file"].IsDefined()) {
+                        std::cout << "log config error: binaryappender file is null, " << a
+                                  << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                }
+                else if (type == "MmapLogAppender") {
+                    lad.type = 5;
+                    if (!a["file"].IsDefined()) {
+                        std::cout << "log config error: mmapappender file is null, " << a
+                                  << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    if (a["size"].IsDefined()) {
+                        lad.size = LogRotatePolicy::SizeFromString(a["size"].as<std::string>());
+                    }
                     if (a["formatter"].IsDefined()) {
                         lad.formatter = a["formatter"].as<std::string>();
                     }
@@ -785,10 +1702,40 @@ public:
             if (a.type == 1) {
                 na["type"] = "FileLogAppender";
                 na["file"] = a.file;
+                if (a.rotate.maxSize) {
+                    na["max_size"] = a.rotate.maxSize;
+                }
+                if (a.rotate.interval != LogRotatePolicy::NONE) {
+                    na["rotate"] = LogRotatePolicy::IntervalToString(a.rotate.interval);
+                }
+                if (a.rotate.maxFiles) {
+                    na["max_files"] = a.rotate.maxFiles;
+                }
+                if (a.rotate.compress) {
+                    na["compress"] = true;
+                }
             }
             else if (a.type == 2) {
                 na["type"] = "StdoutLogAppender";
             }
+            else if (a.type == 4) {
+                na["type"] = "BinaryLogAppender";
+                na["file"] = a.file;
+            }
+            else if (a.type == 5) {
+                na["type"] = "MmapLogAppender";
+                na["file"] = a.file;
+                if (a.size) {
+                    na["size"] = a.size;
+                }
+            }
+            else if (a.type == 3) {
+                na["type"] = "AsyncLogAppender";
+                na["file"] = a.file;
+                if (!a.overflow.empty()) {
+                    na["overflow"] = a.overflow;
+                }
+            }
             if (a.level != LogLevel::UNKNOW) {
                 na["level"] = LogLevel::ToString(a.level);
             }
@@ -842,7 +1789,7 @@ struct LogIniter
                 for (auto& a : i.appenders) {
                     hiper::LogAppender::ptr ap;
                     if (a.type == 1) {
-                        ap.reset(new FileLogAppender(a.file));
+                        ap.reset(new FileLogAppender(a.file, a.rotate));
                     }
                     else if (a.type == 2) {
                         if (!hiper::EnvMgr::GetInstance()->has("d")) {
@@ -852,6 +1799,21 @@ struct LogIniter
                             continue;
                         }
                     }
+                    else if (a.type == 3) {
+                        ap.reset(new AsyncLogAppender(
+                            a.file, AsyncLogAppender::PolicyFromString(a.overflow)));
+                    }
+                    else if (a.type == 4) {
+                        ap.reset(new BinaryLogAppender(a.file));
+                    }
+                    else if (a.type == 5) {
+                        if (a.size) {
+                            ap.reset(new MmapLogAppender(a.file, a.size));
+                        }
+                        else {
+                            ap.reset(new MmapLogAppender(a.file));
+                        }
+                    }
                     ap->setLevel(a.level);
                     if (!a.formatter.empty()) {
                         LogFormatter::ptr fmt(new LogFormatter(a.formatter));
@@ -894,6 +1856,22 @@ std::string LoggerManager::toYamlString()
     return ss.str();
 }
 
+void LoggerManager::flush()
+{
+    std::vector<Logger::ptr> loggers;
+    {
+        MutexType::Lock lock(mutex_);
+        for (auto& i : loggers_) {
+            loggers.push_back(i.second);
+        }
+    }
+    for (auto& logger : loggers) {
+        for (auto& i : logger->getAppenders()) {
+            i->flush();
+        }
+    }
+}
+
 void LoggerManager::init() {}
 
 }   // namespace hiper
@@ -18,19 +18,51 @@
 #include <vector>
 #include <stdarg.h>
 #include <map>
+#include <atomic>
+#include <string_view>
+#include <type_traits>
+#include <string.h>
+#include "macro.h"
 #include "util.h"
 #include "singleton.h"
 #include "thread.h"
 #include "mutex.h"
+#include "rcu.h"
+
+/**
+ * @brief 编译期的最低日志级别，低于该级别的日志语句在编译期被消除
+ * @details 取值与LogLevel::Level一致，默认debug构建全部保留，定义了NDEBUG时只保留INFO及以上，
+ *          可以用-DHIPER_LOG_MIN_LEVEL=N覆盖
+ */
+#ifndef HIPER_LOG_MIN_LEVEL
+#   ifdef NDEBUG
+#       define HIPER_LOG_MIN_LEVEL 2
+#   else
+#       define HIPER_LOG_MIN_LEVEL 0
+#   endif
+#endif
+
+/**
+ * @brief 当前调用点的LogSite，每处宏展开各有一个
+ */
+#define HIPER_LOG_SITE() \
+    ([]() -> hiper::LogSite& { static hiper::LogSite s_site; return s_site; }())
+
+/**
+ * @brief 判断logger在调用点是否输出level级别的日志，logger只求值一次
+ */
+#define HIPER_LOG_IF(hiper_logger, logger, level) \
+    if(const auto& hiper_logger = (logger); \
+        (level) >= HIPER_LOG_MIN_LEVEL && HIPER_LOG_SITE().isEnabled(*hiper_logger, level))
 
 /**
  * @brief 使用流式方式将日志级别level的日志写入到logger
  */
 #define LOG_LEVEL(logger, level) \
-    if(logger->getLevel() <= level) \
-        hiper::LogEventWrap(logger, hiper::LogEvent::ptr(new hiper::LogEvent(level, \
+    HIPER_LOG_IF(hiper_log_logger_, logger, level) \
+        hiper::LogEventWrap(hiper_log_logger_, hiper::LogEvent::Create(level, \
                         __FILE__, __LINE__, 0, hiper::GetThreadId(),\
-                hiper::GetFiberId(), time(0), hiper::Thread::GetName()))).getSS()
+                hiper::GetFiberId(), time(0), hiper::Thread::GetName())).getSS()
 
 /**
  * @brief 使用流式方式将日志级别debug的日志写入到logger
@@ -61,10 +93,10 @@
  * @brief 使用格式化方式将日志级别level的日志写入到logger
  */
 #define LOG_FMT_LEVEL(logger, level, fmt, ...) \
-    if(logger->getLevel() <= level) \
-        hiper::LogEventWrap(logger, hiper::LogEvent::ptr(new hiper::LogEvent(level, \
+    HIPER_LOG_IF(hiper_log_logger_, logger, level) \
+        hiper::LogEventWrap(hiper_log_logger_, hiper::LogEvent::Create(level, \
                         __FILE__, __LINE__, 0, hiper::GetThreadId(),\
-                hiper::GetFiberId(), time(0), hiper::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+                hiper::GetFiberId(), time(0), hiper::Thread::GetName())).getEvent()->format(fmt, __VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别debug的日志写入到logger
@@ -91,6 +123,58 @@
  */
 #define LOG_FMT_FATAL(logger, fmt, ...) LOG_FMT_LEVEL(logger, hiper::LogLevel::FATAL, fmt, __VA_ARGS__)
 
+/**
+ * @brief 当前调用点的LogLimiter，每处宏展开各有一个
+ */
+#define HIPER_LOG_LIMITER() \
+    ([]() -> hiper::LogLimiter& { static hiper::LogLimiter s_limiter; return s_limiter; }())
+
+/**
+ * @brief 调用点限流，每秒最多输出per_second条，之前被丢弃的条数附在下一条输出的日志末尾
+ */
+#define LOG_LEVEL_LIMIT(logger, level, per_second) \
+    HIPER_LOG_IF(hiper_log_logger_, logger, level) \
+    if (uint64_t hiper_log_suppressed_ = 0; \
+        HIPER_LOG_LIMITER().allowRate(per_second, hiper_log_suppressed_)) \
+        hiper::LogEventWrap(hiper_log_logger_, hiper::LogEvent::Create(level, \
+                        __FILE__, __LINE__, 0, hiper::GetThreadId(),\
+                hiper::GetFiberId(), time(0), hiper::Thread::GetName()), hiper_log_suppressed_).getSS()
+
+#define LOG_DEBUG_LIMIT(logger, per_second) LOG_LEVEL_LIMIT(logger, hiper::LogLevel::DEBUG, per_second)
+#define LOG_INFO_LIMIT(logger, per_second)  LOG_LEVEL_LIMIT(logger, hiper::LogLevel::INFO, per_second)
+#define LOG_WARN_LIMIT(logger, per_second)  LOG_LEVEL_LIMIT(logger, hiper::LogLevel::WARN, per_second)
+#define LOG_ERROR_LIMIT(logger, per_second) LOG_LEVEL_LIMIT(logger, hiper::LogLevel::ERROR, per_second)
+
+/**
+ * @brief 调用点采样，每n条输出1条，之前被丢弃的条数附在输出的日志末尾
+ */
+#define LOG_LEVEL_EVERY_N(logger, level, n) \
+    HIPER_LOG_IF(hiper_log_logger_, logger, level) \
+    if (uint64_t hiper_log_suppressed_ = 0; \
+        HIPER_LOG_LIMITER().allowEvery(n, hiper_log_suppressed_)) \
+        hiper::LogEventWrap(hiper_log_logger_, hiper::LogEvent::Create(level, \
+                        __FILE__, __LINE__, 0, hiper::GetThreadId(),\
+                hiper::GetFiberId(), time(0), hiper::Thread::GetName()), hiper_log_suppressed_).getSS()
+
+#define LOG_DEBUG_EVERY_N(logger, n) LOG_LEVEL_EVERY_N(logger, hiper::LogLevel::DEBUG, n)
+#define LOG_INFO_EVERY_N(logger, n)  LOG_LEVEL_EVERY_N(logger, hiper::LogLevel::INFO, n)
+#define LOG_WARN_EVERY_N(logger, n)  LOG_LEVEL_EVERY_N(logger, hiper::LogLevel::WARN, n)
+#define LOG_ERROR_EVERY_N(logger, n) LOG_LEVEL_EVERY_N(logger, hiper::LogLevel::ERROR, n)
+
+/**
+ * @brief 格式化方式的调用点限流，见LOG_LEVEL_LIMIT
+ */
+#define LOG_FMT_LEVEL_LIMIT(logger, level, per_second, fmt, ...) \
+    HIPER_LOG_IF(hiper_log_logger_, logger, level) \
+    if (uint64_t hiper_log_suppressed_ = 0; \
+        HIPER_LOG_LIMITER().allowRate(per_second, hiper_log_suppressed_)) \
+        hiper::LogEventWrap(hiper_log_logger_, hiper::LogEvent::Create(level, \
+                        __FILE__, __LINE__, 0, hiper::GetThreadId(),\
+                hiper::GetFiberId(), time(0), hiper::Thread::GetName()), hiper_log_suppressed_).getEvent()->format(fmt, __VA_ARGS__)
+
+#define LOG_FMT_WARN_LIMIT(logger, per_second, fmt, ...)  LOG_FMT_LEVEL_LIMIT(logger, hiper::LogLevel::WARN, per_second, fmt, __VA_ARGS__)
+#define LOG_FMT_ERROR_LIMIT(logger, per_second, fmt, ...) LOG_FMT_LEVEL_LIMIT(logger, hiper::LogLevel::ERROR, per_second, fmt, __VA_ARGS__)
+
 /**
  * @brief 获取主日志器
  */
@@ -105,6 +189,7 @@ namespace hiper {
 
 class Logger;
 class LoggerManager;
+class BinaryLogSite;
 
 /**
  * @brief 日志级别
@@ -142,12 +227,236 @@ public:
     static LogLevel::Level FromString(const std::string& str);
 };
 
+/**
+ * @brief 日志内容缓冲区
+ * @details 先写入固定大小的内联缓冲区，写满后才申请堆内存，堆内存在复用时保留，
+ *          所以同一个线程反复写日志时不会再申请内存
+ */
+class LogStreamBuf : public std::streambuf {
+public:
+    // 内联缓冲区大小
+    static constexpr size_t kInlineSize = 512;
+    // 复用时保留的最大堆内存，超过的释放掉
+    static constexpr size_t kMaxKeepSize = 64 * 1024;
+
+    LogStreamBuf();
+
+    /**
+     * @brief 清空内容，回到内联缓冲区
+     */
+    void reset();
+
+    /**
+     * @brief 保证还能写入len字节
+     */
+    void reserve(size_t len);
+
+    /**
+     * @brief 追加len字节
+     */
+    void append(const char* data, size_t len)
+    {
+        reserve(len);
+        memcpy(pptr(), data, len);
+        pbump(len);
+    }
+
+    const char* data() const { return pbase();}
+    size_t size() const { return pptr() - pbase();}
+
+    /**
+     * @brief 剩余可写的空间
+     */
+    char* cur() { return pptr();}
+    size_t avail() const { return epptr() - pptr();}
+
+    /**
+     * @brief 直接写入cur()之后，移动写入位置
+     */
+    void commit(size_t len) { pbump(len);}
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+private:
+    char inline_[kInlineSize];
+    // 溢出时使用的堆内存
+    std::unique_ptr<char[]> heap_;
+    size_t heapSize_ = 0;
+};
+
+/**
+ * @brief 日志的结构化字段
+ * @details 字段按类型直接编码进缓冲区，不先转成字符串，由格式器在输出时渲染：
+ *          文本格式追加在%m后面(key=value)，JSON格式放在"fields"对象里
+ */
+class LogFields {
+public:
+    enum Type : uint8_t {
+        STRING = 1,
+        INT = 2,
+        UINT = 3,
+        DOUBLE = 4,
+        BOOL = 5
+    };
+
+    /**
+     * @brief 解码后的字段，key和str指向缓冲区，不拷贝
+     */
+    struct Field {
+        std::string_view key;
+        Type type;
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            bool b;
+        };
+        std::string_view str;
+    };
+
+    void clear() { buf_.reset();}
+    bool empty() const { return buf_.size() == 0;}
+
+    void addString(std::string_view key, std::string_view val);
+    void addInt(std::string_view key, int64_t val) { addValue(key, INT, &val, sizeof(val));}
+    void addUint(std::string_view key, uint64_t val) { addValue(key, UINT, &val, sizeof(val));}
+    void addDouble(std::string_view key, double val) { addValue(key, DOUBLE, &val, sizeof(val));}
+    void addBool(std::string_view key, bool val) { addValue(key, BOOL, &val, sizeof(val));}
+
+    /**
+     * @brief 按值的类型添加字段，其他类型通过operator<<转成字符串
+     */
+    template <class T>
+    void add(std::string_view key, const T& val)
+    {
+        typedef std::decay_t<T> D;
+        if constexpr (std::is_same_v<D, bool>) {
+            addBool(key, val);
+        }
+        else if constexpr (std::is_integral_v<D> && std::is_signed_v<D>) {
+            addInt(key, val);
+        }
+        else if constexpr (std::is_integral_v<D>) {
+            addUint(key, val);
+        }
+        else if constexpr (std::is_enum_v<D>) {
+            addInt(key, (int64_t)val);
+        }
+        else if constexpr (std::is_floating_point_v<D>) {
+            addDouble(key, val);
+        }
+        else if constexpr (std::is_convertible_v<const T&, const char*>) {
+            const char* str = val;
+            addString(key, str ? std::string_view(str) : std::string_view("(null)"));
+        }
+        else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            addString(key, std::string_view(val));
+        }
+        else {
+            std::ostream& os = GetThreadStream();
+            os << val;
+            addStreamed(key);
+        }
+    }
+
+    /**
+     * @brief 按添加的顺序遍历字段
+     */
+    template <class F>
+    void forEach(F&& f) const
+    {
+        const char* p   = buf_.data();
+        const char* end = p + buf_.size();
+        while (p < end) {
+            Field field;
+            p = decode(p, field);
+            f(field);
+        }
+    }
+
+private:
+    void addValue(std::string_view key, Type type, const void* val, size_t len);
+    void addKey(std::string_view key, Type type);
+    void addStreamed(std::string_view key);
+    static const char* decode(const char* p, Field& field);
+    static std::ostream& GetThreadStream();
+
+private:
+    // 每个字段: 类型(1字节) key长度(4字节) key 值(定长，字符串为4字节长度加内容)
+    LogStreamBuf buf_;
+};
+
+/**
+ * @brief 日志内容流，和std::ostream的用法一致，内容写入LogStreamBuf
+ */
+class LogStream : public std::ostream {
+public:
+    LogStream() : std::ostream(&buf_) {}
+
+    /**
+     * @brief 清空内容和结构化字段，恢复默认的格式状态
+     */
+    void reset();
+
+    LogStreamBuf& buffer() { return buf_;}
+    const LogStreamBuf& buffer() const { return buf_;}
+
+    LogFields& fields() { return fields_;}
+    const LogFields& fields() const { return fields_;}
+
+private:
+    LogStreamBuf buf_;
+    LogFields fields_;
+};
+
+/**
+ * @brief 流式日志中的结构化字段，用法 LOG_INFO(logger) << "login" << hiper::LogField("uid", uid)
+ */
+template <class T>
+struct LogFieldRef {
+    std::string_view key;
+    const T& val;
+};
+
+template <class T>
+LogFieldRef<T> LogField(std::string_view key, const T& val)
+{
+    return LogFieldRef<T>{key, val};
+}
+
+/**
+ * @brief 写入日志流时添加为结构化字段，写入其他流时输出" key=value"
+ */
+template <class T>
+std::ostream& operator<<(std::ostream& os, const LogFieldRef<T>& field)
+{
+    if (LogStream* ls = dynamic_cast<LogStream*>(&os)) {
+        ls->fields().add(field.key, field.val);
+    }
+    else {
+        os << ' ' << field.key << '=' << field.val;
+    }
+    return os;
+}
+
 /**
  * @brief 日志事件
  */
 class LogEvent {
 public:
     typedef std::shared_ptr<LogEvent> ptr;
+
+    /**
+     * @brief 创建日志事件，优先复用当前线程缓存的事件
+     * @details 缓存的事件没有被其他地方持有时直接复用(嵌套写日志、Appender保存了事件时会新建)，
+     *          正常情况下不申请内存
+     */
+    static LogEvent::ptr Create(LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            ,const std::string& thread_name);
     /**
      * @brief 构造函数
      * @param[in] logger 日志器
@@ -208,7 +517,13 @@ public:
     /**
      * @brief 返回日志内容
      */
-    std::string getContent() const { return ss_.str();}
+    std::string getContent() const { return std::string(getContentData(), getContentSize());}
+
+    /**
+     * @brief 返回日志内容，不拷贝
+     */
+    const char* getContentData() const { return ss_.buffer().data();}
+    size_t getContentSize() const { return ss_.buffer().size();}
 
     /**
      * @brief 返回日志器
@@ -223,7 +538,25 @@ public:
     /**
      * @brief 返回日志内容字符串流
      */
-    std::stringstream& getSS() { return ss_;}
+    std::ostream& getSS() { return ss_;}
+
+    /**
+     * @brief 返回日志内容缓冲区
+     */
+    LogStreamBuf& getBuffer() { return ss_.buffer();}
+
+    /**
+     * @brief 返回结构化字段
+     */
+    LogFields& getFields() { return ss_.fields();}
+    const LogFields& getFields() const { return ss_.fields();}
+
+    /**
+     * @brief 返回二进制日志的调用点，不是二进制日志时返回nullptr
+     * @details 二进制日志的内容是参数的二进制编码，由%m按调用点的格式渲染
+     */
+    const BinaryLogSite* getBinarySite() const { return binarySite_;}
+    void setBinarySite(const BinaryLogSite* site) { binarySite_ = site;}
 
     /**
      * @brief 格式化写入日志内容
@@ -234,7 +567,16 @@ public:
      * @brief 格式化写入日志内容
      */
     void format(const char* fmt, va_list al);
-    
+
+private:
+    /**
+     * @brief 复用事件时重新设置字段
+     */
+    void reset(LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            ,const std::string& thread_name);
+
 private:
     // 文件名
     const char* file_ = nullptr;
@@ -251,7 +593,9 @@ private:
     // 线程名称
     std::string threadName_;
     // 日志内容流
-    std::stringstream ss_;
+    LogStream ss_;
+    // 二进制日志的调用点
+    const BinaryLogSite* binarySite_ = nullptr;
     // 日志器
     // std::shared_ptr<Logger> logger_;
     // 日志等级
@@ -267,31 +611,35 @@ public:
     /**
      * @brief 构造函数
      * @param[in] e 日志事件
+     * @param[in] suppressed 限流丢弃的条数，大于0时附在日志内容末尾
      */
-    LogEventWrap(std::shared_ptr<Logger> logger, LogEvent::ptr e);
+    LogEventWrap(const std::shared_ptr<Logger>& logger, LogEvent::ptr&& e, uint64_t suppressed = 0);
 
     /**
      * @brief 析构函数
      */
     ~LogEventWrap();
 
-    std::shared_ptr<Logger> getLogger() const { return logger_;}
+    std::shared_ptr<Logger> getLogger() const;
 
     /**
      * @brief 获取日志事件
      */
-    LogEvent::ptr getEvent() const { return event_;}
+    const LogEvent::ptr& getEvent() const { return event_;}
 
     /**
      * @brief 获取日志内容流
      */
-    std::stringstream& getSS();
+    std::ostream& getSS();
 private:
+    // 日志器，LOG_*宏中的logger在整个表达式结束前一直有效，不需要再持有一份引用
+    Logger* logger_;
     /**
      * @brief 日志事件
      */
-    std::shared_ptr<Logger> logger_;
     LogEvent::ptr event_;
+    // 限流丢弃的条数
+    uint64_t suppressed_;
 };
 
 /**
@@ -318,6 +666,9 @@ public:
      *  %N 线程名称
      *
      *  默认格式 "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
+     *
+     *  模板为"json"或"json{时间格式}"时每条日志输出一行JSON，结构化字段放在"fields"对象里，
+     *  时间格式默认"%Y-%m-%dT%H:%M:%S%z"
      */
     LogFormatter(const std::string& pattern);
 
@@ -329,26 +680,51 @@ public:
      */
     std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
     std::ostream& format(std::ostream& ofs, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
+
+    /**
+     * @brief 把格式化后的日志追加到缓冲区
+     */
+    void format(LogStreamBuf& buf, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event);
+
+    /**
+     * @brief 返回当前线程清空后的渲染缓冲区，供Appender格式化时使用
+     */
+    static LogStreamBuf& GetThreadBuffer();
 public:
 
     /**
-     * @brief 日志内容项格式化
-     */
-    class FormatItem {
-    public:
-        typedef std::shared_ptr<FormatItem> ptr;
-        /**
-         * @brief 析构函数
-         */
-        virtual ~FormatItem() {}
-        /**
-         * @brief 格式化日志到流
-         * @param[in, out] os 日志输出流
-         * @param[in] logger 日志器
-         * @param[in] level 日志等级
-         * @param[in] event 日志事件
-         */
-        virtual void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+     * @brief 模板编译后的一条渲染指令
+     */
+    struct Op {
+        enum Type {
+            // 普通字符串，包括%T和%n
+            STRING,
+            // %m 消息
+            MESSAGE,
+            // %p 日志级别
+            LEVEL,
+            // %r 累计毫秒数
+            ELAPSE,
+            // %c 日志名称
+            NAME,
+            // %t 线程id
+            THREAD_ID,
+            // %d 时间
+            DATETIME,
+            // %f 文件名
+            FILENAME,
+            // %l 行号
+            LINE,
+            // %F 协程id
+            FIBER_ID,
+            // %N 线程名称
+            THREAD_NAME
+        };
+        Type type;
+        // STRING的内容，DATETIME的strftime格式
+        std::string arg;
+        // DATETIME在线程时间缓存中的编号
+        uint32_t id = 0;
     };
 
     /**
@@ -365,11 +741,29 @@ public:
      * @brief 返回日志模板
      */
     const std::string getPattern() const { return pattern_;}
+
+    /**
+     * @brief 是否输出JSON
+     */
+    bool isJson() const { return json_;}
+
+    /**
+     * @brief 把str转义成JSON字符串(带引号)追加到buf
+     */
+    static void AppendJsonString(LogStreamBuf& buf, const char* str, size_t len);
+private:
+    /**
+     * @brief 输出一行JSON
+     */
+    void formatJson(LogStreamBuf& buf, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event);
+
 private:
     // 日志格式模板
     std::string pattern_;
-    // 日志格式解析后格式
-    std::vector<FormatItem::ptr> items_;
+    // 日志格式编译后的指令，JSON格式时只有一条DATETIME
+    std::vector<Op> ops_;
+    // 是否输出JSON
+    bool json_ = false;
     // 是否有错误
     bool error_ = false;
 
@@ -402,6 +796,17 @@ public:
      */
     virtual std::string toYamlString() = 0;
 
+    /**
+     * @brief 把缓冲在内存中的日志写入目标，直接写入的Appender什么也不做
+     */
+    virtual void flush() {}
+
+    /**
+     * @brief 由日志的后台线程每秒调用一次，需要先调用startTimer注册
+     * @param[in] now 当前时间
+     */
+    virtual void onTimer(time_t now) {}
+
     /**
      * @brief 更改日志格式器
      */
@@ -421,6 +826,24 @@ public:
      * @brief 设置日志级别
      */
     void setLevel(LogLevel::Level val) { level_ = val;}
+protected:
+    /**
+     * @brief 注册到日志的后台线程，之后每秒调用一次onTimer
+     * @note 派生类析构时要先调用stopTimer，返回后onTimer不会再被调用
+     */
+    void startTimer();
+    void stopTimer();
+
+    /**
+     * @brief 写日志时获取日志格式器，不增加引用计数
+     * @pre 在Rcu::ReadLock内调用，返回的指针在读区间结束前有效
+     */
+    LogFormatter* peekFormatter() const
+    {
+        LogFormatter::ptr* formatter = formatter_.get();
+        return formatter ? formatter->get() : nullptr;
+    }
+
 protected:
     // 日志级别
     LogLevel::Level level_ = LogLevel::DEBUG;
@@ -428,8 +851,8 @@ protected:
     bool hasFormatter_ = false;
     // Mutex
     MutexType mutex_;
-    // 日志格式器
-    LogFormatter::ptr formatter_;
+    // 日志格式器，写日志时在Rcu读区间内读取，不加锁
+    RcuPtr<LogFormatter::ptr> formatter_;
 };
 
 /**
@@ -440,6 +863,7 @@ friend class LoggerManager;
 public:
     typedef std::shared_ptr<Logger> ptr;
     typedef hiper::SpinLock MutexType;
+    typedef std::vector<LogAppender::ptr> AppenderList;
 
     /**
      * @brief 构造函数
@@ -501,21 +925,31 @@ public:
      */
     void clearAppenders();
 
+    /**
+     * @brief 返回日志目标的拷贝
+     */
+    AppenderList getAppenders() const;
+
     /**
      * @brief 返回日志级别
      */
     LogLevel::Level getLevel() const { return level_;}
 
     /**
-     * @brief 设置日志级别
+     * @brief 设置日志级别，同时让所有调用点缓存的判断结果失效
      */
-    void setLevel(LogLevel::Level val) { level_ = val;}
+    void setLevel(LogLevel::Level val);
 
     /**
      * @brief 返回日志名称
      */
     const std::string& getName() const { return name_;}
 
+    /**
+     * @brief 返回日志器编号，进程内唯一，从1开始
+     */
+    uint32_t getId() const { return id_;}
+
     /**
      * @brief 设置日志格式器
      */
@@ -538,50 +972,274 @@ public:
 private:
     // 日志名称
     std::string name_;
+    // 日志器编号
+    uint32_t id_;
     // 日志级别
     LogLevel::Level level_;
-    // Mutex
+    // Mutex，只在修改日志目标和格式器时使用
     MutexType mutex_;
-    // 日志目标集合
-    std::list<LogAppender::ptr> appenders_;
+    // 日志目标集合，修改时在mutex_内复制一份新的再替换，写日志时在Rcu读区间内读取，不加锁
+    RcuPtr<const AppenderList> appenders_;
     // 日志格式器
     LogFormatter::ptr formatter_;
     // 主日志器
     Logger::ptr root_;
 };
 
+/**
+ * @brief 日志调用点，缓存该调用点是否需要输出
+ * @details 缓存的结果和日志器编号、全局的级别版本号打包在一个64位原子变量里，
+ *          任意日志器调用setLevel都会增加版本号，调用点下次检查时重新计算
+ */
+class LogSite {
+public:
+    bool isEnabled(const Logger& logger, LogLevel::Level level)
+    {
+        uint64_t key   = MakeKey(logger);
+        uint64_t state = state_.load(std::memory_order_relaxed);
+        if (HIPER_LIKELY((state & ~1ull) == key)) {
+            return state & 1;
+        }
+        bool enabled = logger.getLevel() <= level;
+        state_.store(key | enabled, std::memory_order_relaxed);
+        return enabled;
+    }
+
+    /**
+     * @brief 让所有调用点的缓存失效
+     */
+    static void Invalidate() { s_generation.fetch_add(1, std::memory_order_release);}
+
+private:
+    static uint64_t MakeKey(const Logger& logger)
+    {
+        return ((uint64_t)logger.getId() << 32) |
+               ((s_generation.load(std::memory_order_acquire) & 0x7fffffff) << 1);
+    }
+
+private:
+    // 高32位日志器编号，低32位版本号<<1|是否输出
+    std::atomic<uint64_t> state_{0};
+    static std::atomic<uint32_t> s_generation;
+};
+
+/**
+ * @brief 调用点的限流和采样计数，只用原子变量，不加锁
+ */
+class LogLimiter {
+public:
+    /**
+     * @brief 每秒最多通过n条
+     * @param[out] suppressed 通过时返回上次通过之后被丢弃的条数
+     */
+    bool allowRate(uint32_t n, uint64_t& suppressed)
+    {
+        uint64_t sec   = (GetElapsedMS() / 1000) & 0xffffffff;
+        uint64_t state = state_.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            if ((state >> 32) != sec) {
+                next = (sec << 32) | 1;
+            }
+            else if ((state & 0xffffffff) < n) {
+                next = state + 1;
+            }
+            else {
+                suppressed_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!state_.compare_exchange_weak(state, next, std::memory_order_relaxed));
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief 每n条通过1条，第一条总是通过
+     * @param[out] suppressed 通过时返回上次通过之后被丢弃的条数
+     */
+    bool allowEvery(uint32_t n, uint64_t& suppressed)
+    {
+        if (n > 1 && state_.fetch_add(1, std::memory_order_relaxed) % n != 0) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    // allowRate: 高32位秒数，低32位这一秒已经通过的条数；allowEvery: 总条数
+    std::atomic<uint64_t> state_{0};
+    // 上次通过之后被丢弃的条数
+    std::atomic<uint64_t> suppressed_{0};
+};
+
 /**
  * @brief 输出到控制台的Appender
+ * @details 控制台只能串行输出。各线程在锁外格式化，锁内只把内容追加到队列，
+ *          由当前没有人在输出时进来的线程负责把队列写到控制台，其他线程追加完直接返回。
+ *          ERROR及以上的日志会等到自己的内容写出去再返回。
+ *          队列超过kMaxQueueBytes时写日志的线程等待，输出的线程连续写kMaxFlushBatches批后
+ *          如果有线程在等，就停下来交给等待的线程接着写
  */
 class StdoutLogAppender : public LogAppender {
 public:
     typedef std::shared_ptr<StdoutLogAppender> ptr;
     void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
     std::string toYamlString() override;
+
+private:
+    // 等待输出的内容超过这个大小时，写日志的线程等输出的线程写出去
+    static const size_t kMaxQueueBytes = 1024 * 1024;
+    // 一个线程连续输出的最多批数，之后交给等待的线程
+    static const uint32_t kMaxFlushBatches = 8;
+
+    Mutex queue_mutex_;
+    Condition flushed_cond_;
+    // 等待输出的内容
+    std::string queue_;
+    // 正在输出的内容，只有输出的线程访问
+    std::string writing_;
+    // 是否有线程正在输出
+    bool flushing_ = false;
+    // 等待队列有空间或者等自己的内容写出去的线程数
+    uint32_t waiting_ = 0;
+    // 追加到队列和已经输出的字节数
+    uint64_t queued_ = 0;
+    uint64_t flushed_ = 0;
+};
+
+/**
+ * @brief 日志文件滚动策略
+ */
+struct LogRotatePolicy {
+    /**
+     * @brief 按时间滚动的周期
+     */
+    enum Interval {
+        NONE = 0,
+        HOURLY = 1,
+        DAILY = 2
+    };
+
+    static const char* IntervalToString(Interval val);
+    static Interval IntervalFromString(const std::string& str);
+
+    /**
+     * @brief 解析带K/M/G后缀的大小，比如"100M"
+     */
+    static uint64_t SizeFromString(const std::string& str);
+
+    /**
+     * @brief 返回now之后下一次按时间滚动的时间(本地时间的整点或零点)，NONE返回0
+     */
+    static time_t NextRotateTime(time_t now, Interval interval);
+
+    bool enabled() const { return maxSize > 0 || interval != NONE;}
+
+    bool operator==(const LogRotatePolicy& oth) const
+    {
+        return maxSize == oth.maxSize && interval == oth.interval &&
+               maxFiles == oth.maxFiles && compress == oth.compress;
+    }
+
+    // 单个文件的最大字节数，0表示不按大小滚动
+    uint64_t maxSize = 0;
+    // 按时间滚动的周期
+    Interval interval = NONE;
+    // 保留的历史文件个数，0表示不限制
+    uint32_t maxFiles = 0;
+    // 历史文件是否用gzip压缩
+    bool compress = false;
 };
 
 /**
  * @brief 输出到文件的Appender
+ * @details 每条日志用一次write(2)写入当前文件，不持有锁。文件的检查、滚动、压缩和清理都在
+ *          日志的后台线程(log_timer)里做，新文件打开后原子地替换掉旧文件，写日志的线程不会被阻塞。
+ *          fork出的子进程不滚动文件，只在发现文件被移走后重新打开
  */
 class FileLogAppender : public LogAppender {
 public:
     typedef std::shared_ptr<FileLogAppender> ptr;
-    FileLogAppender(const std::string& filename);
+    FileLogAppender(const std::string& filename, const LogRotatePolicy& policy = LogRotatePolicy());
+    ~FileLogAppender();
     void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
     std::string toYamlString() override;
 
     /**
      * @brief 重新打开日志文件
      * @return 成功返回true
+     * @note 会等正在写旧文件的线程写完，不能在写日志的过程中调用
      */
     bool reopen();
+
+    /**
+     * @brief 立即滚动日志文件：重命名当前文件、打开新文件，按策略压缩和清理历史文件
+     * @details fork出的子进程要等后台线程发现文件被移走后才重新打开，在此之前还在写旧文件，
+     *          压缩和清理推迟到所有进程都重新打开之后由后台线程执行。
+     *          Appender析构时还没到时间的历史文件不再压缩，保留原文件
+     * @return 成功返回true
+     * @note 同reopen，不能在写日志的过程中调用
+     */
+    bool rotate();
+
+    /**
+     * @brief 由后台线程调用，检查文件是否被移走，是否需要滚动
+     */
+    void onTimer(time_t now) override;
+
+    const LogRotatePolicy& getPolicy() const { return policy_;}
+
+    /**
+     * @brief 返回当前文件打开时的大小加上当前进程写入的字节数，不包括fork出的其他进程写入的
+     */
+    uint64_t getFileSize() const { return fileSize_;}
+
+private:
+    /**
+     * @brief 打开的日志文件，析构时关闭
+     */
+    struct File {
+        File(int v) : fd(v) {}
+        ~File();
+        int fd;
+    };
+
+    /**
+     * @brief 打开文件并替换当前文件，需持有rotateMutex_
+     */
+    bool openLocked();
+
+    /**
+     * @brief 删除超过保留个数的历史文件
+     */
+    void removeOldFiles();
+
+    /**
+     * @brief 压缩到时间的历史文件，再删除超过保留个数的历史文件，需持有rotateMutex_
+     */
+    void finishRotateLocked(time_t now);
+
 private:
     // 文件路径
     std::string filename_;
-    // 文件流
-    std::ofstream filestream_;
-    // 上次重新打开时间
-    uint64_t lastTime_ = 0;
+    // 滚动策略
+    LogRotatePolicy policy_;
+    // 当前文件，写日志时在Rcu读区间内读取，替换后等正在写的线程写完再关闭
+    RcuPtr<File> file_;
+    // 当前文件的大小
+    std::atomic<uint64_t> fileSize_{0};
+    // 下一次按时间滚动的时间
+    time_t nextRotate_ = 0;
+    // 上次检查文件是否被移走的时间
+    time_t lastCheck_ = 0;
+    // 创建Appender的进程，只有它按策略滚动文件
+    pid_t pid_ = 0;
+    // 滚动出的历史文件和可以压缩、清理的时间
+    std::list<std::pair<time_t, std::string>> pending_;
+    // 滚动和重新打开互斥，只在后台线程和手动调用时使用
+    Mutex rotateMutex_;
 };
 
 /**
@@ -615,6 +1273,11 @@ public:
      * @brief 将所有的日志器配置转成YAML String
      */
     std::string toYamlString();
+
+    /**
+     * @brief 刷新所有日志器的Appender，进程不经过析构直接退出(_exit)之前调用
+     */
+    void flush();
 private:
     // Mutex
     MutexType mutex_;
@@ -0,0 +1,354 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-18 14:52:09
+ * @Description: 运行时指标：计数器、仪表和直方图，可以导出为Prometheus文本格式
+ */
+
+#include "metrics.h"
+
+#include "config.h"
+#include "log.h"
+
+#include <cmath>
+#include <sstream>
+
+namespace hiper {
+
+static hiper::Logger::ptr g_logger = LOG_NAME("system");
+
+static hiper::ConfigVar<bool>::ptr g_metrics_enable =
+    hiper::Config::Lookup("metrics.enable", true, "record latency metrics on hot paths");
+
+static bool s_metrics_enable = true;
+
+struct _MetricsIniter
+{
+    _MetricsIniter()
+    {
+        s_metrics_enable = g_metrics_enable->getValue();
+        g_metrics_enable->addListener(
+            [](const bool& old_value, const bool& new_value) { s_metrics_enable = new_value; });
+    }
+};
+
+static _MetricsIniter s_metrics_initer;
+
+static std::atomic<size_t> s_next_shard{0};
+
+size_t MetricShard()
+{
+    static thread_local size_t t_shard = s_next_shard++ % kMetricShards;
+    return t_shard;
+}
+
+Metric::Metric(const std::string& name, const std::string& help, const std::string& labels)
+    : name_(name)
+    , help_(help)
+    , labels_(labels)
+{}
+
+const char* Metric::TypeToString(Type type)
+{
+    switch (type) {
+    case COUNTER: return "counter";
+    case GAUGE: return "gauge";
+    case HISTOGRAM: return "histogram";
+    }
+    return "untyped";
+}
+
+void Metric::writeName(std::ostream& os, const char* suffix, const std::string& extra) const
+{
+    os << name_ << suffix;
+    if (labels_.empty() && extra.empty()) {
+        return;
+    }
+    os << "{" << labels_;
+    if (!labels_.empty() && !extra.empty()) {
+        os << ",";
+    }
+    os << extra << "}";
+}
+
+Counter::Counter(const std::string& name, const std::string& help, const std::string& labels)
+    : Metric(name, help, labels)
+{}
+
+uint64_t Counter::getValue() const
+{
+    uint64_t v = 0;
+    for (auto& s : shards_) {
+        v += s.value.load(std::memory_order_relaxed);
+    }
+    return v;
+}
+
+void Counter::writePrometheus(std::ostream& os) const
+{
+    writeName(os);
+    os << " " << getValue() << "\n";
+}
+
+Gauge::Gauge(const std::string& name, const std::string& help, const std::string& labels,
+             Callback cb)
+    : Metric(name, help, labels)
+    , cb_(cb)
+{}
+
+int64_t Gauge::getValue() const
+{
+    RWMutex::ReadLock lock(mutex_);
+    return cb_ ? cb_() : value_.load(std::memory_order_relaxed);
+}
+
+void Gauge::detach()
+{
+    RWMutex::WriteLock lock(mutex_);
+    cb_ = nullptr;
+}
+
+void Gauge::writePrometheus(std::ostream& os) const
+{
+    writeName(os);
+    os << " " << getValue() << "\n";
+}
+
+Histogram::Shard::Shard()
+{
+    for (auto& b : buckets) {
+        b.store(0, std::memory_order_relaxed);
+    }
+}
+
+Histogram::Histogram(const std::string& name, const std::string& help, const std::string& labels)
+    : Metric(name, help, labels)
+    , shards_(new Shard[kMetricShards])
+{}
+
+uint64_t Histogram::BucketUpperBound(size_t idx)
+{
+    if (idx < 8) {
+        return idx;
+    }
+    int      e     = idx / 8 + 2;
+    uint64_t lower = (8 + idx % 8) << (e - 3);
+    return lower + (1ull << (e - 3)) - 1;
+}
+
+uint64_t Histogram::Snapshot::percentile(double q) const
+{
+    if (!count) {
+        return 0;
+    }
+    uint64_t target = std::max((uint64_t)1, (uint64_t)std::ceil(q * count));
+    uint64_t acc    = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        acc += buckets[i];
+        if (acc >= target) {
+            return std::min(BucketUpperBound(i), max);
+        }
+    }
+    return max;
+}
+
+Histogram::Snapshot Histogram::getSnapshot() const
+{
+    Snapshot snap;
+    snap.buckets.resize(kBuckets);
+    for (size_t i = 0; i < kMetricShards; ++i) {
+        const Shard& s = shards_[i];
+        for (size_t j = 0; j < kBuckets; ++j) {
+            uint64_t n = s.buckets[j].load(std::memory_order_relaxed);
+            snap.buckets[j] += n;
+            snap.count += n;
+        }
+        snap.sum += s.sum.load(std::memory_order_relaxed);
+        snap.max = std::max(snap.max, s.max.load(std::memory_order_relaxed));
+    }
+    return snap;
+}
+
+void Histogram::writePrometheus(std::ostream& os) const
+{
+    Snapshot snap = getSnapshot();
+    uint64_t acc  = 0;
+    size_t   idx  = 0;
+    // le = 2^k - 1，与分桶的边界对齐，累计值是精确的
+    for (int k = 0; k < 64; ++k) {
+        uint64_t le = (1ull << k) - 1;
+        while (idx < kBuckets && BucketUpperBound(idx) <= le) {
+            acc += snap.buckets[idx++];
+        }
+        writeName(os, "_bucket", "le=\"" + std::to_string(le) + "\"");
+        os << " " << acc << "\n";
+        if (le >= snap.max) {
+            break;
+        }
+    }
+    writeName(os, "_bucket", "le=\"+Inf\"");
+    os << " " << snap.count << "\n";
+    writeName(os, "_sum");
+    os << " " << snap.sum << "\n";
+    writeName(os, "_count");
+    os << " " << snap.count << "\n";
+}
+
+Metric::ptr MetricsRegistry::getOrAdd(const std::string& name, const std::string& labels,
+                                      Metric::Type type, std::function<Metric::ptr()> creator)
+{
+    {
+        RWMutexType::ReadLock lock(mutex_);
+        auto                  it = datas_.find(name);
+        if (it != datas_.end()) {
+            auto iit = it->second.find(labels);
+            if (iit != it->second.end() && iit->second->getType() == type) {
+                return iit->second;
+            }
+        }
+    }
+
+    RWMutexType::WriteLock lock(mutex_);
+    auto&                  family = datas_[name];
+    if (!family.empty() && family.begin()->second->getType() != type) {
+        LOG_ERROR(g_logger) << "metric " << name << " type "
+                            << Metric::TypeToString(family.begin()->second->getType())
+                            << " conflicts with " << Metric::TypeToString(type);
+        return creator();
+    }
+    auto& m = family[labels];
+    if (!m) {
+        m = creator();
+    }
+    return m;
+}
+
+Counter::ptr MetricsRegistry::counter(const std::string& name, const std::string& help,
+                                      const std::string& labels)
+{
+    return std::static_pointer_cast<Counter>(getOrAdd(name, labels, Metric::COUNTER, [&]() {
+        return std::make_shared<Counter>(name, help, labels);
+    }));
+}
+
+Gauge::ptr MetricsRegistry::gauge(const std::string& name, const std::string& help,
+                                  const std::string& labels)
+{
+    return std::static_pointer_cast<Gauge>(getOrAdd(
+        name, labels, Metric::GAUGE, [&]() { return std::make_shared<Gauge>(name, help, labels); }));
+}
+
+Gauge::ptr MetricsRegistry::gauge(const std::string& name, Gauge::Callback cb,
+                                  const std::string& help, const std::string& labels)
+{
+    Gauge::ptr g = std::make_shared<Gauge>(name, help, labels, cb);
+
+    RWMutexType::WriteLock lock(mutex_);
+    auto&                  family = datas_[name];
+    if (!family.empty() && family.begin()->second->getType() != Metric::GAUGE) {
+        LOG_ERROR(g_logger) << "metric " << name << " type "
+                            << Metric::TypeToString(family.begin()->second->getType())
+                            << " conflicts with gauge";
+        return g;
+    }
+    family[labels] = g;
+    return g;
+}
+
+Histogram::ptr MetricsRegistry::histogram(const std::string& name, const std::string& help,
+                                          const std::string& labels)
+{
+    return std::static_pointer_cast<Histogram>(getOrAdd(name, labels, Metric::HISTOGRAM, [&]() {
+        return std::make_shared<Histogram>(name, help, labels);
+    }));
+}
+
+void MetricsRegistry::remove(const std::string& name, const std::string& labels)
+{
+    RWMutexType::WriteLock lock(mutex_);
+    auto                   it = datas_.find(name);
+    if (it == datas_.end()) {
+        return;
+    }
+    it->second.erase(labels);
+    if (it->second.empty()) {
+        datas_.erase(it);
+    }
+}
+
+void MetricsRegistry::remove(const Metric::ptr& metric)
+{
+    {
+        RWMutexType::WriteLock lock(mutex_);
+        auto                   it = datas_.find(metric->getName());
+        if (it != datas_.end()) {
+            auto iit = it->second.find(metric->getLabels());
+            if (iit != it->second.end() && iit->second == metric) {
+                it->second.erase(iit);
+                if (it->second.empty()) {
+                    datas_.erase(it);
+                }
+            }
+        }
+    }
+    if (metric->getType() == Metric::GAUGE) {
+        std::static_pointer_cast<Gauge>(metric)->detach();
+    }
+}
+
+uint64_t MetricsRegistry::NextInstanceId()
+{
+    static std::atomic<uint64_t> s_instance_id{0};
+    return ++s_instance_id;
+}
+
+Metric::ptr MetricsRegistry::get(const std::string& name, const std::string& labels)
+{
+    RWMutexType::ReadLock lock(mutex_);
+    auto                  it = datas_.find(name);
+    if (it == datas_.end()) {
+        return nullptr;
+    }
+    auto iit = it->second.find(labels);
+    return iit == it->second.end() ? nullptr : iit->second;
+}
+
+void MetricsRegistry::visit(std::function<void(Metric::ptr)> cb)
+{
+    std::vector<Metric::ptr> metrics;
+    {
+        RWMutexType::ReadLock lock(mutex_);
+        for (auto& i : datas_) {
+            for (auto& j : i.second) {
+                metrics.push_back(j.second);
+            }
+        }
+    }
+    // 回调仪表可能访问其他对象的锁，不在注册表的锁内调用
+    for (auto& i : metrics) {
+        cb(i);
+    }
+}
+
+std::string MetricsRegistry::toPrometheus()
+{
+    std::stringstream ss;
+    std::string       last;
+    visit([&ss, &last](Metric::ptr m) {
+        if (m->getName() != last) {
+            last = m->getName();
+            if (!m->getHelp().empty()) {
+                ss << "# HELP " << m->getName() << " " << m->getHelp() << "\n";
+            }
+            ss << "# TYPE " << m->getName() << " " << Metric::TypeToString(m->getType()) << "\n";
+        }
+        m->writePrometheus(ss);
+    });
+    return ss.str();
+}
+
+bool MetricsRegistry::IsEnabled()
+{
+    return s_metrics_enable;
+}
+
+}   // namespace hiper
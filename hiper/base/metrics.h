@@ -0,0 +1,295 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-18 14:10:25
+ * @Description: 运行时指标：计数器、仪表和直方图，可以导出为Prometheus文本格式
+ */
+
+#ifndef HIPER_METRICS_H
+#define HIPER_METRICS_H
+
+#include "mutex.h"
+#include "noncopyable.h"
+#include "singleton.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace hiper {
+
+/**
+ * @brief 指标基类
+ * @details 指标由名称和标签确定，比如 hiper_scheduler_task_run_us{scheduler="io"}，
+ *          名称相同、标签不同的指标在导出时归为同一组。
+ *          记录数据时只使用线程分片的原子变量，不加锁
+ */
+class Metric : public Noncopyable {
+public:
+    typedef std::shared_ptr<Metric> ptr;
+
+    enum Type
+    {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM
+    };
+
+    /**
+     * @param[in] name 指标名称
+     * @param[in] help 说明
+     * @param[in] labels 标签，格式为 key="value",key2="value2"
+     */
+    Metric(const std::string& name, const std::string& help, const std::string& labels);
+
+    virtual ~Metric() {}
+
+    const std::string& getName() const { return name_; }
+    const std::string& getHelp() const { return help_; }
+    const std::string& getLabels() const { return labels_; }
+
+    virtual Type getType() const = 0;
+
+    /**
+     * @brief 输出Prometheus格式的样本行，不包括HELP和TYPE
+     */
+    virtual void writePrometheus(std::ostream& os) const = 0;
+
+    static const char* TypeToString(Type type);
+
+protected:
+    // 输出 name{labels,extra} ，labels和extra都为空时不输出大括号
+    void writeName(std::ostream& os, const char* suffix = "", const std::string& extra = "") const;
+
+protected:
+    std::string name_;
+    std::string help_;
+    std::string labels_;
+};
+
+/**
+ * @brief 当前线程使用的分片下标
+ * @details 线程第一次调用时按顺序分配，不同线程尽量落在不同的缓存行上
+ */
+size_t MetricShard();
+
+// 每个指标的分片数
+static constexpr size_t kMetricShards = 8;
+
+/**
+ * @brief 只增计数器
+ */
+class Counter : public Metric {
+public:
+    typedef std::shared_ptr<Counter> ptr;
+
+    Counter(const std::string& name, const std::string& help = "", const std::string& labels = "");
+
+    void add(uint64_t v = 1) { shards_[MetricShard()].value.fetch_add(v, std::memory_order_relaxed); }
+
+    uint64_t getValue() const;
+
+    Type getType() const override { return COUNTER; }
+
+    void writePrometheus(std::ostream& os) const override;
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> value = {0};
+    };
+    Shard shards_[kMetricShards];
+};
+
+/**
+ * @brief 可增可减的当前值
+ * @details 设置了回调时导出的是回调的返回值，用于队列长度这类已经由对象自己维护的数值。
+ *          回调在读锁内调用，detach取写锁，返回后回调不会再被调用
+ */
+class Gauge : public Metric {
+public:
+    typedef std::shared_ptr<Gauge> ptr;
+    typedef std::function<int64_t()> Callback;
+
+    Gauge(const std::string& name, const std::string& help = "", const std::string& labels = "",
+          Callback cb = nullptr);
+
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+
+    void add(int64_t v) { value_.fetch_add(v, std::memory_order_relaxed); }
+
+    int64_t getValue() const;
+
+    /**
+     * @brief 解除回调，等待正在执行的回调结束，之后导出set设置的值
+     */
+    void detach();
+
+    Type getType() const override { return GAUGE; }
+
+    void writePrometheus(std::ostream& os) const override;
+
+private:
+    std::atomic<int64_t> value_ = {0};
+    mutable RWMutex      mutex_;
+    Callback             cb_;
+};
+
+/**
+ * @brief 直方图
+ * @details HDR风格的对数线性分桶：小于8的值每个值一个桶，之后每个2的幂区间再均分为8个桶，
+ *          相对误差不超过12.5%，覆盖整个uint64_t范围。记录时只操作当前线程分片上的原子变量
+ */
+class Histogram : public Metric {
+public:
+    typedef std::shared_ptr<Histogram> ptr;
+
+    // 桶的个数
+    static constexpr size_t kBuckets = 496;
+
+    /**
+     * @brief 合并所有分片后的数据
+     */
+    struct Snapshot
+    {
+        uint64_t              count = 0;
+        uint64_t              sum   = 0;
+        uint64_t              max   = 0;
+        std::vector<uint64_t> buckets;
+
+        /**
+         * @brief 分位数，返回所在桶的上界
+         * @param[in] q 0到1之间，比如0.99
+         */
+        uint64_t percentile(double q) const;
+
+        uint64_t mean() const { return count ? sum / count : 0; }
+    };
+
+    Histogram(const std::string& name, const std::string& help = "",
+              const std::string& labels = "");
+
+    void record(uint64_t v)
+    {
+        Shard& s = shards_[MetricShard()];
+        s.buckets[BucketIndex(v)].fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(v, std::memory_order_relaxed);
+        uint64_t cur = s.max.load(std::memory_order_relaxed);
+        while (v > cur && !s.max.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+        }
+    }
+
+    Snapshot getSnapshot() const;
+
+    Type getType() const override { return HISTOGRAM; }
+
+    /**
+     * @brief 按2的幂输出累计的桶，le为2^k-1，到最大值所在的区间为止
+     */
+    void writePrometheus(std::ostream& os) const override;
+
+    static size_t BucketIndex(uint64_t v)
+    {
+        if (v < 8) {
+            return v;
+        }
+        int e = 63 - __builtin_clzll(v);
+        return (e - 2) * 8 + ((v >> (e - 3)) & 7);
+    }
+
+    // 桶中的最大值
+    static uint64_t BucketUpperBound(size_t idx);
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> buckets[kBuckets];
+        std::atomic<uint64_t> sum = {0};
+        std::atomic<uint64_t> max = {0};
+
+        Shard();
+    };
+    std::unique_ptr<Shard[]> shards_;
+};
+
+/**
+ * @brief 指标注册表
+ * @details 按名称和标签查找或创建指标，查找时加锁，调用方应该保存返回的指针，不在热路径上查找。
+ *          同名的回调仪表重复注册时替换旧的回调
+ */
+class MetricsRegistry : public Noncopyable {
+public:
+    typedef RWMutex RWMutexType;
+
+    Counter::ptr counter(const std::string& name, const std::string& help = "",
+                         const std::string& labels = "");
+
+    Gauge::ptr gauge(const std::string& name, const std::string& help = "",
+                     const std::string& labels = "");
+
+    /**
+     * @brief 注册回调仪表，导出时调用cb取值
+     * @note cb引用的对象销毁前需要用返回的指针调用remove。同一类对象可能重名时，
+     *       标签里加上NextInstanceId返回的编号，避免互相覆盖
+     */
+    Gauge::ptr gauge(const std::string& name, Gauge::Callback cb, const std::string& help = "",
+                     const std::string& labels = "");
+
+    Histogram::ptr histogram(const std::string& name, const std::string& help = "",
+                             const std::string& labels = "");
+
+    /**
+     * @brief 删除指标
+     */
+    void remove(const std::string& name, const std::string& labels = "");
+
+    /**
+     * @brief 删除指标，只有注册表中的仍然是这个指标时才删除，回调仪表同时解除回调
+     * @details 返回后回调不会再被调用，正在导出的线程持有的指针也不会再调用回调
+     */
+    void remove(const Metric::ptr& metric);
+
+    Metric::ptr get(const std::string& name, const std::string& labels = "");
+
+    /**
+     * @brief 按名称顺序遍历所有指标
+     */
+    void visit(std::function<void(Metric::ptr)> cb);
+
+    /**
+     * @brief 导出Prometheus文本格式(text/plain; version=0.0.4)
+     */
+    std::string toPrometheus();
+
+    /**
+     * @brief 是否记录耗时类的指标，对应配置metrics.enable
+     * @details 关闭后调度器、IO等热路径不再读取时钟，计数器不受影响
+     */
+    static bool IsEnabled();
+
+    /**
+     * @brief 进程内递增的实例编号，用来区分同名对象的回调仪表
+     */
+    static uint64_t NextInstanceId();
+
+private:
+    // 查找或创建，类型不一致时记录错误，返回一个不在注册表中的新指标，调用方不需要判空
+    Metric::ptr getOrAdd(const std::string& name, const std::string& labels, Metric::Type type,
+                         std::function<Metric::ptr()> creator);
+
+private:
+    RWMutexType mutex_;
+    // 名称 -> 标签 -> 指标
+    std::map<std::string, std::map<std::string, Metric::ptr>> datas_;
+};
+
+// 全局指标注册表
+typedef Singleton<MetricsRegistry> MetricsMgr;
+
+}   // namespace hiper
+
+#endif   // HIPER_METRICS_H
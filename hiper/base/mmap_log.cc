@@ -0,0 +1,296 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-26 19:40:15
+ * @Description: 崩溃安全的日志环形缓冲区
+ */
+
+#include "mmap_log.h"
+#include "config.h"
+#include "util.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace hiper {
+
+const char MmapLogAppender::kMagic[4] = {'H', 'R', 'N', 'G'};
+
+/**
+ * @brief 文件头，位于文件开头的4K里
+ */
+struct MmapLogAppender::Header
+{
+    char     magic[4];
+    uint32_t version;
+    // 环形区大小
+    uint64_t capacity;
+    // 写入的进程和它的启动时间(/proc/<pid>/stat的第22个字段)，pid被重用时启动时间不同
+    uint64_t pid;
+    uint64_t startTime;
+    // 已经预留的总字节数，对容量取模是下一条记录的位置
+    std::atomic<uint64_t> writePos;
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "atomic must be lock free");
+
+// 记录头: 位置+1(8字节) 长度(4字节) 级别(4字节)
+static const size_t kRecordHeaderSize = 16;
+
+static inline uint64_t RecordSize(uint64_t len)
+{
+    return (kRecordHeaderSize + len + 7) & ~7ull;
+}
+
+/**
+ * @brief 进程的启动时间，/proc/<pid>/stat的第22个字段(开机后的时钟滴答数)，进程不存在返回0
+ */
+static uint64_t GetProcessStartTime(pid_t pid)
+{
+    std::ifstream ifs("/proc/" + std::to_string(pid) + "/stat");
+    std::string   stat;
+    if (!std::getline(ifs, stat)) {
+        return 0;
+    }
+    // 第2个字段是带括号的进程名，可能包含空格，从右括号之后开始数
+    size_t pos = stat.rfind(')');
+    if (pos == std::string::npos) {
+        return 0;
+    }
+    std::stringstream ss(stat.substr(pos + 2));
+    std::string       field;
+    for (int i = 3; i <= 22 && ss >> field; ++i) {
+        if (i == 22) {
+            return strtoull(field.c_str(), nullptr, 10);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 写入环形缓冲区的进程是否还活着
+ * @details 只看pid会把崩溃后重用了同一个pid的新进程(比如容器里每次都是1号进程)当成原来的进程，
+ *          还要比较启动时间
+ */
+static bool IsAlive(uint64_t pid, uint64_t start_time)
+{
+    if (pid == 0 || pid > INT32_MAX) {
+        return false;
+    }
+    uint64_t now = GetProcessStartTime((pid_t)pid);
+    return now != 0 && now == start_time;
+}
+
+MmapLogAppender::MmapLogAppender(const std::string& filename, uint64_t capacity)
+    : filename_(filename)
+    , capacity_(64 * 1024)
+{
+    while (capacity_ < capacity) {
+        capacity_ <<= 1;
+    }
+    FSUtil::Mkdir(FSUtil::Dirname(filename_));
+
+    // 保留上一次的内容，进程崩溃重启后还能取出。写入的进程还活着时不是崩溃留下的，
+    // 比如重新加载配置时重建Appender，不能用它覆盖.prev
+    bool reuse = false;
+    int  fd    = open(filename_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        Header old;
+        bool   valid = pread(fd, &old, sizeof(old), 0) == (ssize_t)sizeof(old) &&
+                     memcmp(old.magic, kMagic, sizeof(kMagic)) == 0;
+        close(fd);
+        if (valid && IsAlive(old.pid, old.startTime)) {
+            // 大小不变时接着写原来的环形区，否则换一个新文件，原文件可能还映射在写入的进程里
+            reuse = old.version == kVersion && old.capacity == capacity_;
+            if (!reuse) {
+                unlink(filename_.c_str());
+            }
+        }
+        else if (valid && old.writePos.load(std::memory_order_relaxed) > 0) {
+            rename(filename_.c_str(), (filename_ + ".prev").c_str());
+        }
+    }
+
+    fd = open(filename_.c_str(), O_RDWR | O_CREAT | (reuse ? 0 : O_TRUNC) | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cout << "MmapLogAppender open " << filename_ << " error: " << strerror(errno)
+                  << std::endl;
+        return;
+    }
+    size_t size = kHeaderSize + capacity_;
+    if (ftruncate(fd, size) != 0) {
+        std::cout << "MmapLogAppender ftruncate " << filename_ << " error: " << strerror(errno)
+                  << std::endl;
+        close(fd);
+        return;
+    }
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        std::cout << "MmapLogAppender mmap " << filename_ << " error: " << strerror(errno)
+                  << std::endl;
+        return;
+    }
+
+    if (reuse) {
+        header_ = (Header*)addr;
+        ring_   = (char*)addr + kHeaderSize;
+        return;
+    }
+
+    Header* header    = new (addr) Header;
+    header->version   = kVersion;
+    header->capacity  = capacity_;
+    header->pid       = getpid();
+    header->startTime = GetProcessStartTime(getpid());
+    header->writePos.store(0, std::memory_order_relaxed);
+    // magic最后写，没有初始化完的文件不会被当成环形缓冲区
+    memcpy(header->magic, kMagic, sizeof(kMagic));
+    header_ = header;
+    ring_   = (char*)addr + kHeaderSize;
+}
+
+MmapLogAppender::~MmapLogAppender()
+{
+    if (header_) {
+        munmap(header_, kHeaderSize + capacity_);
+    }
+}
+
+void MmapLogAppender::WriteRing(char* ring, uint64_t mask, uint64_t off, const char* data,
+                                size_t len)
+{
+    off &= mask;
+    size_t first = std::min<size_t>(len, mask + 1 - off);
+    memcpy(ring + off, data, first);
+    if (first < len) {
+        memcpy(ring, data + first, len - first);
+    }
+}
+
+void MmapLogAppender::ReadRing(const char* ring, uint64_t mask, uint64_t off, char* data,
+                               size_t len)
+{
+    off &= mask;
+    size_t first = std::min<size_t>(len, mask + 1 - off);
+    memcpy(data, ring + off, first);
+    if (first < len) {
+        memcpy(data + first, ring, len - first);
+    }
+}
+
+void MmapLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event)
+{
+    if (level < level_ || HIPER_UNLIKELY(!header_)) {
+        return;
+    }
+    LogStreamBuf& buf = LogFormatter::GetThreadBuffer();
+    {
+        Rcu::ReadLock rcu;
+        LogFormatter* formatter = peekFormatter();
+        if (!formatter) {
+            return;
+        }
+        formatter->format(buf, logger, level, event);
+    }
+
+    // 单条记录最多占环形区的1/4，超过的截断
+    uint32_t len  = std::min<size_t>(buf.size(), capacity_ / 4 - kRecordHeaderSize);
+    uint64_t mask = capacity_ - 1;
+    uint64_t pos  = header_->writePos.fetch_add(RecordSize(len), std::memory_order_relaxed);
+    uint64_t off  = pos & mask;
+
+    uint32_t meta[2] = {len, (uint32_t)level};
+    WriteRing(ring_, mask, off + 8, (const char*)meta, sizeof(meta));
+    WriteRing(ring_, mask, off + kRecordHeaderSize, buf.data(), len);
+    // 内容写完再提交，进程在写的过程中崩溃时这条记录不会被取出
+    reinterpret_cast<std::atomic<uint64_t>*>(ring_ + off)
+        ->store(pos + 1, std::memory_order_release);
+}
+
+int64_t MmapLogAppender::Recover(
+    const std::string& filename, const std::function<void(LogLevel::Level, const char*, size_t)>& cb)
+{
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    Header      header;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < kHeaderSize ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+        header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0 ||
+        (uint64_t)st.st_size < kHeaderSize + header.capacity) {
+        close(fd);
+        return -1;
+    }
+    void* addr = mmap(nullptr, kHeaderSize + header.capacity, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return -1;
+    }
+
+    const Header* mapped   = (const Header*)addr;
+    const char*   ring     = (const char*)addr + kHeaderSize;
+    uint64_t      capacity = header.capacity;
+    uint64_t      mask     = capacity - 1;
+    uint64_t      end      = mapped->writePos.load(std::memory_order_acquire);
+    uint64_t      pos      = end > capacity ? end - capacity : 0;
+    int64_t       count    = 0;
+    std::string   tmp;
+    // 最近capacity字节内的记录没有被覆盖。预留了空间但还没提交的记录位置不匹配，
+    // 按8字节往后找下一条位置匹配的记录
+    while (pos + kRecordHeaderSize <= end) {
+        uint64_t off = pos & mask;
+        uint64_t tag =
+            reinterpret_cast<const std::atomic<uint64_t>*>(ring + off)->load(std::memory_order_acquire);
+        uint32_t meta[2];
+        ReadRing(ring, mask, off + 8, (char*)meta, sizeof(meta));
+        if (tag != pos + 1 || meta[0] > capacity / 4 || pos + RecordSize(meta[0]) > end) {
+            pos += 8;
+            continue;
+        }
+        uint64_t data = (off + kRecordHeaderSize) & mask;
+        if (data + meta[0] <= capacity) {
+            cb((LogLevel::Level)meta[1], ring + data, meta[0]);
+        }
+        else {
+            tmp.resize(meta[0]);
+            ReadRing(ring, mask, data, &tmp[0], meta[0]);
+            cb((LogLevel::Level)meta[1], tmp.data(), tmp.size());
+        }
+        ++count;
+        pos += RecordSize(meta[0]);
+    }
+    munmap(addr, kHeaderSize + capacity);
+    return count;
+}
+
+std::string MmapLogAppender::toYamlString()
+{
+    MutexType::Lock lock(mutex_);
+    YAML::Node      node;
+    node["type"] = "MmapLogAppender";
+    node["file"] = filename_;
+    node["size"] = capacity_;
+    if (level_ != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(level_);
+    }
+    LogFormatter::ptr formatter = getFormatter();
+    if (hasFormatter_ && formatter) {
+        node["formatter"] = formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+}   // namespace hiper
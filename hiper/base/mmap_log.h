@@ -0,0 +1,88 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-26 19:40:15
+ * @Description: 崩溃安全的日志环形缓冲区，日志写进mmap映射的文件，进程崩溃后由hiper-logcat取出
+ */
+
+#ifndef HIPER_MMAP_LOG_H
+#define HIPER_MMAP_LOG_H
+
+#include "log.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace hiper {
+
+/**
+ * @brief 写入mmap环形缓冲区的Appender
+ * @details 文件以MAP_SHARED映射，写入的内容在内核的页缓存里，进程被SIGSEGV、abort杀掉也不会丢，
+ *          只有机器掉电才会丢失没有落盘的部分。写日志时用一次fetch_add预留空间，拷贝内容后再提交记录头，
+ *          不加锁也不做系统调用，适合常开DEBUG级别，和普通的Appender挂在同一个日志器上
+ *          (日志器的级别要放到DEBUG，普通Appender用自己的级别过滤)。
+ *          缓冲区写满后覆盖最旧的记录。构造时如果文件里已经有记录，先改名为<file>.prev保留上一次的内容；
+ *          写入文件的进程还活着时(比如重新加载配置)不改名，大小不变时接着写原来的环形区。
+ *          判断是否还活着时同时比较pid和进程的启动时间，pid被崩溃后的新进程重用时仍然改名
+ *
+ *          文件格式：4K的文件头，之后是容量为2的幂的环形区。每条记录8字节对齐：
+ *          位置+1(8字节) 长度(4字节) 级别(4字节) 格式化后的日志。位置最后写入，作为提交标记
+ */
+class MmapLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<MmapLogAppender> ptr;
+
+    static const char     kMagic[4];
+    static const uint32_t kVersion = 1;
+    // 文件头大小
+    static const size_t kHeaderSize = 4096;
+
+    /**
+     * @brief 构造函数，创建并映射文件
+     * @param[in] filename 文件路径
+     * @param[in] capacity 环形区的大小，向上取整到2的幂，最小64K
+     */
+    MmapLogAppender(const std::string& filename, uint64_t capacity = 16 * 1024 * 1024);
+    ~MmapLogAppender();
+
+    void        log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+
+    /**
+     * @brief 映射是否成功
+     */
+    bool isValid() const { return header_ != nullptr; }
+
+    uint64_t getCapacity() const { return capacity_; }
+
+    /**
+     * @brief 从文件中取出还没有被覆盖的记录，按写入的顺序回调
+     * @return 记录条数，不是环形缓冲区文件返回-1
+     */
+    static int64_t Recover(const std::string&                                              filename,
+                           const std::function<void(LogLevel::Level, const char*, size_t)>& cb);
+
+private:
+    struct Header;
+
+    /**
+     * @brief 从环形区的off处写入或读取len字节，超过末尾时从头开始
+     */
+    static void WriteRing(char* ring, uint64_t mask, uint64_t off, const char* data, size_t len);
+    static void ReadRing(const char* ring, uint64_t mask, uint64_t off, char* data, size_t len);
+
+private:
+    // 文件路径
+    std::string filename_;
+    // 环形区大小
+    uint64_t capacity_;
+    // 映射的文件头
+    Header* header_ = nullptr;
+    // 环形区
+    char* ring_ = nullptr;
+};
+
+}   // namespace hiper
+
+#endif   // HIPER_MMAP_LOG_H
@@ -7,6 +7,9 @@
 
 #include "mutex.h"
 
+#include <errno.h>
+#include <time.h>
+
 namespace hiper{
 
     Semaphore::Semaphore(size_t size){
@@ -31,4 +34,16 @@ namespace hiper{
         }
     }
 
+    bool Condition::waitFor(Mutex& mutex, uint64_t ms) {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (ms % 1000) * 1000000;
+        if(ts.tv_nsec >= 1000000000) {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000;
+        }
+        return pthread_cond_timedwait(&cond_, &mutex.mutex_, &ts) != ETIMEDOUT;
+    }
+
 }
@@ -6,6 +6,7 @@
 #include <atomic>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdint.h>
 #include <stdexcept>
 
 
@@ -136,6 +137,8 @@ private:
 
 
 class Mutex : Noncopyable {
+    friend class Condition;
+
 public:
     using Lock = ScopeLock<Mutex>;
 
@@ -149,6 +152,27 @@ private:
 };
 
 
+/**
+ * @brief 条件变量，配合Mutex使用，调用wait时必须已经持有mutex
+ */
+class Condition : Noncopyable {
+public:
+    Condition() { pthread_cond_init(&cond_, nullptr); };
+    ~Condition() { pthread_cond_destroy(&cond_); };
+    void wait(Mutex& mutex) { pthread_cond_wait(&cond_, &mutex.mutex_); };
+    /**
+     * @brief 最多等待ms毫秒
+     * @return 超时返回false
+     */
+    bool waitFor(Mutex& mutex, uint64_t ms);
+    void notify() { pthread_cond_signal(&cond_); };
+    void notifyAll() { pthread_cond_broadcast(&cond_); };
+
+private:
+    pthread_cond_t cond_;
+};
+
+
 class RWMutex : Noncopyable {
 public:
     using ReadLock = RScopeLock<RWMutex>;
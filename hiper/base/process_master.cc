@@ -0,0 +1,421 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-17 10:05:18
+ * @Description: 多进程(prefork)模式，master绑定监听地址并管理worker进程
+ */
+
+#include "process_master.h"
+
+#include "config.h"
+#include "env.h"
+#include "log.h"
+#include "macro.h"
+#include "thread.h"
+#include "util.h"
+
+#include <cstring>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace hiper {
+
+static hiper::Logger::ptr g_logger = LOG_NAME("system");
+
+static hiper::ConfigVar<uint32_t>::ptr g_process_worker_num = hiper::Config::Lookup(
+    "process.worker_num", (uint32_t)0, "prefork worker process num, 0 means single process");
+static hiper::ConfigVar<bool>::ptr g_process_reuse_port = hiper::Config::Lookup(
+    "process.reuse_port", false, "each worker listens with its own SO_REUSEPORT socket");
+static hiper::ConfigVar<uint32_t>::ptr g_process_restart_interval = hiper::Config::Lookup(
+    "process.restart_interval", (uint32_t)1000, "delay in ms before restarting a crashed worker");
+static hiper::ConfigVar<uint32_t>::ptr g_process_stop_timeout = hiper::Config::Lookup(
+    "process.stop_timeout", (uint32_t)5000,
+    "ms to wait for workers to exit after drain_timeout before SIGKILL");
+static hiper::ConfigVar<uint32_t>::ptr g_process_drain_timeout = hiper::Config::Lookup(
+    "process.drain_timeout", (uint32_t)3000,
+    "ms a worker waits for connections to finish after SIGTERM");
+
+static hiper::ConfigVar<std::vector<TcpServerConf>>::ptr g_servers_conf =
+    hiper::Config::Lookup("servers", std::vector<TcpServerConf>(), "tcp server config");
+
+static int s_worker_id = -1;
+
+/**
+ * @brief 当前进程的线程数，/proc/self/task下的目录项个数
+ */
+static size_t GetThreadCount()
+{
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir) {
+        return 0;
+    }
+    size_t  count = 0;
+    dirent* dp;
+    while ((dp = readdir(dir)) != nullptr) {
+        if (dp->d_name[0] != '.') {
+            ++count;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+static volatile sig_atomic_t s_stop   = 0;
+static volatile sig_atomic_t s_reload = 0;
+
+static void OnStopSignal(int)
+{
+    s_stop = 1;
+}
+
+static void OnReloadSignal(int)
+{
+    s_reload = 1;
+}
+
+/**
+ * @brief 设置信号处理函数，不使用SA_RESTART，让master的等待尽快返回
+ */
+static void SetSignal(int sig, void (*handler)(int))
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, nullptr);
+}
+
+static std::string StatusToString(int status)
+{
+    if (WIFEXITED(status)) {
+        return "exit code=" + std::to_string(WEXITSTATUS(status));
+    }
+    if (WIFSIGNALED(status)) {
+        return "killed by signal=" + std::to_string(WTERMSIG(status)) + "(" +
+               strsignal(WTERMSIG(status)) + ")";
+    }
+    return "status=" + std::to_string(status);
+}
+
+/**
+ * @brief master通知worker退出后，到发送SIGKILL之前的等待时间(毫秒)
+ */
+static uint64_t GetKillTimeout()
+{
+    return (uint64_t)g_process_drain_timeout->getValue() + g_process_stop_timeout->getValue();
+}
+
+ProcessMaster::ProcessMaster(uint32_t worker_num)
+    : worker_num_(worker_num ? worker_num : g_process_worker_num->getValue())
+    , reuse_port_(g_process_reuse_port->getValue())
+{}
+
+int ProcessMaster::GetWorkerId()
+{
+    return s_worker_id;
+}
+
+bool ProcessMaster::bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails)
+{
+    std::vector<Socket::ptr> socks;
+    for (auto& addr : addrs) {
+        Socket::ptr sock = Socket::CreateTCP(addr);
+        // reuse_port模式下master只占住端口，不listen就不会分到连接
+        bool reuse_port = reuse_port_ && worker_num_ && addr->getFamily() != AF_UNIX;
+        if (reuse_port && !sock->setReusePort(true)) {
+            fails.push_back(addr);
+            continue;
+        }
+        if (!sock->bind(addr)) {
+            LOG_ERROR(g_logger) << "bind fail errno=" << errno << " errstr=" << strerror(errno)
+                                << " addr=[" << addr->toString() << "]";
+            fails.push_back(addr);
+            continue;
+        }
+        if (!reuse_port && !sock->listen()) {
+            LOG_ERROR(g_logger) << "listen fail errno=" << errno << " errstr=" << strerror(errno)
+                                << " addr=[" << addr->toString() << "]";
+            fails.push_back(addr);
+            continue;
+        }
+        socks.push_back(sock);
+    }
+    if (!fails.empty()) {
+        return false;
+    }
+    for (auto& i : socks) {
+        LOG_INFO(g_logger) << "master bind success: " << *i;
+    }
+    sockets_.push_back(socks);
+    return true;
+}
+
+bool ProcessMaster::bindConfig()
+{
+    auto confs = g_servers_conf->getValue();
+    for (auto& conf : confs) {
+        std::vector<Address::ptr> addrs;
+        for (auto& a : conf.address) {
+            if (!a.empty() && a[0] == '/') {
+                addrs.push_back(Address::ptr(new UnixAddress(a)));
+                continue;
+            }
+            Address::ptr addr = Address::LookupAny(a);
+            if (!addr) {
+                LOG_ERROR(g_logger) << "invalid server address: " << a;
+                return false;
+            }
+            addrs.push_back(addr);
+        }
+        std::vector<Address::ptr> fails;
+        if (!bind(addrs, fails)) {
+            return false;
+        }
+        confs_.push_back(conf);
+    }
+    return true;
+}
+
+const std::vector<Socket::ptr>& ProcessMaster::getSockets(size_t index) const
+{
+    static const std::vector<Socket::ptr> s_empty;
+    return index < sockets_.size() ? sockets_[index] : s_empty;
+}
+
+int ProcessMaster::run(WorkerFunc cb)
+{
+    if (!worker_num_) {
+        return cb();
+    }
+
+    s_stop      = 0;
+    s_reload    = 0;
+    master_pid_ = getpid();
+    SetSignal(SIGTERM, OnStopSignal);
+    SetSignal(SIGINT, OnStopSignal);
+    SetSignal(SIGHUP, OnReloadSignal);
+
+    LOG_INFO(g_logger) << "master start pid=" << getpid() << " workers=" << worker_num_
+                       << " reuse_port=" << reuse_port_;
+    for (uint32_t i = 0; i < worker_num_; ++i) {
+        spawn(i, cb);
+    }
+
+    while (!s_stop) {
+        if (s_reload) {
+            s_reload = 0;
+            Config::LoadFromConfDir(EnvMgr::GetInstance()->getConfigPath());
+            // 逐个重启，任何时刻最多只有一个worker不在服务
+            reload_queue_.clear();
+            for (auto& i : workers_) {
+                reload_queue_.push_back(i.second);
+            }
+            LOG_INFO(g_logger) << "master reload config, restart workers=" << reload_queue_.size();
+        }
+        if (reloading_ < 0 && !reload_queue_.empty()) {
+            reloading_ = reload_queue_.back();
+            reload_queue_.pop_back();
+            reload_deadline_ = GetElapsedMS() + GetKillTimeout();
+            for (auto& i : workers_) {
+                if (i.second == reloading_) {
+                    kill(i.first, SIGTERM);
+                    break;
+                }
+            }
+        }
+
+        reap();
+
+        // worker在drain_timeout内没有结束连接处理，强制结束，由reap按重新加载处理
+        if (reloading_ >= 0 && reload_deadline_ && GetElapsedMS() >= reload_deadline_) {
+            reload_deadline_ = 0;
+            for (auto& i : workers_) {
+                if (i.second == reloading_) {
+                    LOG_WARN(g_logger) << "worker=" << i.second << " pid=" << i.first
+                                       << " reload stop timeout, SIGKILL";
+                    kill(i.first, SIGKILL);
+                    break;
+                }
+            }
+        }
+
+        uint64_t now = GetElapsedMS();
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            if (it->second <= now) {
+                int id = it->first;
+                it     = pending_.erase(it);
+                spawn(id, cb);
+            }
+            else {
+                ++it;
+            }
+        }
+        usleep(50 * 1000);
+    }
+
+    stopWorkers();
+    LOG_INFO(g_logger) << "master stop pid=" << getpid() << " restarts=" << restart_count_;
+    return 0;
+}
+
+bool ProcessMaster::spawn(int id, const WorkerFunc& cb)
+{
+    // 其他线程不会被复制到worker，持有的锁却保持原样，线程数变化时提示一次
+    static size_t s_warned_threads = 1;
+    size_t        threads          = GetThreadCount();
+    if (threads > 1 && threads != s_warned_threads) {
+        s_warned_threads = threads;
+        LOG_WARN(g_logger) << "master fork worker with threads=" << threads
+                           << ", threads started before ProcessMaster::run are not copied";
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERROR(g_logger) << "fork worker=" << id << " errno=" << errno
+                            << " errstr=" << strerror(errno);
+        pending_[id] = GetElapsedMS() + g_process_restart_interval->getValue();
+        return false;
+    }
+    if (pid == 0) {
+        runWorker(id, cb);
+    }
+    workers_[pid] = id;
+    if (reloading_ == id) {
+        reloading_       = -1;
+        reload_deadline_ = 0;
+    }
+    LOG_INFO(g_logger) << "spawn worker=" << id << " pid=" << pid;
+    return true;
+}
+
+void ProcessMaster::runWorker(int id, const WorkerFunc& cb)
+{
+    SetSignal(SIGTERM, SIG_DFL);
+    SetSignal(SIGINT, SIG_DFL);
+    SetSignal(SIGHUP, SIG_DFL);
+    // SIGTERM只由waitStop线程同步等待，之后创建的线程都继承这个信号掩码
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    // master退出时worker跟着退出
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    // master在prctl之前已经退出时不会再收到信号，此时worker已被其他进程收养
+    if (getppid() != master_pid_) {
+        exitWorker(1);
+    }
+
+    s_worker_id = id;
+    Thread::SetName("worker_" + std::to_string(id));
+    EnvMgr::GetInstance()->add("worker_id", std::to_string(id));
+    EnvMgr::GetInstance()->setEnv("HIPER_WORKER_ID", std::to_string(id));
+
+    if (reuse_port_) {
+        for (auto& socks : sockets_) {
+            for (auto& sock : socks) {
+                if (sock->getFamily() == AF_UNIX) {
+                    continue;
+                }
+                Address::ptr addr = sock->getLocalAddress();
+                Socket::ptr  own  = Socket::CreateTCP(addr);
+                if (!own->setReusePort(true) || !own->bind(addr) || !own->listen()) {
+                    LOG_ERROR(g_logger) << "worker=" << id << " listen fail addr=["
+                                        << addr->toString() << "] errno=" << errno
+                                        << " errstr=" << strerror(errno);
+                    exitWorker(1);
+                }
+                sock->close();
+                sock = own;
+            }
+        }
+    }
+    workers_.clear();
+    pending_.clear();
+    reload_queue_.clear();
+
+    stop_thread_.reset(
+        new Thread(std::bind(&ProcessMaster::waitStop, this), "worker_stop_" + std::to_string(id)));
+    exitWorker(cb());
+}
+
+void ProcessMaster::waitStop()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    int sig = 0;
+    while (sigwait(&set, &sig) != 0) {
+    }
+
+    uint32_t timeout = g_process_drain_timeout->getValue();
+    LOG_INFO(g_logger) << "worker=" << s_worker_id << " pid=" << getpid()
+                       << " stopping, drain timeout=" << timeout;
+    // 在master发送SIGKILL之前结束正在处理的连接，而不是直接被信号杀死让对端收到RST
+    TcpServer::DrainAll(timeout);
+    exitWorker(0);
+}
+
+void ProcessMaster::exitWorker(int code)
+{
+    // 不走exit：atexit和静态对象的析构是从master继承来的，其中的Appender、线程对象都不属于worker
+    LoggerMgr::GetInstance()->flush();
+    ::_exit(code);
+}
+
+void ProcessMaster::reap()
+{
+    int   status = 0;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto it = workers_.find(pid);
+        if (it == workers_.end()) {
+            continue;
+        }
+        int id = it->second;
+        workers_.erase(it);
+        ++restart_count_;
+        if (id == reloading_) {
+            LOG_INFO(g_logger) << "worker=" << id << " pid=" << pid << " exit for reload, "
+                               << StatusToString(status);
+            pending_[id] = 0;
+        }
+        else {
+            // 异常退出的worker延迟一段时间再拉起，避免启动即崩溃时不停fork
+            LOG_ERROR(g_logger) << "worker=" << id << " pid=" << pid << " died, "
+                                << StatusToString(status) << ", restart in "
+                                << g_process_restart_interval->getValue() << "ms";
+            pending_[id] = GetElapsedMS() + g_process_restart_interval->getValue();
+        }
+    }
+}
+
+void ProcessMaster::stopWorkers()
+{
+    for (auto& i : workers_) {
+        kill(i.first, SIGTERM);
+    }
+    uint64_t deadline = GetElapsedMS() + GetKillTimeout();
+    while (!workers_.empty() && GetElapsedMS() < deadline) {
+        int   status = 0;
+        pid_t pid    = waitpid(-1, &status, WNOHANG);
+        if (pid > 0) {
+            LOG_INFO(g_logger) << "worker=" << workers_[pid] << " pid=" << pid << " stopped, "
+                               << StatusToString(status);
+            workers_.erase(pid);
+            continue;
+        }
+        usleep(10 * 1000);
+    }
+    for (auto& i : workers_) {
+        LOG_WARN(g_logger) << "worker=" << i.second << " pid=" << i.first
+                           << " stop timeout, SIGKILL";
+        kill(i.first, SIGKILL);
+        waitpid(i.first, nullptr, 0);
+    }
+    workers_.clear();
+    pending_.clear();
+}
+
+}   // namespace hiper
@@ -0,0 +1,138 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-17 09:31:52
+ * @Description: 多进程(prefork)模式，master绑定监听地址并管理worker进程
+ */
+
+#ifndef HIPER_PROCESS_MASTER_H
+#define HIPER_PROCESS_MASTER_H
+
+#include "address.h"
+#include "noncopyable.h"
+#include "socket.h"
+#include "tcp_server.h"
+#include "thread.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace hiper {
+
+/**
+ * @brief prefork模式的master进程
+ * @details master绑定所有监听地址后fork出process.worker_num个worker进程，worker各自运行自己的IOManager，
+ *          进程之间不共享堆和锁，一个worker崩溃不影响其他worker，master负责重新拉起。
+ *          worker获取监听socket有两种方式：
+ *          1. 默认继承master的监听fd，所有worker共用一个accept队列；
+ *          2. process.reuse_port为true时，worker各自创建SO_REUSEPORT的socket，由内核在worker之间分配连接，
+ *             master只bind不listen，用来占住端口并提前发现地址错误(Unix域socket不支持，仍然继承)。
+ *          Config和Env在fork时原样复制到worker；master收到SIGHUP时重新加载配置目录，
+ *          再逐个重启worker，新的worker使用新的配置。收到SIGTERM/SIGINT时停止所有worker后返回。
+ *          worker收到SIGTERM后先对已启动的TcpServer执行drain(process.drain_timeout)再退出，
+ *          master在drain_timeout之后再等待process.stop_timeout，仍未退出的worker用SIGKILL结束
+ * @note fork之前master不能启动任何线程(IOManager、Thread等)，它们不会被复制到worker中，
+ *       持有的锁却会保持加锁状态，fork时发现master有多个线程会输出警告。
+ *       worker在回调返回后刷新日志并以_exit退出，不执行从master继承来的atexit和静态析构
+ */
+class ProcessMaster : public Noncopyable {
+public:
+    typedef std::shared_ptr<ProcessMaster> ptr;
+
+    // worker进程的入口，返回值作为进程退出码
+    typedef std::function<int()> WorkerFunc;
+
+    /**
+     * @brief 构造函数
+     * @param[in] worker_num worker进程数，0表示使用配置process.worker_num
+     */
+    ProcessMaster(uint32_t worker_num = 0);
+
+    /**
+     * @brief 绑定一组监听地址，作为一个服务
+     * @param[out] fails 绑定失败的地址
+     * @return 全部成功返回true
+     */
+    bool bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails);
+
+    /**
+     * @brief 绑定配置servers中每个服务的地址，服务的下标与配置中的顺序一致
+     */
+    bool bindConfig();
+
+    /**
+     * @brief 运行master
+     * @details worker_num为0时直接在当前进程中调用cb，相当于单进程模式
+     * @param[in] cb worker进程的入口，可以通过getSockets取得监听socket
+     * @return master的退出码；在worker中不会返回，cb返回后直接退出进程
+     */
+    int run(WorkerFunc cb);
+
+    /**
+     * @brief 返回第index个服务的监听socket
+     * @details 在worker中调用时，reuse_port模式下返回的是worker自己创建的socket
+     */
+    const std::vector<Socket::ptr>& getSockets(size_t index = 0) const;
+
+    // 服务个数
+    size_t getServerCount() const { return sockets_.size(); }
+
+    // bindConfig时读取的服务配置
+    const std::vector<TcpServerConf>& getServerConfs() const { return confs_; }
+
+    uint32_t getWorkerNum() const { return worker_num_; }
+
+    // worker被重新拉起的次数
+    uint64_t getRestartCount() const { return restart_count_; }
+
+    /**
+     * @brief 当前进程的worker编号，master或单进程模式返回-1
+     */
+    static int GetWorkerId();
+
+private:
+    // fork一个编号为id的worker
+    bool spawn(int id, const WorkerFunc& cb);
+
+    // 在worker进程中执行，准备监听socket后调用cb
+    [[noreturn]] void runWorker(int id, const WorkerFunc& cb);
+
+    // worker中等待SIGTERM的线程，收到后平滑停止服务并退出
+    void waitStop();
+
+    // 刷新日志后用_exit退出worker进程
+    [[noreturn]] void exitWorker(int code);
+
+    // 处理退出的worker，需要时重新拉起
+    void reap();
+
+    // 通知所有worker退出，超时后强制结束
+    void stopWorkers();
+
+private:
+    uint32_t worker_num_;
+    bool     reuse_port_;
+    // 每个服务的监听socket，下标与bind的调用顺序一致
+    std::vector<std::vector<Socket::ptr>> sockets_;
+    std::vector<TcpServerConf>            confs_;
+    // pid -> worker编号
+    std::map<pid_t, int> workers_;
+    // worker编号 -> 需要重新拉起的时间(毫秒)
+    std::map<int, uint64_t> pending_;
+    // 重新加载配置后还没有重启的worker
+    std::vector<int> reload_queue_;
+    // 正在为重新加载配置而重启的worker
+    int reloading_ = -1;
+    // 为重新加载配置而通知退出的worker，超过这个时间(毫秒)还没有退出就强制结束
+    uint64_t reload_deadline_ = 0;
+    uint64_t restart_count_   = 0;
+    // master进程号，worker用来判断master是否在prctl之前已经退出
+    pid_t master_pid_ = 0;
+    // worker中等待SIGTERM的线程
+    Thread::ptr stop_thread_;
+};
+
+}   // namespace hiper
+
+#endif   // HIPER_PROCESS_MASTER_H
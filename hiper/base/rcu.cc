@@ -0,0 +1,163 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-11-02 21:05:37
+ * @Description: 读多写少数据的无锁读取(基于纪元的延迟释放)
+ */
+
+#include "rcu.h"
+
+#include <assert.h>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+
+namespace hiper {
+
+/**
+ * @brief 每个线程一个读者槽位，独占一个缓存行
+ * @details 槽位只增不删，线程退出后标记为空闲，由新线程复用
+ */
+struct alignas(64) RcuReader
+{
+    // 进入读区间时的纪元，0表示不在读区间内
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool>     used{false};
+    RcuReader*            next = nullptr;
+};
+
+// 全局纪元从1开始，0留给空闲的槽位
+static std::atomic<uint64_t>   s_epoch{1};
+static std::atomic<RcuReader*> s_readers{nullptr};
+static std::once_flag          s_atfork_once;
+
+/**
+ * @brief 在读区间内Retire的回调，用无锁栈保存，fork时不会有锁被别的线程持有
+ */
+struct RcuDeferred
+{
+    std::function<void()> cb;
+    RcuDeferred*          next = nullptr;
+};
+
+static std::atomic<RcuDeferred*> s_deferred{nullptr};
+
+struct ThreadReader
+{
+    RcuReader* reader = nullptr;
+    // 读区间的嵌套深度
+    uint32_t depth = 0;
+
+    ~ThreadReader()
+    {
+        if (reader) {
+            reader->epoch.store(0, std::memory_order_release);
+            reader->used.store(false, std::memory_order_release);
+            reader = nullptr;
+        }
+    }
+};
+
+static thread_local ThreadReader t_reader;
+
+/**
+ * @brief 子进程里只剩fork的线程，其他线程的槽位释放掉，否则Synchronize会一直等它们
+ */
+static void ForkChild()
+{
+    for (RcuReader* r = s_readers.load(std::memory_order_acquire); r; r = r->next) {
+        if (r != t_reader.reader) {
+            r->epoch.store(0, std::memory_order_relaxed);
+            r->used.store(false, std::memory_order_relaxed);
+        }
+    }
+}
+
+static RcuReader* AcquireReader()
+{
+    std::call_once(s_atfork_once, []() { pthread_atfork(nullptr, nullptr, &ForkChild); });
+    for (RcuReader* r = s_readers.load(std::memory_order_acquire); r; r = r->next) {
+        if (!r->used.load(std::memory_order_relaxed) &&
+            !r->used.exchange(true, std::memory_order_acquire)) {
+            return r;
+        }
+    }
+    RcuReader* r = new RcuReader;
+    r->used.store(true, std::memory_order_relaxed);
+    RcuReader* head = s_readers.load(std::memory_order_relaxed);
+    do {
+        r->next = head;
+    } while (!s_readers.compare_exchange_weak(head, r, std::memory_order_release,
+                                              std::memory_order_relaxed));
+    return r;
+}
+
+void Rcu::ReadLockEnter()
+{
+    ThreadReader& t = t_reader;
+    if (t.depth++ > 0) {
+        return;
+    }
+    if (!t.reader) {
+        t.reader = AcquireReader();
+    }
+    t.reader->epoch.store(s_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    // 槽位写入后才能读被保护的指针，和Synchronize里的屏障配对
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void Rcu::ReadLockLeave()
+{
+    ThreadReader& t = t_reader;
+    if (--t.depth == 0) {
+        t.reader->epoch.store(0, std::memory_order_release);
+    }
+}
+
+bool Rcu::InReadSection()
+{
+    return t_reader.depth > 0;
+}
+
+void Rcu::Synchronize()
+{
+    assert(!InReadSection());
+    // 替换指针之后才能读槽位，和ReadLockEnter里的屏障配对：
+    // 读者要么读到新指针，要么这里能看到它的槽位
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t target = s_epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+    for (RcuReader* r = s_readers.load(std::memory_order_acquire); r; r = r->next) {
+        while (true) {
+            uint64_t e = r->epoch.load(std::memory_order_acquire);
+            // 空闲或者在这次增加纪元之后进入的读者拿到的都是新指针
+            if (e == 0 || e >= target) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+void Rcu::Retire(std::function<void()> cb)
+{
+    if (InReadSection()) {
+        RcuDeferred* d = new RcuDeferred;
+        d->cb          = std::move(cb);
+        d->next        = s_deferred.load(std::memory_order_relaxed);
+        while (!s_deferred.compare_exchange_weak(d->next, d, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+        }
+        return;
+    }
+    // 推迟的回调在这次Synchronize之前就已经替换掉了，一起执行
+    RcuDeferred* deferred = s_deferred.exchange(nullptr, std::memory_order_acquire);
+    Synchronize();
+    cb();
+    while (deferred) {
+        RcuDeferred* next = deferred->next;
+        deferred->cb();
+        delete deferred;
+        deferred = next;
+    }
+}
+
+}   // namespace hiper
@@ -0,0 +1,96 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-11-02 21:05:37
+ * @Description: 读多写少数据的无锁读取(基于纪元的延迟释放)
+ */
+
+#ifndef HIPER_RCU_H
+#define HIPER_RCU_H
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <functional>
+
+namespace hiper {
+
+/**
+ * @brief 基于纪元的延迟释放
+ * @details 读者进入读区间时把全局纪元写到自己线程的槽位里，离开时清零，
+ *          只写本线程独占的缓存行，不加锁也不修改共享的引用计数。
+ *          写者替换指针后增加全局纪元，等所有槽位要么空闲要么是新纪元，
+ *          之后没有读者还能拿到旧指针，旧对象可以安全释放。
+ *          读区间可以嵌套，区间内不能切换协程，也不能调用Synchronize
+ */
+class Rcu {
+public:
+    /**
+     * @brief 读区间
+     */
+    class ReadLock : public Noncopyable {
+    public:
+        ReadLock() { Rcu::ReadLockEnter(); }
+        ~ReadLock() { Rcu::ReadLockLeave(); }
+    };
+
+    /**
+     * @brief 等待调用前已经进入读区间的读者全部离开
+     * @pre 当前线程不在读区间内
+     */
+    static void Synchronize();
+
+    /**
+     * @brief 等当前的读者离开后执行cb，通常用来释放被替换掉的对象
+     * @details 在读区间内调用时不能等待，cb推迟到下一次在读区间外调用Retire时执行
+     */
+    static void Retire(std::function<void()> cb);
+
+    /**
+     * @brief 当前线程是否在读区间内
+     */
+    static bool InReadSection();
+
+private:
+    static void ReadLockEnter();
+    static void ReadLockLeave();
+};
+
+/**
+ * @brief 读者无锁访问的指针，拥有指向的对象
+ * @details get()需要在Rcu::ReadLock内调用，返回的指针在读区间结束前有效；
+ *          reset()替换后等读者离开再释放旧对象，多个写者需要在外部互斥
+ */
+template <class T>
+class RcuPtr : public Noncopyable {
+public:
+    explicit RcuPtr(T* p = nullptr)
+        : ptr_(p)
+    {}
+
+    /**
+     * @brief 析构时不再有读者，直接释放
+     */
+    ~RcuPtr() { delete ptr_.load(std::memory_order_relaxed); }
+
+    T* get() const { return ptr_.load(std::memory_order_acquire); }
+
+    void reset(T* p)
+    {
+        T* old = exchange(p);
+        if (old) {
+            Rcu::Retire([old]() { delete old; });
+        }
+    }
+
+    /**
+     * @brief 替换后返回旧对象，由调用者用Rcu::Retire释放，适合持有锁时替换、锁外等待
+     */
+    T* exchange(T* p) { return ptr_.exchange(p, std::memory_order_acq_rel); }
+
+private:
+    std::atomic<T*> ptr_;
+};
+
+}   // namespace hiper
+
+#endif   // HIPER_RCU_H
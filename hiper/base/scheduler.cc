@@ -1,12 +1,32 @@
 #include "scheduler.h"
 
+#include "config.h"
 #include "log.h"
 #include "macro.h"
+#include "task_monitor.h"
+#include "util.h"
+
+#include <fstream>
+#include <map>
+#include <sstream>
 
 namespace hiper {
 
 static hiper::Logger::ptr g_logger = LOG_NAME("system");
 
+/**
+ * 调度器名称 -> 绑定的cpu，格式见CpuUtil::Resolve，比如
+ * scheduler:
+ *     affinity:
+ *         io: "2-5"
+ *         accept: "irq:eth0"
+ * 第i个线程绑定到第(i % cpu个数)个cpu上。线程的内存(协程栈、连接缓冲区)在绑定之后首次访问，
+ * 按内核默认的本地分配策略落在同一个NUMA节点上，协程栈缓存也是线程私有的
+ */
+static hiper::ConfigVar<std::map<std::string, std::string>>::ptr g_scheduler_affinity =
+    hiper::Config::Lookup("scheduler.affinity", std::map<std::string, std::string>(),
+                          "scheduler thread cpu affinity, name -> cpu spec");
+
 // 当前线程的调度器对象
 static thread_local Scheduler* t_scheduler = nullptr;
 
@@ -49,10 +69,27 @@ Scheduler::Scheduler(size_t size, bool use_cur_thread, const std::string& name)
         caller_scheduler_thread_id_ = -1;
     }
     thread_count_ = size;
+
+    std::string labels = "scheduler=\"" + name_ + "\"";
+    task_wait_us_      = MetricsMgr::GetInstance()->histogram(
+        "hiper_scheduler_task_wait_us", "time from schedule to resume", labels);
+    task_run_us_ = MetricsMgr::GetInstance()->histogram(
+        "hiper_scheduler_task_run_us", "time a task runs before it yields or ends", labels);
+    // 回调仪表引用this，标签带上实例编号，重名的调度器不会互相覆盖或删除
+    std::string gauge_labels =
+        labels + ",instance=\"" + std::to_string(MetricsRegistry::NextInstanceId()) + "\"";
+    queue_depth_ = MetricsMgr::GetInstance()->gauge(
+        "hiper_scheduler_queue_depth", [this]() { return (int64_t)getTaskCount(); },
+        "tasks waiting in the scheduler queue", gauge_labels);
+    active_threads_ = MetricsMgr::GetInstance()->gauge(
+        "hiper_scheduler_active_threads", [this]() { return (int64_t)active_thread_count_; },
+        "threads running a task", gauge_labels);
 }
 
 Scheduler::~Scheduler()
 {
+    MetricsMgr::GetInstance()->remove(queue_depth_);
+    MetricsMgr::GetInstance()->remove(active_threads_);
     HIPER_ASSERT(stopping_);
     if (GetThis() == this) {
         t_scheduler = nullptr;
@@ -81,6 +118,31 @@ Fiber* Scheduler::GetSchedulerFiber()
 }
 
 
+/**
+ * @brief 线程最近一次运行的cpu，/proc/self/task/<tid>/stat的第39个字段
+ */
+static int GetThreadCpu(int tid)
+{
+    std::ifstream ifs("/proc/self/task/" + std::to_string(tid) + "/stat");
+    std::string   stat;
+    if (!std::getline(ifs, stat)) {
+        return -1;
+    }
+    // 第2个字段是带括号的线程名，可能包含空格，从右括号之后开始数
+    size_t pos = stat.rfind(')');
+    if (pos == std::string::npos) {
+        return -1;
+    }
+    std::stringstream ss(stat.substr(pos + 2));
+    std::string       field;
+    for (int i = 3; i <= 39 && ss >> field; ++i) {
+        if (i == 39) {
+            return atoi(field.c_str());
+        }
+    }
+    return -1;
+}
+
 // 根据线程数创建若干线程，每个线程将会运行着一个调度器
 void Scheduler::start()
 {
@@ -91,11 +153,38 @@ void Scheduler::start()
     stopping_ = false;
     HIPER_ASSERT(threads_.empty());
 
+    std::vector<int> cpus;
+    auto             affinity = g_scheduler_affinity->getValue();
+    auto             it       = affinity.find(name_);
+    if (it != affinity.end()) {
+        cpus = CpuUtil::Resolve(it->second);
+        if (cpus.empty()) {
+            LOG_WARN(g_logger) << "scheduler " << name_ << " affinity [" << it->second
+                               << "] has no usable cpu, threads are not pinned";
+        }
+    }
+
+    // caller线程属于调用者，不绑定
+    placements_.clear();
+    if (caller_scheduler_thread_id_ != -1) {
+        placements_.push_back({caller_scheduler_thread_id_, -1, -1});
+    }
+
     threads_.resize(thread_count_);
     for (size_t i = 0; i < thread_count_; ++i) {
-        threads_[i].reset(
-            new Thread(std::bind(&Scheduler::run, this), name_ + "_" + std::to_string(i)));
+        int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        // 在线程中先绑定再进入调度循环，调度协程和协程栈都在绑定后分配
+        threads_[i].reset(new Thread(
+            [this, cpu]() {
+                if (cpu >= 0) {
+                    Thread::SetAffinity(cpu);
+                }
+                run();
+            },
+            name_ + "_" + std::to_string(i)));
         thread_ids_.push_back(threads_[i]->getId());
+        placements_.push_back(
+            {threads_[i]->getId(), cpu, cpu >= 0 ? CpuUtil::GetNumaNode(cpu) : -1});
     }
     lock.unlock();
 }
@@ -155,6 +244,12 @@ void Scheduler::stop()
     }
 }
 
+size_t Scheduler::getTaskCount()
+{
+    MutexType::Lock lock(mutex_);
+    return fibers_.size();
+}
+
 void Scheduler::setThis()
 {
     t_scheduler = this;
@@ -181,8 +276,10 @@ void Scheduler::run()
 
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
+    TaskMonitor::ThreadEnter(this);
 
     FiberAndThread ft;
+    bool           was_idle = false;   // 上一轮在锁内标记为空闲
     while (true) {
         // LOG_DEBUG(g_logger) << "Scheduler Run";
         ft.reset();
@@ -190,6 +287,10 @@ void Scheduler::run()
         bool is_active = false;   // 标记是否有协程被调度
         {
             MutexType::Lock lock(mutex_);
+            if (was_idle) {
+                idle_threads_.erase(hiper::GetThreadId());
+                was_idle = false;
+            }
             auto            it = fibers_.begin();
 
             while (it != fibers_.end()) {
@@ -204,29 +305,62 @@ void Scheduler::run()
                 HIPER_ASSERT(it->fiber || it->cb);
 
                 // 当前fiber处于执行状态，状态不可调度，跳过
+                // 通常是switchTo先加入队列再切出的协程，切出后需要有线程再来检查一次
                 if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
                     ++it;
+                    tickle_me = true;
                     continue;
                 }
 
                 ft = *it;
                 fibers_.erase(it++);
                 ++active_thread_count_;
+                ++executed_count_;
                 is_active = true;
                 break;
             }
             // 判断是否需要通知其他线程进行调度
             tickle_me |= it != fibers_.end();
+            // 没有可执行的任务时在锁内标记为空闲，之后加入的任务一定能看到空闲线程并发出通知，
+            // 否则在检查队列和进入idle之间加入的任务要等到epoll_wait超时才会被执行
+            if (!is_active) {
+                ++idle_thread_count_;
+                idle_threads_.insert(hiper::GetThreadId());
+                was_idle = true;
+            }
         }
 
         if (tickle_me) {
             tickle();
         }
 
+        // 记录执行时间：metrics在入队时决定，慢任务检测和profile由TaskMonitor决定
+        bool     metrics  = ft.enqueue_us != 0;
+        bool     monitor  = is_active && TaskMonitor::IsEnabled();
+        uint64_t start_us = 0;
+        if (metrics || monitor) {
+            start_us = GetElapsedUS();
+        }
+        if (metrics) {
+            task_wait_us_->record(start_us - ft.enqueue_us);
+        }
+
         if (ft.fiber &&
             (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEPT)) {
+            if (monitor) {
+                TaskMonitor::TaskBegin(ft.fiber->getId(),
+                                       ft.fiber->cb_ ? &ft.fiber->cb_.target_type() : nullptr,
+                                       start_us);
+            }
+            if (ft.thread_id != -1) {
+                ft.fiber->pin_scheduler_ = this;
+                ft.fiber->pin_thread_    = ft.thread_id;
+            }
             ft.fiber->resume();
             --active_thread_count_;
+            if (start_us) {
+                taskDone(metrics, monitor, start_us);
+            }
 
             if (ft.fiber->getState() == Fiber::READY) {
                 schedule(ft.fiber);   // 将协程放回调度队列
@@ -247,9 +381,19 @@ void Scheduler::run()
             else {
                 cb_fiber.reset(new Fiber(ft.cb));
             }
+            if (ft.thread_id != -1) {
+                cb_fiber->pin_scheduler_ = this;
+                cb_fiber->pin_thread_    = ft.thread_id;
+            }
+            if (monitor) {
+                TaskMonitor::TaskBegin(cb_fiber->getId(), &ft.cb.target_type(), start_us);
+            }
             ft.reset();
             cb_fiber->resume();
             --active_thread_count_;
+            if (start_us) {
+                taskDone(metrics, monitor, start_us);
+            }
             if (cb_fiber->getState() == Fiber::READY) {
                 schedule(cb_fiber);
                 cb_fiber.reset();
@@ -269,10 +413,15 @@ void Scheduler::run()
                 continue;
             }
             if (idle_fiber->getState() == Fiber::TERM) {
+                --idle_thread_count_;
+                {
+                    MutexType::Lock lock(mutex_);
+                    idle_threads_.erase(hiper::GetThreadId());
+                }
                 LOG_INFO(g_logger) << " idle fiber (" << idle_fiber->getId() <<") term";
+                TaskMonitor::ThreadLeave();
                 break;
             }
-            ++idle_thread_count_;
             idle_fiber->resume();
             --idle_thread_count_;
             if (idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEPT) {
@@ -282,6 +431,17 @@ void Scheduler::run()
     }
 }
 
+void Scheduler::taskDone(bool metrics, bool monitor, uint64_t start_us)
+{
+    uint64_t now = GetElapsedUS();
+    if (metrics) {
+        task_run_us_->record(now - start_us);
+    }
+    if (monitor) {
+        TaskMonitor::TaskEnd(now);
+    }
+}
+
 /**
  * @brief 类似信号量，tickle之后可以唤醒线程，让它们有机会检查 stopping_ 标志并退出循环。
  *
@@ -294,7 +454,8 @@ void Scheduler::tickle()
 bool Scheduler::stopping()
 {
     MutexType::Lock lock(mutex_);
-    return auto_stop_ && stopping_ && fibers_.empty() && active_thread_count_ == 0;
+    return auto_stop_ && stopping_ && fibers_.empty() && active_thread_count_ == 0 &&
+           external_wait_count_ == 0;
 }
 
 void Scheduler::idle()
@@ -338,6 +499,19 @@ std::ostream& Scheduler::dump(std::ostream& os)
         }
         os << thread_ids_[i];
     }
+    for (auto& p : placements_) {
+        os << std::endl << "    thread=" << p.thread_id;
+        if (p.cpu >= 0) {
+            os << " cpu=" << p.cpu << " node=" << p.node;
+        }
+        else {
+            os << " unpinned";
+        }
+        int cur = GetThreadCpu(p.thread_id);
+        if (cur >= 0) {
+            os << " last_cpu=" << cur;
+        }
+    }
     return os;
 }
 
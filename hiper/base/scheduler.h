@@ -9,9 +9,11 @@
 #define HIPER_SCHEDULER_H
 
 #include "fiber.h"
+#include "metrics.h"
 #include "mutex.h"
 #include "noncopyable.h"
 #include "thread.h"
+#include "util.h"
 
 #include <atomic>
 #include <cstddef>
@@ -19,6 +21,7 @@
 #include <list>
 #include <memory>
 #include <ostream>
+#include <unordered_set>
 #include <vector>
 
 namespace hiper {
@@ -47,7 +50,11 @@ public:
     void start();
     void stop();
 
-    // 协程调度函数
+    /**
+     * @brief 协程调度函数
+     * @param[in] thread 执行的线程，-1表示任意线程。指定了线程的任务在这个调度器中一直留在该线程上，
+     *                   之后不指定线程的调度(比如IO事件、定时器唤醒)也回到这个线程
+     */
     template<class FiberOrCb> void schedule(FiberOrCb fc, int thread = -1)
     {
         bool need_tickle = false;
@@ -82,6 +89,47 @@ public:
 
     std::ostream& dump(std::ostream& os);
 
+    // 调度线程的id，start之后有效
+    const std::vector<int>& getThreadIds() const { return thread_ids_; }
+
+    // use_caller时caller线程的id，否则为-1。caller线程只在stop中参与调度
+    int getCallerThreadId() const { return caller_scheduler_thread_id_; }
+
+    /**
+     * @brief 调度线程绑定的cpu
+     */
+    struct Placement
+    {
+        int thread_id;
+        int cpu;    // -1表示没有绑定
+        int node;   // cpu所在的NUMA节点，没有绑定时为-1
+    };
+
+    // 调度线程的位置，start之后有效，与getThreadIds的顺序一致
+    const std::vector<Placement>& getPlacements() const { return placements_; }
+
+    // 调度线程数，包括caller线程
+    size_t getThreadCount() const { return thread_ids_.size(); }
+
+    // 正在执行任务的线程数
+    size_t getActiveThreadCount() const { return active_thread_count_; }
+
+    // 空闲的线程数
+    size_t getIdleThreadCount() const { return idle_thread_count_; }
+
+    // 队列中等待执行的任务数
+    size_t getTaskCount();
+
+    // 已经开始执行的任务数，协程每次被恢复执行计一次
+    uint64_t getExecutedCount() const { return executed_count_; }
+
+    /**
+     * @brief 记录/撤销一个挂起后由调度器外部(如阻塞任务执行器)负责重新调度的协程
+     * @note 计数不为0时调度器不会停止，防止协程恢复前调度线程已经退出
+     */
+    void addExternalWait() { ++external_wait_count_; }
+    void delExternalWait() { --external_wait_count_; }
+
 protected:
     virtual void tickle();
 
@@ -101,6 +149,7 @@ private:
         Fiber::ptr            fiber;
         std::function<void()> cb;
         int                   thread_id;   // 指定协程在哪个线程上执行
+        uint64_t              enqueue_us = 0;   // 加入队列的时间，关闭metrics.enable时为0
 
         /**
          * @brief
@@ -141,18 +190,33 @@ private:
         void reset()
         {
             fiber     = nullptr;
-            cb        = nullptr;
-            thread_id = -1;
+            cb         = nullptr;
+            thread_id  = -1;
+            enqueue_us = 0;
         }
     };
 
 private:
+    // 一次执行结束后记录执行时间
+    void taskDone(bool metrics, bool monitor, uint64_t start_us);
+
     // 协程无锁调度函数，被schedule函数内部调用
     template<class FiberOrCb> bool scheduleNoLock(FiberOrCb fc, int thread)
     {
-        bool need_tickle = fibers_.empty();
-
         FiberAndThread ft(fc, thread);
+        if (thread == -1 && ft.fiber && ft.fiber->pin_scheduler_ == this) {
+            ft.thread_id = thread = ft.fiber->pin_thread_;
+        }
+
+        // 队列非空时空闲线程也可能在等：队列里只剩指定给其他线程或正在切出的协程。
+        // 这时只在能执行这个任务的线程空闲时多写一次管道：不指定线程的任务看有没有空闲线程，
+        // 指定线程的任务(比如分发到固定线程的连接)只看目标线程，目标线程忙时不用唤醒别人
+        bool need_tickle = fibers_.empty() ||
+                           (thread == -1 ? idle_thread_count_ > 0 : idle_threads_.count(thread) > 0);
+
+        if (MetricsRegistry::IsEnabled()) {
+            ft.enqueue_us = GetElapsedUS();
+        }
         if (ft.fiber || ft.cb) {
             fibers_.push_back(ft);
         }
@@ -169,9 +233,20 @@ private:
 
 protected:
     std::vector<int>    thread_ids_;
+    std::vector<Placement> placements_;
+    // 任务从加入队列到开始执行的时间，以及每次执行的时间(微秒)
+    Histogram::ptr task_wait_us_;
+    Histogram::ptr task_run_us_;
+    // 队列长度和活跃线程数的回调仪表，析构时解除
+    Gauge::ptr queue_depth_;
+    Gauge::ptr active_threads_;
     size_t              thread_count_;
     std::atomic<size_t> active_thread_count_ = {0};
     std::atomic<size_t> idle_thread_count_   = {0};
+    // 在锁内标记为空闲的线程，由mutex_保护，醒来后下一次加锁时移除
+    std::unordered_set<int> idle_threads_;
+    std::atomic<size_t> external_wait_count_ = {0};
+    std::atomic<uint64_t> executed_count_    = {0};
     bool                stopping_            = true;
     bool                auto_stop_           = false; // 方便在内部停止调度器
     int                 caller_scheduler_thread_id_         = 0;   // 主线程id
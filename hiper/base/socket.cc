@@ -1,15 +1,303 @@
 #include "socket.h"
 
+#include "arena.h"
+#include "config.h"
 #include "hiper.h"
 #include "log.h"
 #include "macro.h"
 
+#include <algorithm>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <unordered_map>
+
+// 旧版本的libc头文件中没有定义
+#ifndef UDP_SEGMENT
+#    define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#    define UDP_GRO 104
+#endif
+#ifndef SO_ZEROCOPY
+#    define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#    define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#    define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#    define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+// 内核限制一次SCM_RIGHTS最多传递的fd数量，用户态头文件中没有
+#ifndef SCM_MAX_FD
+#    define SCM_MAX_FD 253
+#endif
 
 namespace hiper {
 
 static hiper::Logger::ptr g_logger = LOG_NAME("system");
 
+static hiper::ConfigVar<uint32_t>::ptr g_zerocopy_threshold =
+    hiper::Config::Lookup("tcp.zerocopy.threshold", (uint32_t)(32 * 1024),
+                          "minimum send size that uses MSG_ZEROCOPY");
+
+static uint32_t s_zerocopy_threshold = 32 * 1024;
+
+struct _SocketIniter
+{
+    _SocketIniter()
+    {
+        s_zerocopy_threshold = g_zerocopy_threshold->getValue();
+        g_zerocopy_threshold->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            LOG_INFO(g_logger) << "tcp zerocopy threshold changed from " << old_value << " to "
+                               << new_value;
+            s_zerocopy_threshold = new_value;
+        });
+    }
+};
+
+static _SocketIniter s_socket_initer;
+
+/**
+ * @brief 读出fd错误队列中的零拷贝完成通知，从pending中删除已经完成的发送
+ * @param[out] copied 被内核退化为拷贝的发送次数
+ * @return 是否有发送被退化为拷贝
+ */
+static bool ReapZeroCopy(int fd, std::map<uint32_t, std::shared_ptr<void>>& pending,
+                         uint64_t& copied)
+{
+    bool degraded = false;
+    while (!pending.empty()) {
+        char   control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        // 错误队列的读取不会阻塞，绕过hook避免在EAGAIN时挂起协程
+        int rt = recvmsg_old(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (rt < 0) {
+            break;
+        }
+
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            sock_extended_err* serr = (sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            // [ee_info, ee_data]范围内的发送已经完成
+            uint32_t lo = serr->ee_info;
+            uint32_t hi = serr->ee_data;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                copied += hi - lo + 1;
+                degraded = true;
+            }
+            if (lo <= hi) {
+                pending.erase(pending.lower_bound(lo), pending.upper_bound(hi));
+            }
+            else {
+                // 序号回绕
+                pending.erase(pending.lower_bound(lo), pending.end());
+                pending.erase(pending.begin(), pending.upper_bound(hi));
+            }
+        }
+    }
+    return degraded;
+}
+
+/**
+ * @brief 关闭时还没有收到完成通知的零拷贝发送
+ * @details 内核只是固定了物理页，缓冲区释放后分配器会重用同一段内存，还在发送队列里的数据会被覆盖。
+ *          关闭前把socket dup一份连同缓冲区持有者放在这里，dup出来的fd以空的事件掩码边沿触发地加入
+ *          一个epoll，只在错误队列有通知或连接断开时报告。后台线程只回收被报告的fd，
+ *          全部完成(或连接断开)后关闭fd、释放缓冲区。后台线程在第一次加入时启动，fork后同样按需重新启动
+ */
+struct ZeroCopyGraveyard
+{
+    typedef std::map<uint32_t, std::shared_ptr<void>> Pending;
+
+    Mutex                            mutex;
+    std::unordered_map<int, Pending> entries;   // dup出来的fd -> 等待完成的发送
+    int                              epfd   = -1;
+    Thread*                          reaper = nullptr;
+
+    static ZeroCopyGraveyard& Get()
+    {
+        static ZeroCopyGraveyard* s_graveyard = new ZeroCopyGraveyard;
+        return *s_graveyard;
+    }
+
+    ZeroCopyGraveyard() { pthread_atfork(&ForkPrepare, &ForkParent, &ForkChild); }
+
+    void add(int fd, Pending&& pending)
+    {
+        Mutex::Lock lock(mutex);
+        if (!reaper) {
+            epfd = epoll_create1(EPOLL_CLOEXEC);
+            if (epfd >= 0) {
+                reaper = new Thread(std::bind(&ZeroCopyGraveyard::run, this, epfd), "zc_reaper");
+            }
+        }
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        // 加入时已经有通知的话epoll_ctl会立即报告一次，不会漏掉之前到达的通知
+        ev.events  = EPOLLET;
+        ev.data.fd = fd;
+        if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            // 无法等待通知时宁可一直持有缓冲区，也不能让内核发送被改写的内存
+            LOG_ERROR(g_logger) << "zerocopy graveyard fd=" << fd << " epoll errno=" << errno
+                                << " errstr=" << strerror(errno) << ", hold buffers until exit";
+        }
+        entries[fd] = std::move(pending);
+    }
+
+    void run(int fd)
+    {
+        epoll_event evs[64];
+        while (true) {
+            int n = epoll_wait(fd, evs, 64, -1);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOG_ERROR(g_logger) << "zerocopy graveyard epoll_wait errno=" << errno
+                                    << " errstr=" << strerror(errno);
+                return;
+            }
+            std::vector<std::pair<int, Pending>> done;
+            {
+                Mutex::Lock lock(mutex);
+                for (int i = 0; i < n; ++i) {
+                    auto it = entries.find(evs[i].data.fd);
+                    if (it == entries.end()) {
+                        continue;
+                    }
+                    uint64_t copied = 0;
+                    ReapZeroCopy(it->first, it->second, copied);
+                    // 连接断开时内核已经清空发送队列，剩下的通知都在错误队列里，回收一次后结束
+                    if (it->second.empty() || (evs[i].events & EPOLLHUP)) {
+                        epoll_ctl(fd, EPOLL_CTL_DEL, it->first, nullptr);
+                        done.emplace_back(it->first, std::move(it->second));
+                        entries.erase(it);
+                    }
+                }
+            }
+            // dup出来的fd不在FdManager里，直接关闭
+            for (auto& i : done) {
+                close_old(i.first);
+            }
+        }
+    }
+
+    static void ForkPrepare() { Get().mutex.lock(); }
+
+    static void ForkParent() { Get().mutex.unlock(); }
+
+    static void ForkChild()
+    {
+        // 发送队列属于父进程，子进程里的fd副本和缓冲区副本都不需要等待，
+        // 线程对象描述的是父进程中的线程，析构时会对它调用pthread_detach，直接泄漏
+        ZeroCopyGraveyard& g = Get();
+        for (auto& i : g.entries) {
+            close_old(i.first);
+        }
+        g.entries.clear();
+        if (g.epfd >= 0) {
+            close_old(g.epfd);
+            g.epfd = -1;
+        }
+        g.reaper = nullptr;
+        g.mutex.unlock();
+    }
+};
+
+DatagramBatch::DatagramBatch(size_t capacity, size_t buffer_size)
+    : msgs_(capacity)
+    , iovs_(capacity)
+    , addrs_(capacity)
+    , buffer_(capacity * buffer_size)
+    , buffer_size_(buffer_size)
+{
+    HIPER_ASSERT(capacity > 0);
+    memset(&msgs_[0], 0, sizeof(mmsghdr) * capacity);
+    memset(&iovs_[0], 0, sizeof(iovec) * capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+        msgs_[i].msg_hdr.msg_iov    = &iovs_[i];
+        msgs_[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+bool DatagramBatch::add(const void* data, size_t length, const Address::ptr to)
+{
+    if (to) {
+        return add(data, length, to->getAddr(), to->getAddrLen());
+    }
+    return add(data, length, nullptr, 0);
+}
+
+bool DatagramBatch::add(const void* data, size_t length, const sockaddr* to, socklen_t tolen)
+{
+    if (HIPER_UNLIKELY(full() || tolen > sizeof(sockaddr_storage))) {
+        return false;
+    }
+    mmsghdr& msg = msgs_[size_];
+    iovs_[size_].iov_base = (void*)data;
+    iovs_[size_].iov_len  = length;
+    if (to) {
+        memcpy(&addrs_[size_], to, tolen);
+        msg.msg_hdr.msg_name    = &addrs_[size_];
+        msg.msg_hdr.msg_namelen = tolen;
+    }
+    else {
+        msg.msg_hdr.msg_name    = nullptr;
+        msg.msg_hdr.msg_namelen = 0;
+    }
+    msg.msg_hdr.msg_flags = 0;
+    msg.msg_len           = length;
+    ++size_;
+    return true;
+}
+
+Address::ptr DatagramBatch::getAddress(size_t i) const
+{
+    if (i >= size_ || !getAddr(i)) {
+        return nullptr;
+    }
+    return Address::Create(getAddr(i), getAddrLen(i));
+}
+
+void DatagramBatch::prepareRecv()
+{
+    size_ = 0;
+    for (size_t i = 0; i < msgs_.size(); ++i) {
+        iovs_[i].iov_base            = &buffer_[i * buffer_size_];
+        iovs_[i].iov_len             = buffer_size_;
+        msgs_[i].msg_hdr.msg_name    = &addrs_[i];
+        msgs_[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        msgs_[i].msg_hdr.msg_flags   = 0;
+        msgs_[i].msg_len             = 0;
+    }
+}
+
+void DatagramBatch::finishRecv(size_t count)
+{
+    size_ = count;
+    for (size_t i = 0; i < count; ++i) {
+        iovs_[i].iov_len = std::min((size_t)msgs_[i].msg_len, buffer_size_);
+    }
+}
+
 Socket::Socket(int family, int type, int protocol)
     : sock_(-1)
     , family_(family)
@@ -31,7 +319,7 @@ void Socket::initSocket()
     setOption(SOL_SOCKET, SO_REUSEADDR, val);
 
     // // 禁用Nagle算法,减少小包的数量,让每条链接可同时有多个未确认的小包
-    if (type_ == SOCK_STREAM) {
+    if (type_ == SOCK_STREAM && family_ != AF_UNIX) {
         setOption(IPPROTO_TCP, TCP_NODELAY, val);
     }
 }
@@ -102,6 +390,35 @@ Socket::ptr Socket::CreateUnixUDPSocket()
     return sock;
 }
 
+Socket::ptr Socket::CreateFromFd(int fd)
+{
+    int family = 0, type = 0, protocol = 0, listening = 0;
+    socklen_t len = sizeof(int);
+    if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &family, &len) ||
+        getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) ||
+        getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &len) ||
+        getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len)) {
+        LOG_ERROR(g_logger) << "CreateFromFd(" << fd << ") errno=" << errno
+                            << " errstr=" << strerror(errno);
+        return nullptr;
+    }
+    Socket::ptr sock(new Socket(family, type, protocol));
+    if (!sock->init(fd)) {
+        return nullptr;
+    }
+    // 监听socket没有对端
+    sock->is_connect_ = !listening;
+    return sock;
+}
+
+void Socket::setNonBlock()
+{
+    int flags = fcntl(sock_, F_GETFL, 0);
+    if (!(flags & O_NONBLOCK)) {
+        fcntl(sock_, F_SETFL, flags | O_NONBLOCK);
+    }
+}
+
 int64_t Socket::getSendTimeout()
 {
     FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock_);
@@ -117,7 +434,7 @@ void Socket::setSendTimeout(int64_t v)
     {
         v / 1000, (int)(v % 1000 * 1000)
     };
-    setOption(SOL_SOCKET, SO_SNDTIMEO, &tv);
+    setOption(SOL_SOCKET, SO_SNDTIMEO, tv);
 }
 
 int64_t Socket::getRecvTimeout()
@@ -165,16 +482,42 @@ bool Socket::setOption(int level, int option, const void* result, socklen_t len)
     }
 }
 
+/**
+ * @brief 是否为通配地址(0.0.0.0或::)
+ * @details 绑定在通配地址上的监听socket，accept得到的连接的本地地址各不相同，不能直接继承
+ */
+static bool IsWildcardAddress(const Address::ptr& addr)
+{
+    const sockaddr* sa = addr->getAddr();
+    if (sa->sa_family == AF_INET) {
+        return ((const sockaddr_in*)sa)->sin_addr.s_addr == htonl(INADDR_ANY);
+    }
+    if (sa->sa_family == AF_INET6) {
+        return IN6_IS_ADDR_UNSPECIFIED(&((const sockaddr_in6*)sa)->sin6_addr);
+    }
+    return false;
+}
+
 Socket::ptr Socket::accept()
 {
-    Socket::ptr sock(new Socket(family_, type_, protocol_));
-    int         newsock = ::accept(sock_, nullptr, nullptr);
+    // Socket对象和引用计数块一起从空闲链表中分配，连接关闭后归还
+    Socket::ptr sock = std::allocate_shared<Socket>(PoolAllocator<Socket>(), family_, type_, protocol_);
+    // accept4直接设置非阻塞和close-on-exec，同时拿到对端地址，省去fcntl和getpeername
+    sock->peer_addr_len_ = sizeof(sock->peer_addr_);
+    int newsock          = ::accept4(
+        sock_, (sockaddr*)&sock->peer_addr_, &sock->peer_addr_len_, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (newsock == -1) {
-        LOG_ERROR(g_logger) << "accept(" << sock_ << ") errno=" << errno
-                            << " errstr=" << strerror(errno);
+        // 非阻塞监听socket上没有连接、fd耗尽等情况由调用方处理
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EMFILE && errno != ENFILE) {
+            LOG_ERROR_LIMIT(g_logger, 10) << "accept(" << sock_ << ") errno=" << errno
+                                          << " errstr=" << strerror(errno);
+        }
         return nullptr;
     }
     if (HIPER_LIKELY(sock->init(newsock))) {
+        if (local_addr_ && !IsWildcardAddress(local_addr_)) {
+            sock->local_addr_ = local_addr_;
+        }
         return sock;
     }
     return nullptr;
@@ -182,8 +525,8 @@ Socket::ptr Socket::accept()
 
 bool Socket::init(int sock)
 {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock);
-    if (HIPER_UNLIKELY(!ctx->isSocket())) {
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock, true);
+    if (HIPER_UNLIKELY(!ctx || !ctx->isSocket())) {
         errno = EBADF;
         return false;
     }
@@ -191,16 +534,15 @@ bool Socket::init(int sock)
         errno = EBADF;
         return false;
     }
-    sock_ = sock;
+    sock_       = sock;
+    is_connect_ = true;
     initSocket();
-    getLocalAddress();
-    getRemoteAddress();
+    // 本地和远程地址在第一次使用时才创建
     return true;
 }
 
 bool Socket::bind(const Address::ptr addr)
 {
-    local_addr_ = addr;
     if (!isValid()) {
         newSocket();
         if (HIPER_UNLIKELY(!isValid())) {
@@ -230,6 +572,8 @@ bool Socket::bind(const Address::ptr addr)
         return false;
     }
 
+    // 取内核实际绑定的地址(端口为0时由内核分配)，accept得到的连接会继承它
+    local_addr_.reset();
     getLocalAddress();
     return true;
 }
@@ -298,11 +642,41 @@ bool Socket::listen(int backlog) {
     return true;
 }
 
+bool Socket::shutdown(int how)
+{
+    // close在释放fd之前要拿同一把锁，这里的sock_不会是已经关闭又被复用的fd
+    Mutex::Lock lock(close_mutex_);
+    if (sock_ == -1) {
+        return false;
+    }
+    return ::shutdown(sock_, how) == 0;
+}
+
 bool Socket::close() {
     if (!is_connect_ && sock_ == -1) {
         return true;
     }
     is_connect_ = false;
+    if (sock_ != -1 && !zerocopy_pending_.empty() && reapZeroCopy() > 0) {
+        // 缓冲区要保留到完成通知回来，关闭后就读不到错误队列了，交给dup出来的fd继续等。
+        // 原fd关闭时还有其他引用，不会发FIN，先shutdown让连接正常结束
+        int fd = fcntl_old(sock_, F_DUPFD_CLOEXEC, 0);
+        if (fd >= 0) {
+            ::shutdown(sock_, SHUT_RDWR);
+            ZeroCopyGraveyard::Get().add(fd, std::move(zerocopy_pending_));
+        }
+        else {
+            LOG_ERROR(g_logger) << "close sock=" << sock_ << " dup for zerocopy errno=" << errno
+                                << " errstr=" << strerror(errno)
+                                << ", wait for pending zerocopy sends";
+            waitZeroCopy();
+        }
+    }
+    zerocopy_pending_.clear();
+    zerocopy_state_ = 0;
+    zerocopy_seq_   = 0;
+    peer_addr_len_  = 0;
+    Mutex::Lock lock(close_mutex_);
     if (sock_ != -1) {
         ::close(sock_);
         sock_ = -1;
@@ -387,11 +761,374 @@ int Socket::recvFrom(iovec *buffers, size_t length, Address::ptr from, int flags
     return -1;
 }
 
+int Socket::sendBatch(DatagramBatch& batch, int flags)
+{
+    if (!isConnect()) {
+        return -1;
+    }
+    size_t total = batch.size();
+    size_t sent  = 0;
+    while (sent < total) {
+        int rt = ::sendmmsg(sock_, batch.getMsgs() + sent, total - sent, flags);
+        if (rt <= 0) {
+            if (sent == 0) {
+                return -1;
+            }
+            break;
+        }
+        sent += rt;
+    }
+    return sent;
+}
+
+int Socket::recvBatch(DatagramBatch& batch, int flags)
+{
+    if (!isConnect()) {
+        return -1;
+    }
+    if (HIPER_UNLIKELY(batch.getBufferSize() == 0)) {
+        LOG_ERROR(g_logger) << "recvBatch sock=" << sock_ << " batch has no receive buffer";
+        return -1;
+    }
+    batch.prepareRecv();
+    // MSG_WAITFORONE: 收到第一个数据报后不再等待，只取走已经到达的数据报
+    int rt = ::recvmmsg(sock_, batch.getMsgs(), batch.capacity(), flags | MSG_WAITFORONE, nullptr);
+    if (rt > 0) {
+        batch.finishRecv(rt);
+    }
+    return rt;
+}
+
+int Socket::sendSegments(const iovec* buffers, size_t length, const Address::ptr to,
+                         uint16_t segment_size, int flags)
+{
+    if (!isConnect()) {
+        return -1;
+    }
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    memset(control, 0, sizeof(control));
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = (iovec*)buffers;
+    msg.msg_iovlen     = length;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+    if (to) {
+        msg.msg_name    = to->getAddr();
+        msg.msg_namelen = to->getAddrLen();
+    }
+
+    cmsghdr* cm    = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type  = UDP_SEGMENT;
+    cm->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+    memcpy(CMSG_DATA(cm), &segment_size, sizeof(uint16_t));
+    return ::sendmsg(sock_, &msg, flags);
+}
+
+int Socket::recvSegments(iovec* buffers, size_t length, Address::ptr from, uint16_t& segment_size,
+                         int flags)
+{
+    if (!isConnect()) {
+        return -1;
+    }
+    char control[CMSG_SPACE(sizeof(int))];
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = buffers;
+    msg.msg_iovlen     = length;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+    if (from) {
+        msg.msg_name    = from->getAddr();
+        msg.msg_namelen = from->getAddrLen();
+    }
+
+    int rt = ::recvmsg(sock_, &msg, flags);
+    if (rt < 0) {
+        return rt;
+    }
+    // 没有GRO控制信息时报告0，单个数据报可能超过uint16_t，不能直接截断成分段大小
+    segment_size = 0;
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int gso_size = 0;
+            memcpy(&gso_size, CMSG_DATA(cm), sizeof(int));
+            segment_size = gso_size;
+            break;
+        }
+    }
+    return rt;
+}
+
+int Socket::sendFds(const int* fds, size_t count, const void* buffer, size_t length, int flags)
+{
+    if (HIPER_UNLIKELY(!isConnect() || !count || count > SCM_MAX_FD || !length)) {
+        errno = EINVAL;
+        return -1;
+    }
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * count));
+
+    iovec iov;
+    iov.iov_base = (void*)buffer;
+    iov.iov_len  = length;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = &control[0];
+    msg.msg_controllen = control.size();
+
+    cmsghdr* cm    = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type  = SCM_RIGHTS;
+    cm->cmsg_len   = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cm), fds, sizeof(int) * count);
+    return ::sendmsg(sock_, &msg, flags);
+}
+
+int Socket::recvFds(int* fds, size_t& count, void* buffer, size_t length, int flags)
+{
+    size_t capacity = count;
+    count           = 0;
+    if (HIPER_UNLIKELY(!isConnect())) {
+        return -1;
+    }
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * std::min<size_t>(capacity, SCM_MAX_FD)));
+
+    iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len  = length;
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = &control[0];
+    msg.msg_controllen = control.size();
+
+    int rt = ::recvmsg(sock_, &msg, flags | MSG_CMSG_CLOEXEC);
+    if (rt < 0) {
+        return rt;
+    }
+    for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            size_t n = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            n        = std::min(n, capacity - count);
+            memcpy(fds + count, CMSG_DATA(cm), sizeof(int) * n);
+            count += n;
+        }
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+        // 放不下的fd已经被内核关闭
+        LOG_WARN(g_logger) << "recvFds sock=" << sock_ << " control truncated, received=" << count;
+    }
+    return rt;
+}
+
+bool Socket::enableZeroCopy()
+{
+    if (zerocopy_state_ == 0) {
+        int val = 1;
+        if (setsockopt(sock_, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)) == 0) {
+            zerocopy_state_ = 1;
+        }
+        else {
+            LOG_DEBUG(g_logger) << "enable SO_ZEROCOPY failed sock=" << sock_ << " errno=" << errno
+                                << " errstr=" << strerror(errno);
+            zerocopy_state_ = -1;
+        }
+    }
+    return zerocopy_state_ == 1;
+}
+
+void Socket::addZeroCopyPending(std::shared_ptr<void> holder)
+{
+    // 内核为每次成功的MSG_ZEROCOPY发送分配一个递增的序号
+    zerocopy_pending_[zerocopy_seq_++] = holder;
+}
+
+int Socket::sendZeroCopy(const void* buffer, size_t length, std::shared_ptr<void> holder,
+                         int flags)
+{
+    iovec iov;
+    iov.iov_base = (void*)buffer;
+    iov.iov_len  = length;
+    return sendZeroCopy(&iov, 1, holder, flags);
+}
+
+int Socket::sendZeroCopy(const iovec* buffers, size_t length, std::shared_ptr<void> holder,
+                         int flags)
+{
+    if (!isConnect()) {
+        return -1;
+    }
+    if (!zerocopy_pending_.empty()) {
+        reapZeroCopy();
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < length; ++i) {
+        total += buffers[i].iov_len;
+    }
+    // 小数据拷贝的开销比页面锁定和完成通知更低
+    if (total < s_zerocopy_threshold || !enableZeroCopy()) {
+        return send(buffers, length, flags);
+    }
+
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = (iovec*)buffers;
+    msg.msg_iovlen = length;
+    int rt         = ::sendmsg(sock_, &msg, flags | MSG_ZEROCOPY);
+    if (rt < 0 && errno == ENOBUFS) {
+        // 锁定的页面超过了optmem限制，本次改为普通发送
+        return send(buffers, length, flags);
+    }
+    if (rt >= 0) {
+        addZeroCopyPending(holder);
+    }
+    return rt;
+}
+
+size_t Socket::reapZeroCopy()
+{
+    if (ReapZeroCopy(sock_, zerocopy_pending_, zerocopy_copied_)) {
+        // 数据最终还是被拷贝了，继续使用零拷贝只会多出完成通知的开销
+        zerocopy_state_ = -1;
+    }
+    return zerocopy_pending_.size();
+}
+
+bool Socket::waitZeroCopy(uint64_t timeout_ms)
+{
+    uint64_t begin = hiper::GetElapsedMS();
+    // 协程中等待时用的epoll，只关注socket的EPOLLERR
+    int    epfd = -1;
+    bool   ok   = true;
+    size_t pending;
+    while ((pending = reapZeroCopy()) > 0) {
+        uint64_t wait = -1;
+        if (timeout_ms != (uint64_t)-1) {
+            uint64_t elapsed = hiper::GetElapsedMS() - begin;
+            if (elapsed >= timeout_ms) {
+                ok = false;
+                break;
+            }
+            wait = timeout_ms - elapsed;
+        }
+
+        uint32_t   revents = 0;
+        IOManager* iom     = IOManager::GetThis();
+        if (iom && Fiber::GetFiberId() != 0 &&
+            Fiber::GetThis().get() != Scheduler::GetSchedulerFiber()) {
+            // 直接在socket上注册读事件时，有未读的普通数据就会立刻唤醒，变成忙等。
+            // 改为把socket以空的事件掩码加入一个私有的epoll，它只在错误队列有数据时报告EPOLLERR，
+            // 再在IOManager中等待这个epoll可读
+            if (epfd < 0) {
+                epfd = epoll_create1(EPOLL_CLOEXEC);
+                epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, sock_, &ev) != 0) {
+                    LOG_ERROR(g_logger) << "waitZeroCopy sock=" << sock_
+                                        << " epoll errno=" << errno << " errstr=" << strerror(errno);
+                    ok = false;
+                    break;
+                }
+            }
+            Timer::ptr timer;
+            if (wait != (uint64_t)-1) {
+                int fd = epfd;
+                timer  = iom->addTimer(wait, [iom, fd]() { iom->cancelEvent(fd, IOManager::READ); });
+            }
+            if (iom->addEvent(epfd, IOManager::READ)) {
+                if (timer) {
+                    timer->cancel();
+                }
+                ok = false;
+                break;
+            }
+            Fiber::GetThis()->yield();
+            if (timer) {
+                timer->cancel();
+            }
+            epoll_event ev;
+            if (epoll_wait(epfd, &ev, 1, 0) == 1) {
+                revents = ev.events;
+            }
+        }
+        else {
+            // events为0时poll只报告POLLERR/POLLHUP
+            pollfd pfd;
+            pfd.fd      = sock_;
+            pfd.events  = 0;
+            pfd.revents = 0;
+            int rt      = ::poll(&pfd, 1, wait == (uint64_t)-1 ? -1 : (int)wait);
+            if (rt < 0 && errno != EINTR) {
+                ok = false;
+                break;
+            }
+            revents =
+                (pfd.revents & POLLHUP ? EPOLLHUP : 0) | (pfd.revents & POLLERR ? EPOLLERR : 0);
+        }
+
+        // 连接断开或socket上有未取走的错误时，EPOLLHUP/EPOLLERR是电平触发的，会一直就绪。
+        // 把已经到达的通知再回收一次，连接断开或没有任何进展时结束等待，否则会空转
+        if (revents & (EPOLLHUP | EPOLLERR)) {
+            size_t left = reapZeroCopy();
+            if (left && ((revents & EPOLLHUP) || left == pending)) {
+                LOG_WARN(g_logger) << "waitZeroCopy sock=" << sock_ << " revents=" << revents
+                                   << ", give up pending=" << left;
+                ok = false;
+                break;
+            }
+        }
+    }
+    if (epfd >= 0) {
+        ::close(epfd);
+    }
+    return ok;
+}
+
+bool Socket::setUdpSegment(uint16_t segment_size)
+{
+    int val = segment_size;
+    return setOption(SOL_UDP, UDP_SEGMENT, val);
+}
+
+bool Socket::setUdpGro(bool on)
+{
+    int val = on ? 1 : 0;
+    return setOption(SOL_UDP, UDP_GRO, val);
+}
+
+bool Socket::setReusePort(bool on)
+{
+    if (!isValid()) {
+        newSocket();
+        if (HIPER_UNLIKELY(!isValid())) {
+            return false;
+        }
+    }
+    int val = on ? 1 : 0;
+    return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 const Address::ptr Socket::getRemoteAddress() {
     if (remote_addr_) {
         return remote_addr_;
     }
 
+    // accept时已经拿到了对端地址
+    if (peer_addr_len_ > 0 && (family_ == AF_INET || family_ == AF_INET6)) {
+        remote_addr_   = Address::Create((const sockaddr*)&peer_addr_, peer_addr_len_);
+        peer_addr_len_ = 0;
+        return remote_addr_;
+    }
+
     Address::ptr result;
     switch (family_) {
     case AF_INET:
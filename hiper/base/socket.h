@@ -10,15 +10,100 @@
 
 #include "address.h"
 #include "env.h"
+#include "mutex.h"
 #include "noncopyable.h"
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <vector>
 
 namespace hiper {
 
+/**
+ * @brief 批量收发数据报使用的缓冲区
+ * @details 预先分配mmsghdr、iovec和sockaddr_storage地址槽，收发过程中不再为每个数据报创建
+ *          Address对象，需要时再通过getAddress()按需创建。
+ *          接收时每个槽位使用构造时分配的固定大小缓冲区；发送时槽位只引用调用方的数据，
+ *          调用方需要保证数据在发送完成前有效。
+ *          接收完成后每个槽位的长度和来源地址保持不变，可以直接用于回发(echo)。
+ */
+class DatagramBatch : Noncopyable {
+public:
+    typedef std::shared_ptr<DatagramBatch> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] capacity 槽位数量，即单次系统调用最多收发的数据报数
+     * @param[in] buffer_size 每个槽位的接收缓冲区大小，0表示只用于发送
+     */
+    DatagramBatch(size_t capacity, size_t buffer_size = 0);
+
+    size_t capacity() const { return msgs_.size(); }
+
+    // 当前有效的数据报数量
+    size_t size() const { return size_; }
+
+    bool empty() const { return size_ == 0; }
+
+    bool full() const { return size_ == msgs_.size(); }
+
+    void clear() { size_ = 0; }
+
+    size_t getBufferSize() const { return buffer_size_; }
+
+    /**
+     * @brief 追加一个待发送的数据报
+     * @param[in] to 目的地址，为空表示发送给已连接的对端
+     * @return 槽位已满时返回false
+     */
+    bool add(const void* data, size_t length, const Address::ptr to = nullptr);
+
+    bool add(const void* data, size_t length, const sockaddr* to, socklen_t tolen);
+
+    // 第i个数据报的数据
+    const void* getData(size_t i) const { return iovs_[i].iov_base; }
+
+    // 第i个数据报的长度
+    size_t getLength(size_t i) const { return msgs_[i].msg_len; }
+
+    // 第i个数据报的地址(来源或目的)，没有地址时返回nullptr
+    const sockaddr* getAddr(size_t i) const
+    {
+        return (const sockaddr*)msgs_[i].msg_hdr.msg_name;
+    }
+
+    socklen_t getAddrLen(size_t i) const { return msgs_[i].msg_hdr.msg_namelen; }
+
+    // 按需为第i个数据报的地址创建Address对象
+    Address::ptr getAddress(size_t i) const;
+
+    // 第i个数据报是否被截断
+    bool isTruncated(size_t i) const { return msgs_[i].msg_hdr.msg_flags & MSG_TRUNC; }
+
+    mmsghdr* getMsgs() { return &msgs_[0]; }
+
+private:
+    friend class Socket;
+
+    // 将所有槽位重置为接收状态
+    void prepareRecv();
+
+    // 接收完成，记录有效数量并把iov长度修正为实际收到的长度
+    void finishRecv(size_t count);
+
+private:
+    std::vector<mmsghdr>          msgs_;
+    std::vector<iovec>            iovs_;
+    std::vector<sockaddr_storage> addrs_;
+    std::vector<char>             buffer_;
+    size_t                        buffer_size_;
+    size_t                        size_ = 0;
+};
+
 class Socket : public std::enable_shared_from_this<Socket>, Noncopyable {
 public:
     typedef std::shared_ptr<Socket> ptr;
@@ -47,10 +132,22 @@ public:
 
     virtual bool listen(int backlog = 1024);
 
+    /**
+     * @brief 接收新连接
+     * @details 新连接为非阻塞、close-on-exec。监听地址不是通配地址时直接继承为新连接的本地地址，
+     *          对端地址由accept4直接返回，两者都在第一次使用时才创建Address对象
+     */
     virtual Socket::ptr accept();
 
     virtual bool close();
 
+    /**
+     * @brief 关闭连接的读或写方向，socket已经关闭时不做任何操作
+     * @details 可以在其他线程调用，和close互斥，不会作用到关闭后被复用的fd上
+     * @param[in] how SHUT_RD、SHUT_WR或SHUT_RDWR
+     */
+    bool shutdown(int how);
+
     virtual bool connect(const Address::ptr addr, uint64_t timeout_ms = -1);
 
     virtual bool reconnect(uint64_t timeout_ms = -1);
@@ -71,6 +168,108 @@ public:
 
     virtual int recvFrom(iovec* buffers, size_t length, Address::ptr from, int flags = 0);
 
+    /**
+     * @brief 通过sendmmsg批量发送batch中的全部数据报
+     * @details 内核只发送了部分数据报时会继续发送剩余部分
+     * @return 成功发送的数据报数量，一个也没有发送成功时返回-1
+     */
+    virtual int sendBatch(DatagramBatch& batch, int flags = 0);
+
+    /**
+     * @brief 通过recvmmsg批量接收数据报
+     * @details 至少收到一个数据报后返回，单次最多填满batch的全部槽位，
+     *          batch中原有的数据报会被清除
+     * @return 收到的数据报数量，出错返回-1
+     */
+    virtual int recvBatch(DatagramBatch& batch, int flags = 0);
+
+    /**
+     * @brief 通过UDP GSO发送，内核按segment_size把buffers切分成多个数据报
+     * @details 只对本次调用生效，不需要事先设置setUdpSegment。
+     *          数据总长度不能超过64KB，最后一个分段可以小于segment_size
+     * @param[in] to 目的地址，为空表示发送给已连接的对端
+     * @param[in] segment_size 每个数据报的负载长度
+     * @return 发送的字节数，出错返回-1(内核不支持时errno为EINVAL或ENOPROTOOPT)
+     */
+    virtual int sendSegments(const iovec* buffers, size_t length, const Address::ptr to,
+                             uint16_t segment_size, int flags = 0);
+
+    /**
+     * @brief 接收数据并取出UDP GRO合并的分段大小
+     * @details 需要先通过setUdpGro开启GRO，收到的数据可能是多个同源数据报的拼接，
+     *          按segment_size切分即可还原，最后一个分段可以小于segment_size
+     * @param[out] from 来源地址，可以为空
+     * @param[out] segment_size 分段大小，没有合并(收到的是单个数据报)时为0
+     * @return 收到的字节数，出错返回-1
+     */
+    virtual int recvSegments(iovec* buffers, size_t length, Address::ptr from,
+                             uint16_t& segment_size, int flags = 0);
+
+    /**
+     * @brief 通过Unix域socket把文件描述符发送给对端(SCM_RIGHTS)
+     * @details 对端收到的是同一个打开的文件，本进程仍然持有自己的fd
+     * @param[in] fds 要发送的fd数组，最多SCM_MAX_FD(253)个
+     * @param[in] buffer 随fd一起发送的数据，至少1字节
+     * @return 发送的字节数，出错返回-1
+     */
+    virtual int sendFds(const int* fds, size_t count, const void* buffer, size_t length,
+                        int flags = 0);
+
+    /**
+     * @brief 接收对端通过SCM_RIGHTS发送的文件描述符
+     * @details 收到的fd带有close-on-exec标志，由调用方负责关闭
+     * @param[out] fds 收到的fd
+     * @param[in, out] count 传入fds的容量，返回收到的fd数量
+     * @return 收到的字节数，出错返回-1
+     */
+    virtual int recvFds(int* fds, size_t& count, void* buffer, size_t length, int flags = 0);
+
+    /**
+     * @brief 通过MSG_ZEROCOPY发送，内核直接引用用户内存而不拷贝
+     * @details 长度低于tcp.zerocopy.threshold或者内核不支持时退化为普通send。
+     *          holder会一直保存到内核发出完成通知为止，调用方在此之前不能修改缓冲区内容。
+     *          完成通知通过socket错误队列返回，每次调用时会顺带回收，也可以调用waitZeroCopy等待。
+     *          内核报告数据实际被拷贝(如回环地址)后，该socket后续的发送不再使用零拷贝。
+     *          close时还没完成的发送，holder连同dup出来的fd保留到完成通知回来，不会提前释放
+     * @param[in] holder 持有缓冲区的对象，例如ByteArray::ptr
+     * @return 发送的字节数，出错返回-1
+     */
+    virtual int sendZeroCopy(const void* buffer, size_t length, std::shared_ptr<void> holder,
+                             int flags = 0);
+
+    virtual int sendZeroCopy(const iovec* buffers, size_t length, std::shared_ptr<void> holder,
+                             int flags = 0);
+
+    /**
+     * @brief 回收错误队列中的零拷贝完成通知，释放内核不再引用的缓冲区，不会阻塞
+     * @return 仍在等待完成通知的发送次数
+     */
+    size_t reapZeroCopy();
+
+    /**
+     * @brief 等待所有零拷贝发送完成
+     * @details 在IOManager中等待错误队列的通知(EPOLLERR)，socket上有未读的普通数据时不会被提前唤醒。
+     *          连接已经断开(EPOLLHUP)时回收一次已到达的通知后返回，不再继续等待
+     * @param[in] timeout_ms 超时时间，-1表示一直等待
+     * @return 全部完成返回true，超时、出错或连接断开后仍有未完成的发送返回false
+     */
+    bool waitZeroCopy(uint64_t timeout_ms = -1);
+
+    // 等待完成通知的零拷贝发送次数
+    size_t getZeroCopyPending() const { return zerocopy_pending_.size(); }
+
+    // 被内核退化为拷贝的零拷贝发送次数
+    uint64_t getZeroCopyCopied() const { return zerocopy_copied_; }
+
+    // 设置UDP_SEGMENT，之后每次发送都由内核按segment_size分段，0表示关闭
+    bool setUdpSegment(uint16_t segment_size);
+
+    // 设置UDP_GRO，开启后内核可以把同一条流的多个数据报合并后一次交付
+    bool setUdpGro(bool on);
+
+    // 设置SO_REUSEPORT，需要在bind之前调用，多个进程可以各自监听同一个地址，由内核分配连接
+    bool setReusePort(bool on);
+
     const int getSocket() const { return sock_; };
 
     int getFamily() const { return family_; }
@@ -146,6 +345,13 @@ public:
 
     static Socket::ptr CreateUnixUDPSocket();
 
+    /**
+     * @brief 用已有的socket fd创建Socket对象，例如从其他进程接收的监听socket
+     * @details family/type/protocol从fd上查询，Socket对象接管fd的所有权
+     * @return fd不是socket时返回nullptr
+     */
+    static Socket::ptr CreateFromFd(int fd);
+
 protected:
     // 创建并初始化socket
     void newSocket();
@@ -154,14 +360,20 @@ protected:
     void initSocket();
 
     /**
-     * @brief 初始化socket，设置option以及本地和远程地址
-     * 
+     * @brief 初始化accept得到的socket，设置option
+     * @details 本地和远程地址不在这里获取，第一次调用getLocalAddress/getRemoteAddress时再创建
      * @param sock 
      * @return true 
      * @return false 
      */
     virtual bool init(int sock);
 
+    // 开启SO_ZEROCOPY，返回当前是否可以使用零拷贝发送
+    bool enableZeroCopy();
+
+    // 一次零拷贝发送成功后记录缓冲区持有者
+    void addZeroCopyPending(std::shared_ptr<void> holder);
+
 private:
     int sock_     = -1;
     int family_   = -1;
@@ -170,8 +382,22 @@ private:
 
     bool is_connect_ = false;
 
+    // close释放fd和shutdown互斥
+    Mutex close_mutex_;
+
     Address::ptr local_addr_  = nullptr;
     Address::ptr remote_addr_ = nullptr;
+
+    // accept时得到的对端地址，在getRemoteAddress时才创建Address对象
+    sockaddr_storage peer_addr_;
+    socklen_t        peer_addr_len_ = 0;
+
+    // 零拷贝状态: 0未开启, 1已开启, -1不可用
+    int      zerocopy_state_  = 0;
+    uint32_t zerocopy_seq_    = 0;
+    uint64_t zerocopy_copied_ = 0;
+    // 内核分配的发送序号 -> 缓冲区持有者
+    std::map<uint32_t, std::shared_ptr<void>> zerocopy_pending_;
 };
 
 std::ostream& operator<<(std::ostream& os, const Socket& sock);
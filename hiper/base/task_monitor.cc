@@ -0,0 +1,509 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-20 10:12:47
+ * @Description: 调度任务监控：慢任务检测、watchdog采样和按回调统计的CPU耗时
+ */
+#include "task_monitor.h"
+
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "metrics.h"
+#include "mutex.h"
+#include "scheduler.h"
+#include "thread.h"
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <execinfo.h>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <signal.h>
+#include <sstream>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unordered_map>
+
+namespace hiper {
+
+static hiper::Logger::ptr g_logger = LOG_NAME("system");
+
+static hiper::ConfigVar<uint32_t>::ptr g_slow_task_ms = hiper::Config::Lookup(
+    "scheduler.slow_task_ms", (uint32_t)100, "report tasks running longer than this, 0 disables");
+
+static hiper::ConfigVar<bool>::ptr g_watchdog = hiper::Config::Lookup(
+    "scheduler.watchdog", false, "sample the stack of scheduler threads stuck in a slow task");
+
+static hiper::ConfigVar<bool>::ptr g_profile =
+    hiper::Config::Lookup("scheduler.profile", false, "accumulate task cpu time per callback");
+
+static uint64_t s_slow_task_us = 100 * 1000;
+static bool     s_watchdog     = false;
+static bool     s_profile      = false;
+
+static void StartWatchdog();
+
+struct _TaskMonitorIniter
+{
+    _TaskMonitorIniter()
+    {
+        s_slow_task_us = g_slow_task_ms->getValue() * 1000ull;
+        s_profile      = g_profile->getValue();
+        g_slow_task_ms->addListener([](const uint32_t& old_value, const uint32_t& new_value) {
+            s_slow_task_us = new_value * 1000ull;
+        });
+        g_watchdog->addListener([](const bool& old_value, const bool& new_value) {
+            if (new_value) {
+                StartWatchdog();
+            }
+            s_watchdog = new_value;
+        });
+        g_profile->addListener(
+            [](const bool& old_value, const bool& new_value) { s_profile = new_value; });
+    }
+};
+
+static _TaskMonitorIniter s_task_monitor_initer;
+
+struct ProfileData
+{
+    uint64_t calls   = 0;
+    uint64_t wall_us = 0;
+    uint64_t cpu_us  = 0;
+    uint64_t max_us  = 0;
+
+    void merge(const ProfileData& o)
+    {
+        calls += o.calls;
+        wall_us += o.wall_us;
+        cpu_us += o.cpu_us;
+        max_us = std::max(max_us, o.max_us);
+    }
+};
+
+typedef std::unordered_map<const std::type_info*, ProfileData> ProfileMap;
+
+/**
+ * @brief 每个调度线程一个，调度线程写入，watchdog和统计读取
+ */
+struct TaskSlot
+{
+    static constexpr int kDepth = 32;
+
+    Scheduler* scheduler = nullptr;
+    int        thread_id = 0;
+
+    // 以下字段只由调度线程自己访问
+    uint64_t              begin_us = 0;
+    uint64_t              begin_cpu_us = 0;
+    const std::type_info* begin_site = nullptr;
+    // 慢任务让出位置的调用栈
+    void*                 yield_frames[kDepth];
+    int                   yield_depth = 0;
+    // 慢任务计数，进入线程时查找一次；告警每秒最多输出一条，期间被省略的条数
+    Counter::ptr slow_tasks;
+    uint64_t     slow_report_us  = 0;
+    uint64_t     slow_suppressed = 0;
+
+    std::atomic<uint64_t>              start_us{0};   // 正在执行的任务开始的时间，0表示空闲
+    std::atomic<uint64_t>              seq{0};        // 任务序号，区分是不是同一个任务
+    std::atomic<uint64_t>              fiber_id{0};
+    std::atomic<const std::type_info*> site{nullptr};
+    std::atomic<uint64_t>              reported_seq{0};   // watchdog已经报告过的任务
+
+    // 由信号处理函数在调度线程上写入
+    void*             frames[kDepth];
+    std::atomic<int>  depth{0};
+    std::atomic<bool> sampled{false};
+
+    SpinLock   profile_mutex;
+    ProfileMap profile;
+};
+
+static Mutex& GetSlotMutex()
+{
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+// watchdog在锁外采样时持有slot的引用，线程退出后slot由最后一个引用释放
+static std::vector<std::shared_ptr<TaskSlot>>& GetSlots()
+{
+    static std::vector<std::shared_ptr<TaskSlot>> s_slots;
+    return s_slots;
+}
+
+// 已经退出的线程的统计
+static ProfileMap& GetRetiredProfile()
+{
+    static ProfileMap s_retired;
+    return s_retired;
+}
+
+static thread_local TaskSlot* t_slot = nullptr;
+
+// watchdog正在采样的线程，信号处理函数中不访问thread_local，通过它找到要写入的位置
+static std::atomic<TaskSlot*> s_sample_slot{nullptr};
+// 正在执行的信号处理函数个数，watchdog等它归零后才释放slot的引用
+static std::atomic<int> s_sample_handlers{0};
+
+static uint64_t GetThreadCpuUS()
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000 * 1000 + ts.tv_nsec / 1000;
+}
+
+static std::string SiteToString(const std::type_info* site)
+{
+    return site ? Demangle(site->name()) : "unknown";
+}
+
+static void OnSampleSignal(int)
+{
+    int saved_errno = errno;
+    s_sample_handlers.fetch_add(1);
+    TaskSlot* slot = s_sample_slot.load();
+    // 上一次采样迟到的信号可能在下一个slot开始采样后才送达，只写入本线程的slot
+    if (slot && slot->thread_id == (int)syscall(SYS_gettid)) {
+        slot->depth.store(::backtrace(slot->frames, TaskSlot::kDepth), std::memory_order_relaxed);
+        slot->sampled.store(true, std::memory_order_release);
+    }
+    s_sample_handlers.fetch_sub(1);
+    errno = saved_errno;
+}
+
+static int SampleSignal()
+{
+    return SIGRTMIN + 1;
+}
+
+/**
+ * @brief 向卡住的线程发信号采集调用栈，最多等待50ms
+ * @details 不持有GetSlotMutex调用，slot由调用方的引用保证存活。线程可能已经退出，
+ *          用tgkill按线程号发送，不使用可能失效的pthread_t
+ */
+static bool SampleStack(TaskSlot* slot)
+{
+    slot->sampled.store(false, std::memory_order_relaxed);
+    s_sample_slot.store(slot);
+    bool ok = false;
+    if (!syscall(SYS_tgkill, getpid(), slot->thread_id, SampleSignal())) {
+        for (int i = 0; i < 50 && !ok; ++i) {
+            usleep(1000);
+            ok = slot->sampled.load(std::memory_order_acquire);
+        }
+    }
+    s_sample_slot.store(nullptr);
+    // 已经读到slot的信号处理函数还在写入时不能释放它
+    while (s_sample_handlers.load()) {
+        sched_yield();
+    }
+    return ok;
+}
+
+static void WatchdogCheck()
+{
+    Counter::ptr stuck = MetricsMgr::GetInstance()->counter(
+        "hiper_watchdog_stuck_total", "tasks sampled by the watchdog while stuck");
+
+    struct Stuck
+    {
+        std::shared_ptr<TaskSlot> slot;
+        uint64_t                  seq;
+        std::string               msg;
+    };
+    // 锁内只挑出卡住的线程，采样最多要等50ms，放到锁外，不阻塞调度线程的启动和退出
+    std::vector<Stuck> stucks;
+    {
+        Mutex::Lock lock(GetSlotMutex());
+        uint64_t    now = GetElapsedUS();
+        for (auto& slot : GetSlots()) {
+            uint64_t start = slot->start_us.load(std::memory_order_acquire);
+            uint64_t seq   = slot->seq.load(std::memory_order_relaxed);
+            if (!start || now < start || now - start < s_slow_task_us ||
+                slot->reported_seq.load(std::memory_order_relaxed) == seq) {
+                continue;
+            }
+            slot->reported_seq.store(seq, std::memory_order_relaxed);
+
+            std::stringstream ss;
+            ss << "task stuck scheduler=" << slot->scheduler->getName()
+               << " thread=" << slot->thread_id
+               << " fiber_id=" << slot->fiber_id.load(std::memory_order_relaxed)
+               << " running_ms=" << (now - start) / 1000
+               << " site=" << SiteToString(slot->site.load(std::memory_order_relaxed));
+            stucks.push_back({slot, seq, ss.str()});
+        }
+    }
+
+    for (auto& i : stucks) {
+        TaskSlot*         slot = i.slot.get();
+        std::stringstream ss;
+        ss << i.msg;
+        stuck->add();
+        // 采样期间任务已经让出的话，栈就不是这个任务的了
+        if (SampleStack(slot) && slot->seq.load(std::memory_order_relaxed) == i.seq &&
+            slot->start_us.load(std::memory_order_relaxed)) {
+            // 跳过信号处理函数和内核的信号返回帧
+            int depth = slot->depth.load(std::memory_order_relaxed);
+            ss << std::endl << BacktraceToString(slot->frames + 2, std::max(depth - 2, 0));
+        }
+        LOG_WARN(g_logger) << ss.str();
+    }
+}
+
+static void RunWatchdog()
+{
+    while (true) {
+        // 检查间隔为阈值的一半，卡住的任务最晚在1.5倍阈值时被发现
+        uint64_t interval_us = std::max<uint64_t>(s_slow_task_us / 2, 10 * 1000);
+        usleep(s_slow_task_us ? interval_us : 100 * 1000);
+        if (s_watchdog && s_slow_task_us) {
+            WatchdogCheck();
+        }
+    }
+}
+
+static Thread* s_watchdog_thread = nullptr;
+// fork后子进程里还没有重新启动watchdog线程，由GetSlotMutex保护
+static bool s_watchdog_forked = false;
+
+// fork时持有slot的锁，子进程里不会有别的线程停在修改slot列表的中间
+static void WatchdogForkPrepare() { GetSlotMutex().lock(); }
+
+static void WatchdogForkParent() { GetSlotMutex().unlock(); }
+
+/**
+ * @brief 子进程里只剩fork的线程，清掉其他线程的slot和采样状态
+ * @details 这里还在fork的过程中，子进程可能马上exec，不创建线程，
+ *          等子进程里第一个调度线程启动时再重新启动watchdog线程
+ */
+static void WatchdogForkChild()
+{
+    auto& slots = GetSlots();
+    slots.erase(std::remove_if(slots.begin(), slots.end(),
+                               [](const std::shared_ptr<TaskSlot>& slot) {
+                                   return slot.get() != t_slot;
+                               }),
+                slots.end());
+    s_sample_slot.store(nullptr);
+    s_sample_handlers.store(0);
+    // 线程对象描述的是父进程中的线程，析构时会对它调用pthread_detach，直接泄漏
+    s_watchdog_thread = nullptr;
+    s_watchdog_forked = true;
+    GetSlotMutex().unlock();
+}
+
+static void StartWatchdog()
+{
+    static std::once_flag s_once;
+    std::call_once(s_once, []() {
+        // backtrace第一次调用会加载libgcc，先在这里调用，信号处理中就不会分配内存
+        void* frames[1];
+        ::backtrace(frames, 1);
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = OnSampleSignal;
+        sa.sa_flags   = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SampleSignal(), &sa, nullptr);
+
+        s_watchdog_thread = new Thread(&RunWatchdog, "watchdog");
+        pthread_atfork(&WatchdogForkPrepare, &WatchdogForkParent, &WatchdogForkChild);
+    });
+}
+
+bool TaskMonitor::IsEnabled()
+{
+    return s_slow_task_us || s_watchdog || s_profile;
+}
+
+void TaskMonitor::ThreadEnter(Scheduler* scheduler)
+{
+    std::shared_ptr<TaskSlot> slot(new TaskSlot);
+    slot->scheduler  = scheduler;
+    slot->thread_id  = GetThreadId();
+    slot->slow_tasks = MetricsMgr::GetInstance()->counter(
+        "hiper_scheduler_slow_tasks_total", "tasks running longer than slow_task_ms",
+        "scheduler=\"" + scheduler->getName() + "\"");
+
+    Mutex::Lock lock(GetSlotMutex());
+    GetSlots().push_back(slot);
+    t_slot = slot.get();
+    if (HIPER_UNLIKELY(s_watchdog_forked)) {
+        s_watchdog_forked = false;
+        s_watchdog_thread = new Thread(&RunWatchdog, "watchdog");
+    }
+}
+
+void TaskMonitor::ThreadLeave()
+{
+    TaskSlot* slot = t_slot;
+    if (!slot) {
+        return;
+    }
+    Mutex::Lock lock(GetSlotMutex());
+    ProfileMap& retired = GetRetiredProfile();
+    {
+        SpinLock::Lock plock(slot->profile_mutex);
+        for (auto& i : slot->profile) {
+            retired[i.first].merge(i.second);
+        }
+        slot->profile.clear();
+    }
+    auto& slots = GetSlots();
+    slots.erase(std::remove_if(slots.begin(), slots.end(),
+                               [slot](const std::shared_ptr<TaskSlot>& i) { return i.get() == slot; }),
+                slots.end());
+    t_slot = nullptr;
+}
+
+void TaskMonitor::TaskBegin(uint64_t fiber_id, const std::type_info* site, uint64_t now_us)
+{
+    TaskSlot* slot = t_slot;
+    if (!slot) {
+        return;
+    }
+    slot->begin_us    = now_us;
+    slot->begin_site  = site;
+    slot->yield_depth = 0;
+    if (s_profile) {
+        slot->begin_cpu_us = GetThreadCpuUS();
+    }
+    slot->fiber_id.store(fiber_id, std::memory_order_relaxed);
+    slot->site.store(site, std::memory_order_relaxed);
+    slot->seq.fetch_add(1, std::memory_order_relaxed);
+    slot->start_us.store(now_us, std::memory_order_release);
+}
+
+void TaskMonitor::TaskYield()
+{
+    TaskSlot* slot = t_slot;
+    if (!slot || !slot->begin_us || !s_slow_task_us ||
+        GetElapsedUS() - slot->begin_us < s_slow_task_us) {
+        return;
+    }
+    // 跳过自己和Fiber::yield
+    void* frames[TaskSlot::kDepth + 2];
+    int   n = ::backtrace(frames, TaskSlot::kDepth + 2);
+    n       = std::max(n - 2, 0);
+    memcpy(slot->yield_frames, frames + 2, n * sizeof(void*));
+    slot->yield_depth = n;
+}
+
+void TaskMonitor::TaskEnd(uint64_t now_us)
+{
+    TaskSlot* slot = t_slot;
+    if (!slot || !slot->begin_us) {
+        return;
+    }
+    slot->start_us.store(0, std::memory_order_relaxed);
+    uint64_t used   = now_us - slot->begin_us;
+    slot->begin_us  = 0;
+
+    if (s_profile && slot->begin_cpu_us) {
+        uint64_t cpu = GetThreadCpuUS() - slot->begin_cpu_us;
+        slot->begin_cpu_us = 0;
+
+        SpinLock::Lock lock(slot->profile_mutex);
+        ProfileData&   d = slot->profile[slot->begin_site];
+        ++d.calls;
+        d.wall_us += used;
+        d.cpu_us += cpu;
+        d.max_us = std::max(d.max_us, used);
+    }
+
+    if (s_slow_task_us && used >= s_slow_task_us) {
+        slot->slow_tasks->add();
+        // 线程卡顿时会连续出现慢任务，每个线程每秒最多输出一条，调用栈的符号化也一起省掉
+        if (slot->slow_report_us && now_us - slot->slow_report_us < 1000 * 1000) {
+            ++slot->slow_suppressed;
+            slot->yield_depth = 0;
+            return;
+        }
+        slot->slow_report_us = now_us;
+        bool reported = slot->reported_seq.load(std::memory_order_relaxed) ==
+                        slot->seq.load(std::memory_order_relaxed);
+        std::stringstream ss;
+        ss << "slow task scheduler=" << slot->scheduler->getName()
+           << " fiber_id=" << slot->fiber_id.load(std::memory_order_relaxed)
+           << " run_ms=" << used / 1000 << " site=" << SiteToString(slot->begin_site);
+        if (slot->slow_suppressed) {
+            ss << " suppressed=" << slot->slow_suppressed;
+            slot->slow_suppressed = 0;
+        }
+        if (reported) {
+            ss << " (stack reported by watchdog)";
+        }
+        else if (slot->yield_depth) {
+            // watchdog关闭时只能拿到让出位置的调用栈，慢的那段代码在它的调用链上
+            ss << " yielded at:" << std::endl
+               << BacktraceToString(slot->yield_frames, slot->yield_depth);
+        }
+        LOG_WARN(g_logger) << ss.str();
+    }
+    slot->yield_depth = 0;
+}
+
+std::vector<TaskMonitor::ProfileEntry> TaskMonitor::GetProfile()
+{
+    ProfileMap merged;
+    {
+        Mutex::Lock lock(GetSlotMutex());
+        merged = GetRetiredProfile();
+        for (auto& slot : GetSlots()) {
+            SpinLock::Lock plock(slot->profile_mutex);
+            for (auto& i : slot->profile) {
+                merged[i.first].merge(i.second);
+            }
+        }
+    }
+
+    // 不同的type_info对象可能表示同一个类型，按名称再合并一次
+    std::map<std::string, ProfileData> by_name;
+    for (auto& i : merged) {
+        by_name[SiteToString(i.first)].merge(i.second);
+    }
+    std::vector<ProfileEntry> rt;
+    for (auto& i : by_name) {
+        ProfileEntry e;
+        e.site    = i.first;
+        e.calls   = i.second.calls;
+        e.wall_us = i.second.wall_us;
+        e.cpu_us  = i.second.cpu_us;
+        e.max_us  = i.second.max_us;
+        rt.push_back(e);
+    }
+    std::sort(rt.begin(), rt.end(), [](const ProfileEntry& a, const ProfileEntry& b) {
+        return a.cpu_us > b.cpu_us;
+    });
+    return rt;
+}
+
+std::ostream& TaskMonitor::DumpProfile(std::ostream& os)
+{
+    os << "[TaskProfile enabled=" << s_profile << "]" << std::endl;
+    for (auto& i : GetProfile()) {
+        os << "cpu_us=" << i.cpu_us << " wall_us=" << i.wall_us << " calls=" << i.calls
+           << " avg_us=" << (i.calls ? i.wall_us / i.calls : 0) << " max_us=" << i.max_us
+           << " site=" << i.site << std::endl;
+    }
+    return os;
+}
+
+void TaskMonitor::ResetProfile()
+{
+    Mutex::Lock lock(GetSlotMutex());
+    GetRetiredProfile().clear();
+    for (auto& slot : GetSlots()) {
+        SpinLock::Lock plock(slot->profile_mutex);
+        slot->profile.clear();
+    }
+}
+
+}   // namespace hiper
@@ -0,0 +1,85 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-20 10:12:47
+ * @Description: 调度任务监控：慢任务检测、watchdog采样和按回调统计的CPU耗时
+ */
+#ifndef HIPER_TASK_MONITOR_H
+#define HIPER_TASK_MONITOR_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+namespace hiper {
+
+class Scheduler;
+
+/**
+ * @brief 调度任务监控，由Scheduler::run在每次恢复、让出协程时调用
+ * @details 三个功能分别由配置开启，都关闭时run中只多一次判断。慢任务检测默认开启，
+ *          run默认会在每次恢复和让出时各取一次时间：
+ *          scheduler.slow_task_ms  一次执行(从恢复到让出)超过该时间的任务输出告警和让出位置的调用栈，
+ *                                  每个线程每秒最多输出一条，默认100，0表示关闭
+ *          scheduler.watchdog      后台线程定期检查，向卡住的调度线程发送信号采集调用栈并输出，
+ *                                  不用等任务让出就能看到它卡在哪里
+ *          scheduler.profile       按回调的类型(lambda的类型名包含所在的函数)累计执行次数、
+ *                                  墙上时间和线程CPU时间
+ */
+class TaskMonitor {
+public:
+    /**
+     * @brief 一个回调位置的累计耗时
+     */
+    struct ProfileEntry
+    {
+        std::string site;
+        uint64_t    calls   = 0;   // 恢复执行的次数
+        uint64_t    wall_us = 0;
+        uint64_t    cpu_us  = 0;
+        uint64_t    max_us  = 0;   // 单次执行的最长墙上时间
+    };
+
+    /**
+     * @brief 是否需要记录任务的开始时间
+     */
+    static bool IsEnabled();
+
+    /**
+     * @brief 调度线程开始/结束运行，登记到watchdog的检查列表
+     */
+    static void ThreadEnter(Scheduler* scheduler);
+    static void ThreadLeave();
+
+    /**
+     * @brief 恢复协程之前调用
+     * @param[in] fiber_id 协程id
+     * @param[in] site 回调的类型，没有时为nullptr
+     * @param[in] now_us GetElapsedUS()
+     */
+    static void TaskBegin(uint64_t fiber_id, const std::type_info* site, uint64_t now_us);
+
+    /**
+     * @brief 协程让出之前在协程的栈上调用，本次执行已经超过慢任务的阈值时保存让出位置的调用栈
+     */
+    static void TaskYield();
+
+    /**
+     * @brief 协程让出或结束之后调用
+     */
+    static void TaskEnd(uint64_t now_us);
+
+    /**
+     * @brief 所有线程合并后的统计，按CPU时间从大到小排列
+     */
+    static std::vector<ProfileEntry> GetProfile();
+
+    static std::ostream& DumpProfile(std::ostream& os);
+
+    static void ResetProfile();
+};
+
+}   // namespace hiper
+
+#endif   // HIPER_TASK_MONITOR_H
@@ -2,25 +2,80 @@
 #include "hiper.h"
 #include "log.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
 
 namespace hiper {
 
 static hiper::Logger::ptr              g_logger                  = LOG_NAME("system");
 static hiper::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout = hiper::Config::Lookup(
     "tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2), "tcp server read timeout");
+static hiper::ConfigVar<uint32_t>::ptr g_tcp_server_max_connections = hiper::Config::Lookup(
+    "tcp_server.max_connections", (uint32_t)0, "tcp server max connections, 0 means unlimited");
+static hiper::ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch = hiper::Config::Lookup(
+    "tcp_server.accept_batch", (uint32_t)64, "tcp server max accepts per readiness event");
 
-TcpServer::TcpServer(hiper::IOManager* worker, hiper::IOManager* accept_worker)
+// 监听socket交接消息，随fd一起发送
+struct HandoffHeader
+{
+    char     magic[4];
+    uint32_t count;
+};
+
+static const char   s_handoff_magic[4] = {'H', 'P', 'R', 'H'};
+static const char   s_handoff_ack      = 'k';
+static const size_t s_max_handoff_fds  = 253;
+
+// 已启动的服务器，由DrainAll统一平滑停止
+static Mutex                                 s_servers_mutex;
+static std::vector<std::weak_ptr<TcpServer>> s_servers;
+
+/**
+ * @brief 等待fd就绪
+ * @details 开启hook时直接返回，由hook后的读写按socket超时时间等待；
+ *          否则用poll等待，因为经过FdMgr初始化的socket都是非阻塞的
+ */
+static bool WaitFd(int fd, short events, uint64_t timeout_ms)
+{
+    if (hiper::is_hook_enable()) {
+        return true;
+    }
+    pollfd pfd;
+    pfd.fd      = fd;
+    pfd.events  = events;
+    pfd.revents = 0;
+    int rt;
+    do {
+        rt = ::poll(&pfd, 1, timeout_ms == (uint64_t)-1 ? -1 : (int)timeout_ms);
+    } while (rt < 0 && errno == EINTR);
+    if (rt == 0) {
+        errno = ETIMEDOUT;
+    }
+    return rt > 0;
+}
+
+TcpServer::TcpServer(hiper::IOManager* worker, hiper::IOManager* accept_worker,
+                     hiper::Scheduler* process_worker)
     : io_worker_(worker)
     , accept_worker_(accept_worker)
+    , process_worker_(process_worker)
     , recv_timeout_(g_tcp_server_read_timeout->getValue())
     , server_name_("hiper/1.0.0")
     , type_("tcp")
     , is_stop_(true)
+    , max_connections_(g_tcp_server_max_connections->getValue())
+    , accept_batch_(std::max(g_tcp_server_accept_batch->getValue(), (uint32_t)1))
+    , reserve_fd_(::open("/dev/null", O_RDONLY | O_CLOEXEC))
 {}
 
 TcpServer::~TcpServer()
 {
+    if (reserve_fd_ >= 0) {
+        ::close(reserve_fd_);
+    }
     for (auto& i : sockets_) {
         i->close();
     }
@@ -69,16 +124,161 @@ bool TcpServer::bind(hiper::Address::ptr addr)
 void TcpServer::startAccept(Socket::ptr sock)
 {
     while (!is_stop_) {
-        Socket::ptr client = sock->accept();
-        if (client) {
-            client->setRecvTimeout(recv_timeout_);
-            io_worker_->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
-            // io_worker_->schedule([this, client]() { this->handleClient(client); });
+        waitConnectionSlot();
+
+        // 一次就绪事件中尽量取完backlog中的连接
+        size_t accepted = 0;
+        bool   drained  = false;
+        while (accepted < accept_batch_ && !is_stop_) {
+            if (max_connections_ && conn_count_ >= max_connections_) {
+                break;
+            }
+            Socket::ptr client = sock->accept();
+            if (client) {
+                dispatchClient(client);
+                ++accepted;
+                continue;
+            }
+
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && shedConnection(sock)) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR_LIMIT(g_logger, 10)
+                    << "accept errno=" << errno << " errstr=" << strerror(errno);
+            }
+            drained = true;
+            break;
+        }
+
+        if (is_stop_) {
+            break;
+        }
+        if (drained) {
+            // backlog已经取空，等待新的连接，stop时cancelAll会唤醒
+            if (HIPER_UNLIKELY(IOManager::GetThis()->addEvent(sock->getSocket(), IOManager::READ))) {
+                LOG_ERROR(g_logger) << "accept addEvent fail sock=" << sock->getSocket();
+                break;
+            }
+            Fiber::GetThis()->yield();
         }
         else {
-            LOG_ERROR(g_logger) << "accept errno=" << errno << " errstr=" << strerror(errno);
+            // 一批处理完让出执行权，避免长时间占用accept线程
+            Fiber::YieldToReady();
+        }
+    }
+}
+
+void TcpServer::dispatchClient(Socket::ptr client)
+{
+    client->setRecvTimeout(recv_timeout_);
+    ++conn_count_;
+    {
+        MutexType::Lock lock(mutex_);
+        clients_.insert(client);
+    }
+
+    // 从轮转位置开始找连接数最少的io线程
+    int    worker = -1;
+    size_t count  = worker_threads_.size();
+    if (count) {
+        size_t start = next_worker_++ % count;
+        size_t min   = (size_t)-1;
+        for (size_t i = 0; i < count; ++i) {
+            size_t idx  = (start + i) % count;
+            size_t load = worker_loads_[idx];
+            if (load < min) {
+                min    = load;
+                worker = idx;
+            }
         }
+        ++worker_loads_[worker];
     }
+
+    auto self = shared_from_this();
+    io_worker_->schedule(
+        [self, client, worker]() {
+            try {
+                self->handleClient(client);
+            }
+            catch (...) {
+                self->releaseClient(client, worker);
+                throw;
+            }
+            self->releaseClient(client, worker);
+        },
+        worker >= 0 ? worker_threads_[worker] : -1);
+}
+
+void TcpServer::releaseClient(const Socket::ptr& client, int worker)
+{
+    if (worker >= 0) {
+        --worker_loads_[worker];
+    }
+    {
+        MutexType::Lock lock(mutex_);
+        clients_.erase(client);
+    }
+    size_t count = --conn_count_;
+    if (max_connections_ && count < max_connections_) {
+        resumeAccept();
+    }
+}
+
+void TcpServer::waitConnectionSlot()
+{
+    while (max_connections_ && !is_stop_) {
+        {
+            MutexType::Lock lock(mutex_);
+            // 加锁后再检查，releaseClient在锁内取走挂起的协程，不会漏掉唤醒
+            if (conn_count_ < max_connections_) {
+                return;
+            }
+            paused_.push_back(std::make_pair(Fiber::GetThis(), hiper::GetThreadId()));
+            // 挂起期间调度器没有该协程的任何记录，计数防止调度器提前停止
+            accept_worker_->addExternalWait();
+        }
+        LOG_DEBUG(g_logger) << "accept paused, connections=" << conn_count_
+                            << " max_connections=" << max_connections_;
+        // 固定回到原线程恢复，保证唤醒时协程已经完全切出
+        Fiber::YieldToHold();
+    }
+}
+
+void TcpServer::resumeAccept()
+{
+    std::vector<std::pair<Fiber::ptr, int>> paused;
+    {
+        MutexType::Lock lock(mutex_);
+        paused.swap(paused_);
+    }
+    for (auto& i : paused) {
+        accept_worker_->schedule(i.first, i.second);
+        accept_worker_->delExternalWait();
+    }
+}
+
+bool TcpServer::shedConnection(Socket::ptr sock)
+{
+    MutexType::Lock lock(mutex_);
+    if (reserve_fd_ < 0) {
+        return false;
+    }
+    ::close(reserve_fd_);
+    int fd = ::accept4(sock->getSocket(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd >= 0) {
+        ::close(fd);
+        ++shed_count_;
+    }
+    reserve_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    // fd耗尽期间每秒最多输出一次
+    LOG_WARN_LIMIT(g_logger, 1) << "accept fd exhausted, shed connections=" << shed_count_
+                                << " connections=" << conn_count_;
+    return fd >= 0;
 }
 
 bool TcpServer::start()
@@ -87,7 +287,33 @@ bool TcpServer::start()
         return true;
     }
     is_stop_ = false;
+
+    {
+        Mutex::Lock lock(s_servers_mutex);
+        s_servers.erase(std::remove_if(s_servers.begin(), s_servers.end(),
+                                       [this](const std::weak_ptr<TcpServer>& i) {
+                                           auto server = i.lock();
+                                           return !server || server.get() == this;
+                                       }),
+                        s_servers.end());
+        s_servers.push_back(shared_from_this());
+    }
+
+    // caller线程要到stop时才开始调度，绑定到它的连接在此之前得不到处理
+    worker_threads_.clear();
+    for (int id : io_worker_->getThreadIds()) {
+        if (id != io_worker_->getCallerThreadId()) {
+            worker_threads_.push_back(id);
+        }
+    }
+    worker_loads_.reset(new std::atomic<size_t>[worker_threads_.size()]);
+    for (size_t i = 0; i < worker_threads_.size(); ++i) {
+        worker_loads_[i] = 0;
+    }
+
     for (auto& sock : sockets_) {
+        // 由accept循环自己等待就绪事件，监听socket设置为非阻塞
+        sock->setNonBlock();
         accept_worker_->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), sock));
     }
     return true;
@@ -97,6 +323,7 @@ void TcpServer::stop()
 {
     is_stop_  = true;
     auto self = shared_from_this();
+    resumeAccept();
     accept_worker_->schedule([this, self]() {
         for (auto& sock : sockets_) {
             sock->cancelAll();
@@ -106,6 +333,232 @@ void TcpServer::stop()
     });
 }
 
+bool TcpServer::drain(uint64_t timeout_ms)
+{
+    is_draining_ = true;
+    if (!is_stop_) {
+        stop();
+    }
+    LOG_INFO(g_logger) << "server " << server_name_ << " draining, connections=" << conn_count_
+                       << " timeout=" << timeout_ms;
+
+    uint64_t start    = hiper::GetElapsedMS();
+    uint64_t last_log = start;
+    while (conn_count_) {
+        uint64_t now = hiper::GetElapsedMS();
+        if (now - start >= timeout_ms) {
+            break;
+        }
+        if (now - last_log >= 1000) {
+            last_log = now;
+            LOG_INFO(g_logger) << "server " << server_name_ << " draining, connections="
+                               << conn_count_ << " elapsed=" << now - start;
+        }
+        // 开启hook时只让出当前协程
+        usleep(10 * 1000);
+    }
+
+    size_t remaining = conn_count_;
+    if (!remaining) {
+        LOG_INFO(g_logger) << "server " << server_name_ << " drained in "
+                           << hiper::GetElapsedMS() - start << "ms";
+        return true;
+    }
+
+    // 超时，关闭剩余连接的读写，处理协程会读到对端关闭并返回。
+    // 处理协程可能同时在别的线程close，Socket::shutdown和close互斥，不会作用到被复用的fd上
+    {
+        MutexType::Lock lock(mutex_);
+        for (auto& i : clients_) {
+            i->shutdown(SHUT_RDWR);
+        }
+    }
+    LOG_WARN(g_logger) << "server " << server_name_ << " drain timeout, shutdown connections="
+                       << remaining;
+    return false;
+}
+
+bool TcpServer::DrainAll(uint64_t timeout_ms)
+{
+    std::vector<TcpServer::ptr> servers;
+    {
+        Mutex::Lock lock(s_servers_mutex);
+        for (auto& i : s_servers) {
+            if (auto server = i.lock()) {
+                servers.push_back(server);
+            }
+        }
+    }
+    // 先让所有服务器停止accept，避免等待前一个时后面的还在接收新连接
+    for (auto& i : servers) {
+        i->is_draining_ = true;
+        if (!i->is_stop_) {
+            i->stop();
+        }
+    }
+    uint64_t deadline = hiper::GetElapsedMS() + timeout_ms;
+    bool     rt       = true;
+    for (auto& i : servers) {
+        uint64_t now = hiper::GetElapsedMS();
+        rt           = i->drain(deadline > now ? deadline - now : 0) && rt;
+    }
+    return rt;
+}
+
+bool TcpServer::handoff(const std::string& path, uint64_t timeout_ms)
+{
+    if (sockets_.empty() || sockets_.size() > s_max_handoff_fds) {
+        LOG_ERROR(g_logger) << "handoff invalid listen socket count=" << sockets_.size();
+        return false;
+    }
+    Address::ptr addr(new UnixAddress(path));
+    Socket::ptr  listener = Socket::CreateUnixTCPSocket();
+    if (!listener->bind(addr) || !listener->listen(1)) {
+        LOG_ERROR(g_logger) << "handoff listen fail path=" << path;
+        return false;
+    }
+    std::vector<int> fds;
+    for (auto& i : sockets_) {
+        fds.push_back(i->getSocket());
+    }
+    HandoffHeader hdr;
+    memcpy(hdr.magic, s_handoff_magic, sizeof(hdr.magic));
+    hdr.count = fds.size();
+
+    // Socket::bind探测地址是否被占用时会连上来再断开，异常退出的新进程也不会回复确认，
+    // 这些连接不算交接，继续等待下一个连接直到超时
+    bool     ok       = false;
+    uint64_t deadline = hiper::GetElapsedMS() + timeout_ms;
+    while (!ok) {
+        uint64_t now = hiper::GetElapsedMS();
+        if (now >= deadline) {
+            errno = ETIMEDOUT;
+            break;
+        }
+        uint64_t left = deadline - now;
+        listener->setRecvTimeout(left);
+        Socket::ptr peer;
+        if (WaitFd(listener->getSocket(), POLLIN, left)) {
+            peer = listener->accept();
+        }
+        if (!peer) {
+            break;
+        }
+        peer->setRecvTimeout(left);
+        peer->setSendTimeout(left);
+
+        // 新进程确认收到后再停止accept，失败时本进程继续服务。对端可能已经关闭，不能触发SIGPIPE
+        char ack = 0;
+        ok = peer->sendFds(&fds[0], fds.size(), &hdr, sizeof(hdr), MSG_NOSIGNAL) ==
+                 (int)sizeof(hdr) &&
+             WaitFd(peer->getSocket(), POLLIN, left) && peer->recv(&ack, 1) == 1 &&
+             ack == s_handoff_ack;
+        peer->close();
+    }
+    listener->close();
+    FSUtil::Unlink(path);
+
+    if (!ok) {
+        LOG_ERROR(g_logger) << "handoff fail path=" << path << " errno=" << errno
+                            << " errstr=" << strerror(errno);
+        return false;
+    }
+    LOG_INFO(g_logger) << "server " << server_name_ << " handoff " << sockets_.size()
+                       << " listen sockets, path=" << path;
+    // 新进程已经持有监听socket，关闭本进程的副本不影响监听队列
+    stop();
+    return true;
+}
+
+bool TcpServer::takeover(const std::string& path, uint64_t timeout_ms)
+{
+    if (access(path.c_str(), F_OK)) {
+        LOG_INFO(g_logger) << "takeover no old process, path=" << path;
+        return false;
+    }
+    Address::ptr addr(new UnixAddress(path));
+    Socket::ptr  sock = Socket::CreateUnixTCPSocket();
+    if (!sock->connect(addr, timeout_ms)) {
+        return false;
+    }
+    sock->setRecvTimeout(timeout_ms);
+    sock->setSendTimeout(timeout_ms);
+
+    HandoffHeader hdr;
+    int           fds[s_max_handoff_fds];
+    size_t        count = s_max_handoff_fds;
+    int           rt    = -1;
+    if (WaitFd(sock->getSocket(), POLLIN, timeout_ms)) {
+        rt = sock->recvFds(fds, count, &hdr, sizeof(hdr));
+    }
+
+    std::vector<Socket::ptr> socks;
+    for (size_t i = 0; i < count; ++i) {
+        Socket::ptr s = Socket::CreateFromFd(fds[i]);
+        if (s) {
+            socks.push_back(s);
+        }
+        else {
+            ::close(fds[i]);
+        }
+    }
+    if (rt != (int)sizeof(hdr) || memcmp(hdr.magic, s_handoff_magic, sizeof(hdr.magic)) ||
+        hdr.count != count || socks.size() != count) {
+        LOG_ERROR(g_logger) << "takeover fail path=" << path << " rt=" << rt << " fds=" << count
+                            << " errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    if (sock->send(&s_handoff_ack, 1) != 1) {
+        LOG_ERROR(g_logger) << "takeover ack fail path=" << path << " errno=" << errno
+                            << " errstr=" << strerror(errno);
+        return false;
+    }
+
+    for (auto& i : socks) {
+        LOG_INFO(g_logger) << "server takeover success: " << *i;
+        sockets_.push_back(i);
+    }
+    return true;
+}
+
+bool TcpServer::setConf(const TcpServerConf& conf)
+{
+    IOManager::ptr io;
+    IOManager::ptr accept;
+    Scheduler::ptr process;
+    if (!conf.io_worker.empty() && !(io = WorkerMgr::GetInstance()->getAsIOManager(conf.io_worker))) {
+        LOG_ERROR(g_logger) << "io_worker " << conf.io_worker << " not exists";
+        return false;
+    }
+    if (!conf.accept_worker.empty() &&
+        !(accept = WorkerMgr::GetInstance()->getAsIOManager(conf.accept_worker))) {
+        LOG_ERROR(g_logger) << "accept_worker " << conf.accept_worker << " not exists";
+        return false;
+    }
+    if (!conf.process_worker.empty() &&
+        !(process = WorkerMgr::GetInstance()->get(conf.process_worker))) {
+        LOG_ERROR(g_logger) << "process_worker " << conf.process_worker << " not exists";
+        return false;
+    }
+    // 调度器由WorkerMgr持有，生命周期长于server
+    if (io) {
+        io_worker_ = io.get();
+    }
+    if (accept) {
+        accept_worker_ = accept.get();
+    }
+    if (process) {
+        process_worker_ = process.get();
+    }
+    if (!conf.name.empty()) {
+        setName(conf.name);
+    }
+    if (conf.timeout) {
+        recv_timeout_ = conf.timeout;
+    }
+    return true;
+}
+
 void TcpServer::handleClient(Socket::ptr client)
 {
     LOG_INFO(g_logger) << "handleClient: " << *client;
@@ -117,7 +570,14 @@ std::string TcpServer::toString(const std::string& prefix)
     ss << prefix << "[type=" << type_ << " name=" << server_name_
        << " io_worker=" << (io_worker_ ? io_worker_->getName() : "")
        << " accept=" << (accept_worker_ ? accept_worker_->getName() : "")
-       << " recv_timeout=" << recv_timeout_ << "]" << std::endl;
+       << " process=" << (getProcessWorker() ? getProcessWorker()->getName() : "")
+       << " recv_timeout=" << recv_timeout_ << " connections=" << conn_count_
+       << " max_connections=" << max_connections_ << " shed=" << shed_count_
+       << " draining=" << is_draining_ << " loads=";
+    for (size_t i = 0; i < worker_threads_.size(); ++i) {
+        ss << (i ? "," : "") << worker_threads_[i] << ":" << worker_loads_[i];
+    }
+    ss << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
     for (auto& i : sockets_) {
         ss << pfx << pfx << *i << std::endl;
@@ -9,22 +9,108 @@
 #define HIPER_TCP_SERVER_H
 
 #include "address.h"
+#include "arena.h"
 #include "config.h"
 #include "iomanager.h"
+#include "mutex.h"
 #include "noncopyable.h"
 #include "socket.h"
 
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <set>
+#include <vector>
 
 namespace hiper {
 
+/**
+ * @brief 服务器配置，对应server.yml中servers下的一项
+ */
+struct TcpServerConf
+{
+    typedef std::shared_ptr<TcpServerConf> ptr;
+
+    // 监听地址，ip:port、域名:port或者以/开头的Unix域socket路径
+    std::vector<std::string> address;
+    int                      keepalive = 0;
+    // 读超时时间(毫秒)
+    int         timeout = 1000 * 2 * 60;
+    std::string name;
+    // 服务器类型，http/ws等
+    std::string type = "http";
+    // 各个任务使用的调度器名称
+    std::string accept_worker;
+    std::string io_worker;
+    std::string process_worker;
+
+    bool isValid() const { return !address.empty(); }
+
+    bool operator==(const TcpServerConf& oth) const
+    {
+        return address == oth.address && keepalive == oth.keepalive && timeout == oth.timeout &&
+               name == oth.name && type == oth.type && accept_worker == oth.accept_worker &&
+               io_worker == oth.io_worker && process_worker == oth.process_worker;
+    }
+};
+
+template<> class LexicalCast<std::string, TcpServerConf> {
+public:
+    TcpServerConf operator()(const std::string& v)
+    {
+        YAML::Node    node = YAML::Load(v);
+        TcpServerConf conf;
+        conf.keepalive      = node["keepalive"].as<int>(conf.keepalive);
+        conf.timeout        = node["timeout"].as<int>(conf.timeout);
+        conf.name           = node["name"].as<std::string>(conf.name);
+        conf.type           = node["type"].as<std::string>(conf.type);
+        conf.accept_worker  = node["accept_worker"].as<std::string>(conf.accept_worker);
+        conf.io_worker      = node["io_worker"].as<std::string>(conf.io_worker);
+        conf.process_worker = node["process_worker"].as<std::string>(conf.process_worker);
+        if (node["address"].IsDefined()) {
+            for (size_t i = 0; i < node["address"].size(); ++i) {
+                conf.address.push_back(node["address"][i].as<std::string>());
+            }
+        }
+        return conf;
+    }
+};
+
+template<> class LexicalCast<TcpServerConf, std::string> {
+public:
+    std::string operator()(const TcpServerConf& conf)
+    {
+        YAML::Node node;
+        node["keepalive"]      = conf.keepalive;
+        node["timeout"]        = conf.timeout;
+        node["name"]           = conf.name;
+        node["type"]           = conf.type;
+        node["accept_worker"]  = conf.accept_worker;
+        node["io_worker"]      = conf.io_worker;
+        node["process_worker"] = conf.process_worker;
+        for (auto& i : conf.address) {
+            node["address"].push_back(i);
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+};
+
 class TcpServer : public std::enable_shared_from_this<TcpServer>, public Noncopyable {
 public:
     typedef std::shared_ptr<TcpServer> ptr;
+    typedef Mutex                      MutexType;
 
-    TcpServer(hiper::IOManager* worker        = hiper::IOManager::GetThis(),
-              hiper::IOManager* accept_worker = hiper::IOManager::GetThis());
+    /**
+     * @brief 构造函数
+     * @param[in] worker 处理连接的调度器
+     * @param[in] accept_worker 接受连接的调度器
+     * @param[in] process_worker 处理CPU密集任务的调度器，nullptr表示与worker相同
+     */
+    TcpServer(hiper::IOManager* worker         = hiper::IOManager::GetThis(),
+              hiper::IOManager* accept_worker  = hiper::IOManager::GetThis(),
+              hiper::Scheduler* process_worker = nullptr);
 
     virtual ~TcpServer();
 
@@ -42,6 +128,11 @@ public:
      */
     virtual bool bind(const std::vector<Address::ptr>& addrs, std::vector<Address::ptr>& fails);
 
+    /**
+     * @brief 使用已经bind并listen的socket，例如prefork模式下从master继承的监听socket
+     */
+    void addListenSocket(Socket::ptr sock) { sockets_.push_back(sock); }
+
     /**
      * @brief 启动服务
      * @pre 需要bind成功后执行
@@ -53,6 +144,59 @@ public:
      */
     virtual void stop();
 
+    /**
+     * @brief 平滑停止：停止accept，等待正在处理的连接结束
+     * @details 等待期间每秒输出一次剩余的连接数，handleClient可以通过isDraining判断是否应尽快结束，
+     *          例如不再保持keep-alive。超时后对剩余连接执行shutdown，阻塞在读写上的处理协程随即返回。
+     *          在协程中调用时需要开启hook，否则会阻塞所在线程
+     * @param[in] timeout_ms 最长等待时间(毫秒)
+     * @return 所有连接在超时前结束返回true
+     */
+    bool drain(uint64_t timeout_ms);
+
+    /**
+     * @brief 平滑停止当前进程中所有已启动的服务器
+     * @details 先停止全部服务器的accept，再逐个drain，总等待时间不超过timeout_ms。
+     *          prefork模式下worker收到SIGTERM时调用
+     * @return 所有连接在超时前结束返回true
+     */
+    static bool DrainAll(uint64_t timeout_ms);
+
+    /**
+     * @brief 把监听socket交给新进程，用于不中断服务的升级
+     * @details 在path上监听Unix域socket，等待新进程调用takeover连接，通过SCM_RIGHTS发送全部监听fd，
+     *          收到确认后停止本进程的accept。监听队列始终由内核持有，交接过程中不会丢失排队的连接。
+     *          之后通常再调用drain等待已有连接结束。path上已经有进程在等待交接时直接失败，
+     *          没有人监听的残留文件由Socket::bind删除
+     * @param[in] path Unix域socket路径
+     * @param[in] timeout_ms 等待新进程的超时时间(毫秒)
+     * @return 交接成功返回true，失败时本进程继续正常服务
+     */
+    bool handoff(const std::string& path, uint64_t timeout_ms);
+
+    /**
+     * @brief 从旧进程接管监听socket，代替bind
+     * @param[in] path 旧进程handoff使用的Unix域socket路径
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @return 没有旧进程或接管失败返回false，调用方可以退回到bind
+     */
+    bool takeover(const std::string& path, uint64_t timeout_ms);
+
+    /**
+     * @brief 按配置设置名称、超时时间和调度器
+     * @details accept_worker/io_worker/process_worker按名称从WorkerMgr中查找，
+     *          为空时保持构造时的调度器，需要在start之前调用
+     * @return 引用的调度器不存在时返回false
+     */
+    bool setConf(const TcpServerConf& conf);
+
+    /**
+     * @brief 返回处理CPU密集任务的调度器
+     * @details handleClient中可以用SchedulerSwitcher切换到这个调度器执行耗时的计算，
+     *          避免占用io线程，完成后切回
+     */
+    Scheduler* getProcessWorker() const { return process_worker_ ? process_worker_ : io_worker_; }
+
     /**
      * @brief 返回读取超时时间(毫秒)
      */
@@ -78,6 +222,31 @@ public:
      */
     bool isStop() const { return is_stop_; }
 
+    /**
+     * @brief 是否正在平滑停止
+     */
+    bool isDraining() const { return is_draining_; }
+
+    /**
+     * @brief 返回最大连接数，0表示不限制
+     */
+    uint32_t getMaxConnections() const { return max_connections_; }
+
+    /**
+     * @brief 设置最大连接数，达到上限后暂停accept，连接释放后自动恢复
+     */
+    void setMaxConnections(uint32_t v) { max_connections_ = v; }
+
+    /**
+     * @brief 返回正在处理的连接数
+     */
+    size_t getConnectionCount() const { return conn_count_; }
+
+    /**
+     * @brief 返回fd耗尽时被直接关闭的连接数
+     */
+    uint64_t getShedCount() const { return shed_count_; }
+
     /**
      * @brief 以字符串形式dump server信息
      */
@@ -91,9 +260,39 @@ protected:
 
     /**
      * @brief 开始接受连接
+     * @details 每次就绪时一次取出backlog中的多个连接(最多tcp_server.accept_batch个)，
+     *          取完后等待监听socket的读事件
      */
     virtual void startAccept(Socket::ptr sock);
 
+    /**
+     * @brief 把新连接交给负载最低的io线程处理
+     */
+    void dispatchClient(Socket::ptr client);
+
+    /**
+     * @brief 连接处理结束，释放连接数，必要时恢复accept
+     * @param[in] worker 连接所在的io线程下标，-1表示未指定线程
+     */
+    void releaseClient(const Socket::ptr& client, int worker);
+
+    /**
+     * @brief 连接数达到上限时挂起当前accept协程，直到有连接释放
+     */
+    void waitConnectionSlot();
+
+    /**
+     * @brief 唤醒所有被挂起的accept协程
+     */
+    void resumeAccept();
+
+    /**
+     * @brief fd耗尽(EMFILE/ENFILE)时释放预留fd，取出一个连接后立即关闭
+     * @details 否则backlog中的连接一直保持就绪，accept循环会不停空转
+     * @return 是否取出了连接
+     */
+    bool shedConnection(Socket::ptr sock);
+
 protected:
     // 监听Socket数组
     std::vector<Socket::ptr> sockets_;
@@ -101,6 +300,8 @@ protected:
     IOManager* io_worker_;
     // 服务器Socket接收连接的调度器
     IOManager* accept_worker_;
+    // 处理CPU密集任务的调度器
+    Scheduler* process_worker_;
     // 接收超时时间(毫秒)
     uint64_t recv_timeout_;
     // 服务器名称
@@ -109,6 +310,28 @@ protected:
     std::string type_;
     // 服务是否停止
     bool is_stop_;
+    // 是否正在平滑停止
+    std::atomic<bool> is_draining_ = {false};
+    // 最大连接数，0表示不限制
+    uint32_t max_connections_;
+    // 一次就绪事件中最多accept的连接数
+    uint32_t accept_batch_;
+    // 正在处理的连接数
+    std::atomic<size_t> conn_count_ = {0};
+    // 正在处理的连接，drain超时后关闭，节点从空闲链表分配
+    std::set<Socket::ptr, std::less<Socket::ptr>, PoolAllocator<Socket::ptr>> clients_;
+    // io_worker_中除caller线程外的线程id，以及每个线程上正在处理的连接数
+    std::vector<int>                        worker_threads_;
+    std::unique_ptr<std::atomic<size_t>[]> worker_loads_;
+    // 选择io线程时的起始位置，负载相同时轮流分配
+    std::atomic<size_t> next_worker_ = {0};
+    // 因连接数达到上限而挂起的accept协程及其所在线程
+    std::vector<std::pair<Fiber::ptr, int>> paused_;
+    // 预留的fd，fd耗尽时用于取出并关闭连接
+    int reserve_fd_;
+    // fd耗尽时被关闭的连接数
+    std::atomic<uint64_t> shed_count_ = {0};
+    MutexType             mutex_;
 };
 
 }   // namespace hiper
@@ -11,6 +11,9 @@
 #include "log.h"
 #include "util.h"
 
+#include <sched.h>
+#include <string.h>
+
 namespace hiper {
 
 static thread_local Thread*     g_cur_thread      = nullptr;
@@ -97,4 +100,24 @@ void Thread::SetName(const std::string& name)
     return;
 }
 
+bool Thread::SetAffinity(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rt) {
+        LOG_ERROR(LOG_NAME("system")) << "pthread_setaffinity_np cpu=" << cpu << " thread="
+                                      << g_cur_thread_name << " rt=" << rt
+                                      << " errstr=" << strerror(rt);
+        return false;
+    }
+    return true;
+}
+
+int Thread::GetCpu()
+{
+    return sched_getcpu();
+}
+
 }   // namespace hiper
\ No newline at end of file
@@ -38,6 +38,17 @@ public:
     static const std::string& GetName();
     static void               SetName(const std::string& name);
 
+    /**
+     * @brief 将当前线程绑定到指定的cpu上
+     * @return 成功返回true
+     */
+    static bool SetAffinity(int cpu);
+
+    /**
+     * @brief 当前线程正在运行的cpu，失败返回-1
+     */
+    static int GetCpu();
+
 private:
     static void* run(void*);
 
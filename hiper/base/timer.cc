@@ -1,5 +1,6 @@
 #include "timer.h"
 
+#include "metrics.h"
 #include "util.h"
 
 #include <cstdint>
@@ -7,6 +8,10 @@
 
 namespace hiper {
 
+// 定时器实际触发的时间比预定时间晚了多少，反映epoll_wait超时精度和调度线程的繁忙程度
+static Histogram::ptr s_timer_lateness_ms = MetricsMgr::GetInstance()->histogram(
+    "hiper_timer_lateness_ms", "delay between a timer's expiration and its dispatch");
+
 Timer::Timer(uint64_t ms, TimeoutCallBack cb, bool is_recurring, TimerManger* manager)
 {
     is_recurring_  = is_recurring; // 是否循环定时器，超时时间到了之后是否需要重新添加到定时器管理器中
@@ -219,6 +224,7 @@ void TimerManger::listExpiredCb(std::vector<std::function<void()>>& cbs)
     timers_.erase(timers_.begin(), it);
     cbs.reserve(expired.size());
     for (auto& timer : expired) {
+        s_timer_lateness_ms->record(now - timer->expiration_);
         cbs.push_back(timer->cb_);
         if (timer->is_recurring_) {
             timer->expiration_ = now + timer->ms_;
@@ -236,6 +242,12 @@ bool TimerManger::hasTimer()
     return !timers_.empty();
 }
 
+size_t TimerManger::getTimerCount()
+{
+    RWMutexType::ReadLock lock(mtx_);
+    return timers_.size();
+}
+
 // bool TimerManger::detectClockRollover(uint64_t now)
 // {
 //     bool rollover = false;
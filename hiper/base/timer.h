@@ -90,6 +90,8 @@ public:
 
     bool hasTimer();   // 是否有定时器
 
+    size_t getTimerCount();   // 定时器个数
+
 protected:
     virtual void onTimerInsertedAtFront() = 0;   // 当有新的定时器插入到定时器首部时执行该函数
 
@@ -18,6 +18,9 @@
 #include <execinfo.h>   // for backtrace()
 #include <fstream>
 #include <iomanip>
+#include <sched.h>
+#include <set>
+#include <sstream>
 #include <signal.h>   // for kill()
 #include <string.h>
 #include <sys/stat.h>
@@ -48,6 +51,18 @@ uint64_t GetElapsedMS()
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
+/**
+ * @brief 微秒精度的单调时间，用于统计耗时
+ *
+ * @return uint64_t
+ */
+uint64_t GetElapsedUS()
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000 * 1000 + ts.tv_nsec / 1000;
+}
+
 uint64_t GetFiberId()
 {
     return hiper::Fiber::GetFiberId();
@@ -356,6 +371,43 @@ std::string BacktraceToString(int size, int skip, const std::string& prefix)
     return ss.str();
 }
 
+std::string BacktraceToString(void* const* frames, int size, const std::string& prefix)
+{
+    if (size <= 0) {
+        return "";
+    }
+    char** strings = ::backtrace_symbols(frames, size);
+    if (strings == nullptr) {
+        LOG_ERROR(g_logger) << "backtrace_symbols error";
+        return "";
+    }
+    // backtrace_symbols的格式是 binary(mangled+0x12) [0x...]
+    std::stringstream ss;
+    for (int i = 0; i < size; ++i) {
+        std::string line  = strings[i];
+        size_t      begin = line.find('(');
+        size_t      end   = line.find('+', begin);
+        size_t      close = line.find(')', end);
+        if (begin != std::string::npos && end != std::string::npos && close != std::string::npos &&
+            end > begin + 1) {
+            line = Demangle(line.substr(begin + 1, end - begin - 1).c_str()) +
+                   line.substr(end, close - end);
+        }
+        ss << prefix << line << std::endl;
+    }
+    free(strings);
+    return ss.str();
+}
+
+std::string Demangle(const char* name)
+{
+    int         status = 0;
+    char*       buf    = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    std::string rt     = status == 0 && buf ? buf : name;
+    free(buf);
+    return rt;
+}
+
 
 
 
@@ -847,4 +899,136 @@ std::wstring StringUtil::StringToWString(const std::string& s)
 
 
 
+std::vector<int> CpuUtil::ParseCpuList(const std::string& str)
+{
+    std::set<int> cpus;
+    std::string   list = StringUtil::Trim(str);
+    // getline不会返回末尾逗号之后的空项，单独检查
+    if (list.empty() || list.back() == ',') {
+        return {};
+    }
+    std::stringstream ss(list);
+    std::string       item;
+    while (std::getline(ss, item, ',')) {
+        item = StringUtil::Trim(item);
+        // 数字之后只能是'-'或者项的结尾，"3x"、"0-3,,"这类输入整体视为格式错误
+        const char* p     = item.c_str();
+        char*       end   = nullptr;
+        long        first = strtol(p, &end, 10);
+        if (end == p || !isdigit(*p)) {
+            return {};
+        }
+        long last = first;
+        if (*end == '-') {
+            p    = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || !isdigit(*p)) {
+                return {};
+            }
+        }
+        if (*end != '\0' || last < first || last >= CPU_SETSIZE) {
+            return {};
+        }
+        for (long i = first; i <= last; ++i) {
+            cpus.insert(i);
+        }
+    }
+    return std::vector<int>(cpus.begin(), cpus.end());
+}
+
+std::vector<int> CpuUtil::GetAllowedCpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t        set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set)) {
+        return cpus;
+    }
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &set)) {
+            cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+int CpuUtil::GetNumaNode(int cpu)
+{
+    // /sys/devices/system/cpu/cpuN/ 下有一个nodeX的链接
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR*        dir  = opendir(path.c_str());
+    if (!dir) {
+        return 0;
+    }
+    int            node = 0;
+    struct dirent* dp   = nullptr;
+    while ((dp = readdir(dir)) != nullptr) {
+        if (strncmp(dp->d_name, "node", 4) == 0 && isdigit(dp->d_name[4])) {
+            node = atoi(dp->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+std::vector<int> CpuUtil::GetNodeCpus(int node)
+{
+    std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string   line;
+    if (!ifs || !std::getline(ifs, line)) {
+        return {};
+    }
+    return ParseCpuList(line);
+}
+
+std::vector<int> CpuUtil::GetIrqCpus(const std::string& name)
+{
+    std::set<int> cpus;
+    std::ifstream ifs("/proc/interrupts");
+    std::string   line;
+    while (std::getline(ifs, line)) {
+        size_t pos = line.find(':');
+        if (pos == std::string::npos || line.find(name, pos) == std::string::npos) {
+            continue;
+        }
+        std::string irq = StringUtil::Trim(line.substr(0, pos));
+        if (irq.empty() || !isdigit(irq[0])) {
+            continue;
+        }
+        std::ifstream aff("/proc/irq/" + irq + "/smp_affinity_list");
+        std::string   list;
+        if (aff && std::getline(aff, list)) {
+            for (int cpu : ParseCpuList(list)) {
+                cpus.insert(cpu);
+            }
+        }
+    }
+    return std::vector<int>(cpus.begin(), cpus.end());
+}
+
+std::vector<int> CpuUtil::Resolve(const std::string& spec)
+{
+    std::vector<int> cpus;
+    if (spec.compare(0, 5, "node:") == 0) {
+        cpus = GetNodeCpus(atoi(spec.c_str() + 5));
+    }
+    else if (spec.compare(0, 4, "irq:") == 0) {
+        cpus = GetIrqCpus(spec.substr(4));
+    }
+    else {
+        cpus = ParseCpuList(spec);
+    }
+
+    std::vector<int> allowed = GetAllowedCpus();
+    std::vector<int> rt;
+    std::set_intersection(cpus.begin(), cpus.end(), allowed.begin(), allowed.end(),
+                          std::back_inserter(rt));
+    if (rt.size() != cpus.size()) {
+        LOG_WARN(g_logger) << "cpu spec [" << spec << "] has " << cpus.size() - rt.size()
+                           << " cpus not allowed for this process";
+    }
+    return rt;
+}
+
 }   // namespace hiper
\ No newline at end of file
@@ -27,6 +27,8 @@ pid_t    GetThreadId();
 
 uint64_t GetElapsedMS();
 
+uint64_t GetElapsedUS();
+
 uint64_t GetFiberId();
 
 std::string GetThreadName();
@@ -68,6 +70,17 @@ void Backtrace(std::vector<std::string> &bt, int size = 64, int skip = 1);
 
 std::string BacktraceToString(int size = 64, int skip = 2, const std::string &prefix = "    ");
 
+/**
+ * @brief 符号化已经保存的返回地址，能解析出函数名时每行输出 函数名+偏移
+ * @details 用于在其他线程(比如watchdog)或者稍后输出某个时刻采集的调用栈
+ */
+std::string BacktraceToString(void *const *frames, int size, const std::string &prefix = "    ");
+
+/**
+ * @brief 还原C++符号名，失败时原样返回
+ */
+std::string Demangle(const char *name);
+
 
 /**
  * @brief 文件系统操作类
@@ -223,6 +236,50 @@ public:
 };
 
 
+/**
+ * @brief cpu与NUMA拓扑，从/sys和/proc中读取
+ */
+class CpuUtil {
+public:
+    /**
+     * @brief 解析cpu列表，格式与/sys中的cpulist相同，比如 "0-3,8,10-11"
+     * @return 排序去重后的cpu编号，有空项、多余字符或超出CPU_SETSIZE时返回空
+     */
+    static std::vector<int> ParseCpuList(const std::string& str);
+
+    /**
+     * @brief 当前进程允许使用的cpu，参考sched_getaffinity(2)
+     */
+    static std::vector<int> GetAllowedCpus();
+
+    /**
+     * @brief cpu所在的NUMA节点，没有NUMA信息时返回0
+     */
+    static int GetNumaNode(int cpu);
+
+    /**
+     * @brief NUMA节点上的cpu
+     */
+    static std::vector<int> GetNodeCpus(int node);
+
+    /**
+     * @brief 处理指定设备中断的cpu
+     * @details 在/proc/interrupts中查找名称包含name的中断(比如网卡名eth0)，
+     *          读取/proc/irq/N/smp_affinity_list
+     */
+    static std::vector<int> GetIrqCpus(const std::string& name);
+
+    /**
+     * @brief 按配置字符串解析cpu集合，结果只保留进程允许使用的cpu
+     * @details 支持以下格式：
+     *          "0-3,8"     cpu列表
+     *          "node:1"    NUMA节点1上的cpu
+     *          "irq:eth0"  处理eth0中断的cpu
+     */
+    static std::vector<int> Resolve(const std::string& spec);
+};
+
+
 }   // namespace hiper
 
 
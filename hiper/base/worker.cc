@@ -0,0 +1,135 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-18 10:05:37
+ * @Description: 按配置创建的具名协程调度器(线程池)
+ */
+
+#include "worker.h"
+
+#include "config.h"
+#include "log.h"
+
+#include <algorithm>
+
+namespace hiper {
+
+static hiper::Logger::ptr g_logger = LOG_NAME("system");
+
+static hiper::ConfigVar<std::map<std::string, std::map<std::string, std::string>>>::ptr
+    g_worker_config = hiper::Config::Lookup(
+        "workers", std::map<std::string, std::map<std::string, std::string>>(),
+        "worker config");
+
+static std::string GetParam(const std::map<std::string, std::string>& m, const std::string& key,
+                            const std::string& def)
+{
+    auto it = m.find(key);
+    return it == m.end() ? def : it->second;
+}
+
+bool WorkerManager::add(Scheduler::ptr s)
+{
+    RWMutexType::WriteLock lock(mutex_);
+    if (!datas_.emplace(s->getName(), s).second) {
+        LOG_ERROR(g_logger) << "worker " << s->getName() << " already exists";
+        return false;
+    }
+    stop_ = false;
+    return true;
+}
+
+Scheduler::ptr WorkerManager::get(const std::string& name)
+{
+    RWMutexType::ReadLock lock(mutex_);
+    auto                  it = datas_.find(name);
+    return it == datas_.end() ? nullptr : it->second;
+}
+
+IOManager::ptr WorkerManager::getAsIOManager(const std::string& name)
+{
+    return std::dynamic_pointer_cast<IOManager>(get(name));
+}
+
+bool WorkerManager::init()
+{
+    return init(g_worker_config->getValue());
+}
+
+bool WorkerManager::init(const std::map<std::string, std::map<std::string, std::string>>& v)
+{
+    for (auto& i : v) {
+        const std::string& name       = i.first;
+        int                thread_num = atoi(GetParam(i.second, "thread_num", "1").c_str());
+        if (thread_num <= 0) {
+            LOG_ERROR(g_logger) << "worker " << name << " invalid thread_num=" << thread_num;
+            return false;
+        }
+        if (get(name)) {
+            LOG_ERROR(g_logger) << "worker " << name << " already exists";
+            return false;
+        }
+
+        // idle时阻塞在epoll_wait上，process这类CPU密集的调度器同样使用IOManager
+        Scheduler::ptr s(new IOManager(thread_num, false, name));
+        add(s);
+        LOG_INFO(g_logger) << "worker " << name << " thread_num=" << thread_num << " started";
+    }
+    return true;
+}
+
+void WorkerManager::stop()
+{
+    std::map<std::string, Scheduler::ptr> datas;
+    {
+        RWMutexType::WriteLock lock(mutex_);
+        if (stop_) {
+            return;
+        }
+        stop_ = true;
+        datas.swap(datas_);
+    }
+    for (auto& i : datas) {
+        i.second->stop();
+    }
+}
+
+size_t WorkerManager::getCount()
+{
+    RWMutexType::ReadLock lock(mutex_);
+    return datas_.size();
+}
+
+std::vector<WorkerManager::Stats> WorkerManager::getStats()
+{
+    std::vector<Scheduler::ptr> schedulers;
+    {
+        RWMutexType::ReadLock lock(mutex_);
+        for (auto& i : datas_) {
+            schedulers.push_back(i.second);
+        }
+    }
+    std::vector<Stats> rt;
+    for (auto& s : schedulers) {
+        Stats st;
+        st.name     = s->getName();
+        st.threads  = s->getThreadCount();
+        st.active   = s->getActiveThreadCount();
+        st.idle     = s->getIdleThreadCount();
+        st.queued   = s->getTaskCount();
+        st.executed = s->getExecutedCount();
+        rt.push_back(st);
+    }
+    return rt;
+}
+
+std::ostream& WorkerManager::dump(std::ostream& os)
+{
+    for (auto& i : getStats()) {
+        os << "[Worker name=" << i.name << " threads=" << i.threads << " active=" << i.active
+           << " idle=" << i.idle << " queued=" << i.queued << " executed=" << i.executed << "]"
+           << std::endl;
+    }
+    return os;
+}
+
+}   // namespace hiper
@@ -0,0 +1,124 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-18 09:42:16
+ * @Description: 按配置创建的具名协程调度器(线程池)
+ */
+
+#ifndef HIPER_WORKER_H
+#define HIPER_WORKER_H
+
+#include "iomanager.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+#include "singleton.h"
+
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace hiper {
+
+/**
+ * @brief 具名调度器管理
+ * @details 按配置workers创建IOManager，每一项是一个调度器：
+ *          workers:
+ *              io:
+ *                  thread_num: 4
+ *              accept:
+ *                  thread_num: 1
+ *              process:
+ *                  thread_num: 8
+ *          用于CPU密集处理的调度器(比如process)与io调度器分开配置，处理函数可以用SchedulerSwitcher
+ *          从io线程切换过去，完成后再切回来，io线程不会被长时间占用。
+ *          调度器的名称就是配置中的名称，scheduler.affinity按这个名称绑定cpu。
+ *          所有调度器都不使用caller线程，stop需要在这些调度器之外的线程中调用
+ */
+class WorkerManager : public Noncopyable {
+public:
+    typedef RWMutex RWMutexType;
+
+    /**
+     * @brief 调度器的负载统计
+     */
+    struct Stats
+    {
+        std::string name;
+        size_t      threads  = 0;   // 线程数
+        size_t      active   = 0;   // 正在执行任务的线程数
+        size_t      idle     = 0;   // 空闲线程数
+        size_t      queued   = 0;   // 排队等待的任务数
+        uint64_t    executed = 0;   // 已执行的任务数
+    };
+
+    /**
+     * @brief 添加一个已经启动的调度器，名称重复时返回false
+     */
+    bool add(Scheduler::ptr s);
+
+    /**
+     * @brief 按名称查找调度器，不存在返回nullptr
+     */
+    Scheduler::ptr get(const std::string& name);
+
+    /**
+     * @brief 按名称查找IOManager，不存在或不是IOManager时返回nullptr
+     */
+    IOManager::ptr getAsIOManager(const std::string& name);
+
+    /**
+     * @brief 按配置workers创建并启动调度器
+     * @return 全部创建成功返回true
+     */
+    bool init();
+
+    /**
+     * @brief 按给定的配置创建并启动调度器，格式与配置workers相同
+     */
+    bool init(const std::map<std::string, std::map<std::string, std::string>>& v);
+
+    /**
+     * @brief 停止所有调度器，队列中的任务执行完后返回
+     */
+    void stop();
+
+    bool isStoped() const { return stop_; }
+
+    // 调度器个数
+    size_t getCount();
+
+    /**
+     * @brief 在指定的调度器上执行
+     * @return 调度器不存在返回false
+     */
+    template<class FiberOrCb> bool schedule(const std::string& name, FiberOrCb fc, int thread = -1)
+    {
+        Scheduler::ptr s = get(name);
+        if (!s) {
+            return false;
+        }
+        s->schedule(fc, thread);
+        return true;
+    }
+
+    /**
+     * @brief 所有调度器的负载统计，按名称排序
+     */
+    std::vector<Stats> getStats();
+
+    std::ostream& dump(std::ostream& os);
+
+private:
+    RWMutexType                           mutex_;
+    std::map<std::string, Scheduler::ptr> datas_;
+    bool                                  stop_ = false;
+};
+
+// 全局具名调度器
+typedef Singleton<WorkerManager> WorkerMgr;
+
+}   // namespace hiper
+
+#endif   // HIPER_WORKER_H
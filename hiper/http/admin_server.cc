@@ -0,0 +1,194 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-19 10:30:06
+ * @Description: 内置的管理端口，提供/metrics和/debug接口
+ */
+#include "admin_server.h"
+
+#include "../base/config.h"
+#include "../base/fdmanager.h"
+#include "../base/fiber.h"
+#include "../base/log.h"
+#include "../base/metrics.h"
+#include "../base/task_monitor.h"
+#include "../base/worker.h"
+
+#include <sstream>
+#include <sys/resource.h>
+
+namespace hiper {
+namespace http {
+
+static hiper::Logger::ptr g_logger = LOG_NAME("system");
+
+static hiper::ConfigVar<std::string>::ptr g_admin_address = hiper::Config::Lookup(
+    "admin.address", std::string(""), "admin http listen address, empty means disabled");
+
+static hiper::ConfigVar<int>::ptr g_admin_nice =
+    hiper::Config::Lookup("admin.nice", (int)10, "nice value of admin threads");
+
+static const char* s_admin_worker = "admin";
+
+static void SetText(HttpResponse::ptr rsp, const std::string& body)
+{
+    rsp->setHeader("Content-Type", "text/plain; charset=utf-8");
+    rsp->setBody(body);
+}
+
+AdminServer::AdminServer(IOManager* worker)
+    : HttpServer(true, worker, worker)
+{
+    type_ = "admin";
+    registerHandlers();
+}
+
+void AdminServer::registerHandlers()
+{
+    addHandler("/metrics", [](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr) {
+        rsp->setHeader("Content-Type", "text/plain; version=0.0.4");
+        rsp->setBody(MetricsMgr::GetInstance()->toPrometheus());
+        return 0;
+    });
+
+    auto index = [](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr) {
+        SetText(rsp,
+                "/metrics\n"
+                "/debug/schedulers\n"
+                "/debug/fibers\n"
+                "/debug/fds\n"
+                "/debug/timers\n"
+                "/debug/config\n"
+                "/debug/profile\n"
+                "/debug/profile/reset\n");
+        return 0;
+    };
+    addHandler("/", index);
+    addHandler("/debug", index);
+    addHandler("/debug/", index);
+
+    addHandler("/debug/schedulers",
+               [](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr) {
+                   std::stringstream ss;
+                   WorkerMgr::GetInstance()->dump(ss);
+                   for (auto& i : WorkerMgr::GetInstance()->getStats()) {
+                       Scheduler::ptr s = WorkerMgr::GetInstance()->get(i.name);
+                       if (s) {
+                           ss << std::endl;
+                           s->dump(ss);
+                       }
+                   }
+                   ss << std::endl;
+                   SetText(rsp, ss.str());
+                   return 0;
+               });
+
+    addHandler("/debug/fibers", [](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr) {
+        std::stringstream ss;
+        Fiber::DumpFibers(ss);
+        SetText(rsp, ss.str());
+        return 0;
+    });
+
+    addHandler("/debug/fds", [](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr) {
+        std::stringstream ss;
+        size_t            count = 0;
+        FdMgr::GetInstance()->visit([&ss, &count](FdCtx::ptr ctx) {
+            if (ctx->isClose()) {
+                return;
+            }
+            ++count;
+            ss << "fd=" << ctx->getFd() << " socket=" << ctx->isSocket()
+               << " sys_nonblock=" << ctx->getSysNonblock()
+               << " user_nonblock=" << ctx->getUserNonblock();
+            uint64_t rto = ctx->getTimeout(SO_RCVTIMEO);
+            uint64_t sto = ctx->getTimeout(SO_SNDTIMEO);
+            if (rto != (uint64_t)-1) {
+                ss << " recv_timeout=" << rto;
+            }
+            if (sto != (uint64_t)-1) {
+                ss << " send_timeout=" << sto;
+            }
+            ss << "\n";
+        });
+        SetText(rsp, "fds=" + std::to_string(count) + "\n" + ss.str());
+        return 0;
+    });
+
+    addHandler("/debug/timers", [](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr) {
+        std::stringstream ss;
+        for (auto& i : WorkerMgr::GetInstance()->getStats()) {
+            IOManager::ptr iom = WorkerMgr::GetInstance()->getAsIOManager(i.name);
+            if (iom) {
+                ss << i.name << " timers=" << iom->getTimerCount() << "\n";
+            }
+        }
+        SetText(rsp, ss.str());
+        return 0;
+    });
+
+    addHandler("/debug/profile", [](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr) {
+        std::stringstream ss;
+        TaskMonitor::DumpProfile(ss);
+        SetText(rsp, ss.str());
+        return 0;
+    });
+
+    addHandler("/debug/profile/reset",
+               [](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr) {
+                   TaskMonitor::ResetProfile();
+                   SetText(rsp, "ok\n");
+                   return 0;
+               });
+
+    addHandler("/debug/config", [](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr) {
+        std::stringstream ss;
+        Config::Visit([&ss](ConfigVarBase::ptr var) {
+            ss << "# " << var->getDescription() << "\n"
+               << var->getName() << " (" << var->getTypeName() << "): " << var->toString()
+               << "\n";
+        });
+        SetText(rsp, ss.str());
+        return 0;
+    });
+}
+
+AdminServer::ptr AdminServer::Start(const std::string& address)
+{
+    std::string addr_str = address.empty() ? g_admin_address->getValue() : address;
+    if (addr_str.empty()) {
+        return nullptr;
+    }
+    Address::ptr addr = Address::LookupAny(addr_str);
+    if (!addr) {
+        LOG_ERROR(g_logger) << "admin server invalid address: " << addr_str;
+        return nullptr;
+    }
+
+    // 独立的调度器，由WorkerMgr负责停止；业务调度器繁忙时管理接口仍然可以响应
+    IOManager::ptr iom = WorkerMgr::GetInstance()->getAsIOManager(s_admin_worker);
+    if (!iom) {
+        if (!WorkerMgr::GetInstance()->init({{s_admin_worker, {{"thread_num", "1"}}}})) {
+            return nullptr;
+        }
+        iom = WorkerMgr::GetInstance()->getAsIOManager(s_admin_worker);
+        int nice = g_admin_nice->getValue();
+        for (auto& p : iom->getPlacements()) {
+            if (setpriority(PRIO_PROCESS, p.thread_id, nice)) {
+                LOG_WARN(g_logger) << "admin thread " << p.thread_id << " setpriority(" << nice
+                                   << ") errno=" << errno << " errstr=" << strerror(errno);
+            }
+        }
+    }
+
+    AdminServer::ptr server(new AdminServer(iom.get()));
+    server->setName("hiper/admin");
+    if (!server->bind(addr) || !server->start()) {
+        LOG_ERROR(g_logger) << "admin server start fail, address=" << addr_str;
+        return nullptr;
+    }
+    LOG_INFO(g_logger) << "admin server listen on " << *addr;
+    return server;
+}
+
+}   // namespace http
+}   // namespace hiper
@@ -0,0 +1,50 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-19 10:30:06
+ * @Description: 内置的管理端口，提供/metrics和/debug接口
+ */
+#ifndef HIPER_ADMIN_SERVER_H
+#define HIPER_ADMIN_SERVER_H
+
+#include "http_server.h"
+
+#include <memory>
+#include <string>
+
+namespace hiper {
+namespace http {
+
+/**
+ * @brief 管理服务器
+ * @details 在独立的IOManager(WorkerMgr中的admin，默认1个线程)上运行，业务线程打满时仍然可以访问。
+ *          admin线程的nice值由admin.nice设置，只在CPU空闲时让出，不和业务线程争抢CPU。
+ *          接口：
+ *          /metrics            Prometheus格式的指标
+ *          /debug/schedulers   WorkerMgr中各调度器的dump和负载
+ *          /debug/fibers       协程总数，开启fiber.trace后还有每个协程的状态和调用栈
+ *          /debug/fds          FdManager中每个fd的状态
+ *          /debug/timers       各IOManager的定时器个数
+ *          /debug/config       所有配置项的当前值
+ *          /debug/profile      按回调统计的任务耗时(scheduler.profile)，/debug/profile/reset清零
+ */
+class AdminServer : public HttpServer {
+public:
+    typedef std::shared_ptr<AdminServer> ptr;
+
+    AdminServer(IOManager* worker);
+
+    /**
+     * @brief 创建admin调度器并启动管理服务器
+     * @param[in] address 监听地址，为空时使用配置admin.address
+     * @return 地址为空或绑定失败返回nullptr
+     */
+    static AdminServer::ptr Start(const std::string& address = "");
+
+private:
+    void registerHandlers();
+};
+
+}   // namespace http
+}   // namespace hiper
+
+#endif   // HIPER_ADMIN_SERVER_H
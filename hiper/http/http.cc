@@ -285,6 +285,23 @@ void HttpRequest::init()
     }
 }
 
+void HttpRequest::reset()
+{
+    method_          = HttpMethod::GET;
+    version_         = 0x11;
+    close_           = true;
+    websocket_       = false;
+    parserParamFlag_ = 0;
+    url_.clear();
+    path_ = "/";
+    query_.clear();
+    fragment_.clear();
+    body_.clear();
+    headers_.clear();
+    params_.clear();
+    cookies_.clear();
+}
+
 HttpResponse::HttpResponse(uint8_t version, bool close)
     : status_(HttpStatus::OK)
     , version_(version)
@@ -471,6 +471,11 @@ public:
      */
     void init();
 
+    /**
+     * @brief 恢复到刚构造时的状态，字符串保留已分配的内存，供同一连接上的下一个请求复用
+     */
+    void reset();
+
 private:
     // HTTP方法
     HttpMethod method_;
@@ -39,6 +39,19 @@ HttpRequestParser::HttpRequestParser() {
     finished_ = false;
 }
 
+void HttpRequestParser::reset() {
+    http_parser_init(&parser_, HTTP_REQUEST);
+    parser_.data = this;
+    if(data_.use_count() == 1) {
+        data_->reset();
+    } else {
+        data_.reset(new HttpRequest);
+    }
+    field_.clear();
+    error_ = 0;
+    finished_ = false;
+}
+
 HttpResponseParser::HttpResponseParser() {
     http_parser_init(&parser_, HTTP_RESPONSE);
     data_.reset(new HttpResponse);
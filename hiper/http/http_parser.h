@@ -27,6 +27,12 @@ public:
      */
     HttpRequestParser();
 
+    /**
+     * @brief 重置解析状态，解析同一连接上的下一个请求
+     * @details 上一个请求对象没有被外部持有时直接复用，否则重新创建
+     */
+    void reset();
+
     /**
      * @brief 解析协议
      * @param[in, out] data 协议文本内存
@@ -0,0 +1,95 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-19 09:48:12
+ * @Description: HTTP服务器，按路径分发请求
+ */
+#include "http_server.h"
+
+#include "../base/hook.h"
+#include "../base/log.h"
+
+#include <fnmatch.h>
+
+namespace hiper {
+namespace http {
+
+static hiper::Logger::ptr g_logger = LOG_NAME("system");
+
+HttpServer::HttpServer(bool keepalive, IOManager* worker, IOManager* accept_worker)
+    : TcpServer(worker, accept_worker)
+    , keepalive_(keepalive)
+{
+    type_    = "http";
+    default_ = [this](HttpRequest::ptr req, HttpResponse::ptr rsp, HttpSession::ptr session) {
+        rsp->setStatus(HttpStatus::NOT_FOUND);
+        rsp->setHeader("Content-Type", "text/plain");
+        rsp->setBody("404 Not Found: " + req->getPath() + "\n");
+        return 0;
+    };
+}
+
+void HttpServer::addHandler(const std::string& path, Handler cb)
+{
+    RWMutexType::WriteLock lock(handler_mutex_);
+    handlers_[path] = cb;
+}
+
+void HttpServer::addGlobHandler(const std::string& path, Handler cb)
+{
+    RWMutexType::WriteLock lock(handler_mutex_);
+    globs_.emplace_back(path, cb);
+}
+
+void HttpServer::setDefaultHandler(Handler cb)
+{
+    RWMutexType::WriteLock lock(handler_mutex_);
+    default_ = cb;
+}
+
+HttpServer::Handler HttpServer::getHandler(const std::string& path)
+{
+    RWMutexType::ReadLock lock(handler_mutex_);
+    auto                  it = handlers_.find(path);
+    if (it != handlers_.end()) {
+        return it->second;
+    }
+    for (auto& i : globs_) {
+        if (!fnmatch(i.first.c_str(), path.c_str(), 0)) {
+            return i.second;
+        }
+    }
+    return default_;
+}
+
+void HttpServer::handleClient(Socket::ptr client)
+{
+    set_hook_enable(true);
+    HttpSession::ptr session(new HttpSession(client));
+    do {
+        HttpRequest::ptr req = session->recvRequest();
+        if (!req) {
+            LOG_DEBUG(g_logger) << "recv http request fail, errno=" << errno
+                                << " errstr=" << strerror(errno) << " client:" << *client;
+            break;
+        }
+
+        bool              close = req->isClose() || !keepalive_;
+        HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), close));
+        rsp->setHeader("Server", getName());
+        try {
+            getHandler(req->getPath())(req, rsp, session);
+        }
+        catch (std::exception& e) {
+            LOG_ERROR(g_logger) << "http handler " << req->getPath() << " except: " << e.what();
+            rsp->setStatus(HttpStatus::INTERNAL_SERVER_ERROR);
+            rsp->setBody("");
+        }
+        if (session->sendResponse(rsp) <= 0 || close) {
+            break;
+        }
+    } while (true);
+    session->close();
+}
+
+}   // namespace http
+}   // namespace hiper
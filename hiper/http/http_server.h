@@ -0,0 +1,75 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-19 09:25:41
+ * @Description: HTTP服务器，按路径分发请求
+ */
+#ifndef HIPER_HTTP_SERVER_H
+#define HIPER_HTTP_SERVER_H
+
+#include "../base/mutex.h"
+#include "../base/tcp_server.h"
+#include "http.h"
+#include "http_session.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hiper {
+namespace http {
+
+class HttpServer : public TcpServer {
+public:
+    typedef std::shared_ptr<HttpServer> ptr;
+    typedef RWMutex                     RWMutexType;
+
+    /**
+     * @brief 请求处理函数
+     * @return 0表示成功，返回值目前只用于日志
+     */
+    typedef std::function<int32_t(HttpRequest::ptr req, HttpResponse::ptr rsp,
+                                  HttpSession::ptr session)>
+        Handler;
+
+    /**
+     * @brief 构造函数
+     * @param[in] keepalive 是否支持长连接
+     */
+    HttpServer(bool keepalive = false, IOManager* worker = IOManager::GetThis(),
+               IOManager* accept_worker = IOManager::GetThis());
+
+    /**
+     * @brief 添加精确匹配路径的处理函数，同一路径重复添加时覆盖
+     */
+    void addHandler(const std::string& path, Handler cb);
+
+    /**
+     * @brief 添加模糊匹配的处理函数，path使用fnmatch的通配符，比如 *.html
+     * @details 精确匹配优先，模糊匹配按添加顺序取第一个
+     */
+    void addGlobHandler(const std::string& path, Handler cb);
+
+    /**
+     * @brief 设置没有匹配时的处理函数，默认返回404
+     */
+    void setDefaultHandler(Handler cb);
+
+protected:
+    void handleClient(Socket::ptr client) override;
+
+    Handler getHandler(const std::string& path);
+
+private:
+    bool                                         keepalive_;
+    RWMutexType                                  handler_mutex_;
+    std::map<std::string, Handler>               handlers_;
+    std::vector<std::pair<std::string, Handler>> globs_;
+    Handler                                      default_;
+};
+
+}   // namespace http
+}   // namespace hiper
+
+#endif   // HIPER_HTTP_SERVER_H
@@ -6,22 +6,39 @@
 #include "http_session.h"
 
 #include "http_parser.h"
+#include "../base/metrics.h"
+#include "../base/util.h"
 
 
 namespace hiper {
 namespace http {
 
+static Counter::ptr s_http_requests = MetricsMgr::GetInstance()->counter(
+    "hiper_http_requests_total", "http requests parsed by HttpSession");
+static Counter::ptr s_http_parse_errors = MetricsMgr::GetInstance()->counter(
+    "hiper_http_parse_errors_total", "http requests rejected by the parser");
+static Histogram::ptr s_http_request_us = MetricsMgr::GetInstance()->histogram(
+    "hiper_http_request_us", "time from the first byte of a request to its response being sent");
+
 HttpSession::HttpSession(Socket::ptr sock, bool owner)
     : SocketStream(sock, owner)
 {}
 
 HttpRequest::ptr HttpSession::recvRequest()
 {
-    HttpRequestParser::ptr parser(new HttpRequestParser);
-    uint64_t               buff_size = HttpRequestParser::GetHttpRequestBufferSize();
-    std::shared_ptr<char>  buffer(new char[buff_size], [](char* ptr) { delete[] ptr; });
-    char*                  data   = buffer.get();
-    int                    offset = 0;
+    // 上一个请求的临时对象全部失效，稳定后读缓冲区不再向系统申请内存
+    arena_.reset();
+    request_start_us_ = 0;
+    if (parser_) {
+        parser_->reset();
+    }
+    else {
+        parser_.reset(new HttpRequestParser);
+    }
+    HttpRequestParser::ptr& parser    = parser_;
+    uint64_t                buff_size = HttpRequestParser::GetHttpRequestBufferSize();
+    char*                   data      = static_cast<char*>(arena_.allocate(buff_size, 1));
+    int                     offset    = 0;
     do {
         // 从sock中循环接收请求数据并解析
         // len表示接收到的数据长度，offset表示已经解析的数据长度
@@ -30,9 +47,14 @@ HttpRequest::ptr HttpSession::recvRequest()
             close();
             return nullptr;
         }
+        // 从收到第一个字节开始计时，不包括keep-alive连接上等待下一个请求的时间
+        if (!request_start_us_ && MetricsRegistry::IsEnabled()) {
+            request_start_us_ = GetElapsedUS();
+        }
         len += offset;
         size_t nparse = parser->execute(data, len);
         if (parser->hasError()) {
+            s_http_parse_errors->add();
             close();
             return nullptr;
         }
@@ -46,6 +68,7 @@ HttpRequest::ptr HttpSession::recvRequest()
         }
     } while (true);
     parser->getData()->init();
+    s_http_requests->add();
     return parser->getData();
 }
 
@@ -53,7 +76,12 @@ int HttpSession::sendResponse(HttpResponse::ptr rsp) {
     std::stringstream ss;
     ss << *rsp;
     std::string data = ss.str();
-    return writeFixSize(data.c_str(), data.size());
+    int         rt   = writeFixSize(data.c_str(), data.size());
+    if (request_start_us_) {
+        s_http_request_us->record(GetElapsedUS() - request_start_us_);
+        request_start_us_ = 0;
+    }
+    return rt;
 }
 
 
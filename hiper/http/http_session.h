@@ -7,8 +7,10 @@
 #ifndef HIPER_HTTP_SESSION_H
 #define HIPER_HTTP_SESSION_H
 
+#include "../base/arena.h"
 #include "../streams/socket_stream.h"
 #include "http.h"
+#include "http_parser.h"
 
 namespace hiper {
 
@@ -35,6 +37,21 @@ public:
      *         <0 Socket异常
      */
     int sendResponse(HttpResponse::ptr rsp);
+
+    /**
+     * @brief 返回请求级别的内存池
+     * @details 每次recvRequest开始时重置，处理请求时的临时对象可以从这里分配，
+     *          生命周期不能超过下一次recvRequest
+     */
+    Arena& getArena() { return arena_; }
+
+private:
+    // 请求级别的内存池，读缓冲区也从这里分配
+    Arena arena_;
+    // 同一连接上的请求复用解析器
+    HttpRequestParser::ptr parser_;
+    // 当前请求收到第一个字节的时间(微秒)，0表示没有在计时
+    uint64_t request_start_us_ = 0;
 };
 
 }   // namespace http
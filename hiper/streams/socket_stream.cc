@@ -64,6 +64,19 @@ int SocketStream::write(ByteArray::ptr ba, size_t length) {
     return rt;
 }
 
+int SocketStream::writeZeroCopy(ByteArray::ptr ba, size_t length) {
+    if(!isConnected()) {
+        return -1;
+    }
+    std::vector<iovec> iovs;
+    ba->getReadBuffers(iovs, length);
+    int rt = sock_->sendZeroCopy(&iovs[0], iovs.size(), ba);
+    if(rt > 0) {
+        ba->setPosition(ba->getPosition() + rt);
+    }
+    return rt;
+}
+
 void SocketStream::close() {
     if(sock_) {
         sock_->close();
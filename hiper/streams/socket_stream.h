@@ -28,6 +28,12 @@ public:
     virtual int write(const void* buffer, size_t length) override;
     virtual int write(ByteArray::ptr ba, size_t length) override;
 
+    /**
+     * @brief 通过Socket::sendZeroCopy发送ByteArray中的数据
+     * @details ba会一直被持有到内核完成发送，在此之前不能修改ba中已发送部分的内容
+     */
+    int writeZeroCopy(ByteArray::ptr ba, size_t length);
+
     virtual void close() override;
 
     Socket::ptr getSocket() const { return sock_; }
@@ -0,0 +1,104 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-15 14:06:33
+ * @Description: accept风暴测试，多个线程不断建立/断开连接，统计服务端每秒accept的连接数
+ */
+#include "../hiper/base/hiper.h"
+
+static hiper::Logger::ptr g_logger = LOG_ROOT();
+
+static const int      s_client_threads = 4;
+static const uint64_t s_duration_ms    = 2000;
+
+static std::atomic<bool>     s_stop{false};
+static std::atomic<uint64_t> s_accepted{0};
+
+/**
+ * @brief 服务端，eager为true时模拟旧的accept流程，每个连接都调用getsockname/getpeername并创建地址对象
+ */
+void server(hiper::Socket::ptr listener, bool eager)
+{
+    hiper::set_hook_enable(true);
+    bool first = true;
+    while (!s_stop) {
+        hiper::Socket::ptr client = listener->accept();
+        if (!client) {
+            continue;
+        }
+        if (eager) {
+            hiper::Address::ptr local(new hiper::IPv4Address);
+            hiper::Address::ptr remote(new hiper::IPv4Address);
+            socklen_t           len = local->getAddrLen();
+            getsockname(client->getSocket(), local->getAddr(), &len);
+            len = remote->getAddrLen();
+            getpeername(client->getSocket(), remote->getAddr(), &len);
+        }
+        if (first) {
+            first = false;
+            LOG_INFO(g_logger) << "first client local=" << client->getLocalAddress()->toString()
+                               << " remote=" << client->getRemoteAddress()->toString();
+        }
+        ++s_accepted;
+        client->close();
+    }
+}
+
+/**
+ * @brief 客户端不断连接再以RST关闭，避免TIME_WAIT耗尽本地端口
+ */
+void client(hiper::Address::ptr addr)
+{
+    linger lg;
+    lg.l_onoff  = 1;
+    lg.l_linger = 0;
+    while (!s_stop) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, addr->getAddr(), addr->getAddrLen()) == 0) {
+            setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        }
+        close(fd);
+    }
+}
+
+void run(bool eager)
+{
+    hiper::Address::ptr addr = hiper::Address::LookupAny("127.0.0.1:8064");
+
+    hiper::Socket::ptr listener = hiper::Socket::CreateTCP(addr);
+    if (!listener->bind(addr) || !listener->listen()) {
+        return;
+    }
+
+    s_stop     = false;
+    s_accepted = 0;
+    {
+        hiper::IOManager iom(1, false, "accept");
+        iom.schedule(std::bind(server, listener, eager));
+
+        std::vector<hiper::Thread::ptr> thrs;
+        for (int i = 0; i < s_client_threads; ++i) {
+            thrs.push_back(hiper::Thread::ptr(
+                new hiper::Thread(std::bind(client, addr), "client_" + std::to_string(i))));
+        }
+        usleep(s_duration_ms * 1000);
+        s_stop = true;
+        for (auto& i : thrs) {
+            i->join();
+        }
+        // 再连接一次，唤醒阻塞在accept上的服务端协程
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        connect(fd, addr->getAddr(), addr->getAddrLen());
+        close(fd);
+    }
+    listener->close();
+
+    LOG_INFO(g_logger) << (eager ? "eager address" : "lazy address") << " accepted=" << s_accepted
+                       << " rate=" << s_accepted * 1000 / s_duration_ms << "/s";
+}
+
+int main(int argc, char** argv)
+{
+    run(false);
+    run(true);
+    return 0;
+}
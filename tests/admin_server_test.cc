@@ -0,0 +1,82 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-19 11:05:37
+ * @Description: 管理服务器测试，请求/metrics和/debug接口
+ */
+#include "../hiper/base/hiper.h"
+
+#include <arpa/inet.h>
+
+using namespace hiper;
+static Logger::ptr g_logger = LOG_ROOT();
+
+static std::string http_get(const std::string& path)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    HIPER_ASSERT(sock >= 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(8070);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    HIPER_ASSERT(connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0);
+
+    std::string req = "GET " + path + " HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+    HIPER_ASSERT(send(sock, req.c_str(), req.size(), 0) == (ssize_t)req.size());
+
+    std::string rsp;
+    char        buf[4096];
+    ssize_t     n;
+    while ((n = recv(sock, buf, sizeof(buf), 0)) > 0) {
+        rsp.append(buf, n);
+    }
+    close(sock);
+    return rsp;
+}
+
+int main(int argc, char** argv)
+{
+    WorkerMgr::GetInstance()->init({{"io", {{"thread_num", "2"}}}});
+    IOManager::ptr io    = WorkerMgr::GetInstance()->getAsIOManager("io");
+    Timer::ptr     timer = io->addTimer(1000 * 1000, []() {});
+    // 让几个业务任务一直占着io线程，管理接口仍然可以响应
+    for (int i = 0; i < 2; ++i) {
+        WorkerMgr::GetInstance()->schedule("io", []() { usleep(300 * 1000); });
+    }
+
+    http::AdminServer::ptr admin = http::AdminServer::Start("127.0.0.1:8070");
+    HIPER_ASSERT(admin);
+
+    std::string rsp = http_get("/metrics");
+    HIPER_ASSERT(rsp.find("200 OK") != std::string::npos);
+    HIPER_ASSERT(rsp.find("# TYPE hiper_scheduler_task_run_us histogram") != std::string::npos);
+
+    rsp = http_get("/debug/schedulers");
+    LOG_INFO(g_logger) << rsp;
+    HIPER_ASSERT(rsp.find("[Scheduler name=io") != std::string::npos);
+    HIPER_ASSERT(rsp.find("[Scheduler name=admin") != std::string::npos);
+
+    rsp = http_get("/debug/fibers");
+    LOG_INFO(g_logger) << rsp;
+    HIPER_ASSERT(rsp.find("[Fibers total=") != std::string::npos);
+
+    rsp = http_get("/debug/fds");
+    LOG_INFO(g_logger) << rsp;
+    HIPER_ASSERT(rsp.find("socket=1") != std::string::npos);
+
+    rsp = http_get("/debug/timers");
+    LOG_INFO(g_logger) << rsp;
+    HIPER_ASSERT(rsp.find("io timers=1") != std::string::npos);
+
+    rsp = http_get("/debug/config");
+    HIPER_ASSERT(rsp.find("admin.nice (int): 10") != std::string::npos);
+
+    rsp = http_get("/not_exists");
+    HIPER_ASSERT(rsp.find("404") != std::string::npos);
+
+    admin->stop();
+    timer->cancel();
+    WorkerMgr::GetInstance()->stop();
+    LOG_INFO(g_logger) << "admin server test ok";
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-16 15:21:08
+ * @Description: Arena与对象池测试，统计同一连接上每个HTTP请求的堆分配次数
+ */
+#include "../hiper/base/hiper.h"
+
+#include <new>
+
+static hiper::Logger::ptr g_logger = LOG_ROOT();
+
+static std::atomic<uint64_t> s_news{0};
+
+void* operator new(size_t size)
+{
+    ++s_news;
+    void* p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+struct Obj
+{
+    Obj(int& dtor_count)
+        : count(dtor_count)
+    {}
+    ~Obj() { ++count; }
+    int& count;
+};
+
+void test_arena()
+{
+    hiper::Arena arena(256);
+    int          dtors = 0;
+    for (int round = 0; round < 3; ++round) {
+        arena.reset();
+        for (int i = 0; i < 100; ++i) {
+            int* v = arena.create<int>(i);
+            HIPER_ASSERT(*v == i);
+            arena.create<Obj>(dtors);
+        }
+        void* p = arena.allocate(64, 64);
+        HIPER_ASSERT(((uintptr_t)p & 63) == 0);
+        LOG_INFO(g_logger) << "round=" << round << " used=" << arena.getUsed()
+                           << " capacity=" << arena.getCapacity()
+                           << " block_allocs=" << arena.getBlockAllocs();
+    }
+    arena.reset();
+    HIPER_ASSERT(dtors == 300);
+
+    // 第一轮之后只保留一个合并后的块，后面不再申请
+    std::vector<int, hiper::ArenaAllocator<int>> vec{hiper::ArenaAllocator<int>(&arena)};
+    for (int i = 0; i < 1000; ++i) {
+        vec.push_back(i);
+    }
+    LOG_INFO(g_logger) << "vector on arena, capacity=" << arena.getCapacity();
+}
+
+void test_pool()
+{
+    std::vector<hiper::FdCtx::ptr> ctxs;
+    for (int i = 0; i < 10; ++i) {
+        ctxs.push_back(
+            std::allocate_shared<hiper::FdCtx>(hiper::PoolAllocator<hiper::FdCtx>(), -1));
+    }
+    ctxs.clear();
+    uint64_t before = s_news;
+    for (int i = 0; i < 10; ++i) {
+        ctxs.push_back(
+            std::allocate_shared<hiper::FdCtx>(hiper::PoolAllocator<hiper::FdCtx>(), -1));
+    }
+    uint64_t news = s_news - before;
+    LOG_INFO(g_logger) << "pool reuse news=" << news;
+}
+
+/**
+ * @brief 在同一连接上发送多个请求，统计服务端每个请求的operator new次数
+ */
+void test_session()
+{
+    hiper::set_hook_enable(true);
+    hiper::Address::ptr addr     = hiper::Address::LookupAny("127.0.0.1:8066");
+    hiper::Socket::ptr  listener = hiper::Socket::CreateTCP(addr);
+    if (!listener->bind(addr) || !listener->listen()) {
+        return;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, addr->getAddr(), addr->getAddrLen())) {
+        LOG_ERROR(g_logger) << "connect errno=" << errno;
+        return;
+    }
+    hiper::Socket::ptr sock = listener->accept();
+    hiper::http::HttpSession::ptr session(new hiper::http::HttpSession(sock));
+
+    const std::string req = "GET /index.html?a=1 HTTP/1.1\r\n"
+                            "Host: localhost\r\n"
+                            "Connection: keep-alive\r\n\r\n";
+    for (int i = 0; i < 5; ++i) {
+        ::write(fd, req.c_str(), req.size());
+        uint64_t                         before = s_news;
+        hiper::http::HttpRequest::ptr    r      = session->recvRequest();
+        uint64_t                         news   = s_news - before;
+        HIPER_ASSERT(r && r->getPath() == "/index.html");
+        LOG_INFO(g_logger) << "request " << i << " news=" << news
+                           << " arena capacity=" << session->getArena().getCapacity();
+    }
+    session->close();
+    ::close(fd);
+    listener->close();
+}
+
+/**
+ * @brief 缓存中有旧大小的栈时调大fiber.stack_size，新协程必须拿到新大小的栈
+ */
+void test_stack_size_change()
+{
+    auto stack_size = hiper::Config::Lookup<uint32_t>("fiber.stack_size");
+    uint32_t old    = stack_size->getValue();
+    stack_size->setValue(64 * 1024);
+    // 先创建线程的主协程，协程结束后切回这里
+    hiper::Fiber::GetThis();
+    {
+        hiper::Fiber::ptr fiber(new hiper::Fiber([]() {}, 0, true));
+        fiber->resume();
+    }
+
+    stack_size->setValue(512 * 1024);
+    bool ok = false;
+    {
+        hiper::Fiber::ptr fiber(new hiper::Fiber([&ok]() {
+            // 远超64K，拿到旧栈时会写坏栈下方的堆内存
+            volatile char buf[256 * 1024];
+            for (size_t i = 0; i < sizeof(buf); ++i) {
+                buf[i] = (char)i;
+            }
+            ok = true;
+            for (size_t i = 0; i < sizeof(buf); i += 4096) {
+                ok = ok && buf[i] == (char)i;
+            }
+        }, 0, true));
+        fiber->resume();
+    }
+    HIPER_ASSERT(ok);
+    std::vector<std::string> strs(1000, std::string(100, 'x'));
+    stack_size->setValue(old);
+}
+
+int main(int argc, char** argv)
+{
+    // 解析回调里的DEBUG日志也会分配内存，关掉后只统计请求本身
+    g_logger->setLevel(hiper::LogLevel::INFO);
+    LOG_NAME("system")->setLevel(hiper::LogLevel::INFO);
+    test_arena();
+    test_pool();
+    test_stack_size_change();
+    hiper::IOManager iom(1, false);
+    iom.schedule(test_session);
+    return 0;
+}
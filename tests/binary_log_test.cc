@@ -0,0 +1,286 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-25 19:02:51
+ * @Description: 二进制日志测试，编码与ByteArray一致、文本Appender渲染、hiper-logcat解码，以及和文本日志的吞吐对比
+ */
+#include "../hiper/base/hiper.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static hiper::Logger::ptr g_logger = LOG_ROOT();
+
+/**
+ * @brief 记录最后一条日志格式化后的内容
+ */
+class CaptureAppender : public hiper::LogAppender {
+public:
+    typedef std::shared_ptr<CaptureAppender> ptr;
+
+    void log(hiper::Logger::ptr logger, hiper::LogLevel::Level level,
+             hiper::LogEvent::ptr event) override
+    {
+        hiper::Rcu::ReadLock rcu;
+        last = peekFormatter()->format(logger, level, event);
+    }
+
+    std::string toYamlString() override { return ""; }
+
+    std::string last;
+};
+
+struct Point
+{
+    int x;
+    int y;
+};
+
+std::ostream& operator<<(std::ostream& os, const Point& p)
+{
+    return os << "(" << p.x << "," << p.y << ")";
+}
+
+void test_encoding()
+{
+    hiper::LogStreamBuf buf;
+    hiper::BinaryEncoder::WriteInt64(buf, -123456789);
+    hiper::BinaryEncoder::WriteUint64(buf, 1ull << 40);
+    hiper::BinaryEncoder::WriteDouble(buf, 3.25);
+    hiper::BinaryEncoder::WriteString(buf, "hello", 5);
+
+    // 编码和ByteArray的Varint、double、字符串格式一致
+    hiper::ByteArray ba;
+    ba.write(buf.data(), buf.size());
+    ba.setPosition(0);
+    HIPER_ASSERT(ba.readInt64() == -123456789);
+    HIPER_ASSERT(ba.readUint64() == (1ull << 40));
+    HIPER_ASSERT(ba.readDouble() == 3.25);
+    HIPER_ASSERT(ba.readStringVint() == "hello");
+    HIPER_ASSERT(ba.getReadSize() == 0);
+}
+
+void test_render()
+{
+    hiper::Logger::ptr       logger = LOG_NAME("binary_render");
+    CaptureAppender::ptr     appender(new CaptureAppender);
+    hiper::LogFormatter::ptr fmt(new hiper::LogFormatter("%m"));
+    appender->setFormatter(fmt);
+    logger->clearAppenders();
+    logger->addAppender(appender);
+
+    std::string str = "world";
+    int64_t     big = -(1ll << 50);
+    LOG_BIN_INFO(logger, "int=%d uint=%u hex=%#x big=%lld dbl=%.3f g=%g str=%s cstr=%-6s| c=%c",
+                 -42, 7u, 255, big, 3.14159, 0.5, str, "ab", 'z');
+    char expect[256];
+    snprintf(expect, sizeof(expect),
+             "int=%d uint=%u hex=%#x big=%lld dbl=%.3f g=%g str=%s cstr=%-6s| c=%c", -42, 7u, 255,
+             (long long)big, 3.14159, 0.5, str.c_str(), "ab", 'z');
+    HIPER_ASSERT(appender->last == expect);
+
+    LOG_BIN_INFO(logger, "no args 100%%");
+    HIPER_ASSERT(appender->last == "no args 100%");
+
+    // operator<<转成字符串，参数不足时输出<?>
+    LOG_BIN_WARN(logger, "point=%s missing=%d", Point{1, 2});
+    HIPER_ASSERT(appender->last == "point=(1,2) missing=<?>");
+
+    // 普通日志不受影响
+    LOG_INFO(logger) << "text " << 1;
+    HIPER_ASSERT(appender->last == "text 1");
+
+    logger->clearAppenders();
+}
+
+static std::vector<std::string> run_logcat(const std::string& args)
+{
+    std::vector<std::string> lines;
+    FILE*                    fp = popen(("./hiper-logcat " + args).c_str(), "r");
+    HIPER_ASSERT(fp);
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        lines.push_back(line);
+    }
+    pclose(fp);
+    return lines;
+}
+
+void test_logcat()
+{
+    const std::string file = "./binary_log_test.blog";
+    unlink(file.c_str());
+
+    hiper::Logger::ptr            logger = LOG_NAME("binary_cat");
+    hiper::BinaryLogAppender::ptr appender(new hiper::BinaryLogAppender(file));
+    logger->clearAppenders();
+    logger->addAppender(appender);
+
+    const int n = 1000;
+    for (int i = 0; i < n; ++i) {
+        LOG_BIN_INFO(logger, "request id=%d cost=%.2fms path=%s", i, i * 0.5, "/index");
+    }
+    LOG_ERROR(logger) << "text line";
+    LOG_BIN_DEBUG(logger, "debug %s", "last");
+    LOG_WARN(logger) << "fields" << hiper::LogField("uid", -7) << hiper::LogField("path", "/a b")
+                     << hiper::LogField("bytes", (uint64_t)1 << 40)
+                     << hiper::LogField("cost", 1.5) << hiper::LogField("ok", true);
+    appender->flush();
+
+    auto lines = run_logcat("-p '%c %p %m%n' " + file);
+    HIPER_ASSERT(lines.size() == n + 3);
+    HIPER_ASSERT(lines[0] == "binary_cat INFO request id=0 cost=0.00ms path=/index\n");
+    HIPER_ASSERT(lines[n - 1] == "binary_cat INFO request id=999 cost=499.50ms path=/index\n");
+    HIPER_ASSERT(lines[n] == "binary_cat ERROR text line\n");
+    HIPER_ASSERT(lines[n + 1] == "binary_cat DEBUG debug last\n");
+    // 普通日志的结构化字段也写进了文件
+    HIPER_ASSERT(lines[n + 2] ==
+                 "binary_cat WARN fields uid=-7 path=/a b bytes=1099511627776 cost=1.5 ok=true\n");
+    lines = run_logcat("-p json " + file);
+    HIPER_ASSERT(lines[n + 2].find("\"msg\":\"fields\",\"fields\":{\"uid\":-7,\"path\":\"/a b\","
+                                   "\"bytes\":1099511627776,\"cost\":1.5,\"ok\":true}}") !=
+                 std::string::npos);
+
+    // 默认格式带文件和行号
+    lines = run_logcat(file);
+    HIPER_ASSERT(lines.size() == n + 3);
+    HIPER_ASSERT(lines[0].find("binary_log_test.cc:") != std::string::npos);
+
+    logger->clearAppenders();
+    appender.reset();
+    unlink(file.c_str());
+}
+
+// 一段INFO日志之后不再写日志，后台线程也要把缓冲的记录写进文件
+void test_idle_flush()
+{
+    const std::string file = "./binary_idle.blog";
+    unlink(file.c_str());
+
+    hiper::Logger::ptr            logger = LOG_NAME("binary_idle");
+    hiper::BinaryLogAppender::ptr appender(new hiper::BinaryLogAppender(file));
+    logger->clearAppenders();
+    logger->addAppender(appender);
+    for (int i = 0; i < 10; ++i) {
+        LOG_BIN_INFO(logger, "idle id=%d", i);
+    }
+    sleep(3);
+    auto lines = run_logcat("-p '%m%n' " + file);
+    HIPER_ASSERT(lines.size() == 10);
+    HIPER_ASSERT(lines[9] == "idle id=9\n");
+
+    logger->clearAppenders();
+    appender.reset();
+    unlink(file.c_str());
+}
+
+// 调用点和日志器在worker里才第一次使用，两个worker分配到相同的编号，解码时不能串用对方的格式
+static void fork_worker(int who, hiper::BinaryLogAppender::ptr appender)
+{
+    if (who == 0) {
+        hiper::Logger::ptr logger = LOG_NAME("binary_fork_a");
+        logger->clearAppenders();
+        logger->addAppender(appender);
+        LOG_BIN_INFO(logger, "worker A peer=%d", 100);
+    }
+    else {
+        hiper::Logger::ptr logger = LOG_NAME("binary_fork_b");
+        logger->clearAppenders();
+        logger->addAppender(appender);
+        LOG_BIN_INFO(logger, "worker B peer=%d", 200);
+    }
+    appender->flush();
+}
+
+void test_fork()
+{
+    const std::string file = "./binary_fork.blog";
+    unlink(file.c_str());
+
+    hiper::Logger::ptr            logger = LOG_NAME("binary_fork");
+    hiper::BinaryLogAppender::ptr appender(new hiper::BinaryLogAppender(file));
+    logger->clearAppenders();
+    logger->addAppender(appender);
+    // 留在缓冲区里，只能由父进程写入一次
+    LOG_BIN_INFO(logger, "master before fork");
+
+    pid_t pids[2];
+    for (int i = 0; i < 2; ++i) {
+        pids[i] = fork();
+        HIPER_ASSERT(pids[i] >= 0);
+        if (pids[i] == 0) {
+            fork_worker(i, appender);
+            _exit(0);
+        }
+        // 第二个worker在第一个写完之后再写，它的定义是文件里最新的
+        int status;
+        HIPER_ASSERT(waitpid(pids[i], &status, 0) == pids[i] && WIFEXITED(status));
+    }
+    appender->flush();
+
+    auto lines = run_logcat("-p '%c %m%n' " + file);
+    HIPER_ASSERT(lines.size() == 3);
+    HIPER_ASSERT(std::count(lines.begin(), lines.end(), "binary_fork master before fork\n") == 1);
+    HIPER_ASSERT(std::count(lines.begin(), lines.end(), "binary_fork_a worker A peer=100\n") == 1);
+    HIPER_ASSERT(std::count(lines.begin(), lines.end(), "binary_fork_b worker B peer=200\n") == 1);
+
+    logger->clearAppenders();
+    appender.reset();
+    unlink(file.c_str());
+}
+
+void test_bench()
+{
+    const int lines = 200000;
+    unlink("./bench_text.log");
+    unlink("./bench_binary.blog");
+
+    hiper::Logger::ptr text = LOG_NAME("bench_text");
+    text->clearAppenders();
+    hiper::AsyncLogAppender::ptr async(new hiper::AsyncLogAppender("./bench_text.log"));
+    text->addAppender(async);
+    uint64_t start = hiper::GetElapsedUS();
+    for (int i = 0; i < lines; ++i) {
+        LOG_FMT_INFO(text, "request id=%d cost=%.2fms path=%s", i, i * 0.5, "/index");
+    }
+    async->flush();
+    uint64_t text_used = hiper::GetElapsedUS() - start;
+    async->stop();
+    text->clearAppenders();
+
+    hiper::Logger::ptr binary = LOG_NAME("bench_binary");
+    binary->clearAppenders();
+    hiper::BinaryLogAppender::ptr appender(new hiper::BinaryLogAppender("./bench_binary.blog"));
+    binary->addAppender(appender);
+    start = hiper::GetElapsedUS();
+    for (int i = 0; i < lines; ++i) {
+        LOG_BIN_INFO(binary, "request id=%d cost=%.2fms path=%s", i, i * 0.5, "/index");
+    }
+    appender->flush();
+    uint64_t binary_used = hiper::GetElapsedUS() - start;
+    binary->clearAppenders();
+
+    struct stat text_st, binary_st;
+    stat("./bench_text.log", &text_st);
+    stat("./bench_binary.blog", &binary_st);
+    std::cout << "text   async: " << (uint64_t)(lines * 1000000.0 / text_used)
+              << " lines/s size=" << text_st.st_size << std::endl;
+    std::cout << "binary:       " << (uint64_t)(lines * 1000000.0 / binary_used)
+              << " lines/s size=" << binary_st.st_size << std::endl;
+
+    unlink("./bench_text.log");
+    unlink("./bench_binary.blog");
+}
+
+int main(int argc, char** argv)
+{
+    test_encoding();
+    test_render();
+    test_logcat();
+    test_idle_flush();
+    test_fork();
+    test_bench();
+    return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-12 15:02:16
+ * @Description: 阻塞任务执行器测试
+ */
+#include "../hiper/base/hiper.h"
+
+#include <unistd.h>
+
+static hiper::Logger::ptr g_logger = LOG_ROOT();
+
+static std::atomic<int> s_ticks{0};
+
+/**
+ * @brief 阻塞调用交给执行器后，同一IO线程上的其他协程仍然可以运行
+ */
+void test_offload()
+{
+    hiper::IOManager iom(1, false, "io");
+
+    iom.schedule([] {
+        uint64_t begin = hiper::GetElapsedMS();
+        hiper::BlockingExecutorMgr::GetInstance()->run([] { usleep(500 * 1000); });
+        LOG_INFO(g_logger) << "blocking call done, cost=" << hiper::GetElapsedMS() - begin
+                           << "ms ticks=" << s_ticks;
+    });
+
+    iom.schedule([] {
+        int value = hiper::BlockingExecutorMgr::GetInstance()->call([] { return 42; });
+        LOG_INFO(g_logger) << "call result=" << value;
+    });
+
+    iom.schedule([] {
+        try {
+            hiper::BlockingExecutorMgr::GetInstance()->run(
+                [] { throw std::runtime_error("offload error"); });
+        }
+        catch (std::exception& e) {
+            LOG_INFO(g_logger) << "caught: " << e.what();
+        }
+    });
+
+    // 执行器中的任务阻塞时，该协程应当不断被调度
+    iom.schedule([] {
+        for (int i = 0; i < 5; ++i) {
+            ++s_ticks;
+            hiper::Fiber::YieldToReady();
+        }
+    });
+}
+
+int main(int argc, char** argv)
+{
+    test_offload();
+
+    std::stringstream ss;
+    hiper::BlockingExecutorMgr::GetInstance()->dump(ss);
+    LOG_INFO(g_logger) << ss.str();
+    return 0;
+}
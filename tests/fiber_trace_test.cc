@@ -0,0 +1,148 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-19 15:12:24
+ * @Description: 协程跟踪测试，查看挂起在定时器和fd上的协程
+ */
+#include "../hiper/base/hiper.h"
+
+#include <dirent.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+using namespace hiper;
+static Logger::ptr g_logger = LOG_ROOT();
+
+void wait_timer()
+{
+    set_hook_enable(true);
+    usleep(500 * 1000);
+}
+
+void wait_fd(int fd)
+{
+    set_hook_enable(true);
+    char c;
+    int  n = read(fd, &c, 1);
+    LOG_INFO(g_logger) << "wait_fd read " << n;
+}
+
+/**
+ * @brief 当前进程里是否有名为name的线程
+ */
+bool has_thread(const std::string& name)
+{
+    DIR* d = opendir("/proc/self/task");
+    HIPER_ASSERT(d);
+    bool           found = false;
+    struct dirent* dp;
+    while (!found && (dp = readdir(d)) != nullptr) {
+        std::ifstream ifs(std::string("/proc/self/task/") + dp->d_name + "/comm");
+        std::string   comm;
+        found = std::getline(ifs, comm) && comm == name;
+    }
+    closedir(d);
+    return found;
+}
+
+int main(int argc, char** argv)
+{
+    g_logger->setLevel(LogLevel::INFO);
+    LOG_NAME("system")->setLevel(LogLevel::INFO);
+
+    Fiber::EnableTrace(true);
+    HIPER_ASSERT(Fiber::IsTraceEnabled());
+
+    int fds[2];
+    HIPER_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    // socketpair没有hook，手动登记到FdManager，读的时候才会挂起协程
+    FdMgr::GetInstance()->get(fds[0], true);
+    {
+        IOManager iom(2, false, "trace");
+        iom.schedule([]() { wait_timer(); });
+        iom.schedule([fds]() { wait_fd(fds[0]); });
+        usleep(100 * 1000);
+
+        std::stringstream ss;
+        Fiber::DumpFibers(ss);
+        std::string dump = ss.str();
+        std::cout << dump;
+        HIPER_ASSERT(dump.find("wait=timer:500ms") != std::string::npos);
+        HIPER_ASSERT(dump.find("wait=fd:" + std::to_string(fds[0]) + "(READ)") !=
+                     std::string::npos);
+        // 让出位置只记录一层，是hook后的usleep
+        HIPER_ASSERT(dump.find("usleep") != std::string::npos);
+        HIPER_ASSERT(dump.find("state=HOLD") != std::string::npos);
+
+        // 后台线程把同样的内容输出到system日志
+        raise(SIGUSR1);
+        usleep(100 * 1000);
+
+        HIPER_ASSERT(write(fds[1], "x", 1) == 1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    // fork出的子进程第一次登记协程时启动自己的后台线程，SIGUSR1输出子进程自己的协程
+    HIPER_ASSERT(has_thread("fiber_dump"));
+    pid_t pid = fork();
+    if (pid == 0) {
+        alarm(10);
+        HIPER_ASSERT(!has_thread("fiber_dump"));
+        Fiber::ptr f(new Fiber([]() {}, 0, true));
+        HIPER_ASSERT(has_thread("fiber_dump"));
+        raise(SIGUSR1);
+        usleep(100 * 1000);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    HIPER_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // 关闭后新建的协程不再登记
+    Fiber::EnableTrace(false);
+    {
+        IOManager iom(1, false, "untraced");
+        iom.schedule([]() { wait_timer(); });
+        usleep(100 * 1000);
+        std::stringstream ss;
+        Fiber::DumpFibers(ss);
+        HIPER_ASSERT(ss.str().find("usleep") == std::string::npos);
+    }
+
+    // 关闭前登记的协程被reset复用时移除，之后切换不再记录
+    {
+        Fiber::EnableTrace(true);
+        Fiber::GetThis();
+        Fiber::ptr f(new Fiber([]() {}, 0, true));
+        f->resume();
+        Fiber::EnableTrace(false);
+        f->reset([]() {});
+        std::stringstream ss;
+        Fiber::DumpFibers(ss);
+        HIPER_ASSERT(ss.str().find("fiber id=" + std::to_string(f->getId()) + " ") ==
+                     std::string::npos);
+    }
+
+    // 切换开销：关闭跟踪时只多一次空指针判断
+    for (bool trace : {false, true}) {
+        Fiber::EnableTrace(trace);
+        const int loops = 100000;
+        Fiber::GetThis();
+        Fiber::ptr f(new Fiber(
+            []() {
+                for (int i = 0; i < loops; ++i) {
+                    Fiber::YieldToHold();
+                }
+            },
+            0, true));
+        uint64_t start = GetElapsedUS();
+        for (int i = 0; i <= loops; ++i) {
+            f->resume();
+        }
+        LOG_INFO(g_logger) << "trace=" << trace << " resume+yield "
+                           << (GetElapsedUS() - start) * 1000.0 / loops << " ns";
+    }
+    Fiber::EnableTrace(false);
+    return 0;
+}
@@ -0,0 +1,298 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-24 14:12:36
+ * @Description: LogEvent复用测试，统计稳定状态下每条日志的堆分配次数，编译期级别和调用点缓存，以及限流和采样
+ */
+// 编译期去掉DEBUG日志
+#define HIPER_LOG_MIN_LEVEL 2
+#include "../hiper/base/hiper.h"
+
+#include <new>
+
+static std::atomic<uint64_t> s_news{0};
+
+void* operator new(size_t size)
+{
+    ++s_news;
+    void* p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+/**
+ * @brief 丢弃所有输出的流
+ */
+class NullBuf : public std::streambuf {
+protected:
+    int_type        overflow(int_type c) override { return traits_type::not_eof(c); }
+    std::streamsize xsputn(const char* s, std::streamsize n) override { return n; }
+};
+
+/**
+ * @brief 格式化日志但不输出，记录最后一条日志的内容
+ */
+class NullAppender : public hiper::LogAppender {
+public:
+    typedef std::shared_ptr<NullAppender> ptr;
+
+    NullAppender()
+        : os_(&buf_)
+    {}
+
+    void log(hiper::Logger::ptr logger, hiper::LogLevel::Level level,
+             hiper::LogEvent::ptr event) override
+    {
+        ++count;
+        hiper::Rcu::ReadLock rcu;
+        peekFormatter()->format(os_, logger, level, event);
+        if (capture) {
+            last = event->getContent();
+        }
+    }
+
+    std::string toYamlString() override { return ""; }
+
+    uint64_t    count   = 0;
+    bool        capture = false;
+    std::string last;
+
+private:
+    NullBuf      buf_;
+    std::ostream os_;
+};
+
+/**
+ * @brief 只计数，可以多线程同时写
+ */
+class CountAppender : public hiper::LogAppender {
+public:
+    typedef std::shared_ptr<CountAppender> ptr;
+
+    void log(hiper::Logger::ptr logger, hiper::LogLevel::Level level,
+             hiper::LogEvent::ptr event) override
+    {
+        ++count;
+    }
+
+    std::string toYamlString() override { return ""; }
+
+    std::atomic<uint64_t> count{0};
+};
+
+static std::string nested(hiper::Logger::ptr logger)
+{
+    LOG_INFO(logger) << "inner";
+    return "outer";
+}
+
+void test_content(hiper::Logger::ptr logger, NullAppender::ptr appender)
+{
+    appender->capture = true;
+
+    LOG_INFO(logger) << "a=" << 1 << " b=" << 2.5 << " c=" << std::hex << 255;
+    HIPER_ASSERT(appender->last == "a=1 b=2.5 c=ff");
+    // 复用事件时格式状态要恢复默认
+    LOG_INFO(logger) << 255;
+    HIPER_ASSERT(appender->last == "255");
+
+    LOG_FMT_INFO(logger, "fmt %d %s", 42, "str");
+    HIPER_ASSERT(appender->last == "fmt 42 str");
+
+    // 超过内联缓冲区的内容
+    std::string big(hiper::LogStreamBuf::kInlineSize * 3 + 7, 'x');
+    LOG_INFO(logger) << "big:" << big;
+    HIPER_ASSERT(appender->last == "big:" + big);
+    LOG_FMT_INFO(logger, "big:%s", big.c_str());
+    HIPER_ASSERT(appender->last == "big:" + big);
+    LOG_INFO(logger) << "small";
+    HIPER_ASSERT(appender->last == "small");
+
+    // 参数求值时又写了日志，内外两条都要完整
+    LOG_INFO(logger) << "begin " << nested(logger) << " end";
+    HIPER_ASSERT(appender->last == "begin outer end");
+
+    appender->capture = false;
+}
+
+void test_alloc(hiper::Logger::ptr logger, NullAppender::ptr appender)
+{
+    const int n = 10000;
+    // 预热：线程缓存的事件、线程名等
+    for (int i = 0; i < 10; ++i) {
+        LOG_INFO(logger) << "warm up " << i << " " << 3.14 << " " << std::string("str");
+        LOG_FMT_INFO(logger, "warm up %d %s", i, "fmt");
+    }
+
+    uint64_t count  = appender->count;
+    uint64_t before = s_news;
+    for (int i = 0; i < n; ++i) {
+        LOG_INFO(logger) << "request id=" << i << " cost=" << 1.25 << "ms path=" << "/index";
+        LOG_FMT_INFO(logger, "request id=%d cost=%.2fms path=%s", i, 1.25, "/index");
+    }
+    uint64_t news = s_news - before;
+    std::cout << "logs=" << appender->count - count << " news=" << news << std::endl;
+    HIPER_ASSERT(appender->count - count == (uint64_t)n * 2);
+    HIPER_ASSERT(news == 0);
+
+    // 内容超过内联缓冲区时只在第一次申请内存
+    std::string big(hiper::LogStreamBuf::kInlineSize * 2, 'y');
+    LOG_INFO(logger) << big;
+    before = s_news;
+    for (int i = 0; i < n; ++i) {
+        LOG_INFO(logger) << big;
+    }
+    news = s_news - before;
+    std::cout << "big logs news=" << news << std::endl;
+    HIPER_ASSERT(news == 0);
+
+    // 结构化字段和JSON格式也不申请内存
+    hiper::LogFormatter::ptr text = appender->getFormatter();
+    appender->setFormatter(hiper::LogFormatter::ptr(new hiper::LogFormatter("json")));
+    LOG_INFO(logger) << "json" << hiper::LogField("uid", 1) << hiper::LogField("path", "/index");
+    before = s_news;
+    for (int i = 0; i < n; ++i) {
+        LOG_INFO(logger) << "json \"quoted\"" << hiper::LogField("uid", i)
+                         << hiper::LogField("path", "/index") << hiper::LogField("cost", 1.25);
+    }
+    news = s_news - before;
+    std::cout << "json logs news=" << news << std::endl;
+    HIPER_ASSERT(news == 0);
+    appender->setFormatter(text);
+}
+
+static int s_evaluated = 0;
+
+static int evaluated()
+{
+    return ++s_evaluated;
+}
+
+static void log_at_same_site(hiper::Logger::ptr logger)
+{
+    LOG_INFO(logger) << "site " << evaluated();
+}
+
+void test_level(hiper::Logger::ptr logger, NullAppender::ptr appender)
+{
+    // 低于编译期最低级别的日志，参数不会被求值
+    uint64_t count = appender->count;
+    LOG_DEBUG(logger) << evaluated();
+    LOG_FMT_DEBUG(logger, "%d", evaluated());
+    HIPER_ASSERT(s_evaluated == 0);
+    HIPER_ASSERT(appender->count == count);
+
+    // 调用点缓存在级别变化后失效
+    logger->setLevel(hiper::LogLevel::WARN);
+    for (int i = 0; i < 3; ++i) {
+        log_at_same_site(logger);
+    }
+    HIPER_ASSERT(s_evaluated == 0);
+    logger->setLevel(hiper::LogLevel::INFO);
+    log_at_same_site(logger);
+    HIPER_ASSERT(s_evaluated == 1);
+
+    // 同一个调用点换了日志器
+    hiper::Logger::ptr quiet = LOG_NAME("log_event_test_quiet");
+    quiet->setLevel(hiper::LogLevel::ERROR);
+    log_at_same_site(quiet);
+    HIPER_ASSERT(s_evaluated == 1);
+    log_at_same_site(logger);
+    HIPER_ASSERT(s_evaluated == 2);
+
+    // 通过配置修改级别
+    YAML::Node node = YAML::Load("logs:\n"
+                                 "  - name: log_event_test_quiet\n"
+                                 "    level: info\n"
+                                 "    appenders:\n"
+                                 "      - type: StdoutLogAppender\n");
+    hiper::Config::LoadFromYaml(node);
+    quiet->clearAppenders();
+    log_at_same_site(quiet);
+    HIPER_ASSERT(s_evaluated == 3);
+}
+
+static void log_every_n(hiper::Logger::ptr logger, int i)
+{
+    LOG_INFO_EVERY_N(logger, 10) << "every " << i;
+}
+
+void test_limit(hiper::Logger::ptr logger, NullAppender::ptr appender)
+{
+    appender->capture = true;
+
+    // 每10条输出1条，输出的日志带上之前丢弃的条数
+    uint64_t count = appender->count;
+    for (int i = 0; i < 100; ++i) {
+        log_every_n(logger, i);
+    }
+    HIPER_ASSERT(appender->count - count == 10);
+    HIPER_ASSERT(appender->last == "every 90 (suppressed 9)");
+
+    // 每秒最多5条
+    uint64_t sec = hiper::GetElapsedMS() / 1000;
+    while (hiper::GetElapsedMS() / 1000 == sec) {
+        usleep(1000);
+    }
+    count = appender->count;
+    for (int i = 0; i < 1000; ++i) {
+        LOG_INFO_LIMIT(logger, 5) << "limit " << i;
+    }
+    HIPER_ASSERT(appender->count - count == 5);
+    HIPER_ASSERT(appender->last == "limit 4");
+    sleep(1);
+    LOG_INFO_LIMIT(logger, 5) << "limit again";
+    HIPER_ASSERT(appender->last == "limit again");
+    for (int i = 0; i < 3; ++i) {
+        LOG_FMT_ERROR_LIMIT(logger, 1, "fmt %d", i);
+    }
+    HIPER_ASSERT(appender->last == "fmt 0");
+
+    // 多线程同时写同一个调用点，计数不丢
+    appender->capture = false;
+    CountAppender::ptr counter(new CountAppender);
+    logger->clearAppenders();
+    logger->addAppender(counter);
+    std::vector<hiper::Thread::ptr> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(new hiper::Thread(
+            [logger]() {
+                for (int i = 0; i < 10000; ++i) {
+                    log_every_n(logger, i);
+                }
+            },
+            "limit_" + std::to_string(t)));
+    }
+    for (auto& i : threads) {
+        i->join();
+    }
+    HIPER_ASSERT(counter->count == 4000);
+    logger->clearAppenders();
+    logger->addAppender(appender);
+}
+
+int main(int argc, char** argv)
+{
+    hiper::Logger::ptr logger = LOG_NAME("log_event_test");
+    NullAppender::ptr  appender(new NullAppender);
+    logger->setLevel(hiper::LogLevel::DEBUG);
+    logger->clearAppenders();
+    logger->addAppender(appender);
+
+    test_content(logger, appender);
+    test_alloc(logger, appender);
+    test_level(logger, appender);
+    test_limit(logger, appender);
+    return 0;
+}
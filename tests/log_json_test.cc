@@ -0,0 +1,207 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-26 15:32:07
+ * @Description: JSON日志格式和结构化字段测试，字符串转义、文本和JSON两种输出、配置，以及格式化速度
+ */
+#include "../hiper/base/hiper.h"
+
+#include <random>
+
+/**
+ * @brief 记录最后一条日志格式化后的内容
+ */
+class CaptureAppender : public hiper::LogAppender {
+public:
+    typedef std::shared_ptr<CaptureAppender> ptr;
+
+    void log(hiper::Logger::ptr logger, hiper::LogLevel::Level level,
+             hiper::LogEvent::ptr event) override
+    {
+        hiper::Rcu::ReadLock rcu;
+        last = peekFormatter()->format(logger, level, event);
+    }
+
+    std::string toYamlString() override { return ""; }
+
+    std::string last;
+};
+
+struct Point
+{
+    int x;
+    int y;
+};
+
+std::ostream& operator<<(std::ostream& os, const Point& p)
+{
+    return os << "(" << p.x << "," << p.y << ")";
+}
+
+/**
+ * @brief 逐字节转义，作为对照
+ */
+static std::string escape(const std::string& str)
+{
+    std::string out = "\"";
+    for (unsigned char c : str) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        default:
+            if (c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            }
+            else {
+                out += (char)c;
+            }
+        }
+    }
+    return out + "\"";
+}
+
+static std::string json_string(const std::string& str)
+{
+    hiper::LogStreamBuf buf;
+    hiper::LogFormatter::AppendJsonString(buf, str.data(), str.size());
+    return std::string(buf.data(), buf.size());
+}
+
+void test_escape()
+{
+    HIPER_ASSERT(json_string("") == "\"\"");
+    HIPER_ASSERT(json_string("hello") == "\"hello\"");
+    HIPER_ASSERT(json_string("a\"b\\c\nd\te\x01") == "\"a\\\"b\\\\c\\nd\\te\\u0001\"");
+    // UTF-8原样输出
+    HIPER_ASSERT(json_string("中文日志") == "\"中文日志\"");
+
+    // 随机内容，需要转义的字符落在16字节块的不同位置
+    std::mt19937 rng(12345);
+    const char   chars[] = "abcXYZ0129 \"\\\n\t\x01\x1f\x7f\xe4\xb8\xad";
+    for (int i = 0; i < 2000; ++i) {
+        std::string str(rng() % 80, ' ');
+        for (auto& c : str) {
+            c = chars[rng() % (sizeof(chars) - 1)];
+        }
+        HIPER_ASSERT(json_string(str) == escape(str));
+    }
+}
+
+void test_fields()
+{
+    hiper::Logger::ptr   logger = LOG_NAME("log_json_test");
+    CaptureAppender::ptr appender(new CaptureAppender);
+    logger->clearAppenders();
+    logger->addAppender(appender);
+
+    // 文本格式：字段追加在消息后面
+    appender->setFormatter(hiper::LogFormatter::ptr(new hiper::LogFormatter("%m")));
+    LOG_INFO(logger) << "login" << hiper::LogField("uid", 42) << hiper::LogField("name", "leo")
+                     << hiper::LogField("ok", true) << hiper::LogField("cost", 1.5)
+                     << hiper::LogField("bytes", (uint64_t)1 << 40)
+                     << hiper::LogField("point", Point{1, 2});
+    HIPER_ASSERT(appender->last ==
+                 "login uid=42 name=leo ok=true cost=1.5 bytes=1099511627776 point=(1,2)");
+    LOG_INFO(logger) << "no fields";
+    HIPER_ASSERT(appender->last == "no fields");
+
+    // JSON格式
+    hiper::LogFormatter::ptr json(new hiper::LogFormatter("json{%Y}"));
+    HIPER_ASSERT(json->isJson() && !json->isError());
+    appender->setFormatter(json);
+    std::string str = "say \"hi\"\n";
+    LOG_WARN(logger) << "user " << str << hiper::LogField("uid", -7)
+                     << hiper::LogField("path", std::string("/a\\b"))
+                     << hiper::LogField("ratio", 0.25) << hiper::LogField("nan", 0.0 / 0.0)
+                     << hiper::LogField("vip", false);
+    const std::string& out = appender->last;
+    HIPER_ASSERT(out.front() == '{' && out.substr(out.size() - 2) == "}\n");
+    HIPER_ASSERT(out.find("\"level\":\"WARN\",\"logger\":\"log_json_test\"") != std::string::npos);
+    HIPER_ASSERT(out.find("\"file\":\"" __FILE__ "\"") != std::string::npos);
+    HIPER_ASSERT(out.find("\"thread_name\":\"" + hiper::Thread::GetName() + "\"") !=
+                 std::string::npos);
+    HIPER_ASSERT(out.find("\"msg\":\"user say \\\"hi\\\"\\n\",\"fields\":{\"uid\":-7,"
+                          "\"path\":\"/a\\\\b\",\"ratio\":0.25,\"nan\":null,\"vip\":false}}\n") !=
+                 std::string::npos);
+    char year[8];
+    time_t now = time(0);
+    strftime(year, sizeof(year), "%Y", localtime(&now));
+    HIPER_ASSERT(out.compare(0, 14, std::string("{\"time\":\"") + year + "\"") == 0);
+
+    // 和固定字段同名的用户字段不会产生重复的键
+    LOG_INFO(logger) << "dup" << hiper::LogField("msg", "user") << hiper::LogField("level", 1);
+    HIPER_ASSERT(out.find("\"msg\":\"dup\",\"fields\":{\"msg\":\"user\",\"level\":1}}\n") !=
+                 std::string::npos);
+
+    // 写到普通的流
+    std::stringstream ss;
+    ss << "plain" << hiper::LogField("k", 1);
+    HIPER_ASSERT(ss.str() == "plain k=1");
+
+    logger->clearAppenders();
+}
+
+void test_config()
+{
+    YAML::Node node = YAML::Load("logs:\n"
+                                 "  - name: log_json_test_conf\n"
+                                 "    level: info\n"
+                                 "    formatter: json\n"
+                                 "    appenders:\n"
+                                 "      - type: StdoutLogAppender\n"
+                                 "      - type: StdoutLogAppender\n"
+                                 "        formatter: \"%m%n\"\n");
+    hiper::Config::LoadFromYaml(node);
+    hiper::Logger::ptr logger = LOG_NAME("log_json_test_conf");
+    HIPER_ASSERT(logger->getFormatter()->isJson());
+    auto appenders = logger->getAppenders();
+    HIPER_ASSERT(appenders.size() == 2);
+    HIPER_ASSERT(appenders[0]->getFormatter()->isJson());
+    HIPER_ASSERT(!appenders[1]->getFormatter()->isJson());
+    LOG_INFO(logger) << "json from config" << hiper::LogField("n", 1);
+    logger->clearAppenders();
+}
+
+void test_bench()
+{
+    const int          lines  = 1000000;
+    hiper::Logger::ptr logger(new hiper::Logger("bench_json"));
+    hiper::LogEvent::ptr event(new hiper::LogEvent(hiper::LogLevel::INFO, __FILE__, __LINE__, 1234,
+                                                   hiper::GetThreadId(), 17, time(0),
+                                                   hiper::Thread::GetName()));
+    event->getSS() << "GET /index.html HTTP/1.1 200 cost=" << 1.25 << "ms";
+    event->getFields().add("path", "/index.html");
+    event->getFields().add("status", 200);
+    event->getFields().add("cost", 1.25);
+
+    hiper::LogFormatter::ptr text = logger->getFormatter();
+    hiper::LogFormatter::ptr json(new hiper::LogFormatter("json"));
+    for (auto& fmt : {text, json}) {
+        size_t   total = 0;
+        uint64_t start = hiper::GetElapsedUS();
+        for (int i = 0; i < lines; ++i) {
+            hiper::LogStreamBuf& buf = hiper::LogFormatter::GetThreadBuffer();
+            fmt->format(buf, logger, hiper::LogLevel::INFO, event);
+            total += buf.size();
+        }
+        uint64_t used = hiper::GetElapsedUS() - start;
+        std::cout << (fmt->isJson() ? "json: " : "text: ")
+                  << (uint64_t)(lines * 1000000.0 / used) << " lines/s bytes=" << total
+                  << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    test_escape();
+    test_fields();
+    test_config();
+    test_bench();
+    return 0;
+}
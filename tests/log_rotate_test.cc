@@ -0,0 +1,318 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-26 10:18:40
+ * @Description: 日志文件滚动测试，按大小和手动滚动、gzip压缩、历史文件个数限制，以及按时间滚动的时间点
+ */
+#include "../hiper/base/hiper.h"
+
+#include <dirent.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static const std::string s_dir  = "./log_rotate_test_dir";
+static const std::string s_file = s_dir + "/rotate.log";
+
+/**
+ * @brief 返回目录下的所有文件
+ */
+static std::vector<std::string> list_files()
+{
+    std::vector<std::string> files;
+    DIR*                     d = opendir(s_dir.c_str());
+    if (!d) {
+        return files;
+    }
+    struct dirent* dp;
+    while ((dp = readdir(d)) != nullptr) {
+        if (dp->d_name[0] != '.') {
+            files.push_back(s_dir + "/" + dp->d_name);
+        }
+    }
+    closedir(d);
+    return files;
+}
+
+static void clear_dir()
+{
+    for (auto& i : list_files()) {
+        unlink(i.c_str());
+    }
+}
+
+/**
+ * @brief 统计文件的行数，.gz结尾的文件先解压
+ */
+static size_t count_lines(const std::string& file)
+{
+    gzFile gz = gzopen(file.c_str(), "rb");
+    HIPER_ASSERT(gz);
+    size_t lines = 0;
+    char   buf[4096];
+    while (gzgets(gz, buf, sizeof(buf))) {
+        ++lines;
+    }
+    gzclose(gz);
+    return lines;
+}
+
+static size_t count_all_lines()
+{
+    size_t lines = 0;
+    for (auto& i : list_files()) {
+        lines += count_lines(i);
+    }
+    return lines;
+}
+
+static size_t count_gz()
+{
+    size_t n = 0;
+    for (auto& i : list_files()) {
+        if (i.size() > 3 && i.compare(i.size() - 3, 3, ".gz") == 0) {
+            ++n;
+        }
+    }
+    return n;
+}
+
+static hiper::Logger::ptr make_logger(hiper::FileLogAppender::ptr appender)
+{
+    hiper::Logger::ptr logger = LOG_NAME("log_rotate_test");
+    logger->setLevel(hiper::LogLevel::DEBUG);
+    logger->clearAppenders();
+    appender->setFormatter(hiper::LogFormatter::ptr(new hiper::LogFormatter("%m%n")));
+    logger->addAppender(appender);
+    return logger;
+}
+
+void test_policy()
+{
+    HIPER_ASSERT(hiper::LogRotatePolicy::SizeFromString("1024") == 1024);
+    HIPER_ASSERT(hiper::LogRotatePolicy::SizeFromString("10K") == 10 * 1024);
+    HIPER_ASSERT(hiper::LogRotatePolicy::SizeFromString("100m") == 100 * 1024 * 1024);
+    HIPER_ASSERT(hiper::LogRotatePolicy::SizeFromString("2G") == 2ull << 30);
+    HIPER_ASSERT(hiper::LogRotatePolicy::SizeFromString("abc") == 0);
+    HIPER_ASSERT(hiper::LogRotatePolicy::IntervalFromString("Daily") ==
+                 hiper::LogRotatePolicy::DAILY);
+    HIPER_ASSERT(hiper::LogRotatePolicy::IntervalFromString("xx") == hiper::LogRotatePolicy::NONE);
+
+    time_t    now    = time(0);
+    time_t    hourly = hiper::LogRotatePolicy::NextRotateTime(now, hiper::LogRotatePolicy::HOURLY);
+    struct tm tm;
+    localtime_r(&hourly, &tm);
+    HIPER_ASSERT(hourly > now && hourly <= now + 3600);
+    HIPER_ASSERT(tm.tm_min == 0 && tm.tm_sec == 0);
+
+    time_t daily = hiper::LogRotatePolicy::NextRotateTime(now, hiper::LogRotatePolicy::DAILY);
+    localtime_r(&daily, &tm);
+    HIPER_ASSERT(daily > now && daily <= now + 25 * 3600);
+    HIPER_ASSERT(tm.tm_hour == 0 && tm.tm_min == 0 && tm.tm_sec == 0);
+    HIPER_ASSERT(hiper::LogRotatePolicy::NextRotateTime(now, hiper::LogRotatePolicy::NONE) == 0);
+}
+
+void test_manual_rotate()
+{
+    clear_dir();
+    hiper::LogRotatePolicy policy;
+    policy.compress = true;
+    hiper::FileLogAppender::ptr appender(new hiper::FileLogAppender(s_file, policy));
+    hiper::Logger::ptr          logger = make_logger(appender);
+
+    // 多个线程写日志的同时滚动，日志一条都不能少
+    const int                                n = 20000;
+    std::vector<std::shared_ptr<hiper::Thread>> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(new hiper::Thread(
+            [logger, t]() {
+                for (int i = 0; i < n; ++i) {
+                    LOG_INFO(logger) << "thread " << t << " line " << i;
+                }
+            },
+            "writer_" + std::to_string(t)));
+    }
+    for (int i = 0; i < 3; ++i) {
+        usleep(1000);
+        HIPER_ASSERT(appender->rotate());
+    }
+    for (auto& i : threads) {
+        i->join();
+    }
+    // 压缩推迟到子进程都重新打开之后
+    HIPER_ASSERT(count_gz() == 0);
+    sleep(6);
+    HIPER_ASSERT(count_gz() == 3);
+    HIPER_ASSERT(list_files().size() == 4);
+    HIPER_ASSERT(count_all_lines() == (size_t)n * 4);
+
+    logger->clearAppenders();
+}
+
+void test_max_files()
+{
+    clear_dir();
+    hiper::LogRotatePolicy policy;
+    policy.maxFiles = 2;
+    hiper::FileLogAppender::ptr appender(new hiper::FileLogAppender(s_file, policy));
+    hiper::Logger::ptr          logger = make_logger(appender);
+
+    for (int i = 0; i < 5; ++i) {
+        LOG_INFO(logger) << "file " << i;
+        HIPER_ASSERT(appender->rotate());
+    }
+    LOG_INFO(logger) << "file 5";
+    // 清理推迟到子进程都重新打开之后，之后只剩当前文件加两个最新的历史文件
+    HIPER_ASSERT(list_files().size() == 6);
+    sleep(6);
+    auto files = list_files();
+    HIPER_ASSERT(files.size() == 3);
+    HIPER_ASSERT(count_all_lines() == 3);
+    for (auto& i : files) {
+        std::ifstream ifs(i);
+        std::string   line;
+        std::getline(ifs, line);
+        HIPER_ASSERT(line == "file 3" || line == "file 4" || line == "file 5");
+    }
+
+    logger->clearAppenders();
+}
+
+void test_background()
+{
+    clear_dir();
+    hiper::LogRotatePolicy policy;
+    policy.maxSize = 1024;
+    hiper::FileLogAppender::ptr appender(new hiper::FileLogAppender(s_file, policy));
+    hiper::Logger::ptr          logger = make_logger(appender);
+
+    std::string line(100, 'x');
+    for (int i = 0; i < 20; ++i) {
+        LOG_INFO(logger) << line;
+    }
+    HIPER_ASSERT(appender->getFileSize() >= 1024);
+    // 后台线程每秒检查一次
+    sleep(2);
+    HIPER_ASSERT(appender->getFileSize() == 0);
+    HIPER_ASSERT(list_files().size() == 2);
+
+    // 文件被删除后重新打开
+    unlink(s_file.c_str());
+    sleep(4);
+    LOG_INFO(logger) << "after unlink";
+    HIPER_ASSERT(count_lines(s_file) == 1);
+
+    logger->clearAppenders();
+}
+
+void test_config()
+{
+    YAML::Node node = YAML::Load("logs:\n"
+                                 "  - name: log_rotate_test_conf\n"
+                                 "    level: info\n"
+                                 "    appenders:\n"
+                                 "      - type: FileLogAppender\n"
+                                 "        file: " + s_file + "\n"
+                                 "        max_size: 10M\n"
+                                 "        rotate: daily\n"
+                                 "        max_files: 7\n"
+                                 "        compress: true\n");
+    hiper::Config::LoadFromYaml(node);
+    std::string yaml = LOG_NAME("log_rotate_test_conf")->toYamlString();
+    HIPER_ASSERT(yaml.find("max_size: 10485760") != std::string::npos);
+    HIPER_ASSERT(yaml.find("rotate: daily") != std::string::npos);
+    HIPER_ASSERT(yaml.find("max_files: 7") != std::string::npos);
+    HIPER_ASSERT(yaml.find("compress: true") != std::string::npos);
+    LOG_NAME("log_rotate_test_conf")->clearAppenders();
+}
+
+/**
+ * @brief fork出的子进程重新启动后台线程，父进程滚动后子进程重新打开新文件，自己不滚动；
+ *        父进程按文件的实际大小滚动，子进程写入的也算在内
+ */
+void test_fork()
+{
+    clear_dir();
+    hiper::LogRotatePolicy policy;
+    policy.maxSize = 1024;
+    hiper::FileLogAppender::ptr appender(new hiper::FileLogAppender(s_file, policy));
+    hiper::Logger::ptr          logger = make_logger(appender);
+    LOG_INFO(logger) << "parent before fork";
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        alarm(20);
+        // 超过max_size也不滚动，等父进程滚动后重新打开
+        for (int i = 0; i < 100; ++i) {
+            LOG_INFO(logger) << "child line " << i << " padding padding padding";
+        }
+        sleep(6);
+        LOG_INFO(logger) << "child after rotate";
+        _exit(0);
+    }
+    sleep(2);
+    // 父进程自己只写了一行，子进程写超max_size后由父进程的后台线程滚动
+    size_t files = list_files().size();
+    HIPER_ASSERT(appender->rotate());
+    int status = 0;
+    waitpid(pid, &status, 0);
+    HIPER_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    HIPER_ASSERT(files == 2);
+
+    std::ifstream ifs(s_file);
+    std::string   content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    HIPER_ASSERT(content.find("child after rotate") != std::string::npos);
+    HIPER_ASSERT(count_all_lines() == 102);
+    logger->clearAppenders();
+}
+
+/**
+ * @brief 压缩滚动时子进程一直在写，重新打开之前写到旧文件的日志压缩后也不能丢
+ */
+void test_fork_compress()
+{
+    clear_dir();
+    hiper::LogRotatePolicy policy;
+    policy.compress = true;
+    hiper::FileLogAppender::ptr appender(new hiper::FileLogAppender(s_file, policy));
+    hiper::Logger::ptr          logger = make_logger(appender);
+    LOG_INFO(logger) << "parent before fork";
+
+    const int n   = 500;
+    pid_t     pid = fork();
+    if (pid == 0) {
+        alarm(20);
+        // 跨过父进程的滚动和自己重新打开文件，持续写5秒
+        for (int i = 0; i < n; ++i) {
+            LOG_INFO(logger) << "child line " << i;
+            usleep(10 * 1000);
+        }
+        _exit(0);
+    }
+    sleep(1);
+    HIPER_ASSERT(appender->rotate());
+    int status = 0;
+    waitpid(pid, &status, 0);
+    HIPER_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    sleep(6);
+    HIPER_ASSERT(count_gz() == 1);
+    HIPER_ASSERT(list_files().size() == 2);
+    HIPER_ASSERT(count_all_lines() == (size_t)n + 1);
+    logger->clearAppenders();
+}
+
+int main(int argc, char** argv)
+{
+    hiper::FSUtil::Mkdir(s_dir);
+    test_policy();
+    test_manual_rotate();
+    test_max_files();
+    test_background();
+    test_config();
+    test_fork();
+    test_fork_compress();
+    clear_dir();
+    rmdir(s_dir.c_str());
+    return 0;
+}
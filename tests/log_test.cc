@@ -7,11 +7,16 @@
 
 #include "../hiper/base/log.h"
 
+#include "../hiper/base/async_log.h"
 #include "../hiper/base/config.h"
 #include "../hiper/base/env.h"
+#include "../hiper/base/macro.h"
+#include "../hiper/base/thread.h"
 #include "../hiper/base/util.h"
 
+#include <atomic>
 #include <ctime>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <yaml-cpp/node/node.h>
 #include <yaml-cpp/yaml.h>
@@ -92,6 +97,202 @@ void test_loadconf()
     hiper::Config::LoadFromConfDir("conf");
 }
 
+// 多线程写同一个文件的吞吐量，同步FileLogAppender和异步AsyncLogAppender对比
+static double bench_appender(hiper::LogAppender::ptr appender, const std::string& name,
+                             int threads, int lines)
+{
+    hiper::Logger::ptr logger = LOG_NAME(name);
+    logger->setLevel(hiper::LogLevel::DEBUG);
+    logger->clearAppenders();
+    logger->addAppender(appender);
+
+    uint64_t                        start = hiper::GetElapsedUS();
+    std::vector<hiper::Thread::ptr> thrs;
+    for (int i = 0; i < threads; ++i) {
+        thrs.push_back(hiper::Thread::ptr(new hiper::Thread(
+            [logger, lines]() {
+                for (int n = 0; n < lines; ++n) {
+                    LOG_INFO(logger) << "benchmark line " << n << " payload " << 3.1415926;
+                }
+            },
+            name + "_" + std::to_string(i))));
+    }
+    for (auto& t : thrs) {
+        t->join();
+    }
+    auto async = std::dynamic_pointer_cast<hiper::AsyncLogAppender>(appender);
+    if (async) {
+        async->flush();
+    }
+    uint64_t used = hiper::GetElapsedUS() - start;
+    logger->clearAppenders();
+    return threads * lines * 1000000.0 / used;
+}
+
+static size_t count_lines(const std::string& file)
+{
+    std::ifstream ifs(file);
+    std::string   line;
+    size_t        n = 0;
+    while (std::getline(ifs, line)) {
+        ++n;
+    }
+    return n;
+}
+
+void test_async_bench()
+{
+    const int threads = 4;
+    const int lines   = 100000;
+    unlink("./bench_sync.log");
+    unlink("./bench_async.log");
+
+    double sync_rate = bench_appender(hiper::LogAppender::ptr(new hiper::FileLogAppender(
+                                          "./bench_sync.log")),
+                                      "bench_sync", threads, lines);
+    hiper::AsyncLogAppender::ptr async(new hiper::AsyncLogAppender("./bench_async.log"));
+    double async_rate = bench_appender(async, "bench_async", threads, lines);
+    async->stop();
+
+    std::cout << "sync  FileLogAppender:  " << (uint64_t)sync_rate << " lines/s" << std::endl;
+    std::cout << "async AsyncLogAppender: " << (uint64_t)async_rate << " lines/s" << std::endl;
+    // BLOCK策略不丢日志
+    HIPER_ASSERT(async->getDropped() == 0);
+    HIPER_ASSERT(count_lines("./bench_async.log") == (size_t)threads * lines);
+
+    // DROP策略在积压满了之后丢弃，丢弃的条数会写进文件
+    hiper::Config::Lookup<uint32_t>("log.async.max_backlog")->setValue(64 * 1024);
+    hiper::Config::Lookup<uint32_t>("log.async.buffer_size")->setValue(16 * 1024);
+    unlink("./bench_async.log");
+    hiper::AsyncLogAppender::ptr drop(
+        new hiper::AsyncLogAppender("./bench_async.log", hiper::AsyncLogAppender::DROP));
+    double drop_rate = bench_appender(drop, "bench_drop", threads, lines);
+    drop->stop();
+    std::cout << "async drop policy:      " << (uint64_t)drop_rate
+              << " lines/s dropped=" << drop->getDropped() << std::endl;
+    HIPER_ASSERT(count_lines("./bench_async.log") + drop->getDropped() >= (size_t)threads * lines);
+
+    unlink("./bench_sync.log");
+    unlink("./bench_async.log");
+}
+
+// fork出的子进程里没有后台线程，写日志时重新启动，积压超过上限也不会一直阻塞
+void test_async_fork()
+{
+    hiper::Config::Lookup<uint32_t>("log.async.max_backlog")->setValue(64 * 1024);
+    hiper::Config::Lookup<uint32_t>("log.async.buffer_size")->setValue(16 * 1024);
+    unlink("./async_fork.log");
+    hiper::Logger::ptr logger = LOG_NAME("async_fork");
+    logger->setLevel(hiper::LogLevel::DEBUG);
+    logger->clearAppenders();
+    hiper::AsyncLogAppender::ptr async(new hiper::AsyncLogAppender("./async_fork.log"));
+    logger->addAppender(async);
+
+    // 父进程还没写入文件的日志不能在子进程里再写一次
+    LOG_INFO(logger) << "parent before fork";
+    const int lines = 10000;
+    pid_t     pid   = fork();
+    if (pid == 0) {
+        alarm(10);
+        for (int i = 0; i < lines; ++i) {
+            LOG_INFO(logger) << "child line " << i << " payload " << 3.1415926;
+        }
+        async->flush();
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    async->stop();
+    logger->clearAppenders();
+    HIPER_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    HIPER_ASSERT(count_lines("./async_fork.log") == (size_t)lines + 1);
+    unlink("./async_fork.log");
+}
+
+// 线程数增加时同一个日志器的吞吐量，写日志时日志器和FileLogAppender都不加锁
+void test_scale_bench()
+{
+    const int total = 320000;
+    for (int threads = 1; threads <= 32; threads *= 2) {
+        unlink("./bench_scale.log");
+        double rate = bench_appender(
+            hiper::LogAppender::ptr(new hiper::FileLogAppender("./bench_scale.log")),
+            "bench_scale", threads, total / threads);
+        std::cout << "threads=" << threads << " FileLogAppender: " << (uint64_t)rate
+                  << " lines/s" << std::endl;
+        HIPER_ASSERT(count_lines("./bench_scale.log") == (size_t)total);
+    }
+    unlink("./bench_scale.log");
+}
+
+// 写日志的同时反复替换日志目标和格式器，被删除的日志目标在delAppender返回时已经释放
+void test_appender_swap()
+{
+    hiper::Logger::ptr logger = LOG_NAME("appender_swap");
+    logger->setLevel(hiper::LogLevel::DEBUG);
+    logger->clearAppenders();
+
+    std::atomic<bool>               stop{false};
+    std::vector<hiper::Thread::ptr> thrs;
+    for (int i = 0; i < 4; ++i) {
+        thrs.push_back(hiper::Thread::ptr(new hiper::Thread(
+            [logger, &stop]() {
+                while (!stop) {
+                    LOG_INFO(logger) << "swap line " << 3.1415926;
+                }
+            },
+            "appender_swap_" + std::to_string(i))));
+    }
+    for (int i = 0; i < 200; ++i) {
+        hiper::LogAppender::ptr appender(new hiper::FileLogAppender("./appender_swap.log"));
+        std::weak_ptr<hiper::LogAppender> weak = appender;
+        logger->addAppender(appender);
+        appender->setFormatter(hiper::LogFormatter::ptr(new hiper::LogFormatter("%m%n")));
+        logger->setFormatter("%d%T%m%n");
+        logger->delAppender(appender);
+        appender.reset();
+        HIPER_ASSERT(weak.expired());
+    }
+    stop = true;
+    for (auto& t : thrs) {
+        t->join();
+    }
+    unlink("./appender_swap.log");
+}
+
+// 默认格式下LogFormatter的渲染速度，不包含写文件
+void test_formatter_bench()
+{
+    const int          lines = 1000000;
+    hiper::Logger::ptr logger(new hiper::Logger("bench_formatter"));
+    hiper::LogFormatter::ptr formatter = logger->getFormatter();
+    hiper::LogEvent::ptr     event(new hiper::LogEvent(hiper::LogLevel::INFO, __FILE__, __LINE__,
+                                                       1234, hiper::GetThreadId(), 17, time(0),
+                                                       hiper::Thread::GetName()));
+    event->getSS() << "GET /index.html HTTP/1.1 200 cost=" << 1.25 << "ms";
+
+    size_t   total = 0;
+    uint64_t start = hiper::GetElapsedUS();
+    for (int i = 0; i < lines; ++i) {
+        total += formatter->format(logger, hiper::LogLevel::INFO, event).size();
+    }
+    uint64_t used = hiper::GetElapsedUS() - start;
+    std::cout << "formatter string: " << (uint64_t)(lines * 1000000.0 / used) << " lines/s"
+              << " bytes=" << total << std::endl;
+
+    size_t buf_total = 0;
+    start            = hiper::GetElapsedUS();
+    for (int i = 0; i < lines; ++i) {
+        hiper::LogStreamBuf& buf = hiper::LogFormatter::GetThreadBuffer();
+        formatter->format(buf, logger, hiper::LogLevel::INFO, event);
+        buf_total += buf.size();
+    }
+    used = hiper::GetElapsedUS() - start;
+    std::cout << "formatter buffer: " << (uint64_t)(lines * 1000000.0 / used) << " lines/s"
+              << " bytes=" << buf_total << std::endl;
+    HIPER_ASSERT(buf_total == total);
+}
+
 
 
 int main(int argc, char* argv[])
@@ -155,5 +356,11 @@ int main(int argc, char* argv[])
 
     LOG_INFO(l) << "xx logger";
 
+    test_formatter_bench();
+    test_async_bench();
+    test_async_fork();
+    test_appender_swap();
+    test_scale_bench();
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,155 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-18 16:35:50
+ * @Description: 指标测试，直方图分桶与分位数、多线程计数以及Prometheus导出
+ */
+#include "../hiper/base/hiper.h"
+
+using namespace hiper;
+static Logger::ptr g_logger = LOG_ROOT();
+
+void test_buckets()
+{
+    // 每个值都落在上界不小于它的桶里，上一个桶的上界小于它
+    for (uint64_t v : {0ull, 1ull, 7ull, 8ull, 15ull, 16ull, 17ull, 1000ull, 123456789ull, ~0ull}) {
+        size_t idx = Histogram::BucketIndex(v);
+        HIPER_ASSERT(idx < Histogram::kBuckets);
+        HIPER_ASSERT(Histogram::BucketUpperBound(idx) >= v);
+        HIPER_ASSERT(idx == 0 || Histogram::BucketUpperBound(idx - 1) < v);
+    }
+
+    Histogram h("test_latency_us");
+    for (uint64_t i = 1; i <= 10000; ++i) {
+        h.record(i);
+    }
+    Histogram::Snapshot snap = h.getSnapshot();
+    LOG_INFO(g_logger) << "count=" << snap.count << " mean=" << snap.mean()
+                       << " p50=" << snap.percentile(0.5) << " p99=" << snap.percentile(0.99)
+                       << " max=" << snap.max;
+    HIPER_ASSERT(snap.count == 10000 && snap.max == 10000);
+    HIPER_ASSERT(snap.percentile(0.5) >= 5000 && snap.percentile(0.5) <= 5000 * 1.125);
+    HIPER_ASSERT(snap.percentile(0.99) >= 9900 && snap.percentile(0.99) <= 10000);
+}
+
+void test_threads()
+{
+    Counter::ptr   c = MetricsMgr::GetInstance()->counter("test_ops_total", "test ops");
+    Histogram::ptr h = MetricsMgr::GetInstance()->histogram("test_op_ns", "test op cost");
+
+    const int                threads = 4;
+    const int                loops   = 1000000;
+    std::vector<Thread::ptr> thrs;
+    uint64_t                 start = GetElapsedUS();
+    for (int i = 0; i < threads; ++i) {
+        thrs.emplace_back(new Thread(
+            [c, h]() {
+                for (int j = 0; j < loops; ++j) {
+                    c->add();
+                    h->record(j & 1023);
+                }
+            },
+            "metrics_" + std::to_string(i)));
+    }
+    for (auto& t : thrs) {
+        t->join();
+    }
+    uint64_t used = GetElapsedUS() - start;
+    HIPER_ASSERT(c->getValue() == (uint64_t)threads * loops);
+    HIPER_ASSERT(h->getSnapshot().count == (uint64_t)threads * loops);
+    LOG_INFO(g_logger) << "counter+histogram " << threads * loops << " ops in " << used
+                       << "us, " << used * 1000.0 / loops << " ns per op per thread";
+}
+
+void test_export()
+{
+    {
+        IOManager iom(2, false, "metrics");
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule([]() { usleep(100); });
+        }
+        iom.addTimer(10, []() {});
+        usleep(100 * 1000);
+    }
+
+    Gauge::ptr g = MetricsMgr::GetInstance()->gauge("test_gauge", "a test gauge", "kind=\"a\"");
+    g->set(42);
+    std::string text = MetricsMgr::GetInstance()->toPrometheus();
+    HIPER_ASSERT(text.find("test_gauge{kind=\"a\"} 42") != std::string::npos);
+    HIPER_ASSERT(text.find("hiper_scheduler_task_run_us_count{scheduler=\"metrics\"} ") !=
+                 std::string::npos);
+    HIPER_ASSERT(text.find("hiper_scheduler_queue_depth{scheduler=\"metrics\",") ==
+                 std::string::npos);
+
+    // 只输出调度器和定时器相关的部分
+    std::stringstream ss(text);
+    std::string       line;
+    while (std::getline(ss, line)) {
+        if (line.find("scheduler=\"metrics\"") != std::string::npos ||
+            line.find("iomanager=\"metrics\"") != std::string::npos ||
+            line.find("hiper_timer_lateness_ms_count") != std::string::npos) {
+            if (line.find("_bucket") == std::string::npos) {
+                std::cout << line << std::endl;
+            }
+        }
+    }
+}
+
+/**
+ * @brief 重名的调度器各自导出回调仪表，先销毁的不影响后创建的
+ */
+void test_same_name_gauges()
+{
+    auto count = [](const std::string& text) {
+        size_t n = 0;
+        for (size_t pos = 0;
+             (pos = text.find("hiper_scheduler_queue_depth{scheduler=\"dup\",", pos)) !=
+             std::string::npos;
+             ++pos) {
+            ++n;
+        }
+        return n;
+    };
+    std::unique_ptr<IOManager> first(new IOManager(1, false, "dup"));
+    {
+        IOManager second(1, false, "dup");
+        HIPER_ASSERT(count(MetricsMgr::GetInstance()->toPrometheus()) == 2);
+        first.reset();
+        HIPER_ASSERT(count(MetricsMgr::GetInstance()->toPrometheus()) == 1);
+    }
+    HIPER_ASSERT(count(MetricsMgr::GetInstance()->toPrometheus()) == 0);
+}
+
+/**
+ * @brief 导出的同时反复创建和销毁调度器，回调不能访问已经销毁的对象
+ */
+void test_scrape_during_destroy()
+{
+    std::atomic<bool> stop{false};
+    std::atomic<int>  scrapes{0};
+    Thread            scraper(
+        [&]() {
+            while (!stop) {
+                MetricsMgr::GetInstance()->toPrometheus();
+                ++scrapes;
+            }
+        },
+        "scraper");
+    for (int i = 0; i < 50; ++i) {
+        BlockingExecutor executor(1, "churn");
+        executor.start();
+        IOManager iom(1, false, "churn");
+    }
+    stop = true;
+    scraper.join();
+    LOG_INFO(g_logger) << "scrapes during churn=" << scrapes;
+}
+
+int main(int argc, char** argv)
+{
+    test_buckets();
+    test_threads();
+    test_export();
+    test_same_name_gauges();
+    test_scrape_during_destroy();
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-26 20:11:52
+ * @Description: mmap环形缓冲区日志测试，顺序读回、环形覆盖、多线程、进程abort后取回，以及hiper-logcat
+ */
+#include "../hiper/base/hiper.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const std::string s_file = "./mmap_log_test.ring";
+
+static hiper::Logger::ptr make_logger(hiper::LogAppender::ptr appender)
+{
+    hiper::Logger::ptr logger = LOG_NAME("mmap_log_test");
+    logger->setLevel(hiper::LogLevel::DEBUG);
+    logger->clearAppenders();
+    appender->setFormatter(hiper::LogFormatter::ptr(new hiper::LogFormatter("%p %m%n")));
+    logger->addAppender(appender);
+    return logger;
+}
+
+static std::vector<std::string> recover(const std::string& file)
+{
+    std::vector<std::string> lines;
+    int64_t                  n = hiper::MmapLogAppender::Recover(
+        file, [&lines](hiper::LogLevel::Level level, const char* data, size_t len) {
+            lines.emplace_back(data, len);
+        });
+    HIPER_ASSERT(n == (int64_t)lines.size());
+    return lines;
+}
+
+void test_basic()
+{
+    unlink(s_file.c_str());
+    hiper::MmapLogAppender::ptr appender(new hiper::MmapLogAppender(s_file, 1024 * 1024));
+    HIPER_ASSERT(appender->isValid());
+    HIPER_ASSERT(appender->getCapacity() == 1024 * 1024);
+    hiper::Logger::ptr logger = make_logger(appender);
+
+    for (int i = 0; i < 1000; ++i) {
+        LOG_DEBUG(logger) << "line " << i;
+    }
+    auto lines = recover(s_file);
+    HIPER_ASSERT(lines.size() == 1000);
+    for (int i = 0; i < 1000; ++i) {
+        HIPER_ASSERT(lines[i] == "DEBUG line " + std::to_string(i) + "\n");
+    }
+    HIPER_ASSERT(hiper::MmapLogAppender::Recover("./no_such_file", nullptr) == -1);
+    logger->clearAppenders();
+}
+
+void test_wrap()
+{
+    unlink(s_file.c_str());
+    // 容量最小64K，写入远超容量的日志
+    hiper::MmapLogAppender::ptr appender(new hiper::MmapLogAppender(s_file, 1));
+    HIPER_ASSERT(appender->getCapacity() == 64 * 1024);
+    hiper::Logger::ptr logger = make_logger(appender);
+
+    const int n = 20000;
+    for (int i = 0; i < n; ++i) {
+        LOG_INFO(logger) << "wrap " << i << std::string(i % 37, 'x');
+    }
+    // 能取回的是最新的连续一段，最后一条是最后写的
+    auto lines = recover(s_file);
+    HIPER_ASSERT(lines.size() > 1000 && lines.size() < (size_t)n);
+    size_t first = n - lines.size();
+    for (size_t i = 0; i < lines.size(); ++i) {
+        int id = first + i;
+        HIPER_ASSERT(lines[i] == "INFO wrap " + std::to_string(id) + std::string(id % 37, 'x') +
+                                     "\n");
+    }
+
+    // 超长的日志被截断
+    LOG_INFO(logger) << std::string(100 * 1024, 'y');
+    lines = recover(s_file);
+    HIPER_ASSERT(lines.back().size() == 16 * 1024 - 16);
+    logger->clearAppenders();
+}
+
+void test_threads()
+{
+    unlink(s_file.c_str());
+    hiper::MmapLogAppender::ptr appender(new hiper::MmapLogAppender(s_file, 16 * 1024 * 1024));
+    hiper::Logger::ptr          logger = make_logger(appender);
+
+    const int                       lines = 20000;
+    std::vector<hiper::Thread::ptr> threads;
+    uint64_t                        start = hiper::GetElapsedUS();
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back(new hiper::Thread(
+            [logger, t]() {
+                for (int i = 0; i < lines; ++i) {
+                    LOG_DEBUG(logger) << "thread " << t << " line " << i;
+                }
+            },
+            "mmap_" + std::to_string(t)));
+    }
+    for (auto& i : threads) {
+        i->join();
+    }
+    uint64_t used = hiper::GetElapsedUS() - start;
+    std::cout << "mmap ring: " << (uint64_t)(lines * 4 * 1000000.0 / used) << " lines/s"
+              << std::endl;
+
+    // 每个线程的日志各自有序且不丢
+    std::vector<int> next(4, 0);
+    auto             all = recover(s_file);
+    HIPER_ASSERT(all.size() == (size_t)lines * 4);
+    for (auto& line : all) {
+        int t, i;
+        HIPER_ASSERT(sscanf(line.c_str(), "DEBUG thread %d line %d", &t, &i) == 2);
+        HIPER_ASSERT(next[t] == i);
+        ++next[t];
+    }
+    logger->clearAppenders();
+}
+
+void test_crash()
+{
+    unlink(s_file.c_str());
+    unlink((s_file + ".prev").c_str());
+    pid_t pid = fork();
+    HIPER_ASSERT(pid >= 0);
+    if (pid == 0) {
+        hiper::MmapLogAppender::ptr appender(new hiper::MmapLogAppender(s_file));
+        hiper::Logger::ptr          logger = make_logger(appender);
+        for (int i = 0; i < 100; ++i) {
+            LOG_DEBUG(logger) << "before crash " << i;
+        }
+        LOG_ERROR(logger) << "last words";
+        abort();
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    HIPER_ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+
+    auto lines = recover(s_file);
+    HIPER_ASSERT(lines.size() == 101);
+    HIPER_ASSERT(lines[0] == "DEBUG before crash 0\n");
+    HIPER_ASSERT(lines.back() == "ERROR last words\n");
+
+    // 重启后上一次的内容保留在.prev
+    hiper::MmapLogAppender::ptr appender(new hiper::MmapLogAppender(s_file));
+    HIPER_ASSERT(recover(s_file).empty());
+    HIPER_ASSERT(recover(s_file + ".prev").size() == 101);
+
+    // hiper-logcat直接输出环形缓冲区里的文本
+    FILE* fp = popen(("./hiper-logcat " + s_file + ".prev").c_str(), "r");
+    HIPER_ASSERT(fp);
+    char                     buf[256];
+    std::vector<std::string> out;
+    while (fgets(buf, sizeof(buf), fp)) {
+        out.push_back(buf);
+    }
+    pclose(fp);
+    HIPER_ASSERT(out.size() == 101 && out.back() == "ERROR last words\n");
+
+    // 重新加载配置时重建Appender，写入的进程还活着，不能覆盖.prev；大小不变时接着写原来的环形区
+    hiper::Logger::ptr logger = make_logger(appender);
+    LOG_DEBUG(logger) << "before reload";
+    hiper::MmapLogAppender::ptr reloaded(new hiper::MmapLogAppender(s_file));
+    make_logger(reloaded);
+    appender.reset();
+    LOG_DEBUG(logger) << "after reload";
+    auto current = recover(s_file);
+    HIPER_ASSERT(current.size() == 2 && current[0] == "DEBUG before reload\n");
+    HIPER_ASSERT(recover(s_file + ".prev").size() == 101);
+    // 大小改变时换一个新文件，.prev仍然不动
+    reloaded.reset(new hiper::MmapLogAppender(s_file, 1024 * 1024));
+    HIPER_ASSERT(recover(s_file).empty());
+    HIPER_ASSERT(recover(s_file + ".prev").size() == 101);
+    logger->clearAppenders();
+
+    unlink(s_file.c_str());
+    unlink((s_file + ".prev").c_str());
+}
+
+/**
+ * @brief 在子进程里写count条日志后正常退出，再把文件头里的pid改成当前进程，模拟崩溃后pid被重用
+ */
+static void write_as_dead_writer(int count)
+{
+    unlink(s_file.c_str());
+    pid_t pid = fork();
+    HIPER_ASSERT(pid >= 0);
+    if (pid == 0) {
+        hiper::MmapLogAppender::ptr appender(new hiper::MmapLogAppender(s_file));
+        hiper::Logger::ptr          logger = make_logger(appender);
+        for (int i = 0; i < count; ++i) {
+            LOG_DEBUG(logger) << "dead writer " << i;
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    HIPER_ASSERT(WIFEXITED(status));
+
+    // 文件头: magic(4) version(4) capacity(8) pid(8)
+    uint64_t self = getpid();
+    int      fd   = open(s_file.c_str(), O_WRONLY);
+    HIPER_ASSERT(fd >= 0);
+    HIPER_ASSERT(pwrite(fd, &self, sizeof(self), 16) == (ssize_t)sizeof(self));
+    close(fd);
+}
+
+void test_pid_reuse()
+{
+    unlink(s_file.c_str());
+    unlink((s_file + ".prev").c_str());
+
+    // pid还活着但启动时间不同，大小不变时也不能接着写，要改名为.prev
+    write_as_dead_writer(10);
+    hiper::MmapLogAppender::ptr appender(new hiper::MmapLogAppender(s_file));
+    HIPER_ASSERT(recover(s_file).empty());
+    auto prev = recover(s_file + ".prev");
+    HIPER_ASSERT(prev.size() == 10 && prev.back() == "DEBUG dead writer 9\n");
+    appender.reset();
+
+    // 大小改变时不能删除
+    write_as_dead_writer(20);
+    appender.reset(new hiper::MmapLogAppender(s_file, 1024 * 1024));
+    HIPER_ASSERT(recover(s_file).empty());
+    HIPER_ASSERT(recover(s_file + ".prev").size() == 20);
+    appender.reset();
+
+    unlink(s_file.c_str());
+    unlink((s_file + ".prev").c_str());
+}
+
+void test_config()
+{
+    unlink(s_file.c_str());
+    YAML::Node node = YAML::Load("logs:\n"
+                                 "  - name: mmap_log_test_conf\n"
+                                 "    level: debug\n"
+                                 "    appenders:\n"
+                                 "      - type: MmapLogAppender\n"
+                                 "        file: " + s_file + "\n"
+                                 "        size: 1M\n");
+    hiper::Config::LoadFromYaml(node);
+    hiper::Logger::ptr logger = LOG_NAME("mmap_log_test_conf");
+    HIPER_ASSERT(logger->toYamlString().find("size: 1048576") != std::string::npos);
+    LOG_DEBUG(logger) << "from config";
+    HIPER_ASSERT(recover(s_file).size() == 1);
+    logger->clearAppenders();
+    unlink(s_file.c_str());
+}
+
+int main(int argc, char** argv)
+{
+    test_basic();
+    test_wrap();
+    test_threads();
+    test_crash();
+    test_pid_reuse();
+    test_config();
+    return 0;
+}
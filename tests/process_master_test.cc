@@ -0,0 +1,153 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-17 14:26:37
+ * @Description: prefork模式测试，多个worker共享监听端口，worker被杀死后由master重新拉起，
+ *               收到SIGTERM时处理完正在进行的连接再退出
+ */
+#include "../hiper/base/hiper.h"
+
+#include <set>
+#include <sys/wait.h>
+
+using namespace hiper;
+static Logger::ptr g_logger = LOG_ROOT();
+
+static const char* s_addr = "127.0.0.1:8068";
+
+/**
+ * @brief 返回处理连接的worker进程号，客户端先发送's'时延迟500ms再回复
+ */
+class PidServer : public TcpServer {
+public:
+    typedef std::shared_ptr<PidServer> ptr;
+
+    PidServer(IOManager* worker)
+        : TcpServer(worker, worker)
+    {}
+
+protected:
+    void handleClient(Socket::ptr client) override
+    {
+        char cmd = 0;
+        if (client->recv(&cmd, 1) == 1 && cmd == 's') {
+            usleep(500 * 1000);
+        }
+        std::string pid = std::to_string(getpid());
+        client->send(pid.c_str(), pid.size());
+        client->close();
+    }
+};
+
+static int worker_main(ProcessMaster* master)
+{
+    IOManager iom(1, false, "worker");
+    iom.schedule([master, &iom]() {
+        static PidServer::ptr server(new PidServer(&iom));
+        for (auto& sock : master->getSockets()) {
+            server->addListenSocket(sock);
+        }
+        server->start();
+        LOG_INFO(g_logger) << "worker=" << ProcessMaster::GetWorkerId() << " pid=" << getpid()
+                           << " env worker_id=" << EnvMgr::GetInstance()->get("worker_id");
+    });
+    return 0;
+}
+
+/**
+ * @brief 连接并发送cmd，返回连接的fd，失败返回-1
+ */
+static int connect_server(char cmd)
+{
+    Address::ptr addr = Address::LookupAny(s_addr);
+    int          fd   = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, addr->getAddr(), addr->getAddrLen()) != 0 || write(fd, &cmd, 1) != 1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief 读取回复的worker进程号，失败返回0
+ */
+static int read_pid(int fd)
+{
+    char buf[32] = {0};
+    int  pid     = 0;
+    if (fd >= 0 && read(fd, buf, sizeof(buf) - 1) > 0) {
+        pid = atoi(buf);
+    }
+    close(fd);
+    return pid;
+}
+
+/**
+ * @brief 连接若干次，收集回复的worker进程号
+ */
+static std::set<int> collect_pids(int times)
+{
+    std::set<int> pids;
+    for (int i = 0; i < times; ++i) {
+        int pid = read_pid(connect_server('p'));
+        if (pid) {
+            pids.insert(pid);
+        }
+    }
+    return pids;
+}
+
+int main(int argc, char** argv)
+{
+    Config::Lookup<bool>("process.reuse_port")->setValue(true);
+    Config::Lookup<uint32_t>("process.restart_interval")->setValue(200);
+
+    pid_t master_pid = fork();
+    if (master_pid == 0) {
+        ProcessMaster master(2);
+        std::vector<Address::ptr> addrs{Address::LookupAny(s_addr)}, fails;
+        if (!master.bind(addrs, fails)) {
+            return 1;
+        }
+        return master.run(std::bind(worker_main, &master));
+    }
+
+    usleep(500 * 1000);
+    std::set<int> pids = collect_pids(20);
+    LOG_INFO(g_logger) << "workers answered=" << pids.size();
+    if (pids.empty()) {
+        kill(master_pid, SIGTERM);
+        waitpid(master_pid, nullptr, 0);
+        return 1;
+    }
+
+    int victim = *pids.begin();
+    kill(victim, SIGKILL);
+    usleep(800 * 1000);
+    std::set<int> after = collect_pids(20);
+    LOG_INFO(g_logger) << "killed pid=" << victim << " still answering=" << after.count(victim)
+                       << " workers answered=" << after.size();
+
+    // 连接处理期间worker收到SIGTERM，先drain再退出，客户端仍然收到回复
+    int fd = connect_server('s');
+    usleep(100 * 1000);
+    for (int pid : after) {
+        kill(pid, SIGTERM);
+    }
+    uint64_t start   = GetElapsedMS();
+    int      drained = read_pid(fd);
+    LOG_INFO(g_logger) << "reply during SIGTERM from pid=" << drained
+                       << " after=" << GetElapsedMS() - start << "ms";
+    HIPER_ASSERT(after.count(drained));
+
+    usleep(800 * 1000);
+    std::set<int> restarted = collect_pids(20);
+    LOG_INFO(g_logger) << "workers answered after SIGTERM=" << restarted.size();
+    HIPER_ASSERT(!restarted.empty());
+
+    kill(master_pid, SIGTERM);
+    int status = 0;
+    waitpid(master_pid, &status, 0);
+    LOG_INFO(g_logger) << "master exited=" << WIFEXITED(status)
+                       << " code=" << WEXITSTATUS(status);
+    return 0;
+}
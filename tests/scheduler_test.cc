@@ -1,4 +1,5 @@
 #include "../hiper/base/hiper.h"
+#include <set>
 #include <unistd.h>
 
 static hiper::Logger::ptr g_logger = LOG_ROOT();
@@ -13,7 +14,95 @@ void test_fiber() {
     }
 }
 
+// 线程绑定到进程允许使用的前两个cpu上，每个调度线程的affinity和所在的cpu都要在配置的集合里
+// cpu列表只接受/sys中cpulist的格式
+void test_parse_cpu_list() {
+    HIPER_ASSERT(hiper::CpuUtil::ParseCpuList(" 0-3,8, 10-11 ") ==
+                 std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+    HIPER_ASSERT(hiper::CpuUtil::ParseCpuList("3") == std::vector<int>({3}));
+    // 多余字符、空项和倒序的范围都视为格式错误
+    for (const char* bad : {"", "3x", "0-3,,", "0-3,", ",1", "1-", "-1", "3-1", "0-3x", "a"}) {
+        HIPER_ASSERT(hiper::CpuUtil::ParseCpuList(bad).empty());
+    }
+}
+
+void test_affinity() {
+    std::vector<int> allowed = hiper::CpuUtil::GetAllowedCpus();
+    std::set<int>    pinned{allowed.front()};
+    std::string      spec = std::to_string(allowed.front());
+    if (allowed.size() > 1) {
+        spec += "," + std::to_string(allowed[1]);
+        pinned.insert(allowed[1]);
+    }
+    hiper::Config::Lookup<std::map<std::string, std::string>>("scheduler.affinity")
+        ->setValue({{"pinned", spec}});
+
+    hiper::Scheduler sc(3, false, "pinned");
+    sc.start();
+    std::atomic<int> checked{0};
+    std::atomic<int> outside{0};
+    for (int i = 0; i < 6; ++i) {
+        sc.schedule([&pinned, &checked, &outside]() {
+            int cpu = hiper::Thread::GetCpu();
+            LOG_INFO(g_logger) << "pinned fiber on cpu=" << cpu;
+            // 在调度线程里取到的是这个线程自己的affinity
+            std::vector<int> mask = hiper::CpuUtil::GetAllowedCpus();
+            bool             ok   = !mask.empty() && pinned.count(cpu);
+            for (int c : mask) {
+                ok = ok && pinned.count(c);
+            }
+            if (!ok) {
+                ++outside;
+            }
+            ++checked;
+        });
+    }
+    while (checked < 6) {
+        usleep(10 * 1000);
+    }
+    std::stringstream ss;
+    sc.dump(ss);
+    LOG_INFO(g_logger) << ss.str();
+    sc.stop();
+    HIPER_ASSERT(outside == 0);
+}
+
+// 队列里只剩指定给忙碌线程的任务时，新加入的任务也要唤醒空闲线程，不能等到epoll_wait超时
+void test_lost_wakeup() {
+    hiper::IOManager        iom(2, false, "wakeup");
+    std::atomic<int>        busy_tid{-1};
+    std::atomic<uint64_t>   ran_us{0};
+    static const uint64_t   kBusyUs = 2000 * 1000;
+
+    // 一个线程忙等，不切出协程
+    iom.schedule([&busy_tid]() {
+        busy_tid = hiper::GetThreadId();
+        uint64_t start = hiper::GetElapsedUS();
+        while (hiper::GetElapsedUS() - start < kBusyUs)
+            ;
+    });
+    while (busy_tid == -1) {
+        usleep(1000);
+    }
+    // 另一个线程被唤醒后跳过这个任务，重新进入idle
+    iom.schedule([]() {}, busy_tid);
+    usleep(100 * 1000);
+
+    uint64_t start = hiper::GetElapsedUS();
+    iom.schedule([&ran_us]() { ran_us = hiper::GetElapsedUS(); });
+    while (ran_us == 0) {
+        usleep(1000);
+    }
+    uint64_t latency = ran_us - start;
+    LOG_INFO(g_logger) << "wakeup latency=" << latency << "us";
+    HIPER_ASSERT(latency < 500 * 1000);
+    iom.stop();
+}
+
 int main(int argc, char** argv) {
+    test_parse_cpu_list();
+    test_affinity();
+    test_lost_wakeup();
     LOG_INFO(g_logger) << "main";
     hiper::Scheduler sc(1, false, "test");
     sc.start();
@@ -0,0 +1,150 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-20 14:36:18
+ * @Description: 任务监控测试，不让出的任务被检测出来，watchdog输出卡住时的调用栈
+ */
+#include "../hiper/base/hiper.h"
+
+#include <algorithm>
+#include <sys/wait.h>
+#include <time.h>
+
+using namespace hiper;
+static Logger::ptr g_logger = LOG_ROOT();
+
+static uint64_t thread_cpu_ms()
+{
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 不让出执行权的计算，模拟阻塞调度线程的处理函数。按线程CPU时间计时，机器繁忙时墙上时间只会更长
+void busy_loop(uint64_t ms)
+{
+    uint64_t           end = thread_cpu_ms() + ms;
+    volatile uint64_t  n   = 0;
+    while (thread_cpu_ms() < end) {
+        ++n;
+    }
+}
+
+/**
+ * @brief 记录输出的日志内容
+ */
+class CaptureAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<CaptureAppender> ptr;
+
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override
+    {
+        Rcu::ReadLock rcu;
+        std::string   msg = peekFormatter()->format(logger, level, event);
+        Mutex::Lock   lock(mutex);
+        lines.push_back(msg);
+    }
+
+    std::string toYamlString() override { return ""; }
+
+    Mutex                    mutex;
+    std::vector<std::string> lines;
+};
+
+void quick_task() {}
+
+int main(int argc, char** argv)
+{
+    g_logger->setLevel(LogLevel::INFO);
+    LOG_NAME("system")->setLevel(LogLevel::INFO);
+
+    Config::Lookup<uint32_t>("scheduler.slow_task_ms")->setValue(50);
+    Config::Lookup<bool>("scheduler.watchdog")->setValue(true);
+    Config::Lookup<bool>("scheduler.profile")->setValue(true);
+    TaskMonitor::ResetProfile();
+
+    {
+        IOManager iom(2, false, "monitor");
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule([]() { quick_task(); });
+        }
+        iom.schedule([]() { busy_loop(200); });
+        usleep(400 * 1000);
+    }
+
+    auto stuck = std::dynamic_pointer_cast<Counter>(
+        MetricsMgr::GetInstance()->get("hiper_watchdog_stuck_total"));
+    auto slow = std::dynamic_pointer_cast<Counter>(MetricsMgr::GetInstance()->get(
+        "hiper_scheduler_slow_tasks_total", "scheduler=\"monitor\""));
+    HIPER_ASSERT(stuck && stuck->getValue() == 1);
+    HIPER_ASSERT(slow && slow->getValue() == 1);
+
+    std::vector<TaskMonitor::ProfileEntry> profile = TaskMonitor::GetProfile();
+    std::stringstream                      ss;
+    TaskMonitor::DumpProfile(ss);
+    std::cout << ss.str();
+    HIPER_ASSERT(!profile.empty());
+    // 按CPU时间排序，busy_loop所在的lambda排在第一个
+    HIPER_ASSERT(profile[0].site.find("main") != std::string::npos);
+    // busy_loop至少占用200ms的CPU时间，留出余量
+    HIPER_ASSERT(profile[0].calls == 1 && profile[0].cpu_us >= 160 * 1000);
+
+    // fork出的子进程重新启动watchdog线程，卡住的任务同样能被发现
+    pid_t pid = fork();
+    if (pid == 0) {
+        alarm(10);
+        uint64_t before = stuck->getValue();
+        {
+            IOManager iom(1, false, "monitor_child");
+            iom.schedule([]() { busy_loop(200); });
+            usleep(400 * 1000);
+        }
+        HIPER_ASSERT(stuck->getValue() == before + 1);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    HIPER_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // watchdog关闭时，慢任务的告警带上让出位置的调用栈
+    Config::Lookup<bool>("scheduler.watchdog")->setValue(false);
+    CaptureAppender::ptr capture(new CaptureAppender);
+    capture->setFormatter(LogFormatter::ptr(new LogFormatter("%m")));
+    LOG_NAME("system")->addAppender(capture);
+    {
+        IOManager iom(1, false, "monitor_yield");
+        iom.schedule([]() {
+            busy_loop(80);
+            Fiber::YieldToReady();
+        });
+        usleep(300 * 1000);
+    }
+    // 同一个线程上连续的慢任务每秒只输出一条，计数不受影响
+    {
+        IOManager iom(1, false, "monitor_burst");
+        for (int i = 0; i < 3; ++i) {
+            iom.schedule([]() { busy_loop(60); });
+        }
+        usleep(400 * 1000);
+    }
+    LOG_NAME("system")->delAppender(capture);
+    auto burst = std::dynamic_pointer_cast<Counter>(MetricsMgr::GetInstance()->get(
+        "hiper_scheduler_slow_tasks_total", "scheduler=\"monitor_burst\""));
+    HIPER_ASSERT(burst && burst->getValue() == 3);
+    auto reports = std::count_if(
+        capture->lines.begin(), capture->lines.end(), [](const std::string& i) {
+            return i.find("slow task scheduler=monitor_burst") != std::string::npos;
+        });
+    HIPER_ASSERT(reports == 1);
+    bool found = false;
+    for (auto& i : capture->lines) {
+        if (i.find("slow task scheduler=monitor_yield") != std::string::npos) {
+            HIPER_ASSERT(i.find("yielded at:") != std::string::npos);
+            HIPER_ASSERT(i.find("YieldToReady") != std::string::npos);
+            found = true;
+        }
+    }
+    HIPER_ASSERT(found);
+
+    Config::Lookup<bool>("scheduler.profile")->setValue(false);
+    return 0;
+}
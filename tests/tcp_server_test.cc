@@ -1,18 +1,237 @@
 /*
  * @Author: Leo
  * @Date: 2023-10-04 16:50:26
- * @Description: 
+ * @Description: TcpServer测试，连接数上限时暂停accept，连接释放后恢复；
+ *               监听socket交接给另一个server后平滑停止；io调度器使用caller线程时连接不绑定到caller线程
  */
 #include "../hiper/base/hiper.h"
 #include <iostream>
+#include <map>
 #include <memory>
 
 using namespace std;
 using namespace hiper;
 static Logger::ptr g_logger = LOG_ROOT();
 
+static const int s_clients = 20;
+
+static const char* s_handoff_path = "/tmp/hiper_tcp_server_test.sock";
+
+static std::atomic<int> s_handled{0};
+// 等待读事件后被换到其他线程继续执行的连接数
+static std::atomic<int> s_moved{0};
+// io线程id -> 处理的连接数
+static Mutex              s_threads_mutex;
+static std::map<int, int> s_threads;
+
+/**
+ * @brief 读到对端关闭为止，记录连接所在的线程
+ */
 class TestServer : public TcpServer {
 public:
     typedef shared_ptr<TestServer> ptr;
-    
-};
\ No newline at end of file
+
+    TestServer(IOManager* worker, IOManager* accept_worker)
+        : TcpServer(worker, accept_worker)
+    {}
+
+protected:
+    void handleClient(Socket::ptr client) override
+    {
+        set_hook_enable(true);
+        int thread = GetThreadId();
+        {
+            Mutex::Lock lock(s_threads_mutex);
+            ++s_threads[thread];
+        }
+        char buf[64];
+        while (client->recv(buf, sizeof(buf)) > 0)
+            ;
+        if (GetThreadId() != thread) {
+            ++s_moved;
+        }
+        ++s_handled;
+    }
+};
+
+static int connect_to(Address::ptr addr)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, addr->getAddr(), addr->getAddrLen())) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void test_max_connections(IOManager* io, IOManager* accept)
+{
+    s_handled = 0;
+    s_moved   = 0;
+    s_threads.clear();
+    TestServer::ptr server(new TestServer(io, accept));
+    server->setMaxConnections(8);
+    Address::ptr addr = Address::LookupAny("127.0.0.1:8065");
+    HIPER_ASSERT(server->bind(addr));
+    server->start();
+
+    // 连接在backlog中排队，超过上限的部分暂时不会被accept
+    std::vector<int> fds;
+    for (int i = 0; i < s_clients; ++i) {
+        int fd = connect_to(addr);
+        if (fd >= 0) {
+            fds.push_back(fd);
+        }
+    }
+    usleep(300 * 1000);
+    LOG_INFO(g_logger) << "connected=" << fds.size() << " " << server->toString();
+    HIPER_ASSERT((int)fds.size() == s_clients);
+    HIPER_ASSERT(server->getConnectionCount() == 8);
+    // 前8个连接同时在线，按连接数平均分到两个io线程上
+    {
+        Mutex::Lock lock(s_threads_mutex);
+        HIPER_ASSERT(s_threads.size() == io->getThreadIds().size());
+        for (auto& i : s_threads) {
+            HIPER_ASSERT(i.second == 4);
+        }
+    }
+
+    for (auto fd : fds) {
+        close(fd);
+    }
+    usleep(300 * 1000);
+    LOG_INFO(g_logger) << "handled=" << s_handled << " moved=" << s_moved << " "
+                       << server->toString();
+    // 连接释放后恢复accept，排队的连接全部被处理；等待读事件之后仍在原来的线程上
+    HIPER_ASSERT(s_handled == s_clients);
+    HIPER_ASSERT(s_moved == 0);
+    HIPER_ASSERT(server->getConnectionCount() == 0);
+
+    server->stop();
+}
+
+/**
+ * @brief old把监听socket交给new后平滑停止，交接前后的连接都不受影响
+ */
+void test_handoff(IOManager* io, IOManager* accept)
+{
+    s_handled = 0;
+    Address::ptr    addr = Address::LookupAny("127.0.0.1:8067");
+    TestServer::ptr old_server(new TestServer(io, accept));
+    if (!old_server->bind(addr)) {
+        return;
+    }
+    old_server->start();
+
+    int before = connect_to(addr);
+    usleep(100 * 1000);
+
+    // 上一次升级崩溃时留下的socket文件不影响这次交接
+    {
+        Socket::ptr stale = Socket::CreateUnixTCPSocket();
+        HIPER_ASSERT(stale->bind(Address::ptr(new UnixAddress(s_handoff_path))));
+        stale->close();
+    }
+
+    // 旧进程一侧等待交接，新进程一侧接管，这里用两个server模拟
+    bool           handoff_ok = false;
+    hiper::Thread  thr([&]() { handoff_ok = old_server->handoff(s_handoff_path, 2000); },
+                       "handoff");
+    usleep(100 * 1000);
+
+    // 已经有进程在等待交接时，另一次交接不能抢走这个路径
+    {
+        TestServer::ptr other(new TestServer(io, accept));
+        HIPER_ASSERT(other->bind(Address::LookupAny("127.0.0.1:8074")));
+        HIPER_ASSERT(!other->handoff(s_handoff_path, 100));
+    }
+
+    TestServer::ptr new_server(new TestServer(io, accept));
+    bool            takeover_ok = new_server->takeover(s_handoff_path, 2000);
+    new_server->start();
+    thr.join();
+    LOG_INFO(g_logger) << "handoff=" << handoff_ok << " takeover=" << takeover_ok;
+    HIPER_ASSERT(handoff_ok && takeover_ok);
+
+    // 交接之后的连接只会由新server处理
+    int after = connect_to(addr);
+    usleep(100 * 1000);
+    LOG_INFO(g_logger) << "old connections=" << old_server->getConnectionCount()
+                       << " new connections=" << new_server->getConnectionCount();
+
+    // 旧连接在超时前关闭，drain成功
+    hiper::Thread closer([before]() {
+        usleep(300 * 1000);
+        close(before);
+    }, "closer");
+    bool drained = old_server->drain(2000);
+    closer.join();
+    LOG_INFO(g_logger) << "old drained=" << drained << " handled=" << s_handled;
+
+    // 新连接一直不关闭，超时后被shutdown
+    drained = new_server->drain(300);
+    usleep(100 * 1000);
+    LOG_INFO(g_logger) << "new drained=" << drained << " handled=" << s_handled << " "
+                       << new_server->toString();
+    close(after);
+}
+
+// 连接关闭后fd被复用，shutdown不能作用到新的fd上
+void test_shutdown_after_close()
+{
+    Address::ptr addr     = Address::LookupAny("127.0.0.1:8072");
+    Socket::ptr  listener = Socket::CreateTCP(addr);
+    HIPER_ASSERT(listener->bind(addr) && listener->listen());
+    int         cfd  = connect_to(addr);
+    Socket::ptr conn = listener->accept();
+    HIPER_ASSERT(cfd >= 0 && conn);
+    HIPER_ASSERT(conn->shutdown(SHUT_WR));
+    int fd = conn->getSocket();
+    conn->close();
+
+    int sv[2];
+    HIPER_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    HIPER_ASSERT(sv[0] == fd || sv[1] == fd);
+    HIPER_ASSERT(!conn->shutdown(SHUT_RDWR));
+    char c = 'x';
+    HIPER_ASSERT(write(sv[0], &c, 1) == 1 && write(sv[1], &c, 1) == 1);
+    HIPER_ASSERT(read(sv[0], &c, 1) == 1 && read(sv[1], &c, 1) == 1);
+    close(sv[0]);
+    close(sv[1]);
+    close(cfd);
+}
+
+/**
+ * @brief io调度器使用caller线程时，连接不能绑定到caller线程，否则要到stop时才会被处理
+ */
+void test_use_caller(IOManager* accept)
+{
+    s_handled = 0;
+    IOManager       io(2, true, "caller_io");
+    Address::ptr    addr = Address::LookupAny("127.0.0.1:8073");
+    TestServer::ptr server(new TestServer(&io, accept));
+    HIPER_ASSERT(server->bind(addr));
+    server->start();
+
+    for (int i = 0; i < 4; ++i) {
+        int fd = connect_to(addr);
+        HIPER_ASSERT(fd >= 0);
+        close(fd);
+    }
+    usleep(300 * 1000);
+    LOG_INFO(g_logger) << "use_caller handled=" << s_handled;
+    HIPER_ASSERT(s_handled == 4);
+    server->stop();
+}
+
+int main(int argc, char** argv)
+{
+    IOManager io(2, false, "io");
+    IOManager accept(1, false, "accept");
+
+    test_max_connections(&io, &accept);
+    test_handoff(&io, &accept);
+    test_shutdown_after_close();
+    test_use_caller(&accept);
+    return 0;
+}
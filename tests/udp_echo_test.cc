@@ -0,0 +1,175 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-13 10:21:45
+ * @Description: UDP回显吞吐测试，对比逐个收发(sendto/recvfrom)与批量收发(sendmmsg/recvmmsg)，
+ *               以及UDP GSO/GRO分段收发
+ */
+#include "../hiper/base/hiper.h"
+
+static hiper::Logger::ptr g_logger = LOG_ROOT();
+
+static const size_t s_packet_size = 64;
+static const size_t s_window      = 64;
+static const size_t s_total       = 200000;
+
+static std::atomic<bool> s_stop{false};
+
+/**
+ * @brief 回显服务，收到的数据报原样发回
+ */
+void echo_server(hiper::Socket::ptr sock, bool batch)
+{
+    if (batch) {
+        hiper::DatagramBatch msgs(s_window, s_packet_size);
+        while (!s_stop) {
+            int n = sock->recvBatch(msgs);
+            if (n <= 0) {
+                continue;
+            }
+            // 收到的数据报保留了来源地址，直接整批发回
+            sock->sendBatch(msgs);
+        }
+    }
+    else {
+        char               buf[s_packet_size];
+        hiper::Address::ptr from(new hiper::IPv4Address);
+        while (!s_stop) {
+            int n = sock->recvFrom(buf, sizeof(buf), from);
+            if (n <= 0) {
+                continue;
+            }
+            sock->sendTo(buf, n, from);
+        }
+    }
+}
+
+/**
+ * @brief 客户端以固定窗口发送，收齐一个窗口的回显后再发送下一个窗口
+ */
+void run(bool batch)
+{
+    hiper::Address::ptr addr = hiper::Address::LookupAny(batch ? "127.0.0.1:8061" : "127.0.0.1:8060");
+
+    hiper::Socket::ptr server = hiper::Socket::CreateUDP(addr);
+    server->setRecvTimeout(100);
+    if (!server->bind(addr)) {
+        return;
+    }
+
+    hiper::Socket::ptr client = hiper::Socket::CreateUDP(addr);
+    client->setRecvTimeout(1000);
+    client->connect(addr);
+
+    s_stop = false;
+    hiper::Thread thr(std::bind(echo_server, server, batch), batch ? "echo_batch" : "echo_single");
+
+    char                 data[s_packet_size] = {0};
+    hiper::DatagramBatch send_msgs(s_window);
+    hiper::DatagramBatch recv_msgs(s_window, s_packet_size);
+    char                 buf[s_packet_size];
+
+    size_t   received = 0;
+    uint64_t syscalls = 0;
+    uint64_t begin    = hiper::GetElapsedMS();
+    while (received < s_total) {
+        size_t pending = 0;
+        if (batch) {
+            send_msgs.clear();
+            while (!send_msgs.full()) {
+                send_msgs.add(data, sizeof(data));
+            }
+            client->sendBatch(send_msgs);
+            ++syscalls;
+            while (pending < s_window) {
+                int n = client->recvBatch(recv_msgs);
+                ++syscalls;
+                if (n <= 0) {
+                    break;
+                }
+                pending += n;
+            }
+        }
+        else {
+            for (size_t i = 0; i < s_window; ++i) {
+                client->send(data, sizeof(data));
+                ++syscalls;
+            }
+            while (pending < s_window) {
+                int n = client->recv(buf, sizeof(buf));
+                ++syscalls;
+                if (n <= 0) {
+                    break;
+                }
+                ++pending;
+            }
+        }
+        if (pending < s_window) {
+            LOG_ERROR(g_logger) << "echo timeout, packet lost received=" << received + pending;
+            break;
+        }
+        received += pending;
+    }
+    uint64_t cost = std::max(hiper::GetElapsedMS() - begin, (uint64_t)1);
+
+    s_stop = true;
+    thr.join();
+
+    LOG_INFO(g_logger) << (batch ? "sendmmsg/recvmmsg" : "sendto/recvfrom") << " packets=" << received
+                       << " cost=" << cost << "ms pps=" << received * 1000 / cost
+                       << " client_syscalls=" << syscalls;
+}
+
+/**
+ * @brief 一次发送32KB，由内核按1000字节分段；接收端开启GRO后合并交付
+ */
+void test_gso()
+{
+    hiper::Address::ptr addr = hiper::Address::LookupAny("127.0.0.1:8062");
+
+    hiper::Socket::ptr server = hiper::Socket::CreateUDP(addr);
+    server->setRecvTimeout(1000);
+    if (!server->bind(addr)) {
+        return;
+    }
+    bool gro = server->setUdpGro(true);
+
+    hiper::Socket::ptr client = hiper::Socket::CreateUDP(addr);
+    client->connect(addr);
+
+    std::vector<char> data(32 * 1024, 'x');
+    iovec             iov;
+    iov.iov_base = &data[0];
+    iov.iov_len  = data.size();
+    int rt       = client->sendSegments(&iov, 1, nullptr, 1000);
+    if (rt < 0) {
+        LOG_INFO(g_logger) << "gso not supported errno=" << errno << " errstr=" << strerror(errno);
+        return;
+    }
+    LOG_INFO(g_logger) << "gso send bytes=" << rt << " segments=" << (rt + 999) / 1000;
+
+    std::vector<char> buf(64 * 1024);
+    size_t            total    = 0;
+    size_t            segments = 0;
+    while (total < data.size()) {
+        uint16_t segment_size = 0;
+        iov.iov_base          = &buf[0];
+        iov.iov_len           = buf.size();
+        int n                 = server->recvSegments(&iov, 1, nullptr, segment_size);
+        if (n <= 0) {
+            break;
+        }
+        LOG_INFO(g_logger) << "recv bytes=" << n << " segment_size=" << segment_size
+                           << " gro=" << gro;
+        total += n;
+        segments += segment_size ? (n + segment_size - 1) / segment_size : 1;
+    }
+    LOG_INFO(g_logger) << "gro recv total=" << total << " segments=" << segments;
+}
+
+int main(int argc, char** argv)
+{
+    run(false);
+    run(true);
+    test_gso();
+    return 0;
+}
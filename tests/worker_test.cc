@@ -0,0 +1,82 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-18 11:20:45
+ * @Description: 具名调度器测试，io线程中的CPU密集计算切换到process调度器执行
+ */
+#include "../hiper/base/hiper.h"
+
+using namespace hiper;
+static Logger::ptr g_logger = LOG_ROOT();
+
+static std::atomic<int> s_done{0};
+
+static uint64_t fib(int n)
+{
+    return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+void test_switch()
+{
+    Scheduler::ptr process = WorkerMgr::GetInstance()->get("process");
+    for (int i = 0; i < 4; ++i) {
+        WorkerMgr::GetInstance()->schedule("io", [process, i]() {
+            std::string from = Thread::GetName();
+            uint64_t    v    = 0;
+            {
+                SchedulerSwitcher sw(process.get());
+                HIPER_ASSERT(Scheduler::GetThis() == process.get());
+                v = fib(25 + i);
+                LOG_INFO(g_logger) << "fib on " << Thread::GetName() << " = " << v;
+            }
+            // 析构时切回原来的io调度器
+            HIPER_ASSERT(Scheduler::GetThis() == WorkerMgr::GetInstance()->get("io").get());
+            LOG_INFO(g_logger) << "task " << i << " " << from << " -> process -> "
+                               << Thread::GetName();
+            ++s_done;
+        });
+    }
+    while (s_done < 4) {
+        usleep(10 * 1000);
+    }
+}
+
+void test_conf()
+{
+    TcpServerConf conf;
+    conf.address        = {"127.0.0.1:8069"};
+    conf.name           = "worker_test";
+    conf.io_worker      = "io";
+    conf.accept_worker  = "accept";
+    conf.process_worker = "process";
+
+    TcpServer::ptr server(new TcpServer(nullptr, nullptr));
+    HIPER_ASSERT(server->setConf(conf));
+    LOG_INFO(g_logger) << server->toString();
+
+    conf.io_worker = "not_exists";
+    HIPER_ASSERT(!server->setConf(conf));
+}
+
+int main(int argc, char** argv)
+{
+    YAML::Node node = YAML::Load("workers:\n"
+                                 "    io:\n"
+                                 "        thread_num: 2\n"
+                                 "    accept:\n"
+                                 "        thread_num: 1\n"
+                                 "    process:\n"
+                                 "        thread_num: 2\n");
+    Config::LoadFromYaml(node);
+    HIPER_ASSERT(WorkerMgr::GetInstance()->init());
+    HIPER_ASSERT(WorkerMgr::GetInstance()->getCount() == 3);
+    HIPER_ASSERT(!WorkerMgr::GetInstance()->get("not_exists"));
+
+    test_switch();
+    test_conf();
+
+    std::stringstream ss;
+    WorkerMgr::GetInstance()->dump(ss);
+    LOG_INFO(g_logger) << "\n" << ss.str();
+    WorkerMgr::GetInstance()->stop();
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-14 09:37:12
+ * @Description: MSG_ZEROCOPY发送测试
+ */
+#include "../hiper/base/hiper.h"
+
+static hiper::Logger::ptr g_logger = LOG_ROOT();
+
+static const size_t s_total = 64 * 1024 * 1024;
+static const size_t s_chunk = 1024 * 1024;
+
+/**
+ * @brief 接收端，读完全部数据后退出
+ */
+void server(hiper::Socket::ptr listener)
+{
+    hiper::set_hook_enable(true);
+    hiper::Socket::ptr client = listener->accept();
+    if (!client) {
+        return;
+    }
+    std::vector<char> buf(s_chunk);
+    size_t            total = 0;
+    while (total < s_total) {
+        int n = client->recv(&buf[0], buf.size());
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    LOG_INFO(g_logger) << "server recv total=" << total;
+}
+
+/**
+ * @brief 发送端，每个1MB的块由shared_ptr持有，直到内核完成通知后才释放
+ */
+void client(hiper::Address::ptr addr, bool zerocopy)
+{
+    hiper::Socket::ptr sock = hiper::Socket::CreateTCP(addr);
+    if (!sock->connect(addr)) {
+        return;
+    }
+
+    std::weak_ptr<std::vector<char>> last;
+    uint64_t                         begin = hiper::GetElapsedMS();
+    size_t                           sent  = 0;
+    while (sent < s_total) {
+        std::shared_ptr<std::vector<char>> chunk(new std::vector<char>(s_chunk, 'z'));
+        last          = chunk;
+        size_t offset = 0;
+        while (offset < chunk->size()) {
+            int n = zerocopy
+                        ? sock->sendZeroCopy(&(*chunk)[offset], chunk->size() - offset, chunk)
+                        : sock->send(&(*chunk)[offset], chunk->size() - offset);
+            if (n <= 0) {
+                LOG_ERROR(g_logger) << "send error errno=" << errno;
+                return;
+            }
+            offset += n;
+        }
+        sent += offset;
+    }
+    size_t pending = sock->getZeroCopyPending();
+    bool   done    = sock->waitZeroCopy(3000);
+    LOG_INFO(g_logger) << (zerocopy ? "sendZeroCopy" : "send") << " total=" << sent
+                       << " cost=" << hiper::GetElapsedMS() - begin
+                       << "ms pending_before_wait=" << pending << " wait=" << done
+                       << " copied=" << sock->getZeroCopyCopied()
+                       << " last_chunk_released=" << last.expired();
+}
+
+void run(bool zerocopy, bool in_iomanager)
+{
+    hiper::Address::ptr addr = hiper::Address::LookupAny("127.0.0.1:8063");
+
+    hiper::Socket::ptr listener = hiper::Socket::CreateTCP(addr);
+    if (!listener->bind(addr) || !listener->listen()) {
+        return;
+    }
+    hiper::IOManager server_iom(1, false, "zc_server");
+    server_iom.schedule(std::bind(server, listener));
+
+    if (in_iomanager) {
+        hiper::IOManager iom(1, false, "zc_client");
+        iom.schedule(std::bind(client, addr, zerocopy));
+    }
+    else {
+        client(addr, zerocopy);
+    }
+}
+
+/**
+ * @brief 客户端有未读数据时等待完成通知，等待期间不能忙等
+ * @details 回环上内核常常在投递时就拷贝数据并立刻发出完成通知，这时不会真正等待
+ */
+void test_wait_with_unread_data()
+{
+    hiper::Address::ptr addr     = hiper::Address::LookupAny("127.0.0.1:8064");
+    hiper::Socket::ptr  listener = hiper::Socket::CreateTCP(addr);
+    // 接收缓冲区很小，发送的数据大部分留在发送端的队列里，完成通知要等接收端读取之后
+    listener->setOption(SOL_SOCKET, SO_RCVBUF, 4096);
+    if (!listener->bind(addr) || !listener->listen()) {
+        return;
+    }
+    hiper::IOManager server_iom(1, false, "zc_server");
+    server_iom.schedule([listener]() {
+        hiper::set_hook_enable(true);
+        hiper::Socket::ptr client = listener->accept();
+        if (!client) {
+            return;
+        }
+        client->send("x", 1);
+        // 接收端读走数据后发送端才会收到完成通知
+        sleep(1);
+        std::vector<char> buf(s_chunk);
+        while (client->recv(&buf[0], buf.size()) > 0) {
+        }
+    });
+
+    hiper::IOManager iom(1, false, "zc_client");
+    iom.schedule([addr]() {
+        hiper::set_hook_enable(true);
+        hiper::Socket::ptr sock = hiper::Socket::CreateTCP(addr);
+        if (!sock->connect(addr)) {
+            return;
+        }
+        std::shared_ptr<std::vector<char>> chunk(new std::vector<char>(64 * 1024, 'z'));
+        if (sock->sendZeroCopy(&(*chunk)[0], chunk->size(), chunk) <= 0) {
+            return;
+        }
+        // 等服务端发来的数据到达，之后一直不读
+        usleep(100 * 1000);
+        clock_t  cpu   = clock();
+        uint64_t begin = hiper::GetElapsedMS();
+        bool     done  = sock->waitZeroCopy(3000);
+        uint64_t cost  = hiper::GetElapsedMS() - begin;
+        uint64_t used  = (clock() - cpu) * 1000 / CLOCKS_PER_SEC;
+        LOG_INFO(g_logger) << "wait with unread data done=" << done << " cost=" << cost
+                           << "ms cpu=" << used << "ms";
+        // cpu和cost只打印出来看是否忙等，负载高的机器上比例不稳定，不做断言
+        HIPER_ASSERT(done);
+        sock->close();
+    });
+}
+
+/**
+ * @brief 发送后立刻关闭，缓冲区保留到完成通知回来，对端收到的数据完整
+ */
+void test_close_with_pending()
+{
+    hiper::Address::ptr addr     = hiper::Address::LookupAny("127.0.0.1:8071");
+    hiper::Socket::ptr  listener = hiper::Socket::CreateTCP(addr);
+    if (!listener->bind(addr) || !listener->listen()) {
+        return;
+    }
+    std::atomic<size_t> received{0};
+    hiper::Thread       thr(
+        [listener, &received]() {
+            hiper::Socket::ptr client = listener->accept();
+            if (!client) {
+                return;
+            }
+            std::vector<char> buf(s_chunk);
+            int               n;
+            while ((n = client->recv(&buf[0], buf.size())) > 0) {
+                for (int i = 0; i < n; ++i) {
+                    HIPER_ASSERT(buf[i] == 'c');
+                }
+                received += n;
+            }
+        },
+        "zc_close");
+
+    hiper::Socket::ptr sock = hiper::Socket::CreateTCP(addr);
+    HIPER_ASSERT(sock->connect(addr));
+    std::weak_ptr<std::vector<char>> weak;
+    {
+        std::shared_ptr<std::vector<char>> chunk(new std::vector<char>(s_chunk, 'c'));
+        weak = chunk;
+        HIPER_ASSERT(sock->sendZeroCopy(&(*chunk)[0], chunk->size(), chunk) == (int)s_chunk);
+    }
+    sock->close();
+    thr.join();
+    HIPER_ASSERT(received == s_chunk);
+    // 完成通知到达后由后台线程释放，不依赖其他socket的关闭或发送
+    for (int i = 0; i < 100 && !weak.expired(); ++i) {
+        usleep(10 * 1000);
+    }
+    LOG_INFO(g_logger) << "close with pending received=" << received
+                       << " released=" << weak.expired();
+    HIPER_ASSERT(weak.expired());
+}
+
+int main(int argc, char** argv)
+{
+    run(false, false);
+    run(true, false);
+    run(true, true);
+    test_wait_with_unread_data();
+    test_close_with_pending();
+    return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * @Author: Leo
+ * @Date: 2023-10-25 16:20:08
+ * @Description: hiper-logcat，把BinaryLogAppender写的二进制日志转成文本
+ *               用法: hiper-logcat [-p pattern] file...
+ *               多个文件按给出的顺序解析，输出格式和LogFormatter的模板一致。
+ *               MmapLogAppender的环形缓冲区文件按写入顺序输出没有被覆盖的记录，已经是格式化好的文本
+ */
+#include "../hiper/base/binary_log.h"
+#include "../hiper/base/bytearray.h"
+#include "../hiper/base/mmap_log.h"
+
+#include <iostream>
+#include <map>
+#include <string.h>
+#include <unistd.h>
+
+struct Site
+{
+    hiper::LogLevel::Level level;
+    int32_t                line;
+    std::string            file;
+    std::string            fmt;
+};
+
+class LogCat {
+public:
+    LogCat(const std::string& pattern)
+        : formatter_(new hiper::LogFormatter(pattern))
+    {}
+
+    bool isPatternError() const { return formatter_->isError(); }
+
+    /**
+     * @brief 解析一个文件，返回解析出的记录数，文件格式错误返回-1
+     */
+    int64_t cat(const std::string& filename);
+
+private:
+    void onRecord(const char* data, size_t len, uint8_t version);
+    void output(hiper::Logger::ptr logger, hiper::LogEvent::ptr event);
+    hiper::Logger::ptr getLogger(uint64_t pid, uint64_t id);
+
+private:
+    // 调用点和日志器的编号只在写入的进程内唯一，按(pid, 编号)查找
+    typedef std::pair<uint64_t, uint64_t> Key;
+
+    hiper::LogFormatter::ptr            formatter_;
+    std::map<Key, Site>                 sites_;
+    std::map<Key, hiper::Logger::ptr>   loggers_;
+};
+
+int64_t LogCat::cat(const std::string& filename)
+{
+    hiper::ByteArray ba;
+    if (!ba.readFromFile(filename)) {
+        return -1;
+    }
+    ba.setPosition(0);
+
+    char magic[sizeof(hiper::BinaryLog::kMagic)];
+    if (ba.getReadSize() < sizeof(magic) + 1) {
+        std::cerr << filename << ": too short" << std::endl;
+        return -1;
+    }
+    ba.read(magic, sizeof(magic));
+    uint8_t version = ba.readFuint8();
+    // 版本1的记录里没有pid
+    if (memcmp(magic, hiper::BinaryLog::kMagic, sizeof(magic)) != 0 || version < 1 ||
+        version > hiper::BinaryLog::kVersion) {
+        std::cerr << filename << ": not a hiper binary log" << std::endl;
+        return -1;
+    }
+
+    int64_t     count = 0;
+    std::string payload;
+    while (ba.getReadSize() > 0) {
+        uint64_t len;
+        try {
+            len = ba.readUint64();
+        }
+        catch (std::out_of_range&) {
+            break;
+        }
+        if (len > ba.getReadSize()) {
+            // 进程异常退出时最后一条记录可能不完整
+            std::cerr << filename << ": truncated record at " << ba.getPosition() << std::endl;
+            break;
+        }
+        payload.resize(len);
+        ba.read(&payload[0], len);
+        onRecord(payload.data(), payload.size(), version);
+        ++count;
+    }
+    return count;
+}
+
+hiper::Logger::ptr LogCat::getLogger(uint64_t pid, uint64_t id)
+{
+    auto it = loggers_.find(Key(pid, id));
+    if (it != loggers_.end()) {
+        return it->second;
+    }
+    hiper::Logger::ptr logger(new hiper::Logger("<logger " + std::to_string(id) + ">"));
+    loggers_[Key(pid, id)] = logger;
+    return logger;
+}
+
+void LogCat::output(hiper::Logger::ptr logger, hiper::LogEvent::ptr event)
+{
+    formatter_->format(std::cout, logger, event->getLevel(), event);
+}
+
+void LogCat::onRecord(const char* data, size_t len, uint8_t version)
+{
+    hiper::BinaryDecoder in(data, len);
+    uint8_t              type;
+    uint64_t             pid = 0;
+    if (!in.readUint8(type) || (version >= 2 && !in.readUint64(pid))) {
+        return;
+    }
+
+    switch (type) {
+    case hiper::BinaryLog::SITE:
+    {
+        uint64_t    id, line;
+        uint8_t     level;
+        const char* file;
+        const char* fmt;
+        size_t      file_len, fmt_len;
+        if (in.readUint64(id) && in.readUint8(level) && in.readUint64(line) &&
+            in.readString(file, file_len) && in.readString(fmt, fmt_len)) {
+            sites_[Key(pid, id)] = Site{(hiper::LogLevel::Level)level, (int32_t)line,
+                              std::string(file, file_len), std::string(fmt, fmt_len)};
+        }
+        break;
+    }
+    case hiper::BinaryLog::LOGGER:
+    {
+        uint64_t    id;
+        const char* name;
+        size_t      name_len;
+        if (in.readUint64(id) && in.readString(name, name_len)) {
+            loggers_[Key(pid, id)].reset(new hiper::Logger(std::string(name, name_len)));
+        }
+        break;
+    }
+    case hiper::BinaryLog::EVENT:
+    {
+        uint64_t site_id, logger_id, time, thread_id, fiber_id;
+        if (!in.readUint64(site_id) || !in.readUint64(logger_id) || !in.readUint64(time) ||
+            !in.readUint64(thread_id) || !in.readUint64(fiber_id)) {
+            break;
+        }
+        auto it = sites_.find(Key(pid, site_id));
+        if (it == sites_.end()) {
+            hiper::LogEvent::ptr event(new hiper::LogEvent(hiper::LogLevel::UNKNOW, "", 0, 0,
+                                                           thread_id, fiber_id, time, ""));
+            event->getSS() << "<unknown site " << site_id << ">";
+            output(getLogger(pid, logger_id), event);
+            break;
+        }
+        const Site&          site = it->second;
+        hiper::LogEvent::ptr event(new hiper::LogEvent(site.level, site.file.c_str(), site.line,
+                                                       0, thread_id, fiber_id, time, ""));
+        hiper::BinaryLog::Render(site.fmt.c_str(), in.cur(), in.left(), event->getBuffer());
+        output(getLogger(pid, logger_id), event);
+        break;
+    }
+    case hiper::BinaryLog::TEXT:
+    {
+        uint64_t    logger_id, time, thread_id, fiber_id, line;
+        uint8_t     level;
+        const char* file;
+        const char* content;
+        size_t      file_len, content_len;
+        if (!in.readUint64(logger_id) || !in.readUint8(level) || !in.readUint64(time) ||
+            !in.readUint64(thread_id) || !in.readUint64(fiber_id) || !in.readUint64(line) ||
+            !in.readString(file, file_len) || !in.readString(content, content_len)) {
+            break;
+        }
+        std::string          filename(file, file_len);
+        hiper::LogEvent::ptr event(new hiper::LogEvent((hiper::LogLevel::Level)level,
+                                                       filename.c_str(), line, 0, thread_id,
+                                                       fiber_id, time, ""));
+        event->getBuffer().append(content, content_len);
+        // 字段不完整时输出已经读出的部分
+        hiper::BinaryLog::ReadFields(in, event->getFields());
+        output(getLogger(pid, logger_id), event);
+        break;
+    }
+    default: break;
+    }
+}
+
+static void usage(const char* name)
+{
+    std::cerr << "usage: " << name << " [-p pattern] file..." << std::endl
+              << "  -p pattern  LogFormatter pattern, default "
+                 "\"%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n\""
+              << std::endl
+              << "  MmapLogAppender ring files are printed as recorded, -p does not apply"
+              << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::string pattern = "%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+    int         opt;
+    while ((opt = getopt(argc, argv, "p:h")) != -1) {
+        switch (opt) {
+        case 'p': pattern = optarg; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    LogCat cat(pattern);
+    if (cat.isPatternError()) {
+        std::cerr << "invalid pattern: " << pattern << std::endl;
+        return 1;
+    }
+    int rt = 0;
+    for (int i = optind; i < argc; ++i) {
+        int64_t n = hiper::MmapLogAppender::Recover(
+            argv[i], [](hiper::LogLevel::Level, const char* data, size_t len) {
+                std::cout.write(data, len);
+            });
+        if (n < 0 && cat.cat(argv[i]) < 0) {
+            rt = 1;
+        }
+    }
+    return rt;
+}
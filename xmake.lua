@@ -29,6 +29,8 @@ if is_mode("release") then
     set_optimize("fastest")
     -- 去除所有符号信息,包括调试符号
     set_strip("all")
+    -- 编译期去掉DEBUG级别的日志
+    add_defines("HIPER_LOG_MIN_LEVEL=2")
 else
     -- 启用调试符号
     set_symbols("debug")
@@ -48,14 +50,18 @@ target("hiper")
     add_headerfiles("hiper/http/**.h")
     add_headerfiles("hiper/streams/**.h")
     add_packages("boost", "yaml-cpp", "gtest", "mimalloc", "jemalloc")
-    add_syslinks("pthread")
+    add_syslinks("pthread", "z")
     -- add_links("mimalloc", "jemalloc")
     -- add_linkdirs("/usr/local/lib")
     set_targetdir("$(projectdir)/lib")
 
 -- Define the executable targets
 for _, name in ipairs({"mutex_test", "log_test", "config_test", "thread_test", "allocator_test", "scheduler_test",
-                       "timer_test", "hook_test", "try", "fiber_test", "address_test", "bytearray_test", "http_test", "http_parser_test", "yaml_test"}) do
+                       "timer_test", "hook_test", "try", "fiber_test", "address_test", "bytearray_test", "http_test", "http_parser_test", "yaml_test",
+                       "blocking_executor_test", "udp_echo_test", "zerocopy_test", "accept_test", "tcp_server_test", "arena_test",
+                       "process_master_test", "worker_test", "metrics_test", "admin_server_test", "fiber_trace_test",
+                       "task_monitor_test", "log_event_test", "binary_log_test", "log_rotate_test",
+                       "log_json_test", "mmap_log_test"}) do
     target(name)
     set_kind("binary")
     add_files("tests/" .. name .. ".cc")
@@ -64,3 +70,10 @@ for _, name in ipairs({"mutex_test", "log_test", "config_test", "thread_test", "
     add_syslinks("pthread")
 end
 
+-- 二进制日志解码工具
+target("hiper-logcat")
+    set_kind("binary")
+    add_files("tools/hiper_logcat.cc")
+    add_packages("boost", "yaml-cpp", "gtest", "mimalloc", "jemalloc")
+    add_deps("hiper")
+    add_syslinks("pthread")